@@ -45,6 +45,20 @@ typedef enum {
   LIBWAD_HASH_MISMATCH = 9,
   //! The provided file has a bad certchain
   LIBWAD_BAD_CERTCHAIN = 10,
+  //! The provided data is not a valid archive
+  LIBWAD_BAD_ARCHIVE = 11,
+  //! The requested entry does not exist
+  LIBWAD_NOT_FOUND = 12,
+  //! The provided data is not validly compressed
+  LIBWAD_DECOMPRESSION_FAILED = 13,
+  //! The operation was cancelled by a progress callback
+  LIBWAD_CANCELLED = 14,
+  //! The requested feature is not available on this system
+  LIBWAD_NOT_SUPPORTED = 15,
+  //! The provided hash index is damaged or belongs to a different wad
+  LIBWAD_BAD_INDEX = 16,
+  //! The operation would need more memory than the budget allows
+  LIBWAD_OVER_BUDGET = 17,
 } libwad_error_t;
 
 //@{
@@ -66,11 +80,37 @@ typedef enum {
 } wad_section_t;
 
 //! Opens a wad file for reading
-/// @param path the path to the file to be opened
+/// path may also be a directory laid out like a title downloaded from NUS,
+/// holding the tmd ("title.tmd" or "tmd"), the ticket ("cetk" or "title.tik")
+/// and the encrypted contents named after their ids ("%08x.app" or "%08x").
+/// Contents missing from such a directory fail to read with LIBWAD_IO_ERROR.
+/// @param path the path to the file or directory to be opened
 /// @returns A wad_t handle on success or NULL on error (See
 /// libwad_get_error() for more details)
 W_EXPORT wad_t wad_open(const char* path);
 
+//! How a wad's file is read from disk
+typedef enum {
+  //! Let the operating system decide
+  WAD_IO_NORMAL = 0,
+  //! Tell the operating system that the file is read front to back
+  WAD_IO_SEQUENTIAL = 1,
+  //! Read sequentially and drop data from the page cache once it was read
+  WAD_IO_DROP_BEHIND = 2,
+  //! Bypass the page cache (O_DIRECT) where supported and drop behind
+  //! otherwise
+  WAD_IO_DIRECT = 3
+} wad_io_policy_t;
+
+//! Opens a wad file for reading with a given I/O policy
+/// Scanning many wads once with WAD_IO_DROP_BEHIND or WAD_IO_DIRECT keeps them
+/// from evicting more useful data from the page cache.
+/// @param path the path to the file to be opened
+/// @param policy how the file should be read
+/// @returns A wad_t handle on success or NULL on error (See
+/// libwad_get_error() for more details)
+W_EXPORT wad_t wad_open_ex(const char* path, wad_io_policy_t policy);
+
 //! Closes a wad handle and frees its resources
 /// @param handle the handle to be free'd
 W_EXPORT void wad_close(wad_t handle);
@@ -83,17 +123,103 @@ W_EXPORT uint64_t wad_get_section_offset(wad_t handle, wad_section_t type);
 /// @returns size of the section in bytes or WAD_BAD_SECTION on error
 W_EXPORT uint32_t wad_get_section_size(wad_t handle, wad_section_t type);
 
+//! Reads part of a section of a wad
+/// For titles opened from a directory only the certificate chain, ticket and
+/// tmd are available.
+/// @param offset position within the section
+/// @param length number of bytes to read
+/// @param dst buffer of at least length bytes to write the data to
+/// @returns 1 on success or 0 on error (See libwad_get_error() for more
+/// details)
+W_EXPORT int wad_read_section(wad_t handle, wad_section_t section,
+                              uint64_t offset, size_t length,
+                              unsigned char* dst);
+
+//! Copies a section of a wad into a file of its own
+/// The data is copied from file to file, by the kernel where possible, instead
+/// of being buffered in memory. Not supported for titles opened from a
+/// directory.
+/// @param section the section to copy
+/// @param path the file to be created
+/// @returns 1 on success or 0 on error (See libwad_get_error() for more
+/// details)
+W_EXPORT int wad_extract_section(wad_t handle, wad_section_t section,
+                                 const char* path);
+
+//! Copies multiple sections of a wad into files of their own concurrently
+/// @param sections the sections to copy, at most one per section type
+/// @param paths the file to be created for each section
+/// @param count the number of sections
+/// @param errors receives the outcome of each section, may be NULL
+/// @returns 1 if all sections were copied or 0 otherwise (See
+/// libwad_get_error() for the last error)
+W_EXPORT int wad_extract_sections(wad_t handle, const wad_section_t* sections,
+                                  const char* const* paths, size_t count,
+                                  libwad_error_t* errors);
+
+//! Callback reporting the progress of extracting or verifying a content
+/// @param processed number of bytes of the content processed so far
+/// @param total size of the content in bytes
+/// @param index index of the content being processed
+/// @param user the pointer passed to wad_set_progress_callback()
+/// @returns 0 to continue or anything else to cancel the operation
+typedef int (*wad_progress_callback_t)(uint64_t processed, uint64_t total,
+                                       uint16_t index, void* user);
+
+//! Sets a callback that is invoked for every chunk of a content extracted or
+//! verified from this wad
+/// Cancelling makes the running operation fail with LIBWAD_CANCELLED.
+/// @param callback the callback or NULL to disable progress reporting
+/// @param user pointer handed to the callback
+W_EXPORT void wad_set_progress_callback(wad_t handle,
+                                        wad_progress_callback_t callback,
+                                        void* user);
+
 // @}
 
-//! Get the last error
+//! Get the last error of the calling thread
 /// @returns An error code describing what went wrong
-/// \remark Use libwad_get_error_msg() for a human readable version
+/// \remark Use libwad_get_error_msg() for a human readable version. Errors
+/// are kept per thread, so concurrent calls don't overwrite each other's
 W_EXPORT libwad_error_t libwad_get_error();
 
 //! Get the last error as a string
 /// @returns A human readable string describing the last error that occured
 W_EXPORT const char* libwad_get_error_msg();
 
+//! Get a human readable string describing an error code
+W_EXPORT const char* libwad_error_to_string(libwad_error_t error);
+
+//! Counters describing where the library spent its time
+/// \remark Only collected if libwad was built with ENABLE_STATS
+typedef struct {
+  //! Number of wads opened
+  uint64_t opens;
+  //! Number of contents extracted
+  uint64_t extracts;
+  //! Bytes read from files and time spent doing so
+  uint64_t read_bytes;
+  uint64_t read_ns;
+  //! Bytes decrypted and time spent doing so
+  uint64_t decrypt_bytes;
+  uint64_t decrypt_ns;
+  //! Bytes hashed and time spent doing so
+  uint64_t hash_bytes;
+  uint64_t hash_ns;
+  //! Bytes allocated for content data and time spent doing so
+  uint64_t alloc_bytes;
+  uint64_t alloc_ns;
+} libwad_stats_t;
+
+//! Get the performance counters accumulated since the last reset
+/// @param stats struct to write the counters to
+/// @returns 1 if the library collects statistics, 0 otherwise (all counters
+/// are zero then)
+W_EXPORT int libwad_get_stats(libwad_stats_t* stats);
+
+//! Resets all performance counters to zero
+W_EXPORT void libwad_reset_stats();
+
 //! Get the library version
 /// @returns A string describing the current release, build and branch
 W_EXPORT const char* libwad_get_version_string();
@@ -201,11 +327,22 @@ typedef enum {
   LIBWAD_REGION_NTSC_K = 4
 } tmd_region_t;
 
+//! Flags found in the type of a content
+typedef enum {
+  //! Content is a regular part of the title
+  LIBWAD_CONTENT_NORMAL = 0x0001,
+  //! Content is downloadable content
+  LIBWAD_CONTENT_DLC = 0x4000,
+  //! Content is shared between titles and stored once in shared1
+  LIBWAD_CONTENT_SHARED = 0x8000
+} tmd_content_type_t;
+
 //! Struct containing all information stored about a given piece of content in
 //! the tmd
 typedef struct {
   uint32_t id;
   uint16_t index;
+  //! Combination of the flags listed in tmd_content_type_t
   uint16_t type;
   //! Size of the contents
   uint64_t size;
@@ -296,6 +433,31 @@ W_EXPORT uint64_t ticket_get_title_id(ticket_t handle);
 //! Get the title key
 // @returns the key used to encrypt the contents (always 16 bytes in length)
 W_EXPORT unsigned const char* ticket_get_title_key(ticket_t handle);
+
+//! The decrypted title key of a ticket, see ticket_decrypt_keys()
+typedef struct {
+  //! Title id the key belongs to
+  uint64_t title_id;
+  //! The decrypted title key
+  unsigned char title_key[16];
+  //! Issuer of the ticket
+  char issuer[64];
+  //! LIBWAD_NO_ERROR or the reason this ticket could not be decrypted
+  libwad_error_t error;
+} ticket_key_t;
+
+//! Decrypts the title keys of many tickets at once
+/// Tickets are grouped by the common key they use, so every common key is set
+/// up once and each group is decrypted in a single pass.
+/// @param tickets the raw tickets
+/// @param sizes the size of each ticket in bytes
+/// @param count the number of tickets
+/// @param keys receives one record per ticket
+/// @returns 1 if all keys were decrypted or 0 otherwise (See the error of
+/// each record for details)
+W_EXPORT int ticket_decrypt_keys(const unsigned char* const* tickets,
+                                 const size_t* sizes, size_t count,
+                                 ticket_key_t* keys);
 /// @}
 
 //@{
@@ -322,16 +484,652 @@ W_EXPORT data_t data_open(const char* path);
 // @param handle the handle to be free'd
 W_EXPORT void data_close(data_t handle);
 
+//! A handle holding the expanded title key of a ticket
+/// Setting the key up once per title rather than once per content pays off
+/// for titles with many small contents. A decryptor is never modified after it
+/// has been created, so any number of threads may use it at once.
+typedef void* data_decryptor_t;
+
+//! Creates a decryptor for the contents of a ticket's title
+/// @returns A data_decryptor_t handle on success or NULL on error (See
+/// libwad_get_error() for more details)
+W_EXPORT data_decryptor_t data_decryptor_open(ticket_t ticket);
+
+//! Frees a decryptor
+W_EXPORT void data_decryptor_close(data_decryptor_t handle);
+
+//! Gets the decryptor of a wad, which is owned by the wad handle
+W_EXPORT data_decryptor_t wad_get_decryptor(wad_t handle);
+
+//! Gets the IV the encrypted data of a content starts with
+W_EXPORT void data_get_content_iv(const tmd_content_t* content,
+                                  unsigned char iv[16]);
+
+//! Decrypts content data
+/// @param iv the IV, which is updated so that a following call continues
+/// where this one stopped
+/// @param size number of bytes to decrypt, has to be a multiple of 16
+/// @returns 1 on success or 0 on error
+W_EXPORT int data_decrypt(data_decryptor_t handle, unsigned char iv[16],
+                          const unsigned char* src, unsigned char* dst,
+                          size_t size);
+
 //! Extracts given content from a wad
 /// \warning You have to take care of freeing the returned buffer yourself
 W_EXPORT unsigned char* data_extract_from_wad(wad_t handle, uint16_t index,
                                               data_verify_t verify);
 
+//! Verifies the hash of given content from a wad
+/// The content is decrypted and hashed in chunks instead of being extracted as
+/// a whole.
+/// @returns 1 if the hash matches or 0 on error (See libwad_get_error() for
+/// more details)
+W_EXPORT int data_verify_from_wad(wad_t handle, uint16_t index);
+
+//! A piece of a content handed out by data_extract_all()
+typedef struct {
+  //! Index of the content
+  uint16_t index;
+  //! Size of the whole content
+  uint64_t size;
+  //! Offset of this piece within the content
+  uint64_t offset;
+  //! The decrypted data, only valid during the callback
+  const unsigned char* data;
+  //! Number of bytes in data
+  size_t length;
+  //! Whether this is the last piece of the content
+  int last;
+  //! On the last piece: LIBWAD_NO_ERROR or LIBWAD_HASH_MISMATCH if the hash
+  //! was verified and did not match
+  libwad_error_t verdict;
+} data_chunk_t;
+
+//! Callback receiving the pieces of contents extracted by data_extract_all()
+/// @returns 0 to continue or anything else to stop extracting
+typedef int (*data_chunk_callback_t)(const data_chunk_t* chunk, void* user);
+
+//! Extracts all contents of a wad in a single front to back pass
+/// The data section is read sequentially exactly once and every content is
+/// handed to the callback in order, piece by piece. Contents whose hash does
+/// not match are still passed on in full, with the verdict on their last
+/// piece.
+/// @param callback receives the decrypted contents
+/// @param user pointer handed to the callback
+/// @returns 1 on success or 0 on error (See libwad_get_error() for more
+/// details). If any content failed verification the error is
+/// LIBWAD_HASH_MISMATCH and all contents have still been extracted.
+W_EXPORT int data_extract_all(wad_t handle, data_chunk_callback_t callback,
+                              void* user, data_verify_t verify);
+
+//! Reads and decrypts a byte range of given content from a wad
+/// Only the AES blocks covering the range (plus the preceding one) are read
+/// and decrypted, so this is cheap even for very large contents.
+/// @param index index of the content to read from
+/// @param offset offset into the decrypted content
+/// @param length number of bytes to read
+/// @param dst buffer of at least length bytes to write the data to
+/// @returns 1 on success or 0 on error (See libwad_get_error() for more
+/// details)
+/// \remark The returned data is only verified if a hash index was loaded
+/// (See wad_load_hash_index())
+W_EXPORT int data_read_range(wad_t handle, uint16_t index, uint64_t offset,
+                             size_t length, unsigned char* dst);
+
+//! Extracts given content from a wad and decompresses it on the fly
+/// The content is decrypted in chunks that are fed straight to the
+/// decompressor. Contents that are not LZ77 compressed are returned as they
+/// are.
+/// @param size receives the size of the returned data
+/// @returns the decompressed content or NULL on error (See libwad_get_error()
+/// for more details)
+/// \warning You have to take care of freeing the returned buffer yourself
+W_EXPORT unsigned char* data_extract_decompressed(wad_t handle, uint16_t index,
+                                                  data_verify_t verify,
+                                                  size_t* size);
+
 //! Extracts given content from a file
 /// \warning You have to take care of freeing the returned buffer yourself
 W_EXPORT unsigned char* data_extract(data_t handle, wad_t tmd, tmd_t ticket,
                                      uint16_t index, data_verify_t verify);
 
+//! Extracts given content from a file using an existing decryptor
+/// \warning You have to take care of freeing the returned buffer yourself
+W_EXPORT unsigned char*
+data_extract_with_decryptor(data_t handle, tmd_t tmd,
+                            data_decryptor_t decryptor, uint16_t index,
+                            data_verify_t verify);
+
+//@}
+
+//@{
+//! @name Batch extraction
+
+//! A handle representing a batch extraction engine
+typedef void* batch_t;
+
+//! I/O backends of the batch engine
+typedef enum {
+  //! Use io_uring if available and worker threads otherwise
+  BATCH_BACKEND_AUTO = 0,
+  //! Asynchronous reads and writes via io_uring (Linux only)
+  BATCH_BACKEND_IO_URING = 1,
+  //! Blocking reads and writes on the worker threads
+  BATCH_BACKEND_THREADS = 2
+} batch_backend_t;
+
+//! A content to be extracted or verified by the batch engine
+typedef struct {
+  //! The wad to read from, has to stay open until the job completed
+  wad_t wad;
+  //! Index of the content
+  uint16_t index;
+  //! Path to write the decrypted content to or NULL to discard it
+  /// \remark The file is created by batch_submit(), the string is not used
+  /// afterwards
+  const char* output;
+  //! Whether to verify the hash of the content
+  data_verify_t verify;
+  //! Arbitrary pointer handed back on completion
+  void* user;
+} batch_job_t;
+
+//! A completed job
+typedef struct {
+  //! The job as it was submitted
+  batch_job_t job;
+  //! LIBWAD_NO_ERROR on success or the reason the job failed
+  libwad_error_t error;
+} batch_completion_t;
+
+//! Creates a batch engine
+/// Contents are read in chunks of 1 MiB with up to depth chunks in flight
+/// across all jobs, while the worker threads decrypt and hash the chunks that
+/// have been read.
+/// @param depth maximum number of chunks in flight or 0 for the default (32)
+/// @param threads number of worker threads or 0 for one per processor
+/// @param backend the I/O backend to use
+/// @returns A batch_t handle on success or NULL on error (See
+/// libwad_get_error() for more details)
+W_EXPORT batch_t batch_open(unsigned depth, unsigned threads,
+                            batch_backend_t backend);
+
+//! Gets the backend a batch engine is using
+W_EXPORT batch_backend_t batch_get_backend(batch_t handle);
+
+//! Queues a job
+/// @returns 1 on success or 0 on error (See libwad_get_error() for more
+/// details)
+W_EXPORT int batch_submit(batch_t handle, const batch_job_t* job);
+
+//! Waits for the next job to complete
+/// Jobs complete in no particular order.
+/// @param completion receives the completed job
+/// @returns 1 if a job completed or 0 if there are no jobs left
+W_EXPORT int batch_wait(batch_t handle, batch_completion_t* completion);
+
+//! Waits for all running jobs and frees the engine
+/// \remark Completions that have not been picked up by batch_wait() are
+/// discarded
+W_EXPORT void batch_close(batch_t handle);
+
+//@}
+
+//@{
+//! @name Work-stealing scheduler
+//!
+//! Spreads the contents of any number of wads across worker threads. Contents
+//! of more than 4 MiB are split into segments that are decrypted concurrently
+//! and hashed in order, so a single large content does not leave the other
+//! threads idle. Every worker takes tasks from its own queue and steals from
+//! the others once it runs dry. Unlike the batch engine, jobs complete in the
+//! order they were submitted.
+
+//! A handle representing a scheduler
+typedef void* sched_t;
+
+//! Creates a scheduler
+/// @param threads number of worker threads or 0 for libwad_get_thread_count()
+/// @returns A sched_t handle on success or NULL on error (See
+/// libwad_get_error() for more details)
+W_EXPORT sched_t sched_open(unsigned threads);
+
+//! Queues a job
+/// \remark The output file is created by sched_submit(), the string is not
+/// used afterwards
+/// @returns 1 on success or 0 on error (See libwad_get_error() for more
+/// details)
+W_EXPORT int sched_submit(sched_t handle, const batch_job_t* job);
+
+//! Waits for the oldest job that has not been picked up yet to complete
+/// @param completion receives the completed job
+/// @returns 1 if a job completed or 0 if there are no jobs left
+W_EXPORT int sched_wait(sched_t handle, batch_completion_t* completion);
+
+//! Cancels the jobs that have not started yet and frees the scheduler
+/// \remark Completions that have not been picked up by sched_wait() are
+/// discarded
+W_EXPORT void sched_close(sched_t handle);
+
+//@}
+
+//@{
+//! @name Writing wads
+
+//! A handle representing a wad file that is being written
+typedef void* wad_writer_t;
+
+//! Creates a new wad file
+/// Certificate chain, ticket and title metadata are copied as given, except
+/// for the size and hash of each content in the title metadata which are
+/// filled in as the contents are written.
+/// @param path path of the file to be created
+/// @returns A wad_writer_t handle on success or NULL on error (See
+/// libwad_get_error() for more details)
+W_EXPORT wad_writer_t wad_writer_open(const char* path,
+                                      const unsigned char* certchain,
+                                      uint32_t certchain_size,
+                                      const unsigned char* ticket,
+                                      uint32_t ticket_size,
+                                      const unsigned char* tmd,
+                                      uint32_t tmd_size);
+
+//! Starts writing the next content
+/// Contents have to be written in the order they are listed in the title
+/// metadata.
+/// @returns 1 on success or 0 on error
+W_EXPORT int wad_writer_begin_content(wad_writer_t handle);
+
+//! Encrypts and writes decrypted data to the current content
+/// @returns 1 on success or 0 on error
+W_EXPORT int wad_writer_write(wad_writer_t handle, const unsigned char* data,
+                              size_t size);
+
+//! Finishes the current content
+/// @returns 1 on success or 0 on error
+W_EXPORT int wad_writer_end_content(wad_writer_t handle);
+
+//! Writes a whole content at once
+/// @returns 1 on success or 0 on error
+W_EXPORT int wad_writer_add_content(wad_writer_t handle,
+                                    const unsigned char* data, size_t size);
+
+//! Writes the footer and header, then closes the file and frees the handle
+/// @param footer footer data. May be NULL if footer_size is 0
+/// @returns 1 on success or 0 on error (See libwad_get_error() for more
+/// details)
+W_EXPORT int wad_writer_close(wad_writer_t handle, const unsigned char* footer,
+                              uint32_t footer_size);
+
+//! Stops writing and frees the handle, leaving an incomplete file behind
+W_EXPORT void wad_writer_abort(wad_writer_t handle);
+
+//@}
+
+//@{
+//! @name Comparing wads
+//!
+//! Two versions of a title are compared content by content using the sizes
+//! and hashes in their title metadata, so unchanged contents are never read.
+
+//! A handle representing the differences between two wads
+typedef void* wad_diff_t;
+
+#define WAD_DIFF_NO_DIFFERENCE 0xffffffffffffffffULL
+
+//! How closely modified contents are compared
+typedef enum {
+  //! Only compare the title metadata
+  WAD_DIFF_TMD = 0,
+  //! Additionally decrypt modified contents and compare them byte by byte
+  WAD_DIFF_BYTES = 1
+} wad_diff_mode_t;
+
+//! How a content changed from one wad to the other
+typedef enum {
+  WAD_DIFF_UNCHANGED = 0,
+  WAD_DIFF_ADDED = 1,
+  WAD_DIFF_REMOVED = 2,
+  WAD_DIFF_MODIFIED = 3
+} wad_diff_status_t;
+
+//! A content present in either of the compared wads
+typedef struct {
+  //! Value is one of the types listed in wad_diff_status_t
+  wad_diff_status_t status;
+  //! Index of the content as stored in the title metadata
+  uint16_t index;
+  //! The content in the old wad or NULL if it was added
+  const tmd_content_t* old_content;
+  //! The content in the new wad or NULL if it was removed
+  const tmd_content_t* new_content;
+  //! WAD_DIFF_BYTES only: Offset of the first byte that differs or
+  //! WAD_DIFF_NO_DIFFERENCE
+  uint64_t first_difference;
+  //! WAD_DIFF_BYTES only: Number of bytes that differ, including those only
+  //! present in one of the versions
+  uint64_t changed_bytes;
+} wad_diff_entry_t;
+
+//! Compares the contents of two wads
+/// Contents are matched up by their index.
+/// @param old_wad the wad to compare against
+/// @param new_wad the wad to compare
+/// @param mode how closely modified contents are compared
+/// @returns A wad_diff_t handle on success or NULL on error (See
+/// libwad_get_error() for more details)
+/// \remark Both wads have to stay open until the handle is closed
+W_EXPORT wad_diff_t wad_diff(wad_t old_wad, wad_t new_wad,
+                             wad_diff_mode_t mode);
+
+//! Get the amount of contents compared, ordered by their index
+W_EXPORT size_t wad_diff_get_count(wad_diff_t handle);
+
+//! Get the result for a single content
+W_EXPORT const wad_diff_entry_t* wad_diff_get_entry(wad_diff_t handle,
+                                                    size_t index);
+
+//! Frees the results of a comparison
+W_EXPORT void wad_diff_close(wad_diff_t handle);
+
+//@}
+
+//@{
+//! @name Hash index
+//!
+//! The tmd only holds one hash per content, so checking a few bytes of a
+//! content means hashing all of it. A hash index is a sidecar file holding the
+//! SHA-1 of every 64 KiB chunk of every content, tied to the tmd by the content
+//! hashes it was generated from. Once loaded, range reads and streaming
+//! extraction verify each chunk as it is decrypted.
+
+//! A chunk that failed verification against the hash index
+typedef struct {
+  //! Position of the content in the tmd
+  uint16_t index;
+  //! Offset of the chunk within the decrypted content
+  uint64_t offset;
+  //! Size of the chunk
+  uint64_t length;
+} wad_bad_chunk_t;
+
+//! Writes a hash index for a wad
+/// Every content is decrypted once and checked against the tmd.
+/// @param path the file to be created
+/// @returns 1 on success or 0 on error (See libwad_get_error() for more
+/// details)
+W_EXPORT int wad_write_hash_index(wad_t handle, const char* path);
+
+//! Loads a hash index to verify all further reads against
+/// @param path the file written by wad_write_hash_index()
+/// @returns 1 on success or 0 on error, LIBWAD_BAD_INDEX if the index is
+/// damaged or does not match the tmd (See libwad_get_error() for more
+/// details)
+W_EXPORT int wad_load_hash_index(wad_t handle, const char* path);
+
+//! Gets the chunk that most recently failed verification
+/// Reads failing with LIBWAD_HASH_MISMATCH because of the hash index record
+/// the offending chunk here.
+/// @param chunk receives the chunk
+/// @returns 1 if a chunk failed verification or 0 otherwise
+W_EXPORT int wad_get_bad_chunk(wad_t handle, wad_bad_chunk_t* chunk);
+
+//@}
+
+//@{
+//! @name NAND
+//!
+//! Titles are installed into and exported from a directory laid out like the
+//! NAND of a console, as used by emulators: decrypted contents go to
+//! title/<high>/<low>/content, the ticket to ticket/<high>/<low>.tik and
+//! shared contents to shared1, where content.map names them by their hash.
+
+//! What an installation did
+typedef struct {
+  //! Contents that were decrypted and written
+  uint16_t installed;
+  //! Contents that were already present with a matching hash
+  uint16_t skipped;
+  //! Shared contents among the installed and skipped ones
+  uint16_t shared;
+} nand_install_stats_t;
+
+//! Installs a wad into a NAND directory
+/// Contents already present with a matching hash are left alone, so
+/// installing the same or an updated title again only writes what changed.
+/// The contents are decrypted concurrently using libwad_get_thread_count()
+/// threads and verified before they replace anything.
+/// @param root the root directory of the NAND, has to exist
+/// @param stats receives what was done, may be NULL
+/// @returns 1 on success or 0 on error (See libwad_get_error() for more
+/// details)
+W_EXPORT int wad_install_to_nand(wad_t handle, const char* root,
+                                 nand_install_stats_t* stats);
+
+//! Exports a title installed in a NAND directory into a wad
+/// The certificate chain is assembled from sys/cert.sys. Contents are
+/// verified and encrypted concurrently using libwad_get_thread_count()
+/// threads and streamed straight into the wad, nothing else is written to
+/// disk.
+/// @param root the root directory of the NAND
+/// @param title_id the title to export
+/// @param path the wad to be created, removed again on failure
+/// @returns 1 on success or 0 on error (See libwad_get_error() for more
+/// details)
+W_EXPORT int wad_export_from_nand(const char* root, uint64_t title_id,
+                                  const char* path);
+
+//@}
+
+//@{
+//! @name LZ77 compression
+//!
+//! Handles data compressed with Nintendo's LZ77 variants (types 0x10 and 0x11,
+//! with or without a leading "LZ77" magic).
+
+//! A handle representing an in-progress decompression
+typedef void* lz77_stream_t;
+
+//! Checks whether a buffer holds LZ77 compressed data
+/// Data without the magic only counts if the size in its header fits the
+/// buffer and the start of it decodes, lz77_decompress() and streams accept it
+/// regardless.
+/// @returns 1 if the data is compressed, 0 otherwise
+W_EXPORT int lz77_is_compressed(const unsigned char* data, size_t size);
+
+//! Decompresses a buffer
+/// @param out_size receives the size of the decompressed data. May be NULL
+/// @returns the decompressed data or NULL on error (See libwad_get_error() for
+/// more details)
+/// \warning You have to take care of freeing the returned buffer yourself
+W_EXPORT unsigned char* lz77_decompress(const unsigned char* data, size_t size,
+                                        size_t* out_size);
+
+//! Starts a decompression that is fed piece by piece
+/// @returns A lz77_stream_t handle on success or NULL on error
+W_EXPORT lz77_stream_t lz77_stream_open();
+
+//! Feeds the next piece of compressed data
+/// Pieces may be split at arbitrary positions.
+/// @returns 1 on success or 0 on error (See libwad_get_error() for more
+/// details)
+W_EXPORT int lz77_stream_feed(lz77_stream_t handle, const unsigned char* data,
+                              size_t size);
+
+//! Finishes a decompression and frees the handle
+/// @param size receives the size of the decompressed data. May be NULL
+/// @returns the decompressed data or NULL on error (See libwad_get_error() for
+/// more details)
+/// \warning You have to take care of freeing the returned buffer yourself
+W_EXPORT unsigned char* lz77_stream_finish(lz77_stream_t handle, size_t* size);
+
+//! Aborts a decompression and frees the handle
+W_EXPORT void lz77_stream_close(lz77_stream_t handle);
+
+//@}
+
+//@{
+//! @name U8 archives
+//!
+//! Most contents (e.g. the banner in content 0) are U8 archives. Archives can
+//! be opened on top of a decrypted buffer, in which case file data is handed
+//! out without copying, or directly on top of a content of a wad, in which
+//! case only the node table is read and file data is read on demand.
+
+//! A handle representing a U8 archive
+typedef void* u8_t;
+
+#define U8_BAD_NODE 0xffffffff
+
+//! Types of nodes in a U8 archive
+typedef enum { U8_NODE_FILE = 0, U8_NODE_DIRECTORY = 1 } u8_node_type_t;
+
+//! Struct describing a single file or directory of a U8 archive
+typedef struct {
+  //! Name of the node (without its path). Empty for the root node
+  const char* name;
+  //! Files: Offset of the data relative to the start of the archive.
+  //! Directories: Index of the parent directory
+  uint32_t offset;
+  //! Files: Size of the data. Directories: Index of the first node that is
+  //! not part of this directory
+  uint32_t size;
+  //! Index of the directory containing this node or U8_BAD_NODE for the root
+  uint32_t parent;
+  //! Value is one of the types listed in u8_node_type_t
+  uint8_t type;
+} u8_node_t;
+
+//! Opens a U8 archive stored in memory
+/// An IMET banner header in front of the archive is skipped automatically.
+/// @param buffer decrypted data containing the archive. Has to stay valid until
+/// the handle is closed
+/// @param size size of buffer in bytes
+/// @returns A u8_t handle on success or NULL on error (See
+/// libwad_get_error() for more details)
+W_EXPORT u8_t u8_open_buffer(const unsigned char* buffer, size_t size);
+
+//! Opens a U8 archive stored in a content of a wad without extracting it
+/// @param index index of the content holding the archive
+/// @returns A u8_t handle on success or NULL on error (See
+/// libwad_get_error() for more details)
+/// \remark The wad handle has to stay open until the archive is closed
+W_EXPORT u8_t u8_open_from_wad(wad_t handle, uint16_t index);
+
+//! Closes a U8 handle and frees its resources
+W_EXPORT void u8_close(u8_t handle);
+
+//! Get the amount of nodes (files and directories) in the archive
+W_EXPORT uint32_t u8_get_node_count(u8_t handle);
+
+//! Get a single node of the archive
+W_EXPORT const u8_node_t* u8_get_node(u8_t handle, uint32_t index);
+
+//! Looks up a node by its path (e.g. "meta/banner.bin")
+/// @returns The index of the node or U8_BAD_NODE if it doesn't exist
+W_EXPORT uint32_t u8_find(u8_t handle, const char* path);
+
+//! Get a pointer to the data of a file without copying it
+/// @param size receives the size of the file. May be NULL
+/// @returns A pointer into the buffer given to u8_open_buffer() or NULL on
+/// error and for archives opened with u8_open_from_wad()
+W_EXPORT const unsigned char* u8_get_file_data(u8_t handle, uint32_t index,
+                                               size_t* size);
+
+//! Reads a range of a file in the archive
+/// @param dst buffer of at least length bytes to write the data to
+/// @returns 1 on success or 0 on error (See libwad_get_error() for more
+/// details)
+W_EXPORT int u8_read_file(u8_t handle, uint32_t index, uint64_t offset,
+                          size_t length, unsigned char* dst);
+
+//@}
+
+//@{
+//! @name Block cache
+//!
+//! Decrypted content data can be kept in a process-wide cache of fixed-size
+//! blocks that is shared between all wad handles referring to the same file.
+//! Both whole content extraction and range reads go through the cache once it
+//! has been given a budget.
+
+//! Statistics about the block cache
+typedef struct {
+  //! Number of lookups that were served from the cache
+  uint64_t hits;
+  //! Number of lookups that had to go to the file
+  uint64_t misses;
+  //! Number of blocks dropped to stay within the budget
+  uint64_t evictions;
+  //! Number of blocks currently cached
+  uint64_t blocks;
+  //! Amount of decrypted data currently cached in bytes
+  size_t size;
+  //! Configured memory budget in bytes
+  size_t budget;
+} libwad_cache_stats_t;
+
+//! Sets the amount of memory the block cache may use
+/// @param bytes budget in bytes. 0 disables the cache (default)
+/// \remark Lowering the budget evicts blocks right away
+W_EXPORT void libwad_cache_set_budget(size_t bytes);
+
+//! Gets the amount of memory the block cache may use
+W_EXPORT size_t libwad_cache_get_budget();
+
+//! Gets hit/miss counters and the current size of the block cache
+W_EXPORT void libwad_cache_get_stats(libwad_cache_stats_t* stats);
+
+//! Drops all cached blocks and resets the counters
+W_EXPORT void libwad_cache_clear();
+
+//@}
+
+//@{
+//! @name Memory budget
+//!
+//! Caps the extraction buffers in flight, i.e. those whose size depends on the
+//! input: whole contents, range reads and decompressed data. They are charged
+//! against a process-wide budget while the library works on them. Requests
+//! that would exceed it fail with LIBWAD_OVER_BUDGET instead of attempting the
+//! allocation, so a single oversized wad can't exhaust the memory of a process
+//! handling many others. data_extract() decrypts contents in place, so it
+//! holds a single copy.
+//!
+//! This is not a limit on the memory of the process: buffers handed to the
+//! caller stop counting once they are returned, and the fixed size buffers of
+//! the block cache (see libwad_cache_set_budget()), the batch engine, the
+//! scheduler and NAND installs and exports are not charged.
+
+//! Sets the amount of memory extraction buffers may take at once across all
+//! threads
+/// @param bytes budget in bytes. 0 means unlimited (default)
+W_EXPORT void libwad_set_memory_budget(size_t bytes);
+
+//! Gets the amount of memory extraction buffers may take at once
+W_EXPORT size_t libwad_get_memory_budget();
+
+//! Gets the amount of memory extraction buffers currently take
+W_EXPORT size_t libwad_get_memory_usage();
+
+//@}
+
+//@{
+//! @name Threads
+//!
+//! Contents of 8 MiB and more are split into segments that several threads
+//! decrypt at once, while the calling thread hashes them in order. This
+//! applies to data_extract_from_wad(), data_verify_from_wad() and
+//! data_extract().
+
+//! Sets the number of threads decrypting a single content
+/// @param count number of threads. 0 uses one per processor (default), 1
+/// decrypts on the calling thread only
+W_EXPORT void libwad_set_thread_count(unsigned count);
+
+//! Gets the number of threads decrypting a single content
+W_EXPORT unsigned libwad_get_thread_count();
+
 //@}
 
 //@{
@@ -0,0 +1,973 @@
+// Copyright 2019 spycrab0
+// Licensed under GPLv3+
+// Refer to the LICENSE file included.
+
+#ifndef _WIN32
+#define _GNU_SOURCE
+#endif
+
+#include "libwad.h"
+
+#include <errno.h>
+#include <memory.h>
+#include <stdlib.h>
+
+#ifdef LIBWAD_HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+#include <mbedtls/sha1.h>
+
+#include "io.h"
+#include "stats.h"
+#include "thread.h"
+#include "wad.h"
+
+// Amount of data read, decrypted and written at once
+#define BATCH_CHUNK_SIZE 0x100000
+
+// Default number of chunks in flight
+#define BATCH_DEFAULT_DEPTH 32
+
+enum batch_chunk_state {
+  BATCH_CHUNK_READING,
+  BATCH_CHUNK_READ,
+  BATCH_CHUNK_WRITING
+};
+
+struct batch_entry;
+
+struct batch_chunk {
+  struct batch_entry* entry;
+  uint32_t number;
+  enum batch_chunk_state state;
+
+  // Chunks other than the first one also read the preceding AES block to get
+  // their IV
+  unsigned char* buffer;
+  uint64_t file_offset;
+  size_t io_size;
+
+  // The decrypted data within buffer
+  unsigned char* data;
+  size_t length;
+
+#ifdef LIBWAD_HAVE_IO_URING
+  struct iovec iov;
+#endif
+};
+
+struct batch_entry {
+  batch_job_t job;
+
+  int in;
+  int out;
+  data_decryptor_t decryptor;
+  unsigned char hash[20];
+  uint16_t content_index;
+  uint64_t offset;
+  uint64_t size;
+
+  uint32_t chunk_count;
+  uint32_t next_read;
+  uint32_t next_process;
+  struct batch_chunk** chunks;
+
+  // Reads and writes that have not completed yet
+  unsigned io_pending;
+  // Whether a worker is currently decrypting chunks of this entry
+  int busy;
+  libwad_error_t error;
+
+  mbedtls_sha1_context sha1;
+
+  // Link in the queue of entries that still have chunks to read
+  int queued;
+  struct batch_entry* next;
+};
+
+enum batch_task_type { BATCH_TASK_READ, BATCH_TASK_WRITE, BATCH_TASK_PROCESS };
+
+struct batch_task {
+  enum batch_task_type type;
+  void* target;
+  struct batch_task* next;
+};
+
+struct batch_result {
+  batch_completion_t completion;
+  struct batch_result* next;
+};
+
+#ifdef LIBWAD_HAVE_IO_URING
+struct batch_ring {
+  int fd;
+
+  unsigned* sq_tail;
+  unsigned* sq_mask;
+  unsigned* sq_array;
+  struct io_uring_sqe* sqes;
+
+  unsigned* cq_head;
+  unsigned* cq_tail;
+  unsigned* cq_mask;
+  struct io_uring_cqe* cqes;
+
+  void* sq_map;
+  size_t sq_map_size;
+  void* cq_map;
+  size_t cq_map_size;
+  size_t sqes_size;
+
+  // Guards the submission queue
+  mutex_t lock;
+};
+#endif
+
+struct batch_data {
+  batch_backend_t backend;
+  unsigned depth;
+
+  mutex_t lock;
+  // Signalled when tasks are queued or the engine stops
+  cond_t task_cond;
+  // Signalled when a job completes
+  cond_t done_cond;
+
+  struct batch_entry* read_head;
+  struct batch_entry* read_tail;
+  struct batch_task* task_head;
+  struct batch_task* task_tail;
+  struct batch_result* result_head;
+  struct batch_result* result_tail;
+
+  // Chunks currently holding a buffer
+  unsigned chunks_in_flight;
+  // Jobs that have not completed yet
+  unsigned jobs_active;
+  // Jobs whose completion has not been picked up by batch_wait() yet
+  unsigned jobs_pending;
+  int stop;
+
+  thread_t* threads;
+  unsigned thread_count;
+
+#ifdef LIBWAD_HAVE_IO_URING
+  struct batch_ring ring;
+  thread_t reaper;
+  int has_reaper;
+  // Signalled when operations are submitted to the ring
+  cond_t ring_cond;
+  unsigned ring_pending;
+#endif
+};
+
+#ifdef LIBWAD_HAVE_IO_URING
+static int batch_ring_init(struct batch_ring* ring, unsigned entries)
+{
+  struct io_uring_params params;
+
+  memset(ring, 0, sizeof(struct batch_ring));
+  memset(&params, 0, sizeof(params));
+
+  ring->fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+
+  if (ring->fd < 0)
+    return 0;
+
+  ring->sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  ring->cq_map_size =
+      params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+  int single_map = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+
+  if (single_map) {
+    if (ring->cq_map_size > ring->sq_map_size)
+      ring->sq_map_size = ring->cq_map_size;
+
+    ring->cq_map_size = ring->sq_map_size;
+  }
+
+  ring->sq_map = mmap(NULL, ring->sq_map_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+
+  if (ring->sq_map == MAP_FAILED) {
+    close(ring->fd);
+    return 0;
+  }
+
+  ring->cq_map = single_map ? ring->sq_map
+                            : mmap(NULL, ring->cq_map_size,
+                                   PROT_READ | PROT_WRITE,
+                                   MAP_SHARED | MAP_POPULATE, ring->fd,
+                                   IORING_OFF_CQ_RING);
+
+  ring->sqes = (struct io_uring_sqe*)mmap(
+      NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+      ring->fd, IORING_OFF_SQES);
+
+  if (ring->cq_map == MAP_FAILED || ring->sqes == MAP_FAILED) {
+    if (ring->cq_map != MAP_FAILED && !single_map)
+      munmap(ring->cq_map, ring->cq_map_size);
+    if (ring->sqes != MAP_FAILED)
+      munmap(ring->sqes, ring->sqes_size);
+
+    munmap(ring->sq_map, ring->sq_map_size);
+    close(ring->fd);
+    return 0;
+  }
+
+  unsigned char* sq = (unsigned char*)ring->sq_map;
+  unsigned char* cq = (unsigned char*)ring->cq_map;
+
+  ring->sq_tail = (unsigned*)(sq + params.sq_off.tail);
+  ring->sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+  ring->sq_array = (unsigned*)(sq + params.sq_off.array);
+
+  ring->cq_head = (unsigned*)(cq + params.cq_off.head);
+  ring->cq_tail = (unsigned*)(cq + params.cq_off.tail);
+  ring->cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+
+  mutex_init(&ring->lock);
+
+  return 1;
+}
+
+static void batch_ring_close(struct batch_ring* ring)
+{
+  munmap(ring->sqes, ring->sqes_size);
+
+  if (ring->cq_map != ring->sq_map)
+    munmap(ring->cq_map, ring->cq_map_size);
+
+  munmap(ring->sq_map, ring->sq_map_size);
+  close(ring->fd);
+  mutex_destroy(&ring->lock);
+}
+
+static int batch_ring_submit(struct batch_ring* ring, int opcode, int fd,
+                             struct iovec* iov, uint64_t offset, void* user)
+{
+  mutex_lock(&ring->lock);
+
+  unsigned tail = *ring->sq_tail;
+  unsigned index = tail & *ring->sq_mask;
+  struct io_uring_sqe* sqe = &ring->sqes[index];
+
+  memset(sqe, 0, sizeof(struct io_uring_sqe));
+  sqe->opcode = (uint8_t)opcode;
+  sqe->fd = fd;
+  sqe->addr = (uint64_t)(uintptr_t)iov;
+  sqe->len = 1;
+  sqe->off = offset;
+  sqe->user_data = (uint64_t)(uintptr_t)user;
+
+  ring->sq_array[index] = index;
+  __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+  long ret;
+
+  do {
+    ret = syscall(__NR_io_uring_enter, ring->fd, 1, 0, 0, NULL, 0);
+  } while (ret < 0 && errno == EINTR);
+
+  // Take the entry back if the kernel did not consume it
+  if (ret != 1)
+    __atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+
+  mutex_unlock(&ring->lock);
+
+  return ret == 1;
+}
+#endif
+
+static void batch_push_task(struct batch_data* batch, enum batch_task_type type,
+                            void* target);
+static void batch_check_done(struct batch_data* batch,
+                             struct batch_entry* entry);
+static void batch_io_done(struct batch_data* batch, struct batch_chunk* chunk,
+                          int success);
+
+// Hands a read or write of a chunk to the backend. Called with the lock held.
+static void batch_submit_io(struct batch_data* batch,
+                            struct batch_chunk* chunk)
+{
+  chunk->entry->io_pending++;
+
+#ifdef LIBWAD_HAVE_IO_URING
+  if (batch->backend == BATCH_BACKEND_IO_URING) {
+    struct batch_entry* entry = chunk->entry;
+    int reading = chunk->state == BATCH_CHUNK_READING;
+
+    if (reading) {
+      chunk->iov.iov_base = chunk->buffer;
+      chunk->iov.iov_len = chunk->io_size;
+    } else {
+      chunk->iov.iov_base = chunk->data;
+      chunk->iov.iov_len = chunk->length;
+    }
+
+    if (!batch_ring_submit(
+            &batch->ring, reading ? IORING_OP_READV : IORING_OP_WRITEV,
+            reading ? entry->in : entry->out, &chunk->iov,
+            reading ? chunk->file_offset
+                    : (uint64_t)chunk->number * BATCH_CHUNK_SIZE,
+            chunk)) {
+      batch_io_done(batch, chunk, 0);
+      return;
+    }
+
+    batch->ring_pending++;
+    cond_signal(&batch->ring_cond);
+    return;
+  }
+#endif
+
+  batch_push_task(batch,
+                  chunk->state == BATCH_CHUNK_READING ? BATCH_TASK_READ
+                                                      : BATCH_TASK_WRITE,
+                  chunk);
+}
+
+static void batch_push_task(struct batch_data* batch, enum batch_task_type type,
+                            void* target)
+{
+  struct batch_task* task = (struct batch_task*)malloc(sizeof(struct batch_task));
+
+  if (task == NULL) {
+    // Handle the work right away rather than losing it
+    if (type == BATCH_TASK_PROCESS) {
+      ((struct batch_entry*)target)->error = LIBWAD_BAD_ALLOC;
+      ((struct batch_entry*)target)->busy = 0;
+      batch_check_done(batch, (struct batch_entry*)target);
+    } else {
+      batch_io_done(batch, (struct batch_chunk*)target, 0);
+    }
+    return;
+  }
+
+  task->type = type;
+  task->target = target;
+  task->next = NULL;
+
+  if (batch->task_tail != NULL)
+    batch->task_tail->next = task;
+  else
+    batch->task_head = task;
+
+  batch->task_tail = task;
+
+  cond_signal(&batch->task_cond);
+}
+
+static void batch_free_chunk(struct batch_data* batch,
+                             struct batch_chunk* chunk)
+{
+  chunk->entry->chunks[chunk->number] = NULL;
+  batch->chunks_in_flight--;
+
+  free(chunk->buffer);
+  free(chunk);
+}
+
+static void batch_unqueue(struct batch_data* batch, struct batch_entry* entry)
+{
+  struct batch_entry* prev = NULL;
+
+  for (struct batch_entry* e = batch->read_head; e != NULL; e = e->next) {
+    if (e == entry) {
+      if (prev != NULL)
+        prev->next = e->next;
+      else
+        batch->read_head = e->next;
+
+      if (batch->read_tail == e)
+        batch->read_tail = prev;
+
+      break;
+    }
+
+    prev = e;
+  }
+
+  entry->queued = 0;
+  entry->next = NULL;
+}
+
+// Completes an entry once nothing refers to it anymore. Called with the lock
+// held.
+static void batch_check_done(struct batch_data* batch,
+                             struct batch_entry* entry)
+{
+  if (entry->busy || entry->io_pending > 0)
+    return;
+
+  if (entry->error == LIBWAD_NO_ERROR &&
+      entry->next_process < entry->chunk_count)
+    return;
+
+  if (entry->queued)
+    batch_unqueue(batch, entry);
+
+  for (uint32_t i = 0; i < entry->chunk_count; i++) {
+    if (entry->chunks[i] != NULL)
+      batch_free_chunk(batch, entry->chunks[i]);
+  }
+
+  if (entry->error == LIBWAD_NO_ERROR &&
+      entry->job.verify == LIBWAD_VERIFY_HASH) {
+    unsigned char hash[20];
+    mbedtls_sha1_finish_ret(&entry->sha1, hash);
+
+    if (memcmp(hash, entry->hash, 20) != 0)
+      entry->error = LIBWAD_HASH_MISMATCH;
+  }
+
+  if (entry->error == LIBWAD_NO_ERROR)
+    STATS_COUNT(STATS_EXTRACTS);
+
+  if (entry->out >= 0)
+    io_close_output(entry->out);
+
+  struct batch_result* result =
+      (struct batch_result*)malloc(sizeof(struct batch_result));
+
+  // Without memory for the result the job is reported as gone
+  if (result != NULL) {
+    result->completion.job = entry->job;
+    result->completion.error = entry->error;
+    result->next = NULL;
+
+    if (batch->result_tail != NULL)
+      batch->result_tail->next = result;
+    else
+      batch->result_head = result;
+
+    batch->result_tail = result;
+  } else {
+    batch->jobs_pending--;
+  }
+
+  batch->jobs_active--;
+
+  mbedtls_sha1_free(&entry->sha1);
+  free(entry->chunks);
+  free(entry);
+
+  cond_broadcast(&batch->done_cond);
+}
+
+static void batch_issue_read(struct batch_data* batch,
+                             struct batch_entry* entry)
+{
+  uint32_t number = entry->next_read++;
+  uint64_t start = (uint64_t)number * BATCH_CHUNK_SIZE;
+
+  struct batch_chunk* chunk =
+      (struct batch_chunk*)malloc(sizeof(struct batch_chunk));
+  unsigned char* buffer = (unsigned char*)malloc(BATCH_CHUNK_SIZE + 16);
+
+  if (chunk == NULL || buffer == NULL) {
+    free(chunk);
+    free(buffer);
+    entry->error = LIBWAD_BAD_ALLOC;
+    return;
+  }
+
+  chunk->entry = entry;
+  chunk->number = number;
+  chunk->state = BATCH_CHUNK_READING;
+  chunk->buffer = buffer;
+  chunk->length = BATCH_CHUNK_SIZE;
+
+  if (chunk->length > entry->size - start)
+    chunk->length = (size_t)(entry->size - start);
+
+  chunk->io_size = (chunk->length + 15) & ~(size_t)15;
+
+  if (number == 0) {
+    chunk->file_offset = entry->offset;
+    chunk->data = buffer;
+  } else {
+    chunk->file_offset = entry->offset + start - 16;
+    chunk->io_size += 16;
+    chunk->data = buffer + 16;
+  }
+
+  entry->chunks[number] = chunk;
+  batch->chunks_in_flight++;
+
+  batch_submit_io(batch, chunk);
+}
+
+// Issues reads until the queue depth is reached. Called with the lock held.
+static void batch_fill(struct batch_data* batch)
+{
+  while (!batch->stop && batch->chunks_in_flight < batch->depth &&
+         batch->read_head != NULL) {
+    struct batch_entry* entry = batch->read_head;
+
+    if (entry->error != LIBWAD_NO_ERROR ||
+        entry->next_read >= entry->chunk_count) {
+      batch_unqueue(batch, entry);
+      batch_check_done(batch, entry);
+      continue;
+    }
+
+    batch_issue_read(batch, entry);
+  }
+}
+
+static void batch_io_done(struct batch_data* batch, struct batch_chunk* chunk,
+                          int success)
+{
+  struct batch_entry* entry = chunk->entry;
+
+  entry->io_pending--;
+
+  if (!success && entry->error == LIBWAD_NO_ERROR)
+    entry->error = LIBWAD_IO_ERROR;
+
+  if (chunk->state == BATCH_CHUNK_READING && entry->error == LIBWAD_NO_ERROR) {
+    chunk->state = BATCH_CHUNK_READ;
+
+    // Chunks are decrypted and hashed in order by a single worker at a time.
+    // The entry is completed right away if the task can't be queued.
+    if (chunk->number == entry->next_process && !entry->busy) {
+      entry->busy = 1;
+      batch_push_task(batch, BATCH_TASK_PROCESS, entry);
+      batch_fill(batch);
+      return;
+    }
+  } else {
+    batch_free_chunk(batch, chunk);
+  }
+
+  batch_check_done(batch, entry);
+  batch_fill(batch);
+}
+
+static libwad_error_t batch_decrypt(struct batch_entry* entry,
+                                    struct batch_chunk* chunk)
+{
+  unsigned char iv[16];
+
+  if (chunk->number == 0) {
+    memset(iv, 0, sizeof(iv));
+    iv[0] = (unsigned char)(entry->content_index >> 8);
+    iv[1] = (unsigned char)entry->content_index;
+  } else {
+    memcpy(iv, chunk->buffer, 16);
+  }
+
+  if (!data_decrypt(entry->decryptor, iv, chunk->data, chunk->data,
+                    (chunk->length + 15) & ~(size_t)15))
+    return LIBWAD_DECRYPTION_FAILED;
+
+  if (entry->job.verify == LIBWAD_VERIFY_HASH) {
+    STATS_TIMER(hash_timer);
+    mbedtls_sha1_update_ret(&entry->sha1, chunk->data, chunk->length);
+    STATS_ADD(STATS_HASH, chunk->length, hash_timer);
+  }
+
+  return LIBWAD_NO_ERROR;
+}
+
+// Decrypts all chunks of an entry that are ready, in order. Called with the
+// lock held, which is released while decrypting.
+static void batch_process(struct batch_data* batch, struct batch_entry* entry)
+{
+  while (entry->error == LIBWAD_NO_ERROR &&
+         entry->next_process < entry->chunk_count) {
+    struct batch_chunk* chunk = entry->chunks[entry->next_process];
+
+    if (chunk == NULL || chunk->state != BATCH_CHUNK_READ)
+      break;
+
+    mutex_unlock(&batch->lock);
+    libwad_error_t error = batch_decrypt(entry, chunk);
+    mutex_lock(&batch->lock);
+
+    if (error != LIBWAD_NO_ERROR) {
+      entry->error = error;
+      break;
+    }
+
+    entry->next_process++;
+
+    if (entry->out >= 0) {
+      chunk->state = BATCH_CHUNK_WRITING;
+      batch_submit_io(batch, chunk);
+    } else {
+      batch_free_chunk(batch, chunk);
+    }
+  }
+
+  entry->busy = 0;
+
+  batch_check_done(batch, entry);
+  batch_fill(batch);
+}
+
+static void batch_worker(void* arg)
+{
+  struct batch_data* batch = (struct batch_data*)arg;
+
+  mutex_lock(&batch->lock);
+
+  for (;;) {
+    while (!batch->stop && batch->task_head == NULL)
+      cond_wait(&batch->task_cond, &batch->lock);
+
+    struct batch_task* task = batch->task_head;
+
+    if (task == NULL)
+      break;
+
+    batch->task_head = task->next;
+
+    if (batch->task_head == NULL)
+      batch->task_tail = NULL;
+
+    enum batch_task_type type = task->type;
+    void* target = task->target;
+
+    free(task);
+
+    if (type == BATCH_TASK_PROCESS) {
+      batch_process(batch, (struct batch_entry*)target);
+      continue;
+    }
+
+    struct batch_chunk* chunk = (struct batch_chunk*)target;
+    struct batch_entry* entry = chunk->entry;
+
+    mutex_unlock(&batch->lock);
+
+    int success;
+
+    if (type == BATCH_TASK_READ) {
+      success = io_read_content((struct wad_data*)entry->job.wad,
+                                entry->job.index, chunk->buffer,
+                                chunk->io_size,
+                                chunk->file_offset - entry->offset);
+    } else {
+      success = io_pwrite(entry->out, chunk->data, chunk->length,
+                          (uint64_t)chunk->number * BATCH_CHUNK_SIZE);
+    }
+
+    mutex_lock(&batch->lock);
+
+    batch_io_done(batch, chunk, success);
+  }
+
+  mutex_unlock(&batch->lock);
+}
+
+#ifdef LIBWAD_HAVE_IO_URING
+static void batch_reaper(void* arg)
+{
+  struct batch_data* batch = (struct batch_data*)arg;
+  struct batch_ring* ring = &batch->ring;
+
+  mutex_lock(&batch->lock);
+
+  for (;;) {
+    while (!batch->stop && batch->ring_pending == 0)
+      cond_wait(&batch->ring_cond, &batch->lock);
+
+    if (batch->ring_pending == 0)
+      break;
+
+    mutex_unlock(&batch->lock);
+
+    // Interruptions are fine, we just look at the queue again
+    syscall(__NR_io_uring_enter, ring->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL,
+            0);
+
+    mutex_lock(&batch->lock);
+
+    unsigned head = *ring->cq_head;
+
+    while (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+      struct io_uring_cqe* cqe = &ring->cqes[head & *ring->cq_mask];
+      struct batch_chunk* chunk = (struct batch_chunk*)(uintptr_t)cqe->user_data;
+      int result = cqe->res;
+
+      __atomic_store_n(ring->cq_head, ++head, __ATOMIC_RELEASE);
+
+      batch->ring_pending--;
+
+      size_t expected = chunk->state == BATCH_CHUNK_READING ? chunk->io_size
+                                                            : chunk->length;
+
+      if (chunk->state == BATCH_CHUNK_READING && result > 0) {
+        // Reads overlap each other, so only their size is accounted for
+        STATS_ADD(STATS_READ, (uint64_t)result, stats_now());
+
+        // The ring reads through the page cache whatever the policy is
+        io_done((struct wad_data*)chunk->entry->job.wad, chunk->file_offset,
+                (uint64_t)result);
+      }
+
+      batch_io_done(batch, chunk, result >= 0 && (size_t)result == expected);
+    }
+  }
+
+  mutex_unlock(&batch->lock);
+}
+#endif
+
+static void batch_stop(struct batch_data* batch)
+{
+  mutex_lock(&batch->lock);
+  batch->stop = 1;
+  cond_broadcast(&batch->task_cond);
+#ifdef LIBWAD_HAVE_IO_URING
+  cond_broadcast(&batch->ring_cond);
+#endif
+  mutex_unlock(&batch->lock);
+
+  for (unsigned i = 0; i < batch->thread_count; i++)
+    thread_join(batch->threads[i]);
+
+#ifdef LIBWAD_HAVE_IO_URING
+  if (batch->has_reaper)
+    thread_join(batch->reaper);
+
+  if (batch->backend == BATCH_BACKEND_IO_URING)
+    batch_ring_close(&batch->ring);
+
+  cond_destroy(&batch->ring_cond);
+#endif
+
+  free(batch->threads);
+
+  while (batch->result_head != NULL) {
+    struct batch_result* next = batch->result_head->next;
+    free(batch->result_head);
+    batch->result_head = next;
+  }
+
+  cond_destroy(&batch->task_cond);
+  cond_destroy(&batch->done_cond);
+  mutex_destroy(&batch->lock);
+
+  free(batch);
+}
+
+batch_t batch_open(unsigned depth, unsigned threads, batch_backend_t backend)
+{
+  struct batch_data* batch =
+      (struct batch_data*)calloc(1, sizeof(struct batch_data));
+
+  if (batch == NULL) {
+    g_error = LIBWAD_BAD_ALLOC;
+    return NULL;
+  }
+
+  batch->depth = depth != 0 ? depth : BATCH_DEFAULT_DEPTH;
+
+  if (threads == 0)
+    threads = thread_get_cpu_count();
+
+  mutex_init(&batch->lock);
+  cond_init(&batch->task_cond);
+  cond_init(&batch->done_cond);
+
+#ifdef LIBWAD_HAVE_IO_URING
+  cond_init(&batch->ring_cond);
+
+  if (backend != BATCH_BACKEND_THREADS &&
+      batch_ring_init(&batch->ring, batch->depth)) {
+    backend = BATCH_BACKEND_IO_URING;
+  } else if (backend == BATCH_BACKEND_IO_URING) {
+    g_error = LIBWAD_NOT_SUPPORTED;
+    batch->backend = BATCH_BACKEND_THREADS;
+    batch_stop(batch);
+    return NULL;
+  }
+#else
+  if (backend == BATCH_BACKEND_IO_URING) {
+    g_error = LIBWAD_NOT_SUPPORTED;
+    batch_stop(batch);
+    return NULL;
+  }
+#endif
+
+  if (backend == BATCH_BACKEND_AUTO)
+    backend = BATCH_BACKEND_THREADS;
+
+  batch->backend = backend;
+
+  batch->threads = (thread_t*)malloc(sizeof(thread_t) * threads);
+
+  if (batch->threads == NULL) {
+    g_error = LIBWAD_BAD_ALLOC;
+    batch_stop(batch);
+    return NULL;
+  }
+
+  for (; batch->thread_count < threads; batch->thread_count++) {
+    if (!thread_create(&batch->threads[batch->thread_count], batch_worker,
+                       batch))
+      break;
+  }
+
+  int started = batch->thread_count > 0;
+
+#ifdef LIBWAD_HAVE_IO_URING
+  if (started && backend == BATCH_BACKEND_IO_URING)
+    started = batch->has_reaper =
+        thread_create(&batch->reaper, batch_reaper, batch);
+#endif
+
+  if (!started) {
+    g_error = LIBWAD_BAD_ALLOC;
+    batch_stop(batch);
+    return NULL;
+  }
+
+  return batch;
+}
+
+batch_backend_t batch_get_backend(batch_t handle)
+{
+  return ((struct batch_data*)handle)->backend;
+}
+
+int batch_submit(batch_t handle, const batch_job_t* job)
+{
+  struct batch_data* batch = (struct batch_data*)handle;
+  struct wad_data* wad = (struct wad_data*)job->wad;
+  tmd_content_t* content = tmd_get_content(wad->tmd, job->index);
+
+  if (content == NULL) {
+    g_error = LIBWAD_OUT_OF_RANGE;
+    return 0;
+  }
+
+  uint64_t offset;
+  int in = io_get_content_fd(wad, job->index, &offset);
+
+  if (in < 0) {
+    g_error = LIBWAD_NOT_FOUND;
+    return 0;
+  }
+
+  struct batch_entry* entry =
+      (struct batch_entry*)calloc(1, sizeof(struct batch_entry));
+
+  uint32_t chunk_count =
+      (uint32_t)((content->size + BATCH_CHUNK_SIZE - 1) / BATCH_CHUNK_SIZE);
+
+  if (entry == NULL || (entry->chunks = (struct batch_chunk**)calloc(
+                            chunk_count + 1, sizeof(struct batch_chunk*))) ==
+                           NULL) {
+    free(entry);
+    g_error = LIBWAD_BAD_ALLOC;
+    return 0;
+  }
+
+  entry->out = -1;
+
+  if (job->output != NULL) {
+    entry->out = io_open_output(job->output);
+
+    if (entry->out < 0) {
+      free(entry->chunks);
+      free(entry);
+      g_error = LIBWAD_OPEN_FAILED;
+      return 0;
+    }
+  }
+
+  entry->job = *job;
+  entry->in = in;
+  entry->decryptor = wad->decryptor;
+  memcpy(entry->hash, content->hash, 20);
+  entry->content_index = content->index;
+  entry->offset = offset;
+  entry->size = content->size;
+  entry->chunk_count = chunk_count;
+
+  mbedtls_sha1_init(&entry->sha1);
+  mbedtls_sha1_starts_ret(&entry->sha1);
+
+  mutex_lock(&batch->lock);
+
+  batch->jobs_active++;
+  batch->jobs_pending++;
+
+  entry->queued = 1;
+
+  if (batch->read_tail != NULL)
+    batch->read_tail->next = entry;
+  else
+    batch->read_head = entry;
+
+  batch->read_tail = entry;
+
+  // Empty contents complete right away
+  batch_check_done(batch, entry);
+  batch_fill(batch);
+
+  mutex_unlock(&batch->lock);
+
+  return 1;
+}
+
+int batch_wait(batch_t handle, batch_completion_t* completion)
+{
+  struct batch_data* batch = (struct batch_data*)handle;
+
+  mutex_lock(&batch->lock);
+
+  while (batch->result_head == NULL && batch->jobs_pending > 0)
+    cond_wait(&batch->done_cond, &batch->lock);
+
+  struct batch_result* result = batch->result_head;
+
+  if (result == NULL) {
+    mutex_unlock(&batch->lock);
+    return 0;
+  }
+
+  batch->result_head = result->next;
+
+  if (batch->result_head == NULL)
+    batch->result_tail = NULL;
+
+  batch->jobs_pending--;
+
+  mutex_unlock(&batch->lock);
+
+  *completion = result->completion;
+  free(result);
+
+  return 1;
+}
+
+void batch_close(batch_t handle)
+{
+  if (handle == NULL)
+    return;
+
+  struct batch_data* batch = (struct batch_data*)handle;
+
+  // Let running jobs finish, their results are discarded
+  mutex_lock(&batch->lock);
+
+  while (batch->jobs_active > 0)
+    cond_wait(&batch->done_cond, &batch->lock);
+
+  mutex_unlock(&batch->lock);
+
+  batch_stop(batch);
+}
@@ -0,0 +1,336 @@
+// Copyright 2019 spycrab0
+// Licensed under GPLv3+
+// Refer to the LICENSE file included.
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#include <libwad.h>
+
+#define OPTPARSE_IMPLEMENTATION
+#include <optparse.h>
+
+#include "gen.h"
+
+struct result {
+  const char* name;
+  uint64_t ops;
+  uint64_t bytes;
+  double seconds;
+};
+
+static double now()
+{
+#ifdef _WIN32
+  LARGE_INTEGER frequency, counter;
+  QueryPerformanceFrequency(&frequency);
+  QueryPerformanceCounter(&counter);
+  return (double)counter.QuadPart / frequency.QuadPart;
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
+}
+
+static uint64_t xorshift64(uint64_t* state)
+{
+  uint64_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  return *state = x;
+}
+
+static int bench_open(const char* path, unsigned iterations,
+                      struct result* result)
+{
+  double start = now();
+
+  for (unsigned i = 0; i < iterations; i++) {
+    wad_t wad = wad_open(path);
+
+    if (wad == NULL)
+      return 0;
+
+    wad_close(wad);
+  }
+
+  result->seconds = now() - start;
+  result->ops = iterations;
+
+  return 1;
+}
+
+static int bench_metadata(const char* path, unsigned iterations,
+                          struct result* result)
+{
+  // Keep the compiler from dropping the reads
+  volatile uint64_t sink = 0;
+
+  double start = now();
+
+  for (unsigned i = 0; i < iterations; i++) {
+    wad_t wad = wad_open(path);
+
+    if (wad == NULL)
+      return 0;
+
+    tmd_t tmd = wad_get_tmd(wad);
+    certchain_t certchain = wad_get_certchain(wad);
+
+    sink += ticket_get_title_id(wad_get_ticket(wad));
+    sink += tmd_get_title_version(tmd);
+
+    for (uint16_t c = 0; c < tmd_get_content_count(tmd); c++)
+      sink += tmd_get_content(tmd, c)->size;
+
+    for (size_t c = 0; c < certchain_get_cert_count(certchain); c++)
+      sink += certchain_get_cert(certchain, c)->key_type;
+
+    wad_close(wad);
+  }
+
+  result->seconds = now() - start;
+  result->ops = iterations;
+
+  (void)sink;
+
+  return 1;
+}
+
+static int bench_extract(wad_t wad, data_verify_t verify,
+                         struct result* result)
+{
+  tmd_t tmd = wad_get_tmd(wad);
+
+  double start = now();
+
+  for (uint16_t i = 0; i < tmd_get_content_count(tmd); i++) {
+    unsigned char* data = data_extract_from_wad(wad, i, verify);
+
+    if (data == NULL)
+      return 0;
+
+    free(data);
+
+    result->bytes += tmd_get_content(tmd, i)->size;
+  }
+
+  result->seconds = now() - start;
+  result->ops = tmd_get_content_count(tmd);
+
+  return 1;
+}
+
+static int bench_range(wad_t wad, unsigned count, size_t length,
+                       struct result* result)
+{
+  tmd_t tmd = wad_get_tmd(wad);
+  uint16_t content_count = tmd_get_content_count(tmd);
+
+  unsigned char* buffer = (unsigned char*)malloc(length);
+
+  if (buffer == NULL)
+    return 0;
+
+  uint64_t state = 0x9e3779b97f4a7c15ULL;
+
+  double start = now();
+
+  for (unsigned i = 0; i < count; i++) {
+    uint16_t index = (uint16_t)(xorshift64(&state) % content_count);
+    uint64_t size = tmd_get_content(tmd, index)->size;
+
+    size_t n = size < length ? (size_t)size : length;
+    uint64_t offset = xorshift64(&state) % (size - n + 1);
+
+    if (!data_read_range(wad, index, offset, n, buffer)) {
+      free(buffer);
+      return 0;
+    }
+
+    result->bytes += n;
+  }
+
+  result->seconds = now() - start;
+  result->ops = count;
+
+  free(buffer);
+
+  return 1;
+}
+
+static void print_result(const struct result* r, int last)
+{
+  double seconds = r->seconds > 0 ? r->seconds : 1e-9;
+
+  printf("    {\"name\": \"%s\", \"ops\": %" PRIu64 ", \"bytes\": %" PRIu64
+         ", \"seconds\": %.6f, \"ops_per_sec\": %.2f, \"mb_per_sec\": %.2f}%s\n",
+         r->name, r->ops, r->bytes, r->seconds, r->ops / seconds,
+         r->bytes / seconds / (1024 * 1024), last ? "" : ",");
+}
+
+void show_help(const char* program)
+{
+  printf("%s [options] [wadfile]\n\n"
+         "Benchmarks libwad on the given wad or a generated one and prints\n"
+         "the results as JSON.\n\n"
+         "Options:\n\n"
+         "-h, --help\t\tShow this message\n"
+         "-i, --iterations N\tIterations of the open benchmarks (default: "
+         "200)\n"
+         "-k, --keep\t\tKeep the generated wad\n"
+         "-l, --length BYTES\tLength of range reads (default: 4096)\n"
+         "-n, --contents COUNT\tContents of the generated wad (default: 8)\n"
+         "-o, --output PATH\tPath of the generated wad (default: "
+         "libwad_bench.wad)\n"
+         "-r, --ranges N\t\tNumber of range reads (default: 10000)\n"
+         "-s, --size BYTES\tContent size of the generated wad (default: "
+         "16777216)\n"
+         "-v, --version\t\tDisplay version\n\n",
+         program);
+}
+
+int main(int argc, char** argv)
+{
+  struct optparse options;
+
+  optparse_init(&options, argv);
+
+  unsigned iterations = 200, ranges = 10000;
+  size_t length = 4096;
+  long count = 8;
+  uint64_t size = 16 * 1024 * 1024;
+  int keep = 0;
+  const char* gen_path = "libwad_bench.wad";
+
+  struct optparse_long flags[] = {{"help", 'h', OPTPARSE_NONE},
+                                  {"iterations", 'i', OPTPARSE_REQUIRED},
+                                  {"keep", 'k', OPTPARSE_NONE},
+                                  {"length", 'l', OPTPARSE_REQUIRED},
+                                  {"contents", 'n', OPTPARSE_REQUIRED},
+                                  {"output", 'o', OPTPARSE_REQUIRED},
+                                  {"ranges", 'r', OPTPARSE_REQUIRED},
+                                  {"size", 's', OPTPARSE_REQUIRED},
+                                  {"version", 'v', OPTPARSE_NONE},
+                                  {0}};
+
+  for (int c = optparse_long(&options, flags, NULL); c != -1;
+       c = optparse_long(&options, flags, NULL)) {
+    switch (c) {
+    case 'h':
+      show_help(argv[0]);
+      return 0;
+    case 'i':
+      iterations = (unsigned)strtoul(options.optarg, NULL, 10);
+      break;
+    case 'k':
+      keep = 1;
+      break;
+    case 'l':
+      length = (size_t)strtoull(options.optarg, NULL, 10);
+      break;
+    case 'n':
+      count = strtol(options.optarg, NULL, 10);
+      break;
+    case 'o':
+      gen_path = options.optarg;
+      break;
+    case 'r':
+      ranges = (unsigned)strtoul(options.optarg, NULL, 10);
+      break;
+    case 's':
+      size = strtoull(options.optarg, NULL, 10);
+      break;
+    case 'v':
+      printf("libwad_bench from libwad version %s\n",
+             libwad_get_version_string());
+      return 0;
+    case '?':
+      fprintf(
+          stderr,
+          "Invalid arguments provided or parameter missing. See -h for help\n");
+      return 1;
+    }
+  }
+
+  const char* wad_path = optparse_arg(&options);
+  int generated = 0;
+
+  if (wad_path == NULL) {
+    if (count < 1 || count > 0xffff || length == 0) {
+      fprintf(stderr, "Bad parameters given. See -h for help\n");
+      return 1;
+    }
+
+    uint64_t* sizes = (uint64_t*)malloc(sizeof(uint64_t) * count);
+
+    if (sizes == NULL)
+      return 1;
+
+    for (long i = 0; i < count; i++)
+      sizes[i] = size;
+
+    if (!gen_write_wad(gen_path, 0x0001000142454e43ULL, (uint16_t)count, sizes,
+                       1)) {
+      fprintf(stderr, "Failed to generate '%s': %s\n", gen_path,
+              libwad_get_error_msg());
+      free(sizes);
+      return 1;
+    }
+
+    free(sizes);
+
+    wad_path = gen_path;
+    generated = 1;
+  }
+
+  struct result results[] = {{"open"},
+                             {"metadata_scan"},
+                             {"extract"},
+                             {"verify"},
+                             {"range_read"}};
+
+  wad_t wad = wad_open(wad_path);
+
+  int ok = wad != NULL && bench_open(wad_path, iterations, &results[0]) &&
+           bench_metadata(wad_path, iterations, &results[1]) &&
+           bench_extract(wad, LIBWAD_DONT_VERIFY_HASH, &results[2]) &&
+           bench_extract(wad, LIBWAD_VERIFY_HASH, &results[3]) &&
+           bench_range(wad, ranges, length, &results[4]);
+
+  if (!ok) {
+    fprintf(stderr, "Benchmark failed on '%s': %s\n", wad_path,
+            libwad_get_error_msg());
+  } else {
+    size_t result_count = sizeof(results) / sizeof(results[0]);
+
+    printf("{\n  \"version\": \"%s\",\n", libwad_get_version_string());
+    printf("  \"wad\": {\"path\": \"%s\", \"contents\": %u, \"data_size\": "
+           "%" PRIu32 "},\n",
+           wad_path, tmd_get_content_count(wad_get_tmd(wad)),
+           wad_get_section_size(wad, WAD_SECTION_DATA));
+    printf("  \"results\": [\n");
+
+    for (size_t i = 0; i < result_count; i++)
+      print_result(&results[i], i + 1 == result_count);
+
+    printf("  ]\n}\n");
+  }
+
+  wad_close(wad);
+
+  if (generated && !keep)
+    remove(wad_path);
+
+  return ok ? 0 : 1;
+}
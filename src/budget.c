@@ -0,0 +1,64 @@
+// Copyright 2019 spycrab0
+// Licensed under GPLv3+
+// Refer to the LICENSE file included.
+
+#include "budget.h"
+
+#include "thread.h"
+#include "wad.h"
+
+static mutex_t s_lock = MUTEX_INITIALIZER;
+
+// 0 means unlimited
+static uint64_t s_budget = 0;
+static uint64_t s_usage = 0;
+
+int budget_acquire(uint64_t size)
+{
+  mutex_lock(&s_lock);
+
+  // Usage is tracked even without a budget so setting one later is accurate
+  if (s_budget != 0 && (size > s_budget || s_usage > s_budget - size)) {
+    mutex_unlock(&s_lock);
+    g_error = LIBWAD_OVER_BUDGET;
+    return 0;
+  }
+
+  s_usage += size;
+
+  mutex_unlock(&s_lock);
+
+  return 1;
+}
+
+void budget_release(uint64_t size)
+{
+  mutex_lock(&s_lock);
+  s_usage -= size;
+  mutex_unlock(&s_lock);
+}
+
+void libwad_set_memory_budget(size_t bytes)
+{
+  mutex_lock(&s_lock);
+  s_budget = bytes;
+  mutex_unlock(&s_lock);
+}
+
+size_t libwad_get_memory_budget()
+{
+  mutex_lock(&s_lock);
+  size_t budget = (size_t)s_budget;
+  mutex_unlock(&s_lock);
+
+  return budget;
+}
+
+size_t libwad_get_memory_usage()
+{
+  mutex_lock(&s_lock);
+  size_t usage = (size_t)s_usage;
+  mutex_unlock(&s_lock);
+
+  return usage;
+}
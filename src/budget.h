@@ -0,0 +1,15 @@
+// Copyright 2019 spycrab0
+// Licensed under GPLv3+
+// Refer to the LICENSE file included.
+
+#ifndef BUDGET_H
+#define BUDGET_H
+
+#include "libwad.h"
+
+// Reserves size bytes of the memory budget. Fails with LIBWAD_OVER_BUDGET if
+// that would exceed the budget, in which case nothing has to be released
+int budget_acquire(uint64_t size);
+void budget_release(uint64_t size);
+
+#endif
@@ -0,0 +1,304 @@
+// Copyright 2019 spycrab0
+// Licensed under GPLv3+
+// Refer to the LICENSE file included.
+
+#include "cache.h"
+
+#include <memory.h>
+#include <stdlib.h>
+
+#include "thread.h"
+
+#define CACHE_SHARD_COUNT 16
+#define CACHE_MIN_BUCKETS 64
+
+struct cache_entry {
+  struct cache_key key;
+  struct cache_entry* hash_next;
+  struct cache_entry* lru_prev;
+  struct cache_entry* lru_next;
+  size_t size;
+  unsigned char data[];
+};
+
+struct cache_shard {
+  mutex_t lock;
+  struct cache_entry** buckets;
+  size_t bucket_count;
+  size_t entry_count;
+  // Most recently used entry is at the head
+  struct cache_entry* lru_head;
+  struct cache_entry* lru_tail;
+  size_t size;
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t evictions;
+};
+
+static struct cache_shard s_shards[CACHE_SHARD_COUNT] = {
+    {MUTEX_INITIALIZER}, {MUTEX_INITIALIZER}, {MUTEX_INITIALIZER},
+    {MUTEX_INITIALIZER}, {MUTEX_INITIALIZER}, {MUTEX_INITIALIZER},
+    {MUTEX_INITIALIZER}, {MUTEX_INITIALIZER}, {MUTEX_INITIALIZER},
+    {MUTEX_INITIALIZER}, {MUTEX_INITIALIZER}, {MUTEX_INITIALIZER},
+    {MUTEX_INITIALIZER}, {MUTEX_INITIALIZER}, {MUTEX_INITIALIZER},
+    {MUTEX_INITIALIZER}};
+
+// Budget per shard in bytes. A budget of 0 disables the cache
+static volatile size_t s_shard_budget = 0;
+
+static uint64_t cache_hash(const struct cache_key* key)
+{
+  // splitmix64 finalizer
+  uint64_t x = key->wad_id ^ (key->block * 0x9e3779b97f4a7c15ULL) ^
+               ((uint64_t)key->index << 48);
+
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+
+  return x ^ (x >> 31);
+}
+
+static int cache_key_equal(const struct cache_key* a, const struct cache_key* b)
+{
+  return a->wad_id == b->wad_id && a->block == b->block &&
+         a->index == b->index;
+}
+
+static struct cache_shard* cache_get_shard(uint64_t hash)
+{
+  return &s_shards[hash % CACHE_SHARD_COUNT];
+}
+
+static void cache_lru_unlink(struct cache_shard* shard,
+                             struct cache_entry* entry)
+{
+  if (entry->lru_prev != NULL)
+    entry->lru_prev->lru_next = entry->lru_next;
+  else
+    shard->lru_head = entry->lru_next;
+
+  if (entry->lru_next != NULL)
+    entry->lru_next->lru_prev = entry->lru_prev;
+  else
+    shard->lru_tail = entry->lru_prev;
+}
+
+static void cache_lru_push(struct cache_shard* shard, struct cache_entry* entry)
+{
+  entry->lru_prev = NULL;
+  entry->lru_next = shard->lru_head;
+
+  if (shard->lru_head != NULL)
+    shard->lru_head->lru_prev = entry;
+  else
+    shard->lru_tail = entry;
+
+  shard->lru_head = entry;
+}
+
+static void cache_remove(struct cache_shard* shard, struct cache_entry* entry)
+{
+  size_t bucket = (cache_hash(&entry->key) / CACHE_SHARD_COUNT) %
+                  shard->bucket_count;
+
+  for (struct cache_entry** e = &shard->buckets[bucket]; *e != NULL;
+       e = &(*e)->hash_next) {
+    if (*e == entry) {
+      *e = entry->hash_next;
+      break;
+    }
+  }
+
+  cache_lru_unlink(shard, entry);
+
+  shard->size -= entry->size;
+  shard->entry_count--;
+
+  free(entry);
+}
+
+static void cache_evict(struct cache_shard* shard, size_t budget)
+{
+  while (shard->lru_tail != NULL && shard->size > budget) {
+    cache_remove(shard, shard->lru_tail);
+    shard->evictions++;
+  }
+}
+
+static void cache_grow(struct cache_shard* shard)
+{
+  size_t count = shard->bucket_count == 0 ? CACHE_MIN_BUCKETS
+                                          : shard->bucket_count * 2;
+
+  struct cache_entry** buckets =
+      (struct cache_entry**)calloc(count, sizeof(struct cache_entry*));
+
+  // Keep going with the old table, chains just get a bit longer
+  if (buckets == NULL)
+    return;
+
+  for (size_t i = 0; i < shard->bucket_count; i++) {
+    struct cache_entry* e = shard->buckets[i];
+
+    while (e != NULL) {
+      struct cache_entry* next = e->hash_next;
+      size_t bucket = (cache_hash(&e->key) / CACHE_SHARD_COUNT) % count;
+
+      e->hash_next = buckets[bucket];
+      buckets[bucket] = e;
+
+      e = next;
+    }
+  }
+
+  free(shard->buckets);
+  shard->buckets = buckets;
+  shard->bucket_count = count;
+}
+
+int cache_enabled() { return s_shard_budget != 0; }
+
+size_t cache_lookup(const struct cache_key* key, unsigned char* dst)
+{
+  uint64_t hash = cache_hash(key);
+  struct cache_shard* shard = cache_get_shard(hash);
+  size_t size = 0;
+
+  mutex_lock(&shard->lock);
+
+  if (shard->bucket_count != 0) {
+    struct cache_entry* e =
+        shard->buckets[(hash / CACHE_SHARD_COUNT) % shard->bucket_count];
+
+    for (; e != NULL; e = e->hash_next) {
+      if (cache_key_equal(&e->key, key)) {
+        memcpy(dst, e->data, e->size);
+        size = e->size;
+
+        cache_lru_unlink(shard, e);
+        cache_lru_push(shard, e);
+        break;
+      }
+    }
+  }
+
+  if (size != 0)
+    shard->hits++;
+  else
+    shard->misses++;
+
+  mutex_unlock(&shard->lock);
+
+  return size;
+}
+
+void cache_insert(const struct cache_key* key, const unsigned char* data,
+                  size_t size)
+{
+  size_t budget = s_shard_budget;
+
+  if (size == 0 || size > CACHE_BLOCK_SIZE || size > budget)
+    return;
+
+  uint64_t hash = cache_hash(key);
+  struct cache_shard* shard = cache_get_shard(hash);
+
+  mutex_lock(&shard->lock);
+
+  // Another reader might have beaten us to it
+  if (shard->bucket_count != 0) {
+    for (struct cache_entry* e =
+             shard->buckets[(hash / CACHE_SHARD_COUNT) % shard->bucket_count];
+         e != NULL; e = e->hash_next) {
+      if (cache_key_equal(&e->key, key)) {
+        mutex_unlock(&shard->lock);
+        return;
+      }
+    }
+  }
+
+  cache_evict(shard, budget - size);
+
+  if (shard->entry_count >= shard->bucket_count)
+    cache_grow(shard);
+
+  struct cache_entry* entry =
+      (struct cache_entry*)malloc(sizeof(struct cache_entry) + size);
+
+  if (entry == NULL || shard->bucket_count == 0) {
+    free(entry);
+    mutex_unlock(&shard->lock);
+    return;
+  }
+
+  entry->key = *key;
+  entry->size = size;
+  memcpy(entry->data, data, size);
+
+  size_t bucket = (hash / CACHE_SHARD_COUNT) % shard->bucket_count;
+
+  entry->hash_next = shard->buckets[bucket];
+  shard->buckets[bucket] = entry;
+
+  cache_lru_push(shard, entry);
+
+  shard->size += size;
+  shard->entry_count++;
+
+  mutex_unlock(&shard->lock);
+}
+
+void libwad_cache_set_budget(size_t bytes)
+{
+  size_t budget = bytes / CACHE_SHARD_COUNT;
+
+  s_shard_budget = budget;
+
+  for (int i = 0; i < CACHE_SHARD_COUNT; i++) {
+    mutex_lock(&s_shards[i].lock);
+    cache_evict(&s_shards[i], budget);
+    mutex_unlock(&s_shards[i].lock);
+  }
+}
+
+size_t libwad_cache_get_budget() { return s_shard_budget * CACHE_SHARD_COUNT; }
+
+void libwad_cache_get_stats(libwad_cache_stats_t* stats)
+{
+  memset(stats, 0, sizeof(libwad_cache_stats_t));
+
+  stats->budget = libwad_cache_get_budget();
+
+  for (int i = 0; i < CACHE_SHARD_COUNT; i++) {
+    struct cache_shard* shard = &s_shards[i];
+
+    mutex_lock(&shard->lock);
+    stats->hits += shard->hits;
+    stats->misses += shard->misses;
+    stats->evictions += shard->evictions;
+    stats->blocks += shard->entry_count;
+    stats->size += shard->size;
+    mutex_unlock(&shard->lock);
+  }
+}
+
+void libwad_cache_clear()
+{
+  for (int i = 0; i < CACHE_SHARD_COUNT; i++) {
+    struct cache_shard* shard = &s_shards[i];
+
+    mutex_lock(&shard->lock);
+
+    cache_evict(shard, 0);
+
+    free(shard->buckets);
+    shard->buckets = NULL;
+    shard->bucket_count = 0;
+
+    shard->hits = 0;
+    shard->misses = 0;
+    shard->evictions = 0;
+
+    mutex_unlock(&shard->lock);
+  }
+}
@@ -0,0 +1,28 @@
+// Copyright 2019 spycrab0
+// Licensed under GPLv3+
+// Refer to the LICENSE file included.
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "libwad.h"
+
+// Size of a cached block of decrypted data. Must be a multiple of 16
+#define CACHE_BLOCK_SIZE 0x10000
+
+struct cache_key {
+  uint64_t wad_id;
+  uint64_t block;
+  uint16_t index;
+};
+
+int cache_enabled();
+
+// Copies the cached block into dst (which has to hold CACHE_BLOCK_SIZE bytes)
+// Returns the size of the block or 0 if it isn't cached
+size_t cache_lookup(const struct cache_key* key, unsigned char* dst);
+
+void cache_insert(const struct cache_key* key, const unsigned char* data,
+                  size_t size);
+
+#endif
@@ -4,13 +4,22 @@
 
 #include "certchain.h"
 
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
+#include "io.h"
+#include "layout.h"
 #include "util.h"
 #include "wad.h"
 
-certchain_t certchain_parse(FILE* fh, size_t end)
+certchain_t certchain_parse_buffer(const unsigned char* buffer, size_t size)
 {
+  if (size > CERTCHAIN_MAX_SIZE) {
+    g_error = LIBWAD_BAD_CERTCHAIN;
+    return NULL;
+  }
+
   struct certchain_data* data =
       (struct certchain_data*)malloc(sizeof(struct certchain_data));
 
@@ -19,35 +28,39 @@ certchain_t certchain_parse(FILE* fh, size_t end)
     return NULL;
   }
 
-  data->fh = NULL;
   data->cert_count = 0;
   data->chain = NULL;
 
-  if ((size_t)ftell(fh) >= end)
-    return NULL;
+  if (size == 0)
+    return data;
 
   data->chain = (struct link*)malloc(sizeof(struct link));
 
   if (data->chain == NULL) {
     g_error = LIBWAD_BAD_ALLOC;
+    free(data);
     return NULL;
   }
 
+  struct reader reader;
+  reader_init(&reader, buffer, size);
+
   struct link* current = data->chain;
-  while ((size_t)ftell(fh) < end) {
+  while (reader.pos < size) {
     current->next = NULL;
     cert_t* cert = &current->data;
     cert->signature = NULL;
     cert->public_key = NULL;
 
-    fread(&cert->signature_type, sizeof(cert->signature_type), 1, fh);
-    be_int32(&cert->signature_type);
+    reader_read(&reader, &cert->signature_type, sizeof(cert->signature_type));
+    cert->signature_type = be32(cert->signature_type);
 
     size_t signature_size =
         certchain_get_signature_key_length(cert->signature_type);
 
     if (signature_size == 0) {
       printf("Bad signature type: %x\n", cert->signature_type);
+      g_error = LIBWAD_BAD_CERTCHAIN;
       certchain_close((certchain_t)data);
       return NULL;
     }
@@ -60,45 +73,52 @@ certchain_t certchain_parse(FILE* fh, size_t end)
       return NULL;
     }
 
-    fread(cert->signature, signature_size, 1, fh);
+    reader_read(&reader, cert->signature, signature_size);
 
-    fseek(fh, 0x3c, SEEK_CUR);
+    reader_skip(&reader, 0x3c);
 
-    fread(cert->issuer, sizeof(cert->issuer), 1, fh);
+    struct cert_layout layout;
+    reader_read(&reader, &layout, sizeof(layout));
 
-    fread(&cert->key_type, sizeof(cert->key_type), 1, fh);
-    be_int32(&cert->key_type);
+    memcpy(cert->issuer, layout.issuer, sizeof(cert->issuer));
+    cert->key_type = be32(layout.key_type);
+    memcpy(cert->child_cert, layout.child_cert, sizeof(cert->child_cert));
 
     size_t key_size = certchain_get_private_key_length(cert->key_type);
 
     if (key_size == 0) {
       printf("Bad key type: %x\n", cert->key_type);
+      g_error = LIBWAD_BAD_CERTCHAIN;
       certchain_close((certchain_t)data);
       return NULL;
     }
 
-    fread(&cert->child_cert, sizeof(cert->child_cert), 1, fh);
-
     cert->public_key = (unsigned char*)malloc(key_size);
 
     if (cert->public_key == NULL) {
       g_error = LIBWAD_BAD_ALLOC;
-      certchain_close(cert->public_key);
+      certchain_close(data);
       return NULL;
     }
 
-    fread(cert->public_key, key_size, 1, fh);
+    reader_read(&reader, cert->public_key, key_size);
 
-    fseek(fh, align32(ftell(fh)), SEEK_SET);
+    if (reader.overrun) {
+      g_error = LIBWAD_BAD_CERTCHAIN;
+      certchain_close(data);
+      return NULL;
+    }
+
+    reader_skip(&reader, align32((uint32_t)reader.pos) - reader.pos);
 
     data->cert_count++;
 
-    if ((size_t)ftell(fh) < end) {
+    if (reader.pos < size) {
       current->next = (struct link*)malloc(sizeof(struct link));
 
       if (current->next == NULL) {
         g_error = LIBWAD_BAD_ALLOC;
-        data_close(current->next);
+        certchain_close(data);
         return NULL;
       }
 
@@ -113,31 +133,31 @@ certchain_t certchain_from_wad(wad_t handle)
 {
   struct wad_data* wad = (struct wad_data*)handle;
 
-  fseek(wad->fh, (long)wad_get_section_offset(wad, WAD_SECTION_CERTCHAIN),
-        SEEK_SET);
+  unsigned char* buffer = io_read_section(wad, WAD_SECTION_CERTCHAIN);
+
+  if (buffer == NULL)
+    return NULL;
 
-  return certchain_parse(wad->fh, align32(0x20) + align32(wad->certchain_size));
+  certchain_t certchain = certchain_parse_buffer(buffer, wad->certchain_size);
+
+  free(buffer);
+
+  return certchain;
 }
 
 certchain_t certchain_open(const char* filename)
 {
-  FILE* fh = fopen(filename, "rb");
+  size_t size;
+  unsigned char* buffer = util_read_file(filename, &size);
 
-  if (!fh) {
-    g_error = LIBWAD_OPEN_FAILED;
+  if (buffer == NULL)
     return NULL;
-  }
 
-  fseek(fh, 0, SEEK_END);
-  size_t end = ftell(fh);
+  certchain_t certchain = certchain_parse_buffer(buffer, size);
 
-  fseek(fh, 0, SEEK_SET);
+  free(buffer);
 
-  struct certchain_data* data =
-      (struct certchain_data*)certchain_parse(fh, end);
-  data->fh = fh;
-
-  return data;
+  return certchain;
 }
 
 void certchain_close(certchain_t handle)
@@ -147,9 +167,6 @@ void certchain_close(certchain_t handle)
 
   struct certchain_data* data = (struct certchain_data*)handle;
 
-  if (data->fh != NULL)
-    fclose(data->fh);
-
   struct link* current = data->chain;
 
   while (current != NULL) {
@@ -166,6 +183,178 @@ void certchain_close(certchain_t handle)
   free(handle);
 }
 
+void certchain_remove_duplicates(certchain_t handle)
+{
+  struct certchain_data* data = (struct certchain_data*)handle;
+
+  for (struct link* l = data->chain; l != NULL; l = l->next) {
+    struct link** next = &l->next;
+
+    while (*next != NULL) {
+      struct link* candidate = *next;
+
+      if (memcmp(candidate->data.issuer, l->data.issuer,
+                 sizeof(l->data.issuer)) != 0 ||
+          memcmp(candidate->data.child_cert, l->data.child_cert,
+                 sizeof(l->data.child_cert)) != 0) {
+        next = &candidate->next;
+        continue;
+      }
+
+      *next = candidate->next;
+
+      free(candidate->data.signature);
+      free(candidate->data.public_key);
+      free(candidate);
+
+      data->cert_count--;
+    }
+  }
+}
+
+// Checks whether the certificate named name is part of the chain of issuer
+static int certchain_signs(const char* name, size_t length, const char* issuer)
+{
+  return strncmp(name, issuer, length) == 0 &&
+         (issuer[length] == '\0' || issuer[length] == '-');
+}
+
+// Finds the end of the certificate at pos and gets its name, which is made
+// up of its issuer and child, e.g. Root-CA00000001-XS00000003
+// Returns 0 if the certificate is damaged
+static size_t certchain_next(const unsigned char* buffer, size_t size,
+                             size_t pos, char name[CERTCHAIN_NAME_SIZE])
+{
+  uint32_t signature_type;
+  struct cert_layout layout;
+
+  if (size - pos < sizeof(signature_type)) {
+    g_error = LIBWAD_BAD_CERTCHAIN;
+    return 0;
+  }
+
+  memcpy(&signature_type, buffer + pos, sizeof(signature_type));
+
+  size_t signature_size = certchain_get_signature_key_length(
+      (cert_signature_type_t)be32(signature_type));
+  size_t layout_pos = pos + sizeof(signature_type) + signature_size + 0x3c;
+
+  if (signature_size == 0 || layout_pos + sizeof(layout) > size) {
+    g_error = LIBWAD_BAD_CERTCHAIN;
+    return 0;
+  }
+
+  memcpy(&layout, buffer + layout_pos, sizeof(layout));
+
+  size_t key_size = certchain_get_private_key_length(
+      (cert_key_type_t)be32(layout.key_type));
+  size_t end = align32((uint32_t)(layout_pos + sizeof(layout) + key_size));
+
+  if (key_size == 0 || end > size) {
+    g_error = LIBWAD_BAD_CERTCHAIN;
+    return 0;
+  }
+
+  snprintf(name, CERTCHAIN_NAME_SIZE, "%.*s-%.*s", (int)sizeof(layout.issuer),
+           (const char*)layout.issuer, (int)sizeof(layout.child_cert),
+           (const char*)layout.child_cert);
+
+  return end;
+}
+
+unsigned char* certchain_select(const unsigned char* buffer, size_t size,
+                                const char* const* issuers, size_t count,
+                                size_t* selected_size)
+{
+  unsigned char* selected = (unsigned char*)malloc(size > 0 ? size : 1);
+
+  if (selected == NULL) {
+    g_error = LIBWAD_BAD_ALLOC;
+    return NULL;
+  }
+
+  *selected_size = 0;
+
+  for (size_t pos = 0; pos < size;) {
+    char name[CERTCHAIN_NAME_SIZE];
+    size_t end = certchain_next(buffer, size, pos, name);
+
+    if (end == 0) {
+      free(selected);
+      return NULL;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+      if (certchain_signs(name, strlen(name), issuers[i])) {
+        memcpy(selected + *selected_size, buffer + pos, end - pos);
+        *selected_size += end - pos;
+        break;
+      }
+    }
+
+    pos = end;
+  }
+
+  return selected;
+}
+
+// Checks whether a certificate of the given name is part of the buffer
+static int certchain_contains(const unsigned char* buffer, size_t size,
+                              const char* name)
+{
+  for (size_t pos = 0; pos < size;) {
+    char other[CERTCHAIN_NAME_SIZE];
+
+    pos = certchain_next(buffer, size, pos, other);
+
+    if (pos == 0)
+      return -1;
+
+    if (strcmp(name, other) == 0)
+      return 1;
+  }
+
+  return 0;
+}
+
+unsigned char* certchain_merge(const unsigned char* buffer, size_t size,
+                               const unsigned char* added, size_t added_size,
+                               size_t* merged_size)
+{
+  unsigned char* merged = (unsigned char*)malloc(size + added_size + 1);
+
+  if (merged == NULL) {
+    g_error = LIBWAD_BAD_ALLOC;
+    return NULL;
+  }
+
+  if (size != 0)
+    memcpy(merged, buffer, size);
+
+  *merged_size = size;
+
+  for (size_t pos = 0; pos < added_size;) {
+    char name[CERTCHAIN_NAME_SIZE];
+    size_t end = certchain_next(added, added_size, pos, name);
+    int present = end != 0 ? certchain_contains(merged, *merged_size, name)
+                           : -1;
+
+    if (present < 0) {
+      free(merged);
+      return NULL;
+    }
+
+    if (!present) {
+      memcpy(merged + *merged_size, added + pos, end - pos);
+      *merged_size += end - pos;
+    }
+
+    pos = end;
+  }
+
+  return merged;
+}
+
 size_t certchain_get_cert_count(certchain_t handle)
 {
   return ((struct certchain_data*)handle)->cert_count;
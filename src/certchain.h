@@ -7,7 +7,10 @@
 
 #include "libwad.h"
 
-#include <stdio.h>
+#include <stddef.h>
+
+// Far more than any real chain needs, which is three or four certificates
+#define CERTCHAIN_MAX_SIZE 0x100000
 
 struct link {
   cert_t data;
@@ -15,11 +18,29 @@ struct link {
 };
 
 struct certchain_data {
-  FILE* fh;
   size_t cert_count;
   struct link* chain;
 };
 
 certchain_t certchain_from_wad(wad_t handle);
+certchain_t certchain_parse_buffer(const unsigned char* buffer, size_t size);
+
+// Drops certificates that appear earlier in the chain already
+void certchain_remove_duplicates(certchain_t handle);
+
+// Size of a certificate name: issuer, a dash, child and the terminator
+#define CERTCHAIN_NAME_SIZE (64 + 1 + 64 + 1)
+
+// Copies the certificates that are part of the chain of any of the given
+// issuers out of a buffer of certificates, keeping their order
+unsigned char* certchain_select(const unsigned char* buffer, size_t size,
+                                const char* const* issuers, size_t count,
+                                size_t* selected_size);
+
+// Appends the certificates of added that are not part of buffer yet, returns
+// a new buffer holding both
+unsigned char* certchain_merge(const unsigned char* buffer, size_t size,
+                               const unsigned char* added, size_t added_size,
+                               size_t* merged_size);
 
 #endif
@@ -10,23 +10,468 @@
 #include <mbedtls/aes.h>
 #include <mbedtls/sha1.h>
 
+#include "budget.h"
+#include "cache.h"
+#include "hashindex.h"
+#include "io.h"
+#include "lz77.h"
+#include "stats.h"
+#include "thread.h"
 #include "util.h"
 #include "wad.h"
 
+// Amount of data decrypted at once when streaming a content
+#define DATA_CHUNK_SIZE 0x100000
+
+// Contents smaller than this are not worth spreading across threads
+#define DATA_PARALLEL_MIN_SIZE (8 * DATA_CHUNK_SIZE)
+
+// 0 picks one thread per processor
+static volatile unsigned data_thread_count = 0;
+
+struct data_decryptor {
+  mbedtls_aes_context ctx;
+};
+
+data_decryptor_t data_decryptor_open(ticket_t ticket)
+{
+  struct data_decryptor* decryptor =
+      (struct data_decryptor*)malloc(sizeof(struct data_decryptor));
+
+  if (decryptor == NULL) {
+    g_error = LIBWAD_BAD_ALLOC;
+    return NULL;
+  }
+
+  mbedtls_aes_init(&decryptor->ctx);
+
+  if (mbedtls_aes_setkey_dec(&decryptor->ctx, ticket_get_title_key(ticket),
+                             128) != 0) {
+    g_error = LIBWAD_DECRYPTION_FAILED;
+    data_decryptor_close(decryptor);
+    return NULL;
+  }
+
+  return decryptor;
+}
+
+void data_decryptor_close(data_decryptor_t handle)
+{
+  if (handle == NULL)
+    return;
+
+  mbedtls_aes_free(&((struct data_decryptor*)handle)->ctx);
+  free(handle);
+}
+
+data_decryptor_t wad_get_decryptor(wad_t handle)
+{
+  return ((struct wad_data*)handle)->decryptor;
+}
+
+void data_get_content_iv(const tmd_content_t* content, unsigned char iv[16])
+{
+  memset(iv, 0, 16);
+
+  uint16_t x = content->index;
+
+  be_int16(&x);
+
+  memcpy(iv, &x, sizeof(x));
+}
+
+int data_decrypt(data_decryptor_t handle, unsigned char iv[16],
+                 const unsigned char* src, unsigned char* dst, size_t size)
+{
+  struct data_decryptor* decryptor = (struct data_decryptor*)handle;
+
+  STATS_TIMER(decrypt_timer);
+
+  // The context is only read here, which is what makes sharing it safe
+  int ret = mbedtls_aes_crypt_cbc(&decryptor->ctx, MBEDTLS_AES_DECRYPT, size,
+                                  iv, src, dst);
+
+  STATS_ADD(STATS_DECRYPT, size, decrypt_timer);
+
+  if (ret != 0) {
+    g_error = LIBWAD_DECRYPTION_FAILED;
+    return 0;
+  }
+
+  return 1;
+}
+
+static int data_report_progress(struct wad_data* wad,
+                                const tmd_content_t* content, uint16_t index,
+                                uint64_t processed)
+{
+  if (wad->progress != NULL &&
+      wad->progress(processed, content->size, index, wad->progress_user) != 0) {
+    g_error = LIBWAD_CANCELLED;
+    return 0;
+  }
+
+  return 1;
+}
+
+static int data_stream(struct wad_data* wad, const tmd_content_t* content,
+                       uint16_t index, unsigned char* dst,
+                       data_verify_t verify);
+
+static int data_read(struct wad_data* wad, const tmd_content_t* content,
+                     uint16_t index, uint64_t offset, size_t length,
+                     unsigned char* dst);
+
+void libwad_set_thread_count(unsigned count)
+{
+  data_thread_count = count;
+}
+
+unsigned libwad_get_thread_count()
+{
+  unsigned count = data_thread_count;
+
+  return count != 0 ? count : thread_get_cpu_count();
+}
+
+// A content split into segments of DATA_CHUNK_SIZE bytes. Since CBC takes the
+// IV of each block from the preceding ciphertext block, segments can be
+// decrypted by any number of worker threads while the calling thread hashes
+// them in order.
+struct data_segments {
+  // Decrypts the segment at offset into dst
+  int (*decrypt)(struct data_segments* segments, uint64_t offset,
+                 size_t length, unsigned char* dst);
+
+  const tmd_content_t* content;
+  uint16_t index;
+  // Wad the content is read from, its progress callback is invoked as well
+  struct wad_data* wad;
+  // Key and the IV of every segment for contents that were read into dst
+  // and are decrypted in place
+  const unsigned char* ivs;
+  data_decryptor_t decryptor;
+
+  // Destination of the whole content or NULL to decrypt into slots
+  unsigned char* dst;
+  unsigned char* slots;
+  // Workers stay at most this many segments ahead of the hashing
+  uint64_t slot_count;
+  uint64_t segment_count;
+
+  mutex_t mutex;
+  cond_t ready_cond;
+  cond_t consumed_cond;
+  unsigned char* ready;
+  uint64_t next;
+  uint64_t consumed;
+  int failed;
+  int error;
+};
+
+static int data_decrypt_from_wad(struct data_segments* segments,
+                                 uint64_t offset, size_t length,
+                                 unsigned char* dst)
+{
+  return data_read(segments->wad, segments->content, segments->index, offset,
+                   length, dst);
+}
+
+static int data_decrypt_in_place(struct data_segments* segments,
+                                 uint64_t offset, size_t length,
+                                 unsigned char* dst)
+{
+  unsigned char iv[16];
+
+  memcpy(iv, segments->ivs + offset / DATA_CHUNK_SIZE * 16, 16);
+
+  return data_decrypt(segments->decryptor, iv, dst, dst,
+                      (length + 15) & ~(size_t)15);
+}
+
+static size_t data_segment_length(const struct data_segments* segments,
+                                  uint64_t segment)
+{
+  uint64_t remaining = segments->content->size - segment * DATA_CHUNK_SIZE;
+
+  return remaining > DATA_CHUNK_SIZE ? DATA_CHUNK_SIZE : (size_t)remaining;
+}
+
+static unsigned char* data_segment_target(const struct data_segments* segments,
+                                          uint64_t segment)
+{
+  if (segments->dst != NULL)
+    return segments->dst + segment * DATA_CHUNK_SIZE;
+
+  return segments->slots +
+         (size_t)(segment % segments->slot_count) * DATA_CHUNK_SIZE;
+}
+
+static void data_segment_worker(void* arg)
+{
+  struct data_segments* segments = (struct data_segments*)arg;
+
+  mutex_lock(&segments->mutex);
+
+  while (!segments->failed && segments->next < segments->segment_count) {
+    if (segments->next >= segments->consumed + segments->slot_count) {
+      cond_wait(&segments->consumed_cond, &segments->mutex);
+      continue;
+    }
+
+    uint64_t segment = segments->next++;
+
+    mutex_unlock(&segments->mutex);
+
+    int ret = segments->decrypt(segments, segment * DATA_CHUNK_SIZE,
+                                data_segment_length(segments, segment),
+                                data_segment_target(segments, segment));
+    int error = g_error;
+
+    mutex_lock(&segments->mutex);
+
+    if (!ret && !segments->failed) {
+      segments->failed = 1;
+      segments->error = error;
+      cond_broadcast(&segments->consumed_cond);
+    }
+
+    segments->ready[segment] = 1;
+    cond_signal(&segments->ready_cond);
+  }
+
+  mutex_unlock(&segments->mutex);
+}
+
+// Starts up to count workers, returns how many are running
+static unsigned data_start_workers(struct data_segments* segments,
+                                   thread_t* threads, unsigned count)
+{
+  segments->ready = (unsigned char*)calloc((size_t)segments->segment_count, 1);
+
+  if (segments->ready == NULL)
+    return 0;
+
+  mutex_init(&segments->mutex);
+  cond_init(&segments->ready_cond);
+  cond_init(&segments->consumed_cond);
+
+  unsigned started = 0;
+
+  while (started < count &&
+         thread_create(&threads[started], data_segment_worker, segments))
+    started++;
+
+  if (started == 0) {
+    mutex_destroy(&segments->mutex);
+    cond_destroy(&segments->ready_cond);
+    cond_destroy(&segments->consumed_cond);
+    free(segments->ready);
+    segments->ready = NULL;
+  }
+
+  return started;
+}
+
+static void data_stop_workers(struct data_segments* segments,
+                              thread_t* threads, unsigned count)
+{
+  mutex_lock(&segments->mutex);
+  segments->failed = 1;
+  cond_broadcast(&segments->consumed_cond);
+  mutex_unlock(&segments->mutex);
+
+  for (unsigned i = 0; i < count; i++)
+    thread_join(threads[i]);
+
+  mutex_destroy(&segments->mutex);
+  cond_destroy(&segments->ready_cond);
+  cond_destroy(&segments->consumed_cond);
+  free(segments->ready);
+}
+
+// Decrypts all segments of a content, hashing them and reporting progress in
+// order. Large contents are decrypted by several threads.
+static int data_process_segments(struct data_segments* segments,
+                                 data_verify_t verify)
+{
+  uint64_t size = segments->content->size;
+  unsigned workers = libwad_get_thread_count();
+
+  segments->segment_count = (size + DATA_CHUNK_SIZE - 1) / DATA_CHUNK_SIZE;
+
+  if (size < DATA_PARALLEL_MIN_SIZE || workers < 2)
+    workers = 0;
+  else if (workers > segments->segment_count)
+    workers = (unsigned)segments->segment_count;
+
+  thread_t* threads = NULL;
+
+  if (workers != 0) {
+    threads = (thread_t*)malloc(sizeof(thread_t) * workers);
+
+    if (threads == NULL)
+      workers = 0;
+  }
+
+  segments->slot_count = workers != 0 ? 2 * workers : 1;
+  segments->slots = NULL;
+  segments->next = 0;
+  segments->consumed = 0;
+  segments->failed = 0;
+
+  if (segments->dst == NULL) {
+    segments->slots =
+        (unsigned char*)malloc((size_t)segments->slot_count * DATA_CHUNK_SIZE);
+
+    if (segments->slots == NULL) {
+      g_error = LIBWAD_BAD_ALLOC;
+      free(threads);
+      return 0;
+    }
+  }
+
+  if (workers != 0)
+    workers = data_start_workers(segments, threads, workers);
+
+  mbedtls_sha1_context sha1;
+  mbedtls_sha1_init(&sha1);
+  mbedtls_sha1_starts_ret(&sha1);
+
+  int result = 1;
+  int error = LIBWAD_NO_ERROR;
+
+  for (uint64_t segment = 0; segment < segments->segment_count; segment++) {
+    uint64_t offset = segment * DATA_CHUNK_SIZE;
+    size_t length = data_segment_length(segments, segment);
+    unsigned char* target = data_segment_target(segments, segment);
+
+    if (workers == 0) {
+      result = segments->decrypt(segments, offset, length, target);
+    } else {
+      mutex_lock(&segments->mutex);
+
+      while (!segments->ready[segment] && !segments->failed)
+        cond_wait(&segments->ready_cond, &segments->mutex);
+
+      result = !segments->failed;
+      error = segments->error;
+
+      mutex_unlock(&segments->mutex);
+    }
+
+    if (!result)
+      break;
+
+    if (verify == LIBWAD_VERIFY_HASH) {
+      STATS_TIMER(hash_timer);
+      mbedtls_sha1_update_ret(&sha1, target, length);
+      STATS_ADD(STATS_HASH, length, hash_timer);
+    }
+
+    if (segments->wad != NULL &&
+        !data_report_progress(segments->wad, segments->content,
+                              segments->index, offset + length)) {
+      result = 0;
+      break;
+    }
+
+    if (workers != 0) {
+      mutex_lock(&segments->mutex);
+      segments->consumed = segment + 1;
+      cond_broadcast(&segments->consumed_cond);
+      mutex_unlock(&segments->mutex);
+    }
+  }
+
+  if (workers != 0) {
+    // Failures of the calling thread have to survive the workers winding down
+    if (error == LIBWAD_NO_ERROR)
+      error = g_error;
+
+    data_stop_workers(segments, threads, workers);
+
+    if (!result)
+      g_error = error;
+  }
+
+  if (result && verify == LIBWAD_VERIFY_HASH) {
+    unsigned char hash[20];
+    mbedtls_sha1_finish_ret(&sha1, hash);
+
+    if (memcmp(hash, segments->content->hash, 20) != 0) {
+      g_error = LIBWAD_HASH_MISMATCH;
+      result = 0;
+    }
+  }
+
+  mbedtls_sha1_free(&sha1);
+  free(segments->slots);
+  free(threads);
+
+  return result;
+}
+
 unsigned char* data_extract_from_wad(wad_t handle, uint16_t index,
                                      data_verify_t verify)
 {
   struct wad_data* wad = (struct wad_data*)handle;
-  tmd_t tmd = wad_get_tmd(wad);
-  tmd_t ticket = wad_get_ticket(wad);
+  tmd_content_t* content = tmd_get_content(wad_get_tmd(wad), index);
+
+  if (content == NULL) {
+    g_error = LIBWAD_OUT_OF_RANGE;
+    return NULL;
+  }
+
+  STATS_COUNT(STATS_EXTRACTS);
+
+  uint64_t size = align64(content->size, 16);
+
+  if (!budget_acquire(size))
+    return NULL;
 
-  fseek(wad->fh, (long)wad_get_section_offset(wad, WAD_SECTION_DATA), SEEK_SET);
+  STATS_TIMER(alloc_timer);
+  unsigned char* buffer = (unsigned char*)malloc((size_t)size);
+  STATS_ADD(STATS_ALLOC, size, alloc_timer);
+
+  if (buffer == NULL) {
+    g_error = LIBWAD_BAD_ALLOC;
+    budget_release(size);
+    return NULL;
+  }
+
+  // Reads and decrypts the content chunk by chunk straight into the buffer
+  int result = data_stream(wad, content, index, buffer, verify);
+
+  budget_release(size);
+
+  if (!result) {
+    free(buffer);
+    return NULL;
+  }
 
-  return data_extract((data_t)wad->fh, tmd, ticket, index, verify);
+  return buffer;
 }
 
 unsigned char* data_extract(data_t handle, wad_t tmd, tmd_t ticket,
                             uint16_t index, data_verify_t verify)
+{
+  data_decryptor_t decryptor = data_decryptor_open(ticket);
+
+  if (decryptor == NULL)
+    return NULL;
+
+  unsigned char* buffer =
+      data_extract_with_decryptor(handle, tmd, decryptor, index, verify);
+
+  data_decryptor_close(decryptor);
+
+  return buffer;
+}
+
+unsigned char* data_extract_with_decryptor(data_t handle, tmd_t tmd,
+                                           data_decryptor_t decryptor,
+                                           uint16_t index, data_verify_t verify)
 {
   tmd_content_t* content = tmd_get_content(tmd, index);
 
@@ -35,81 +480,505 @@ unsigned char* data_extract(data_t handle, wad_t tmd, tmd_t ticket,
     return NULL;
   }
 
-  unsigned char* enc_buffer =
-      (unsigned char*)malloc((size_t)align64(content->size, 16));
-  unsigned char* buffer =
-      (unsigned char*)malloc((size_t)align64(content->size, 16));
+  STATS_COUNT(STATS_EXTRACTS);
+
+  uint64_t size = align64(content->size, 16);
+  uint64_t segment_count = (size + DATA_CHUNK_SIZE - 1) / DATA_CHUNK_SIZE;
+  uint64_t charged = size + segment_count * 16;
+
+  if (!budget_acquire(charged))
+    return NULL;
 
-  if (enc_buffer == NULL || buffer == NULL) {
+  STATS_TIMER(alloc_timer);
+  unsigned char* buffer = (unsigned char*)malloc(size > 0 ? (size_t)size : 1);
+  unsigned char* ivs = (unsigned char*)malloc(
+      segment_count > 0 ? (size_t)segment_count * 16 : 1);
+  STATS_ADD(STATS_ALLOC, charged, alloc_timer);
+
+  if (buffer == NULL || ivs == NULL) {
     g_error = LIBWAD_BAD_ALLOC;
 
-    free(enc_buffer);
     free(buffer);
+    free(ivs);
+    budget_release(charged);
 
     return NULL;
   }
 
   FILE* fh = (FILE*)handle;
 
+  STATS_TIMER(read_timer);
+
   // Skip over the previous entries
   for (uint16_t i = 0; i < index; i++)
     fseek(fh, (long)align64(tmd_get_content(tmd, i)->size, 64), SEEK_CUR);
 
-  if (fread(enc_buffer, align64(content->size, 16), 1, fh) != 1) {
+  if (size != 0 && fread(buffer, (size_t)size, 1, fh) != 1) {
     g_error = LIBWAD_IO_ERROR;
-    free(enc_buffer);
     free(buffer);
+    free(ivs);
+    budget_release(charged);
     return 0;
   }
 
-  unsigned const char* key = ticket_get_title_key(ticket);
+  STATS_ADD(STATS_READ, size, read_timer);
 
-  // Decrypt title key
+  // The ciphertext is decrypted in place, so the block preceding each segment
+  // has to be saved as its IV before any segment is decrypted
+  data_get_content_iv(content, ivs);
 
-  mbedtls_aes_context ctx;
+  for (uint64_t i = 1; i < segment_count; i++)
+    memcpy(ivs + i * 16, buffer + i * DATA_CHUNK_SIZE - 16, 16);
 
-  mbedtls_aes_setkey_dec(&ctx, key, 128);
+  struct data_segments segments;
 
-  unsigned char iv[16] = {0};
+  memset(&segments, 0, sizeof(segments));
+  segments.decrypt = data_decrypt_in_place;
+  segments.content = content;
+  segments.index = index;
+  segments.ivs = ivs;
+  segments.decryptor = decryptor;
+  segments.dst = buffer;
 
-  uint16_t x = content->index;
+  int ret = data_process_segments(&segments, verify);
 
-  be_int16(&x);
+  free(ivs);
+  budget_release(charged);
 
-  memcpy(iv, &x, sizeof(x));
+  if (!ret) {
+    free(buffer);
+    return NULL;
+  }
 
-  int ret = mbedtls_aes_crypt_cbc(&ctx, MBEDTLS_AES_DECRYPT,
-                                  (size_t)align64(content->size, 16), iv,
-                                  &enc_buffer[0], &buffer[0]);
+  return buffer;
+}
 
-  free(enc_buffer);
+// Reads and decrypts a range of a content straight from the file
+static int data_decrypt_range(struct wad_data* wad,
+                              const tmd_content_t* content, uint16_t index,
+                              uint64_t offset, size_t length,
+                              unsigned char* dst)
+{
+  // CBC only needs the previous ciphertext block as IV, so we read the blocks
+  // covering the range plus the one preceding it (if any)
+  uint64_t first_block = offset / 16;
+  uint64_t end_block = (offset + length + 15) / 16;
+  uint64_t read_block = first_block > 0 ? first_block - 1 : 0;
 
-  if (ret != 0) {
-    g_error = LIBWAD_DECRYPTION_FAILED;
+  size_t read_size = (size_t)(end_block - read_block) * 16;
+
+  if (!budget_acquire(read_size))
+    return 0;
+
+  unsigned char* buffer = (unsigned char*)malloc(read_size);
+
+  if (buffer == NULL) {
+    g_error = LIBWAD_BAD_ALLOC;
+    budget_release(read_size);
+    return 0;
+  }
+
+  if (!io_read_content(wad, index, buffer, read_size, read_block * 16)) {
+    g_error = LIBWAD_IO_ERROR;
     free(buffer);
-    return NULL;
+    budget_release(read_size);
+    return 0;
+  }
+
+  unsigned char iv[16];
+  unsigned char* enc = buffer;
+
+  if (first_block > 0) {
+    memcpy(iv, buffer, 16);
+    enc += 16;
+  } else {
+    data_get_content_iv(content, iv);
+  }
+
+  size_t enc_size = (size_t)(end_block - first_block) * 16;
+
+  int result = data_decrypt(wad->decryptor, iv, enc, enc, enc_size);
+
+  if (result)
+    memcpy(dst, enc + offset % 16, length);
+
+  free(buffer);
+  budget_release(read_size);
+
+  return result;
+}
+
+// Reads and decrypts a range of a content, checking every chunk it touches
+// against the hash index if one was loaded
+static int data_read_direct(struct wad_data* wad, const tmd_content_t* content,
+                            uint16_t index, uint64_t offset, size_t length,
+                            unsigned char* dst)
+{
+  if (wad->hash_index == NULL)
+    return data_decrypt_range(wad, content, index, offset, length, dst);
+
+  uint32_t chunk_size = hash_index_get_chunk_size(wad->hash_index);
+
+  uint64_t start = offset - offset % chunk_size;
+  uint64_t end = align64(offset + length, chunk_size);
+
+  if (end > content->size)
+    end = content->size;
+
+  // Ranges already covering whole chunks are verified in place
+  if (start == offset && end == offset + length)
+    return data_decrypt_range(wad, content, index, offset, length, dst) &&
+           hash_index_verify(wad->hash_index, index, offset, dst, length);
+
+  if (!budget_acquire(end - start))
+    return 0;
+
+  unsigned char* buffer = (unsigned char*)malloc((size_t)(end - start));
+
+  if (buffer == NULL) {
+    g_error = LIBWAD_BAD_ALLOC;
+    budget_release(end - start);
+    return 0;
+  }
+
+  int result = data_decrypt_range(wad, content, index, start,
+                                  (size_t)(end - start), buffer) &&
+               hash_index_verify(wad->hash_index, index, start, buffer,
+                                 (size_t)(end - start));
+
+  if (result)
+    memcpy(dst, buffer + (offset - start), length);
+
+  free(buffer);
+  budget_release(end - start);
+
+  return result;
+}
+
+// Reads a range of a content block by block through the block cache
+static int data_read_cached(struct wad_data* wad, const tmd_content_t* content,
+                            uint16_t index, uint64_t offset, size_t length,
+                            unsigned char* dst)
+{
+  unsigned char* block = (unsigned char*)malloc(CACHE_BLOCK_SIZE);
+
+  if (block == NULL) {
+    g_error = LIBWAD_BAD_ALLOC;
+    return 0;
+  }
+
+  uint64_t end = offset + length;
+
+  while (offset < end) {
+    struct cache_key key = {wad->cache_id, offset / CACHE_BLOCK_SIZE, index};
+
+    uint64_t block_start = key.block * CACHE_BLOCK_SIZE;
+    size_t block_size = (size_t)(content->size - block_start);
+
+    if (block_size > CACHE_BLOCK_SIZE)
+      block_size = CACHE_BLOCK_SIZE;
+
+    size_t skip = (size_t)(offset - block_start);
+    size_t count = block_size - skip;
+
+    if (count > end - offset)
+      count = (size_t)(end - offset);
+
+    // Decrypt whole blocks right into the destination to save a copy
+    unsigned char* target = (skip == 0 && count == block_size) ? dst : block;
+
+    if (cache_lookup(&key, target) != block_size) {
+      if (!data_read_direct(wad, content, index, block_start, block_size,
+                            target)) {
+        free(block);
+        return 0;
+      }
+
+      cache_insert(&key, target, block_size);
+    }
+
+    if (target == block)
+      memcpy(dst, block + skip, count);
+
+    dst += count;
+    offset += count;
+  }
+
+  free(block);
+
+  return 1;
+}
+
+static int data_read(struct wad_data* wad, const tmd_content_t* content,
+                     uint16_t index, uint64_t offset, size_t length,
+                     unsigned char* dst)
+{
+  if (cache_enabled() && wad->cache_id != 0)
+    return data_read_cached(wad, content, index, offset, length, dst);
+
+  return data_read_direct(wad, content, index, offset, length, dst);
+}
+
+// Decrypts a whole content chunk by chunk, hashing it and reporting progress
+// along the way. If dst is NULL the decrypted chunks are only hashed.
+static int data_stream(struct wad_data* wad, const tmd_content_t* content,
+                       uint16_t index, unsigned char* dst, data_verify_t verify)
+{
+  struct data_segments segments;
+
+  memset(&segments, 0, sizeof(segments));
+  segments.decrypt = data_decrypt_from_wad;
+  segments.content = content;
+  segments.index = index;
+  segments.wad = wad;
+  segments.dst = dst;
+
+  return data_process_segments(&segments, verify);
+}
+
+int data_verify_from_wad(wad_t handle, uint16_t index)
+{
+  struct wad_data* wad = (struct wad_data*)handle;
+  tmd_content_t* content = tmd_get_content(wad->tmd, index);
+
+  if (content == NULL) {
+    g_error = LIBWAD_OUT_OF_RANGE;
+    return 0;
   }
 
-  if (verify == LIBWAD_DONT_VERIFY_HASH)
-    return buffer;
+  return data_stream(wad, content, index, NULL, LIBWAD_VERIFY_HASH);
+}
+
+int data_extract_all(wad_t handle, data_chunk_callback_t callback, void* user,
+                     data_verify_t verify)
+{
+  struct wad_data* wad = (struct wad_data*)handle;
+  uint16_t count = tmd_get_content_count(wad->tmd);
+
+  unsigned char* buffer = (unsigned char*)malloc(DATA_CHUNK_SIZE);
+
+  if (buffer == NULL) {
+    g_error = LIBWAD_BAD_ALLOC;
+    return 0;
+  }
+
+  io_hint_sequential(wad, wad_get_section_offset(wad, WAD_SECTION_DATA),
+                     wad->data_size);
+
+  int result = 1, mismatch = 0;
+
+  for (uint16_t index = 0; index < count && result; index++) {
+    const tmd_content_t* content = tmd_get_content(wad->tmd, index);
+
+    uint64_t position = 0;
+
+    STATS_COUNT(STATS_EXTRACTS);
+
+    unsigned char iv[16];
+    data_get_content_iv(content, iv);
+
+    mbedtls_sha1_context sha1;
+    mbedtls_sha1_init(&sha1);
+    mbedtls_sha1_starts_ret(&sha1);
+
+    // Set once a piece fails the hash index, reported on the last piece
+    int bad_chunk = 0;
+
+    data_chunk_t chunk;
+
+    chunk.index = index;
+    chunk.size = content->size;
+    chunk.offset = 0;
+    chunk.data = buffer;
+    chunk.verdict = LIBWAD_NO_ERROR;
 
-  unsigned char hash[20];
-  mbedtls_sha1_ret(buffer, (size_t)content->size, hash);
+    // Runs at least once so empty contents get reported as well
+    do {
+      chunk.length = DATA_CHUNK_SIZE;
 
-  if (memcmp(hash, content->hash, 20) != 0) {
+      if (chunk.length > content->size - chunk.offset)
+        chunk.length = (size_t)(content->size - chunk.offset);
+
+      chunk.last = chunk.offset + chunk.length == content->size;
+
+      size_t enc_size = (chunk.length + 15) & ~(size_t)15;
+
+      if (!io_read_content(wad, index, buffer, enc_size, position)) {
+        g_error = LIBWAD_IO_ERROR;
+        result = 0;
+        break;
+      }
+
+      position += enc_size;
+
+      // The IV is updated in place, so chunks chain on their own
+      if (!data_decrypt(wad->decryptor, iv, buffer, buffer, enc_size)) {
+        result = 0;
+        break;
+      }
+
+      if (wad->hash_index != NULL && !bad_chunk &&
+          !hash_index_verify(wad->hash_index, index, chunk.offset, buffer,
+                             chunk.length))
+        bad_chunk = 1;
+
+      if (bad_chunk && chunk.last) {
+        chunk.verdict = LIBWAD_HASH_MISMATCH;
+        mismatch = 1;
+      }
+
+      if (verify == LIBWAD_VERIFY_HASH) {
+        STATS_TIMER(hash_timer);
+        mbedtls_sha1_update_ret(&sha1, buffer, chunk.length);
+        STATS_ADD(STATS_HASH, chunk.length, hash_timer);
+
+        if (chunk.last) {
+          unsigned char hash[20];
+          mbedtls_sha1_finish_ret(&sha1, hash);
+
+          if (memcmp(hash, content->hash, 20) != 0) {
+            chunk.verdict = LIBWAD_HASH_MISMATCH;
+            mismatch = 1;
+          }
+        }
+      }
+
+      if (callback(&chunk, user) != 0 ||
+          !data_report_progress(wad, content, index,
+                                chunk.offset + chunk.length)) {
+        g_error = LIBWAD_CANCELLED;
+        result = 0;
+        break;
+      }
+
+      chunk.offset += chunk.length;
+    } while (!chunk.last);
+
+    mbedtls_sha1_free(&sha1);
+  }
+
+  free(buffer);
+
+  if (result && mismatch) {
     g_error = LIBWAD_HASH_MISMATCH;
-    free(buffer);
+    result = 0;
+  }
+
+  return result;
+}
+
+int data_read_range(wad_t handle, uint16_t index, uint64_t offset,
+                    size_t length, unsigned char* dst)
+{
+  struct wad_data* wad = (struct wad_data*)handle;
+  tmd_content_t* content = tmd_get_content(wad->tmd, index);
+
+  if (content == NULL || offset > content->size ||
+      length > content->size - offset) {
+    g_error = LIBWAD_OUT_OF_RANGE;
+    return 0;
+  }
+
+  if (length == 0)
+    return 1;
+
+  return data_read(wad, content, index, offset, length, dst);
+}
+
+unsigned char* data_extract_decompressed(wad_t handle, uint16_t index,
+                                         data_verify_t verify, size_t* size)
+{
+  struct wad_data* wad = (struct wad_data*)handle;
+  tmd_content_t* content = tmd_get_content(wad->tmd, index);
+
+  if (content == NULL) {
+    g_error = LIBWAD_OUT_OF_RANGE;
     return NULL;
   }
 
-  return buffer;
+  // Empty contents have no header to look at
+  if (content->size == 0) {
+    if (size != NULL)
+      *size = 0;
+
+    return data_extract_from_wad(handle, index, verify);
+  }
+
+  unsigned char* chunk = (unsigned char*)malloc(DATA_CHUNK_SIZE);
+  lz77_stream_t stream = lz77_stream_open();
+
+  if (chunk == NULL || stream == NULL) {
+    g_error = LIBWAD_BAD_ALLOC;
+    free(chunk);
+    lz77_stream_close(stream);
+    return NULL;
+  }
+
+  mbedtls_sha1_context sha1;
+  mbedtls_sha1_init(&sha1);
+  mbedtls_sha1_starts_ret(&sha1);
+
+  for (uint64_t offset = 0; offset < content->size;
+       offset += DATA_CHUNK_SIZE) {
+    size_t length = DATA_CHUNK_SIZE;
+
+    if (length > content->size - offset)
+      length = (size_t)(content->size - offset);
+
+    if (!data_read(wad, content, index, offset, length, chunk))
+      goto fail;
+
+    if (offset == 0 && !lz77_detect(chunk, length, content->size)) {
+      // Nothing to decompress, hand out the plain content
+      free(chunk);
+      lz77_stream_close(stream);
+      mbedtls_sha1_free(&sha1);
+
+      if (size != NULL)
+        *size = (size_t)content->size;
+
+      return data_extract_from_wad(handle, index, verify);
+    }
+
+    STATS_TIMER(hash_timer);
+    mbedtls_sha1_update_ret(&sha1, chunk, length);
+    STATS_ADD(STATS_HASH, length, hash_timer);
+
+    if (!lz77_stream_feed(stream, chunk, length) ||
+        !data_report_progress(wad, content, index, offset + length))
+      goto fail;
+  }
+
+  if (verify == LIBWAD_VERIFY_HASH) {
+    unsigned char hash[20];
+    mbedtls_sha1_finish_ret(&sha1, hash);
+
+    if (memcmp(hash, content->hash, 20) != 0) {
+      g_error = LIBWAD_HASH_MISMATCH;
+      goto fail;
+    }
+  }
+
+  free(chunk);
+  mbedtls_sha1_free(&sha1);
+
+  STATS_COUNT(STATS_EXTRACTS);
+
+  return lz77_stream_finish(stream, size);
+
+fail:
+  free(chunk);
+  lz77_stream_close(stream);
+  mbedtls_sha1_free(&sha1);
+
+  return NULL;
 }
 
 data_t data_open(const char* filename)
 {
   FILE* fh = fopen(filename, "rb");
 
-  if (fh != NULL) {
+  if (fh == NULL) {
     g_error = LIBWAD_OPEN_FAILED;
     return NULL;
   }
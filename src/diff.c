@@ -0,0 +1,222 @@
+// Copyright 2019 spycrab0
+// Licensed under GPLv3+
+// Refer to the LICENSE file included.
+
+#include "libwad.h"
+
+#include <memory.h>
+#include <stdlib.h>
+
+#include "wad.h"
+
+// Amount of data compared at once in byte-level mode
+#define DIFF_CHUNK_SIZE 0x100000
+
+struct diff_data {
+  size_t count;
+  wad_diff_entry_t* entries;
+};
+
+static int diff_compare_index(const void* a, const void* b)
+{
+  const tmd_content_t* x = *(const tmd_content_t* const*)a;
+  const tmd_content_t* y = *(const tmd_content_t* const*)b;
+
+  return (int)x->index - (int)y->index;
+}
+
+// Collects the contents of a wad sorted by their index
+static const tmd_content_t** diff_sorted_contents(wad_t wad, uint16_t* count)
+{
+  tmd_t tmd = wad_get_tmd(wad);
+
+  *count = tmd_get_content_count(tmd);
+
+  const tmd_content_t** contents = (const tmd_content_t**)malloc(
+      sizeof(tmd_content_t*) * (*count > 0 ? *count : 1));
+
+  if (contents == NULL)
+    return NULL;
+
+  for (uint16_t i = 0; i < *count; i++)
+    contents[i] = tmd_get_content(tmd, i);
+
+  qsort(contents, *count, sizeof(tmd_content_t*), diff_compare_index);
+
+  return contents;
+}
+
+// Finds the position of a content within the tmd
+static uint16_t diff_position(wad_t wad, const tmd_content_t* content)
+{
+  return (uint16_t)(content - tmd_get_content(wad_get_tmd(wad), 0));
+}
+
+// Decrypts both versions of a modified content side by side
+static int diff_bytes(wad_t old_wad, wad_t new_wad, wad_diff_entry_t* entry)
+{
+  uint64_t old_size = entry->old_content->size;
+  uint64_t new_size = entry->new_content->size;
+  uint64_t common = old_size < new_size ? old_size : new_size;
+
+  uint16_t old_position = diff_position(old_wad, entry->old_content);
+  uint16_t new_position = diff_position(new_wad, entry->new_content);
+
+  unsigned char* old_buffer = (unsigned char*)malloc(DIFF_CHUNK_SIZE);
+  unsigned char* new_buffer = (unsigned char*)malloc(DIFF_CHUNK_SIZE);
+
+  if (old_buffer == NULL || new_buffer == NULL) {
+    g_error = LIBWAD_BAD_ALLOC;
+    free(old_buffer);
+    free(new_buffer);
+    return 0;
+  }
+
+  entry->first_difference = WAD_DIFF_NO_DIFFERENCE;
+  entry->changed_bytes = 0;
+
+  for (uint64_t offset = 0; offset < common; offset += DIFF_CHUNK_SIZE) {
+    size_t length = common - offset < DIFF_CHUNK_SIZE
+                        ? (size_t)(common - offset)
+                        : DIFF_CHUNK_SIZE;
+
+    if (!data_read_range(old_wad, old_position, offset, length, old_buffer) ||
+        !data_read_range(new_wad, new_position, offset, length, new_buffer)) {
+      free(old_buffer);
+      free(new_buffer);
+      return 0;
+    }
+
+    for (size_t i = 0; i < length; i++) {
+      if (old_buffer[i] == new_buffer[i])
+        continue;
+
+      if (entry->first_difference == WAD_DIFF_NO_DIFFERENCE)
+        entry->first_difference = offset + i;
+
+      entry->changed_bytes++;
+    }
+  }
+
+  free(old_buffer);
+  free(new_buffer);
+
+  // Bytes only present in one of the versions count as changed as well
+  if (old_size != new_size) {
+    if (entry->first_difference == WAD_DIFF_NO_DIFFERENCE)
+      entry->first_difference = common;
+
+    entry->changed_bytes += (old_size > new_size ? old_size : new_size) - common;
+  }
+
+  return 1;
+}
+
+wad_diff_t wad_diff(wad_t old_wad, wad_t new_wad, wad_diff_mode_t mode)
+{
+  uint16_t old_count, new_count;
+
+  const tmd_content_t** old_contents =
+      diff_sorted_contents(old_wad, &old_count);
+  const tmd_content_t** new_contents =
+      diff_sorted_contents(new_wad, &new_count);
+
+  struct diff_data* diff = (struct diff_data*)malloc(sizeof(struct diff_data));
+
+  size_t max_count = (size_t)old_count + new_count;
+
+  wad_diff_entry_t* entries = (wad_diff_entry_t*)malloc(
+      sizeof(wad_diff_entry_t) * (max_count > 0 ? max_count : 1));
+
+  if (old_contents == NULL || new_contents == NULL || diff == NULL ||
+      entries == NULL) {
+    g_error = LIBWAD_BAD_ALLOC;
+    free(old_contents);
+    free(new_contents);
+    free(diff);
+    free(entries);
+    return NULL;
+  }
+
+  diff->entries = entries;
+  diff->count = 0;
+
+  // Contents are matched up by their index, just like the system does
+  uint16_t i = 0, j = 0;
+
+  while (i < old_count || j < new_count) {
+    wad_diff_entry_t* entry = &entries[diff->count++];
+
+    entry->old_content = NULL;
+    entry->new_content = NULL;
+    entry->first_difference = WAD_DIFF_NO_DIFFERENCE;
+    entry->changed_bytes = 0;
+
+    if (j == new_count ||
+        (i < old_count && old_contents[i]->index < new_contents[j]->index)) {
+      entry->status = WAD_DIFF_REMOVED;
+      entry->index = old_contents[i]->index;
+      entry->old_content = old_contents[i++];
+      continue;
+    }
+
+    if (i == old_count || new_contents[j]->index < old_contents[i]->index) {
+      entry->status = WAD_DIFF_ADDED;
+      entry->index = new_contents[j]->index;
+      entry->new_content = new_contents[j++];
+      continue;
+    }
+
+    entry->index = old_contents[i]->index;
+    entry->old_content = old_contents[i++];
+    entry->new_content = new_contents[j++];
+
+    // The hashes cover the decrypted data, so nothing needs to be decrypted
+    // to tell whether a content changed
+    if (entry->old_content->size == entry->new_content->size &&
+        memcmp(entry->old_content->hash, entry->new_content->hash, 20) == 0) {
+      entry->status = WAD_DIFF_UNCHANGED;
+      continue;
+    }
+
+    entry->status = WAD_DIFF_MODIFIED;
+
+    if (mode == WAD_DIFF_BYTES && !diff_bytes(old_wad, new_wad, entry)) {
+      free(old_contents);
+      free(new_contents);
+      wad_diff_close(diff);
+      return NULL;
+    }
+  }
+
+  free(old_contents);
+  free(new_contents);
+
+  return diff;
+}
+
+size_t wad_diff_get_count(wad_diff_t handle)
+{
+  return ((struct diff_data*)handle)->count;
+}
+
+const wad_diff_entry_t* wad_diff_get_entry(wad_diff_t handle, size_t index)
+{
+  struct diff_data* diff = (struct diff_data*)handle;
+
+  if (index >= diff->count) {
+    g_error = LIBWAD_OUT_OF_RANGE;
+    return NULL;
+  }
+
+  return &diff->entries[index];
+}
+
+void wad_diff_close(wad_diff_t handle)
+{
+  if (handle == NULL)
+    return;
+
+  free(((struct diff_data*)handle)->entries);
+  free(handle);
+}
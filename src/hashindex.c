@@ -0,0 +1,344 @@
+// Copyright 2019 spycrab0
+// Licensed under GPLv3+
+// Refer to the LICENSE file included.
+
+#include "hashindex.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <mbedtls/sha1.h>
+
+#include "layout.h"
+#include "stats.h"
+#include "thread.h"
+#include "util.h"
+#include "wad.h"
+
+#define HASH_INDEX_MAGIC "WHIX"
+#define HASH_INDEX_VERSION 1
+
+// Chunk size of new indexes, the same as the block cache uses
+#define HASH_INDEX_CHUNK_SIZE 0x10000
+
+// Chunks have to evenly divide the pieces data_extract_all() hands out
+#define HASH_INDEX_MAX_CHUNK_SIZE 0x100000
+
+struct hash_index {
+  uint32_t chunk_size;
+  uint16_t content_count;
+
+  // The file as read, hashes point into it
+  unsigned char* buffer;
+  const unsigned char** hashes;
+
+  mutex_t lock;
+  int has_bad_chunk;
+  wad_bad_chunk_t bad_chunk;
+};
+
+static uint64_t hash_index_chunk_count(uint64_t size, uint32_t chunk_size)
+{
+  return (size + chunk_size - 1) / chunk_size;
+}
+
+// Hashes the content hash followed by all chunk hashes
+static void hash_index_root(const unsigned char content_hash[20],
+                            const unsigned char* hashes, uint64_t chunk_count,
+                            unsigned char root[20])
+{
+  mbedtls_sha1_context sha1;
+  mbedtls_sha1_init(&sha1);
+  mbedtls_sha1_starts_ret(&sha1);
+  mbedtls_sha1_update_ret(&sha1, content_hash, 20);
+  mbedtls_sha1_update_ret(&sha1, hashes, (size_t)chunk_count * 20);
+  mbedtls_sha1_finish_ret(&sha1, root);
+  mbedtls_sha1_free(&sha1);
+}
+
+struct hash_index_builder {
+  unsigned char** hashes;
+};
+
+static int hash_index_build_chunk(const data_chunk_t* chunk, void* user)
+{
+  struct hash_index_builder* builder = (struct hash_index_builder*)user;
+  unsigned char* hashes = builder->hashes[chunk->index];
+
+  for (size_t pos = 0; pos < chunk->length; pos += HASH_INDEX_CHUNK_SIZE) {
+    size_t length = chunk->length - pos;
+
+    if (length > HASH_INDEX_CHUNK_SIZE)
+      length = HASH_INDEX_CHUNK_SIZE;
+
+    uint64_t number = (chunk->offset + pos) / HASH_INDEX_CHUNK_SIZE;
+
+    mbedtls_sha1_ret(chunk->data + pos, length, hashes + number * 20);
+  }
+
+  return 0;
+}
+
+static int hash_index_write_file(struct wad_data* wad, const char* path,
+                                 unsigned char** hashes)
+{
+  uint16_t count = tmd_get_content_count(wad->tmd);
+
+  FILE* fh = fopen(path, "wb");
+
+  if (fh == NULL) {
+    g_error = LIBWAD_OPEN_FAILED;
+    return 0;
+  }
+
+  struct hash_index_header_layout header;
+
+  memcpy(header.magic, HASH_INDEX_MAGIC, sizeof(header.magic));
+  header.version = be32(HASH_INDEX_VERSION);
+  header.chunk_size = be32(HASH_INDEX_CHUNK_SIZE);
+  header.content_count = be16(count);
+
+  int result = fwrite(&header, sizeof(header), 1, fh) == 1;
+
+  for (uint16_t i = 0; i < count && result; i++) {
+    const tmd_content_t* content = tmd_get_content(wad->tmd, i);
+    uint64_t chunk_count =
+        hash_index_chunk_count(content->size, HASH_INDEX_CHUNK_SIZE);
+
+    struct hash_index_content_layout entry;
+
+    entry.size = be64(content->size);
+    memcpy(entry.content_hash, content->hash, 20);
+    hash_index_root(entry.content_hash, hashes[i], chunk_count,
+                    entry.root_hash);
+
+    result = fwrite(&entry, sizeof(entry), 1, fh) == 1 &&
+             (chunk_count == 0 ||
+              fwrite(hashes[i], (size_t)chunk_count * 20, 1, fh) == 1);
+  }
+
+  result = fclose(fh) == 0 && result;
+
+  if (!result) {
+    g_error = LIBWAD_IO_ERROR;
+    remove(path);
+  }
+
+  return result;
+}
+
+int wad_write_hash_index(wad_t handle, const char* path)
+{
+  struct wad_data* wad = (struct wad_data*)handle;
+  uint16_t count = tmd_get_content_count(wad->tmd);
+
+  struct hash_index_builder builder;
+
+  builder.hashes =
+      (unsigned char**)calloc(count > 0 ? count : 1, sizeof(unsigned char*));
+
+  int result = builder.hashes != NULL;
+
+  for (uint16_t i = 0; i < count && result; i++) {
+    uint64_t chunk_count = hash_index_chunk_count(
+        tmd_get_content(wad->tmd, i)->size, HASH_INDEX_CHUNK_SIZE);
+
+    builder.hashes[i] =
+        (unsigned char*)malloc(chunk_count > 0 ? (size_t)chunk_count * 20 : 1);
+    result = builder.hashes[i] != NULL;
+  }
+
+  if (!result)
+    g_error = LIBWAD_BAD_ALLOC;
+
+  // Every content is checked against the tmd, anchoring the chunk hashes to it
+  result = result &&
+           data_extract_all(handle, hash_index_build_chunk, &builder,
+                            LIBWAD_VERIFY_HASH) &&
+           hash_index_write_file(wad, path, builder.hashes);
+
+  for (uint16_t i = 0; builder.hashes != NULL && i < count; i++)
+    free(builder.hashes[i]);
+
+  free(builder.hashes);
+
+  return result;
+}
+
+static struct hash_index* hash_index_parse(struct wad_data* wad,
+                                           unsigned char* buffer, size_t size)
+{
+  struct hash_index_header_layout header;
+
+  if (size < sizeof(header))
+    return NULL;
+
+  memcpy(&header, buffer, sizeof(header));
+
+  uint32_t chunk_size = be32(header.chunk_size);
+  uint16_t count = be16(header.content_count);
+
+  // Chunks have to be whole AES blocks and a power of two
+  if (memcmp(header.magic, HASH_INDEX_MAGIC, sizeof(header.magic)) != 0 ||
+      be32(header.version) != HASH_INDEX_VERSION || chunk_size < 16 ||
+      chunk_size > HASH_INDEX_MAX_CHUNK_SIZE ||
+      (chunk_size & (chunk_size - 1)) != 0 ||
+      count != tmd_get_content_count(wad->tmd))
+    return NULL;
+
+  struct hash_index* index =
+      (struct hash_index*)calloc(1, sizeof(struct hash_index));
+
+  if (index == NULL)
+    return NULL;
+
+  index->hashes = (const unsigned char**)malloc(
+      sizeof(unsigned char*) * (count > 0 ? count : 1));
+
+  if (index->hashes == NULL) {
+    free(index);
+    return NULL;
+  }
+
+  index->chunk_size = chunk_size;
+  index->content_count = count;
+  index->buffer = buffer;
+
+  size_t pos = sizeof(header);
+  uint16_t i = 0;
+
+  for (; i < count; i++) {
+    const tmd_content_t* content = tmd_get_content(wad->tmd, i);
+    struct hash_index_content_layout entry;
+
+    if (size - pos < sizeof(entry))
+      break;
+
+    memcpy(&entry, buffer + pos, sizeof(entry));
+    pos += sizeof(entry);
+
+    uint64_t chunk_count = hash_index_chunk_count(content->size, chunk_size);
+
+    if (be64(entry.size) != content->size ||
+        memcmp(entry.content_hash, content->hash, 20) != 0 ||
+        (size - pos) / 20 < chunk_count)
+      break;
+
+    unsigned char root[20];
+    hash_index_root(entry.content_hash, buffer + pos, chunk_count, root);
+
+    if (memcmp(root, entry.root_hash, sizeof(root)) != 0)
+      break;
+
+    index->hashes[i] = buffer + pos;
+    pos += (size_t)chunk_count * 20;
+  }
+
+  // An index ending right after an entry still has to cover every content
+  if (i != count || pos != size) {
+    free(index->hashes);
+    free(index);
+    return NULL;
+  }
+
+  mutex_init(&index->lock);
+
+  return index;
+}
+
+int wad_load_hash_index(wad_t handle, const char* path)
+{
+  struct wad_data* wad = (struct wad_data*)handle;
+
+  size_t size;
+  unsigned char* buffer = util_read_file(path, &size);
+
+  if (buffer == NULL)
+    return 0;
+
+  struct hash_index* index = hash_index_parse(wad, buffer, size);
+
+  if (index == NULL) {
+    g_error = LIBWAD_BAD_INDEX;
+    free(buffer);
+    return 0;
+  }
+
+  hash_index_close(wad->hash_index);
+  wad->hash_index = index;
+
+  return 1;
+}
+
+int wad_get_bad_chunk(wad_t handle, wad_bad_chunk_t* chunk)
+{
+  struct hash_index* index = ((struct wad_data*)handle)->hash_index;
+
+  if (index == NULL)
+    return 0;
+
+  mutex_lock(&index->lock);
+
+  int found = index->has_bad_chunk;
+
+  if (found)
+    *chunk = index->bad_chunk;
+
+  mutex_unlock(&index->lock);
+
+  return found;
+}
+
+uint32_t hash_index_get_chunk_size(const struct hash_index* index)
+{
+  return index->chunk_size;
+}
+
+int hash_index_verify(struct hash_index* index, uint16_t content,
+                      uint64_t offset, const unsigned char* data,
+                      size_t length)
+{
+  const unsigned char* expected =
+      index->hashes[content] + (offset / index->chunk_size) * 20;
+
+  for (size_t pos = 0; pos < length; pos += index->chunk_size) {
+    size_t size = length - pos;
+
+    if (size > index->chunk_size)
+      size = index->chunk_size;
+
+    unsigned char hash[20];
+
+    STATS_TIMER(hash_timer);
+    mbedtls_sha1_ret(data + pos, size, hash);
+    STATS_ADD(STATS_HASH, size, hash_timer);
+
+    if (memcmp(hash, expected, sizeof(hash)) != 0) {
+      mutex_lock(&index->lock);
+      index->has_bad_chunk = 1;
+      index->bad_chunk.index = content;
+      index->bad_chunk.offset = offset + pos;
+      index->bad_chunk.length = size;
+      mutex_unlock(&index->lock);
+
+      g_error = LIBWAD_HASH_MISMATCH;
+      return 0;
+    }
+
+    expected += 20;
+  }
+
+  return 1;
+}
+
+void hash_index_close(struct hash_index* index)
+{
+  if (index == NULL)
+    return;
+
+  mutex_destroy(&index->lock);
+  free(index->hashes);
+  free(index->buffer);
+  free(index);
+}
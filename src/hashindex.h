@@ -0,0 +1,25 @@
+// Copyright 2019 spycrab0
+// Licensed under GPLv3+
+// Refer to the LICENSE file included.
+
+#ifndef HASHINDEX_H
+#define HASHINDEX_H
+
+#include "libwad.h"
+
+#include <stddef.h>
+
+struct hash_index;
+
+uint32_t hash_index_get_chunk_size(const struct hash_index* index);
+
+// Checks decrypted data starting at a chunk boundary of a content, which has
+// to consist of whole chunks unless it ends with the content. Records the
+// first chunk that does not match and sets g_error.
+int hash_index_verify(struct hash_index* index, uint16_t content,
+                      uint64_t offset, const unsigned char* data,
+                      size_t length);
+
+void hash_index_close(struct hash_index* index);
+
+#endif
@@ -0,0 +1,562 @@
+// Copyright 2019 spycrab0
+// Licensed under GPLv3+
+// Refer to the LICENSE file included.
+
+#ifndef _WIN32
+#define _GNU_SOURCE
+#endif
+
+#include "io.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <memory.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#include <io.h>
+#include <sys/stat.h>
+#include <windows.h>
+#else
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef LIBWAD_HAVE_SENDFILE
+#include <sys/sendfile.h>
+#endif
+
+#include "stats.h"
+#include "thread.h"
+#include "wad.h"
+
+// O_DIRECT needs buffers, offsets and sizes aligned to the logical block size
+#define IO_DIRECT_ALIGNMENT 4096
+
+// Size of the bounce buffer used for O_DIRECT reads
+#define IO_DIRECT_BUFFER_SIZE 0x100000
+
+// Size of the buffer used to copy data when the kernel can't do it for us
+#define IO_COPY_BUFFER_SIZE 0x100000
+
+#if !defined(_WIN32) && defined(POSIX_FADV_DONTNEED)
+#define IO_HAVE_FADVISE
+#endif
+
+#if !defined(_WIN32) && defined(O_DIRECT)
+#define IO_HAVE_DIRECT
+#endif
+
+int io_open(struct wad_data* wad, const char* filename,
+            wad_io_policy_t policy)
+{
+  wad->fh = fopen(filename, "rb");
+  wad->direct_fd = -1;
+  wad->io_policy = policy;
+
+  if (wad->fh == NULL)
+    return 0;
+
+#ifdef IO_HAVE_DIRECT
+  if (policy == WAD_IO_DIRECT)
+    wad->direct_fd = open(filename, O_RDONLY | O_DIRECT);
+
+  // Allocated once, every read needs it and many of them are tiny
+  if (wad->direct_fd >= 0 &&
+      posix_memalign(&wad->direct_buffer, IO_DIRECT_ALIGNMENT,
+                     IO_DIRECT_BUFFER_SIZE) != 0) {
+    close(wad->direct_fd);
+    wad->direct_fd = -1;
+  }
+
+  if (wad->direct_fd >= 0)
+    mutex_init(&wad->direct_lock);
+#endif
+
+  // Not every filesystem supports O_DIRECT, dropping behind comes closest
+  if (policy == WAD_IO_DIRECT && wad->direct_fd < 0)
+    wad->io_policy = WAD_IO_DROP_BEHIND;
+
+#ifdef IO_HAVE_FADVISE
+  if (wad->io_policy == WAD_IO_SEQUENTIAL ||
+      wad->io_policy == WAD_IO_DROP_BEHIND)
+    posix_fadvise(fileno(wad->fh), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+  return 1;
+}
+
+void io_close(struct wad_data* wad)
+{
+#ifndef _WIN32
+  if (wad->direct_fd >= 0) {
+    close(wad->direct_fd);
+    mutex_destroy(&wad->direct_lock);
+    free(wad->direct_buffer);
+  }
+#endif
+
+  if (wad->fh != NULL)
+    fclose(wad->fh);
+
+  for (uint16_t i = 0; i < wad->content_file_count; i++) {
+    if (wad->content_files[i] != NULL)
+      fclose(wad->content_files[i]);
+  }
+
+  free(wad->content_files);
+
+  for (int i = 0; i <= WAD_SECTION_FOOTER; i++)
+    free(wad->section_data[i]);
+}
+
+int io_pread(int fd, void* buffer, size_t size, uint64_t offset)
+{
+  unsigned char* dst = (unsigned char*)buffer;
+
+  while (size > 0) {
+#ifdef _WIN32
+    OVERLAPPED overlapped;
+    DWORD count = 0;
+
+    memset(&overlapped, 0, sizeof(overlapped));
+    overlapped.Offset = (DWORD)offset;
+    overlapped.OffsetHigh = (DWORD)(offset >> 32);
+
+    if (!ReadFile((HANDLE)_get_osfhandle(fd), dst, (DWORD)size, &count,
+                  &overlapped) ||
+        count == 0)
+      return 0;
+#else
+    ssize_t count = pread(fd, dst, size, (off_t)offset);
+
+    if (count < 0 && errno == EINTR)
+      continue;
+
+    if (count <= 0)
+      return 0;
+#endif
+
+    dst += count;
+    size -= (size_t)count;
+    offset += (uint64_t)count;
+  }
+
+  return 1;
+}
+
+int io_pwrite(int fd, const void* buffer, size_t size, uint64_t offset)
+{
+  const unsigned char* src = (const unsigned char*)buffer;
+
+  while (size > 0) {
+#ifdef _WIN32
+    OVERLAPPED overlapped;
+    DWORD count = 0;
+
+    memset(&overlapped, 0, sizeof(overlapped));
+    overlapped.Offset = (DWORD)offset;
+    overlapped.OffsetHigh = (DWORD)(offset >> 32);
+
+    if (!WriteFile((HANDLE)_get_osfhandle(fd), src, (DWORD)size, &count,
+                   &overlapped) ||
+        count == 0)
+      return 0;
+#else
+    ssize_t count = pwrite(fd, src, size, (off_t)offset);
+
+    if (count < 0 && errno == EINTR)
+      continue;
+
+    if (count <= 0)
+      return 0;
+#endif
+
+    src += count;
+    size -= (size_t)count;
+    offset += (uint64_t)count;
+  }
+
+  return 1;
+}
+
+#ifdef IO_HAVE_DIRECT
+// Gets a bounce buffer, the one of the wad unless another read is using it
+static void* io_take_bounce(struct wad_data* wad)
+{
+  mutex_lock(&wad->direct_lock);
+
+  void* bounce = wad->direct_buffer;
+  wad->direct_buffer = NULL;
+
+  mutex_unlock(&wad->direct_lock);
+
+  if (bounce == NULL &&
+      posix_memalign(&bounce, IO_DIRECT_ALIGNMENT, IO_DIRECT_BUFFER_SIZE) != 0)
+    return NULL;
+
+  return bounce;
+}
+
+static void io_return_bounce(struct wad_data* wad, void* bounce)
+{
+  mutex_lock(&wad->direct_lock);
+
+  if (wad->direct_buffer == NULL) {
+    wad->direct_buffer = bounce;
+    bounce = NULL;
+  }
+
+  mutex_unlock(&wad->direct_lock);
+
+  free(bounce);
+}
+
+// Reads through an aligned bounce buffer, the end of the file may cut the last
+// block short
+static int io_read_direct(struct wad_data* wad, unsigned char* dst,
+                          size_t size, uint64_t offset)
+{
+  void* bounce = io_take_bounce(wad);
+
+  if (bounce == NULL)
+    return 0;
+
+  while (size > 0) {
+    uint64_t start = offset & ~(uint64_t)(IO_DIRECT_ALIGNMENT - 1);
+    size_t skip = (size_t)(offset - start);
+    size_t length = skip + size;
+
+    if (length > IO_DIRECT_BUFFER_SIZE)
+      length = IO_DIRECT_BUFFER_SIZE;
+    else
+      length = (length + IO_DIRECT_ALIGNMENT - 1) &
+               ~(size_t)(IO_DIRECT_ALIGNMENT - 1);
+
+    ssize_t count = pread(wad->direct_fd, bounce, length, (off_t)start);
+
+    if (count < 0 && errno == EINTR)
+      continue;
+
+    if (count < 0 && errno == EINVAL) {
+      // The filesystem accepted O_DIRECT on open but not for this read
+      io_return_bounce(wad, bounce);
+      return io_pread(fileno(wad->fh), dst, size, offset);
+    }
+
+    if (count <= (ssize_t)skip) {
+      io_return_bounce(wad, bounce);
+      return 0;
+    }
+
+    size_t available = (size_t)count - skip;
+
+    if (available > size)
+      available = size;
+
+    memcpy(dst, (unsigned char*)bounce + skip, available);
+
+    dst += available;
+    size -= available;
+    offset += available;
+  }
+
+  io_return_bounce(wad, bounce);
+
+  return 1;
+}
+#endif
+
+int io_read(struct wad_data* wad, void* dst, size_t size, uint64_t offset)
+{
+  STATS_TIMER(read_timer);
+
+  int success;
+
+#ifdef IO_HAVE_DIRECT
+  if (wad->direct_fd >= 0)
+    success = io_read_direct(wad, (unsigned char*)dst, size, offset);
+  else
+#endif
+    success = io_pread(fileno(wad->fh), dst, size, offset);
+
+  if (!success)
+    return 0;
+
+  STATS_ADD(STATS_READ, size, read_timer);
+
+  if (wad->io_policy == WAD_IO_DROP_BEHIND)
+    io_done(wad, offset, size);
+
+  return 1;
+}
+
+int io_get_content_fd(struct wad_data* wad, uint16_t index, uint64_t* offset)
+{
+  if (wad->content_files != NULL) {
+    *offset = 0;
+
+    return wad->content_files[index] != NULL
+               ? fileno(wad->content_files[index])
+               : -1;
+  }
+
+  *offset = wad_get_section_offset(wad, WAD_SECTION_DATA) +
+            wad->content_offsets[index];
+
+  return fileno(wad->fh);
+}
+
+int io_read_content(struct wad_data* wad, uint16_t index, void* dst,
+                    size_t size, uint64_t offset)
+{
+  if (wad->content_files == NULL)
+    return io_read(wad, dst, size,
+                   wad_get_section_offset(wad, WAD_SECTION_DATA) +
+                       wad->content_offsets[index] + offset);
+
+  if (wad->content_files[index] == NULL)
+    return 0;
+
+  STATS_TIMER(read_timer);
+
+  if (!io_pread(fileno(wad->content_files[index]), dst, size, offset))
+    return 0;
+
+  STATS_ADD(STATS_READ, size, read_timer);
+
+  return 1;
+}
+
+unsigned char* io_read_section(struct wad_data* wad, wad_section_t section)
+{
+  uint32_t size = wad_get_section_size(wad, section);
+
+  // Allocate at least one byte so empty sections aren't mistaken for errors
+  unsigned char* buffer = (unsigned char*)malloc(size > 0 ? size : 1);
+
+  if (buffer == NULL) {
+    g_error = LIBWAD_BAD_ALLOC;
+    return NULL;
+  }
+
+  if (wad->fh == NULL) {
+    if (wad->section_data[section] == NULL) {
+      g_error = LIBWAD_NOT_SUPPORTED;
+      free(buffer);
+      return NULL;
+    }
+
+    memcpy(buffer, wad->section_data[section], size);
+    return buffer;
+  }
+
+  if (!io_read(wad, buffer, size, wad_get_section_offset(wad, section))) {
+    g_error = LIBWAD_IO_ERROR;
+    free(buffer);
+    return NULL;
+  }
+
+  return buffer;
+}
+
+void io_hint_sequential(struct wad_data* wad, uint64_t offset, uint64_t size)
+{
+#ifdef IO_HAVE_FADVISE
+  if (wad->fh != NULL)
+    posix_fadvise(fileno(wad->fh), (off_t)offset, (off_t)size,
+                  POSIX_FADV_SEQUENTIAL);
+#else
+  (void)wad;
+  (void)offset;
+  (void)size;
+#endif
+}
+
+void io_done(struct wad_data* wad, uint64_t offset, uint64_t size)
+{
+#ifdef IO_HAVE_FADVISE
+  if (wad->fh != NULL && (wad->io_policy == WAD_IO_DROP_BEHIND ||
+                          wad->io_policy == WAD_IO_DIRECT))
+    posix_fadvise(fileno(wad->fh), (off_t)offset, (off_t)size,
+                  POSIX_FADV_DONTNEED);
+#else
+  (void)wad;
+  (void)offset;
+  (void)size;
+#endif
+}
+
+int io_open_output(const char* path)
+{
+#ifdef _WIN32
+  return _open(path, _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY,
+               _S_IREAD | _S_IWRITE);
+#else
+  return open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+#endif
+}
+
+void io_close_output(int fd)
+{
+#ifdef _WIN32
+  _close(fd);
+#else
+  close(fd);
+#endif
+}
+
+int io_make_directory(const char* path)
+{
+#ifdef _WIN32
+  if (_mkdir(path) == 0)
+    return 1;
+#else
+  if (mkdir(path, 0755) == 0)
+    return 1;
+#endif
+
+  return errno == EEXIST;
+}
+
+int io_make_directories(const char* path)
+{
+  size_t length = strlen(path);
+  char* partial = (char*)malloc(length + 1);
+
+  if (partial == NULL)
+    return 0;
+
+  memcpy(partial, path, length + 1);
+
+  // Make every parent, skipping the root of absolute paths and drive letters
+  for (size_t i = 1; i < length; i++) {
+    if ((partial[i] != '/' && partial[i] != '\\') || partial[i - 1] == ':')
+      continue;
+
+    char separator = partial[i];
+    partial[i] = '\0';
+
+    int made = io_make_directory(partial);
+    partial[i] = separator;
+
+    if (!made) {
+      free(partial);
+      return 0;
+    }
+  }
+
+  free(partial);
+
+  return io_make_directory(path);
+}
+
+int io_replace(const char* from, const char* to)
+{
+#ifdef _WIN32
+  // rename() refuses to overwrite existing files on Windows
+  return MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+  return rename(from, to) == 0;
+#endif
+}
+
+void io_preallocate(int fd, uint64_t size)
+{
+#ifdef LIBWAD_HAVE_POSIX_FALLOCATE
+  if (size > 0)
+    posix_fallocate(fd, 0, (off_t)size);
+#else
+  (void)fd;
+  (void)size;
+#endif
+}
+
+// Copies through a bounded buffer, used when the kernel can't copy for us
+static int io_copy_buffered(struct wad_data* wad, int fd, uint64_t offset,
+                            uint64_t out_offset, uint64_t size)
+{
+  size_t buffer_size =
+      size < IO_COPY_BUFFER_SIZE ? (size_t)size : IO_COPY_BUFFER_SIZE;
+
+  unsigned char* buffer = (unsigned char*)malloc(buffer_size);
+
+  if (buffer == NULL)
+    return 0;
+
+  while (size > 0) {
+    size_t count = size < buffer_size ? (size_t)size : buffer_size;
+
+    if (!io_read(wad, buffer, count, offset) ||
+        !io_pwrite(fd, buffer, count, out_offset)) {
+      free(buffer);
+      return 0;
+    }
+
+    offset += count;
+    out_offset += count;
+    size -= count;
+  }
+
+  free(buffer);
+
+  return 1;
+}
+
+int io_copy(struct wad_data* wad, int fd, uint64_t offset, uint64_t size)
+{
+  uint64_t start = offset, out_offset = 0;
+
+  STATS_TIMER(read_timer);
+
+#ifdef LIBWAD_HAVE_COPY_FILE_RANGE
+  // Lets filesystems share or clone the blocks instead of copying them
+  while (size > 0 && wad->direct_fd < 0) {
+    loff_t in_off = (loff_t)offset, out_off = (loff_t)out_offset;
+    ssize_t count =
+        copy_file_range(fileno(wad->fh), &in_off, fd, &out_off, size, 0);
+
+    if (count < 0 && errno == EINTR)
+      continue;
+
+    // Not supported for these files, try the next way
+    if (count <= 0)
+      break;
+
+    offset += (uint64_t)count;
+    out_offset += (uint64_t)count;
+    size -= (uint64_t)count;
+  }
+#endif
+
+#ifdef LIBWAD_HAVE_SENDFILE
+  if (size > 0 && wad->direct_fd < 0 &&
+      lseek(fd, (off_t)out_offset, SEEK_SET) == (off_t)out_offset) {
+    while (size > 0) {
+      off_t in_off = (off_t)offset;
+      ssize_t count = sendfile(fd, fileno(wad->fh), &in_off, (size_t)size);
+
+      if (count < 0 && errno == EINTR)
+        continue;
+
+      if (count <= 0)
+        break;
+
+      offset += (uint64_t)count;
+      out_offset += (uint64_t)count;
+      size -= (uint64_t)count;
+    }
+  }
+#endif
+
+  STATS_ADD(STATS_READ, offset - start, read_timer);
+
+  if (offset > start)
+    io_done(wad, start, offset - start);
+
+  // O_DIRECT reads and everything the kernel refused to copy end up here
+  return size == 0 || io_copy_buffered(wad, fd, offset, out_offset, size);
+}
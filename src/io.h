@@ -0,0 +1,64 @@
+// Copyright 2019 spycrab0
+// Licensed under GPLv3+
+// Refer to the LICENSE file included.
+
+#ifndef IO_H
+#define IO_H
+
+#include "libwad.h"
+
+#include <stddef.h>
+
+struct wad_data;
+
+// Opens the file backing a wad according to the given policy
+int io_open(struct wad_data* wad, const char* filename,
+            wad_io_policy_t policy);
+void io_close(struct wad_data* wad);
+
+// Reads size bytes at offset, returns 0 on failure without setting g_error
+int io_read(struct wad_data* wad, void* dst, size_t size, uint64_t offset);
+
+// Gets the descriptor of the file holding a content and the offset the
+// content starts at, returns -1 if the content's file is missing
+int io_get_content_fd(struct wad_data* wad, uint16_t index, uint64_t* offset);
+
+// Reads size bytes at offset within a content, returns 0 on failure without
+// setting g_error
+int io_read_content(struct wad_data* wad, uint16_t index, void* dst,
+                    size_t size, uint64_t offset);
+
+// Reads a whole section into a newly allocated buffer
+unsigned char* io_read_section(struct wad_data* wad, wad_section_t section);
+
+// Announces that a range is about to be read front to back
+void io_hint_sequential(struct wad_data* wad, uint64_t offset, uint64_t size);
+
+// Tells the policy that a range read without io_read() is no longer needed
+void io_done(struct wad_data* wad, uint64_t offset, uint64_t size);
+
+// Positioned I/O on file descriptors, returns 0 on failure or end of file
+int io_pread(int fd, void* buffer, size_t size, uint64_t offset);
+int io_pwrite(int fd, const void* buffer, size_t size, uint64_t offset);
+
+// Creates or truncates a file for writing, returns -1 on failure
+int io_open_output(const char* path);
+void io_close_output(int fd);
+
+// Creates a directory, succeeds if it exists already
+int io_make_directory(const char* path);
+
+// Creates a directory along with any missing parents
+int io_make_directories(const char* path);
+
+// Renames a file, replacing the target if it exists, returns 0 on failure
+int io_replace(const char* from, const char* to);
+
+// Reserves space for a file about to be written, failing is harmless
+void io_preallocate(int fd, uint64_t size);
+
+// Copies a range of the wad to the start of fd without going through user
+// space where the system allows it, returns 0 on failure
+int io_copy(struct wad_data* wad, int fd, uint64_t offset, uint64_t size);
+
+#endif
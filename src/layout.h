@@ -0,0 +1,159 @@
+// Copyright 2019 spycrab0
+// Licensed under GPLv3+
+// Refer to the LICENSE file included.
+
+#ifndef LAYOUT_H
+#define LAYOUT_H
+
+// On-disk layouts of the structures found in wads. All integers are stored
+// big endian, parsers copy a whole structure out of the buffer once its size
+// has been checked and then swap the fields they need.
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Fails to compile if cond does not hold
+#define LAYOUT_ASSERT(cond, name)                                               \
+  typedef char layout_assert_##name[(cond) ? 1 : -1]
+
+#pragma pack(push, 1)
+
+struct wad_header_layout {
+  uint32_t header_size;
+  uint32_t type;
+  uint32_t certchain_size;
+  uint32_t reserved;
+  uint32_t ticket_size;
+  uint32_t tmd_size;
+  uint32_t data_size;
+  uint32_t footer_size;
+};
+
+// Fixed part of a certificate following its signature and padding
+struct cert_layout {
+  unsigned char issuer[64];
+  uint32_t key_type;
+  unsigned char child_cert[64];
+};
+
+// v0 ticket signed with RSA-2048
+struct ticket_layout {
+  uint32_t signature_type;
+  unsigned char signature[0x100];
+  unsigned char signature_padding[0x3c];
+  char issuer[64];
+  unsigned char ecdh_data[0x3c];
+  uint8_t version;
+  uint8_t reserved[2];
+  unsigned char title_key[16];
+  uint8_t unknown;
+  unsigned char ticket_id[8];
+  unsigned char console_id[4];
+  uint64_t title_id;
+  uint16_t unknown2;
+  uint16_t title_version;
+  uint32_t permitted_titles_mask;
+  uint32_t permit_mask;
+  uint8_t title_export_allowed;
+  uint8_t common_key_index;
+  unsigned char unknown3[0x30];
+  unsigned char content_access_permissions[0x40];
+  uint16_t padding;
+  unsigned char time_limits[0x40];
+};
+
+// TMD signed with RSA-2048, followed by content_count content records
+struct tmd_header_layout {
+  uint32_t signature_type;
+  unsigned char signature[0x100];
+  unsigned char signature_padding[0x3c];
+  char issuer[64];
+  uint8_t version;
+  uint8_t ca_crl_version;
+  uint8_t signer_crl_version;
+  uint8_t vwii_title;
+  uint64_t ios_version;
+  uint64_t title_id;
+  uint32_t title_type;
+  uint16_t group_id;
+  uint16_t zero;
+  uint16_t region;
+  unsigned char ratings[16];
+  unsigned char reserved[12];
+  unsigned char ipc_mask[12];
+  unsigned char reserved2[18];
+  uint32_t access_rights;
+  uint16_t title_version;
+  uint16_t content_count;
+  uint16_t boot_index;
+  uint16_t padding;
+};
+
+struct tmd_content_layout {
+  uint32_t id;
+  uint16_t index;
+  uint16_t type;
+  uint64_t size;
+  unsigned char hash[20];
+};
+
+// Entry of shared1/content.map on a NAND, naming the file a shared content
+// with the given hash is stored in
+struct content_map_layout {
+  char name[8];
+  unsigned char hash[20];
+};
+
+// Sidecar hash index, the header is followed by one entry per content and the
+// SHA-1 of each of its chunks
+struct hash_index_header_layout {
+  char magic[4];
+  uint32_t version;
+  uint32_t chunk_size;
+  uint16_t content_count;
+};
+
+struct hash_index_content_layout {
+  uint64_t size;
+  // The hash from the tmd the chunk hashes were checked against
+  unsigned char content_hash[20];
+  // SHA-1 over the content hash and all chunk hashes
+  unsigned char root_hash[20];
+};
+
+#pragma pack(pop)
+
+LAYOUT_ASSERT(sizeof(struct wad_header_layout) == 0x20, wad_header_size);
+
+LAYOUT_ASSERT(sizeof(struct cert_layout) == 0x84, cert_size);
+
+LAYOUT_ASSERT(offsetof(struct ticket_layout, issuer) == 0x140, ticket_issuer);
+LAYOUT_ASSERT(offsetof(struct ticket_layout, title_key) == 0x1bf,
+              ticket_title_key);
+LAYOUT_ASSERT(offsetof(struct ticket_layout, console_id) == 0x1d8,
+              ticket_console_id);
+LAYOUT_ASSERT(offsetof(struct ticket_layout, title_id) == 0x1dc,
+              ticket_title_id);
+LAYOUT_ASSERT(offsetof(struct ticket_layout, common_key_index) == 0x1f1,
+              ticket_common_key_index);
+LAYOUT_ASSERT(sizeof(struct ticket_layout) == 0x2a4, ticket_size);
+
+LAYOUT_ASSERT(offsetof(struct tmd_header_layout, ios_version) == 0x184,
+              tmd_ios_version);
+LAYOUT_ASSERT(offsetof(struct tmd_header_layout, region) == 0x19c, tmd_region);
+LAYOUT_ASSERT(offsetof(struct tmd_header_layout, title_version) == 0x1dc,
+              tmd_title_version);
+LAYOUT_ASSERT(offsetof(struct tmd_header_layout, content_count) == 0x1de,
+              tmd_content_count);
+LAYOUT_ASSERT(sizeof(struct tmd_header_layout) == 0x1e4, tmd_header_size);
+
+LAYOUT_ASSERT(offsetof(struct tmd_content_layout, size) == 8, tmd_content_size);
+LAYOUT_ASSERT(sizeof(struct tmd_content_layout) == 36, tmd_content_record);
+
+LAYOUT_ASSERT(sizeof(struct content_map_layout) == 28, content_map_entry);
+
+LAYOUT_ASSERT(sizeof(struct hash_index_header_layout) == 14, hash_index_header);
+LAYOUT_ASSERT(sizeof(struct hash_index_content_layout) == 48,
+              hash_index_content);
+
+#endif
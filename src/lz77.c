@@ -0,0 +1,384 @@
+// Copyright 2019 spycrab0
+// Licensed under GPLv3+
+// Refer to the LICENSE file included.
+
+#include "lz77.h"
+
+#include <memory.h>
+#include <stdlib.h>
+
+#include "budget.h"
+#include "wad.h"
+
+#define LZ77_MAGIC "LZ77"
+
+#define LZ77_TYPE_LZ10 0x10
+#define LZ77_TYPE_LZ11 0x11
+
+// Largest flag group: One flag byte followed by eight 4 byte references
+#define LZ77_MAX_GROUP (1 + 8 * 4)
+
+// Header: Optional magic, type + 24-bit size, optional 32-bit size
+#define LZ77_MAX_HEADER (4 + 4 + 4)
+
+// Slack behind the output so matches can be copied in 8 byte steps
+#define LZ77_SLACK 8
+
+// Output decoded to tell data without the magic from plain data
+#define LZ77_TRIAL_SIZE 0x1000
+
+// Padding allowed behind the compressed data
+#define LZ77_MAX_PADDING 0x40
+
+struct lz77_stream {
+  int type;
+  unsigned char* out;
+  size_t out_size;
+  size_t out_pos;
+
+  // Input that could not be decoded yet because it might end mid-group
+  unsigned char pending[2 * LZ77_MAX_GROUP];
+  size_t pending_size;
+};
+
+// Parses the header
+// Returns its size, 0 if more data is needed or -1 if the data isn't
+// compressed
+static int lz77_parse_header(const unsigned char* src, size_t size, int* type,
+                             size_t* out_size)
+{
+  size_t pos = 0;
+
+  if (size >= 4 && memcmp(src, LZ77_MAGIC, 4) == 0)
+    pos = 4;
+  else if (size < 4 && memcmp(src, LZ77_MAGIC, size) == 0)
+    return 0;
+
+  if (size < pos + 4)
+    return 0;
+
+  if (src[pos] != LZ77_TYPE_LZ10 && src[pos] != LZ77_TYPE_LZ11)
+    return -1;
+
+  *type = src[pos];
+  *out_size = src[pos + 1] | src[pos + 2] << 8 | (size_t)src[pos + 3] << 16;
+  pos += 4;
+
+  // Sizes beyond 24-bit are stored in an extra field
+  if (*out_size == 0) {
+    if (size < pos + 4)
+      return 0;
+
+    *out_size = src[pos] | src[pos + 1] << 8 | (size_t)src[pos + 2] << 16 |
+                (size_t)src[pos + 3] << 24;
+    pos += 4;
+  }
+
+  return (int)pos;
+}
+
+static void lz77_copy(unsigned char* out, size_t pos, size_t disp,
+                      size_t length)
+{
+  unsigned char* dst = out + pos;
+  const unsigned char* src = dst - disp;
+
+  if (disp >= 8) {
+    // Chunks never overlap, overshooting is covered by the slack
+    for (size_t i = 0; i < length; i += 8)
+      memcpy(dst + i, src + i, 8);
+  } else {
+    for (size_t i = 0; i < length; i++)
+      dst[i] = src[i];
+  }
+}
+
+// Decodes as many flag groups as possible
+// Unless final is set, only whole groups are decoded so decoding can pick up
+// again once more input arrives
+// Returns the number of bytes consumed or -1 on error
+static long lz77_decode(struct lz77_stream* s, const unsigned char* in,
+                        size_t size, int final)
+{
+  const unsigned char* p = in;
+  const unsigned char* end = in + size;
+
+  unsigned char* out = s->out;
+  size_t pos = s->out_pos;
+  size_t out_size = s->out_size;
+
+  while (pos < out_size && p < end) {
+    // A group might be cut off, leave it for the next round
+    if (!final && (size_t)(end - p) < LZ77_MAX_GROUP)
+      break;
+
+    unsigned flags = *p++;
+
+    for (int bit = 0; bit < 8 && pos < out_size; bit++, flags <<= 1) {
+      // Can only run dry on the final round, i.e. the data is truncated
+      if (p >= end)
+        return -1;
+
+      if (!(flags & 0x80)) {
+        out[pos++] = *p++;
+        continue;
+      }
+
+      size_t length, disp, needed;
+
+      if (s->type == LZ77_TYPE_LZ10) {
+        needed = 2;
+      } else {
+        unsigned indicator = p[0] >> 4;
+        needed = indicator == 0 ? 3 : indicator == 1 ? 4 : 2;
+      }
+
+      if ((size_t)(end - p) < needed)
+        return -1;
+
+      if (s->type == LZ77_TYPE_LZ10) {
+        length = (p[0] >> 4) + 3;
+        disp = ((p[0] & 0xf) << 8 | p[1]) + 1;
+      } else if (needed == 3) {
+        length = ((p[0] & 0xf) << 4 | p[1] >> 4) + 0x11;
+        disp = ((p[1] & 0xf) << 8 | p[2]) + 1;
+      } else if (needed == 4) {
+        length = ((p[0] & 0xf) << 12 | p[1] << 4 | p[2] >> 4) + 0x111;
+        disp = ((p[2] & 0xf) << 8 | p[3]) + 1;
+      } else {
+        length = (p[0] >> 4) + 1;
+        disp = ((p[0] & 0xf) << 8 | p[1]) + 1;
+      }
+
+      p += needed;
+
+      if (disp > pos)
+        return -1;
+
+      if (length > out_size - pos)
+        length = out_size - pos;
+
+      lz77_copy(out, pos, disp, length);
+      pos += length;
+    }
+  }
+
+  s->out_pos = pos;
+
+  if (final && pos < out_size)
+    return -1;
+
+  return (long)(p - in);
+}
+
+lz77_stream_t lz77_stream_open()
+{
+  struct lz77_stream* s =
+      (struct lz77_stream*)calloc(1, sizeof(struct lz77_stream));
+
+  if (s == NULL)
+    g_error = LIBWAD_BAD_ALLOC;
+
+  return s;
+}
+
+static int lz77_stream_start(struct lz77_stream* s)
+{
+  int header =
+      lz77_parse_header(s->pending, s->pending_size, &s->type, &s->out_size);
+
+  if (header == 0)
+    return 1;
+
+  if (header < 0) {
+    g_error = LIBWAD_DECOMPRESSION_FAILED;
+    return 0;
+  }
+
+  // The size comes straight from the data, so check it before trusting it
+  if (!budget_acquire(s->out_size + LZ77_SLACK))
+    return 0;
+
+  s->out = (unsigned char*)malloc(s->out_size + LZ77_SLACK);
+
+  if (s->out == NULL) {
+    g_error = LIBWAD_BAD_ALLOC;
+    budget_release(s->out_size + LZ77_SLACK);
+    return 0;
+  }
+
+  s->pending_size -= header;
+  memmove(s->pending, s->pending + header, s->pending_size);
+
+  return 1;
+}
+
+int lz77_stream_feed(lz77_stream_t handle, const unsigned char* data,
+                     size_t size)
+{
+  struct lz77_stream* s = (struct lz77_stream*)handle;
+
+  while (size > 0 && (s->out == NULL || s->out_pos < s->out_size)) {
+    long used;
+
+    if (s->out != NULL && s->pending_size == 0) {
+      // Fast path: Decode straight from the caller's buffer
+      used = lz77_decode(s, data, size, 0);
+
+      if (used < 0) {
+        g_error = LIBWAD_DECOMPRESSION_FAILED;
+        return 0;
+      }
+
+      data += used;
+      size -= (size_t)used;
+
+      // What's left might end mid-group, keep it until more data arrives
+      if (size < LZ77_MAX_GROUP) {
+        memcpy(s->pending, data, size);
+        s->pending_size = size;
+        size = 0;
+      }
+
+      continue;
+    }
+
+    // Slow path: Glue the leftovers of the last call to the new data
+    size_t take = sizeof(s->pending) - s->pending_size;
+
+    if (take > size)
+      take = size;
+
+    memcpy(s->pending + s->pending_size, data, take);
+    s->pending_size += take;
+    data += take;
+    size -= take;
+
+    if (s->out == NULL) {
+      if (!lz77_stream_start(s))
+        return 0;
+
+      // Header is still incomplete
+      if (s->out == NULL)
+        continue;
+    }
+
+    used = lz77_decode(s, s->pending, s->pending_size, 0);
+
+    if (used < 0) {
+      g_error = LIBWAD_DECOMPRESSION_FAILED;
+      return 0;
+    }
+
+    s->pending_size -= (size_t)used;
+
+    if (s->pending_size <= take) {
+      // Everything left came from the caller's buffer, continue there
+      data -= s->pending_size;
+      size += s->pending_size;
+      s->pending_size = 0;
+    } else {
+      memmove(s->pending, s->pending + used, s->pending_size);
+    }
+  }
+
+  return 1;
+}
+
+unsigned char* lz77_stream_finish(lz77_stream_t handle, size_t* size)
+{
+  struct lz77_stream* s = (struct lz77_stream*)handle;
+
+  if (s->out == NULL) {
+    g_error = LIBWAD_DECOMPRESSION_FAILED;
+    lz77_stream_close(s);
+    return NULL;
+  }
+
+  if (s->out_pos < s->out_size &&
+      lz77_decode(s, s->pending, s->pending_size, 1) < 0) {
+    g_error = LIBWAD_DECOMPRESSION_FAILED;
+    lz77_stream_close(s);
+    return NULL;
+  }
+
+  unsigned char* out = s->out;
+
+  if (size != NULL)
+    *size = s->out_size;
+
+  // The output belongs to the caller from here on
+  budget_release(s->out_size + LZ77_SLACK);
+  free(s);
+
+  return out;
+}
+
+void lz77_stream_close(lz77_stream_t handle)
+{
+  if (handle == NULL)
+    return;
+
+  struct lz77_stream* s = (struct lz77_stream*)handle;
+
+  if (s->out != NULL)
+    budget_release(s->out_size + LZ77_SLACK);
+
+  free(s->out);
+  free(s);
+}
+
+int lz77_detect(const unsigned char* data, size_t size, uint64_t total_size)
+{
+  int type;
+  size_t out_size;
+  int header = lz77_parse_header(data, size, &type, &out_size);
+
+  if (header <= 0)
+    return 0;
+
+  if (memcmp(data, LZ77_MAGIC, 4) == 0)
+    return 1;
+
+  // Plain data may well start with 0x10 or 0x11. Every flag group of eight
+  // tokens takes at least 9 bytes for 8 literals or 17 bytes for 8 LZ10
+  // references of at most 18 bytes each, which bounds the size of the input.
+  uint64_t input = total_size - header;
+
+  if (input > out_size + out_size / 8 + 1 + LZ77_MAX_PADDING ||
+      (type == LZ77_TYPE_LZ10 && out_size / (8 * 18) > input / 17 + 1))
+    return 0;
+
+  // Random data refers back before the start of the output almost at once
+  unsigned char out[LZ77_TRIAL_SIZE + LZ77_SLACK];
+  struct lz77_stream trial;
+
+  memset(&trial, 0, sizeof(trial));
+  trial.type = type;
+  trial.out = out;
+  trial.out_size = out_size < LZ77_TRIAL_SIZE ? out_size : LZ77_TRIAL_SIZE;
+
+  return lz77_decode(&trial, data + header, size - header,
+                     size == total_size) >= 0;
+}
+
+int lz77_is_compressed(const unsigned char* data, size_t size)
+{
+  return lz77_detect(data, size, size);
+}
+
+unsigned char* lz77_decompress(const unsigned char* data, size_t size,
+                               size_t* out_size)
+{
+  lz77_stream_t s = lz77_stream_open();
+
+  if (s == NULL)
+    return NULL;
+
+  if (!lz77_stream_feed(s, data, size)) {
+    lz77_stream_close(s);
+    return NULL;
+  }
+
+  return lz77_stream_finish(s, out_size);
+}
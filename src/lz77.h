@@ -0,0 +1,16 @@
+// Copyright 2019 spycrab0
+// Licensed under GPLv3+
+// Refer to the LICENSE file included.
+
+#ifndef LZ77_H
+#define LZ77_H
+
+#include "libwad.h"
+
+// Checks whether data that may or may not be compressed is. data holds the
+// start of the input, total_size is the size of all of it. Without the magic
+// the header is only believed if its size fits total_size and the start of
+// the data decodes
+int lz77_detect(const unsigned char* data, size_t size, uint64_t total_size);
+
+#endif
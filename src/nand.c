@@ -0,0 +1,932 @@
+// Copyright 2019 spycrab0
+// Licensed under GPLv3+
+// Refer to the LICENSE file included.
+
+#include "libwad.h"
+
+#include <mbedtls/aes.h>
+#include <mbedtls/sha1.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "certchain.h"
+#include "io.h"
+#include "layout.h"
+#include "thread.h"
+#include "ticket.h"
+#include "tmd.h"
+#include "util.h"
+#include "wad.h"
+#include "writer.h"
+
+// Amount of data hashed at once when checking installed contents
+#define NAND_HASH_CHUNK_SIZE 0x100000
+
+// Amount of data encrypted at once when exporting
+#define NAND_EXPORT_CHUNK_SIZE 0x100000
+
+// Chunks a content may be encrypted ahead of the writer
+#define NAND_EXPORT_SLOTS 4
+
+struct nand_install {
+  struct wad_data* wad;
+  const char* root;
+  uint32_t title_high;
+  uint32_t title_low;
+
+  // Entries of shared1/content.map, written back if anything was added
+  struct content_map_layout* map;
+  size_t map_count;
+  int map_changed;
+
+  // Path each content is installed to or NULL if it was already present
+  char** targets;
+};
+
+// Formats a path below the root of the NAND
+static char* nand_path(const char* root, const char* format, ...)
+{
+  va_list args;
+
+  va_start(args, format);
+  int length = vsnprintf(NULL, 0, format, args);
+  va_end(args);
+
+  size_t root_length = strlen(root);
+  char* path = (char*)malloc(root_length + (size_t)length + 1);
+
+  if (path == NULL) {
+    g_error = LIBWAD_BAD_ALLOC;
+    return NULL;
+  }
+
+  memcpy(path, root, root_length);
+
+  va_start(args, format);
+  vsnprintf(path + root_length, (size_t)length + 1, format, args);
+  va_end(args);
+
+  return path;
+}
+
+static int nand_make_directories(struct nand_install* install)
+{
+  // Parents come before their children
+  static const char* const formats[] = {"/title",
+                                        "/title/%08x",
+                                        "/title/%08x/%08x",
+                                        "/title/%08x/%08x/content",
+                                        "/title/%08x/%08x/data",
+                                        "/ticket",
+                                        "/ticket/%08x",
+                                        "/shared1",
+                                        "/sys"};
+
+  // The root may not exist yet either
+  if (!io_make_directories(install->root)) {
+    g_error = LIBWAD_OPEN_FAILED;
+    return 0;
+  }
+
+  for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+    char* path = nand_path(install->root, formats[i], install->title_high,
+                           install->title_low);
+
+    if (path == NULL)
+      return 0;
+
+    int made = io_make_directory(path);
+
+    free(path);
+
+    if (!made) {
+      g_error = LIBWAD_OPEN_FAILED;
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+// Checks whether a file holds exactly the given content
+static int nand_is_installed(const char* path, const tmd_content_t* content)
+{
+  FILE* fh = fopen(path, "rb");
+
+  if (fh == NULL)
+    return 0;
+
+  unsigned char* buffer = (unsigned char*)malloc(NAND_HASH_CHUNK_SIZE);
+
+  if (buffer == NULL) {
+    fclose(fh);
+    return 0;
+  }
+
+  mbedtls_sha1_context sha1;
+  mbedtls_sha1_init(&sha1);
+  mbedtls_sha1_starts_ret(&sha1);
+
+  uint64_t size = 0;
+  size_t read;
+
+  while ((read = fread(buffer, 1, NAND_HASH_CHUNK_SIZE, fh)) > 0) {
+    mbedtls_sha1_update_ret(&sha1, buffer, read);
+    size += read;
+  }
+
+  unsigned char hash[20];
+  mbedtls_sha1_finish_ret(&sha1, hash);
+  mbedtls_sha1_free(&sha1);
+
+  int error = ferror(fh);
+
+  free(buffer);
+  fclose(fh);
+
+  return !error && size == content->size &&
+         memcmp(hash, content->hash, sizeof(hash)) == 0;
+}
+
+static int nand_load_map(const char* root, struct content_map_layout** map,
+                         size_t* count)
+{
+  char* path = nand_path(root, "/shared1/content.map");
+
+  if (path == NULL)
+    return 0;
+
+  size_t size;
+  unsigned char* buffer = util_read_file(path, &size);
+
+  free(path);
+
+  // No shared contents were installed yet
+  if (buffer == NULL)
+    return 1;
+
+  *map = (struct content_map_layout*)buffer;
+  *count = size / sizeof(struct content_map_layout);
+
+  return 1;
+}
+
+static const struct content_map_layout*
+nand_map_find(const struct content_map_layout* map, size_t count,
+              const tmd_content_t* content)
+{
+  for (size_t i = 0; i < count; i++) {
+    if (memcmp(map[i].hash, content->hash, 20) == 0)
+      return &map[i];
+  }
+
+  return NULL;
+}
+
+// Gets the name of the file a shared content is stored in, assigning the next
+// free one to contents not in the map yet
+static int nand_map_name(struct nand_install* install,
+                         const tmd_content_t* content, char name[9])
+{
+  const struct content_map_layout* entry =
+      nand_map_find(install->map, install->map_count, content);
+
+  if (entry != NULL) {
+    memcpy(name, entry->name, 8);
+    name[8] = '\0';
+    return 1;
+  }
+
+  struct content_map_layout* map = (struct content_map_layout*)realloc(
+      install->map, sizeof(*map) * (install->map_count + 1));
+
+  if (map == NULL) {
+    g_error = LIBWAD_BAD_ALLOC;
+    return 0;
+  }
+
+  install->map = map;
+
+  // Files are numbered in the order they were added
+  snprintf(name, 9, "%08x", (unsigned)install->map_count);
+  memcpy(map[install->map_count].name, name, 8);
+  memcpy(map[install->map_count].hash, content->hash, 20);
+
+  install->map_count++;
+  install->map_changed = 1;
+
+  return 1;
+}
+
+// Writes a whole file next to its destination before moving it into place
+static int nand_write_file(const char* path, const void* data, size_t size)
+{
+  size_t length = strlen(path);
+  char* temp = (char*)malloc(length + 5);
+
+  if (temp == NULL) {
+    g_error = LIBWAD_BAD_ALLOC;
+    return 0;
+  }
+
+  memcpy(temp, path, length);
+  memcpy(temp + length, ".tmp", 5);
+
+  FILE* fh = fopen(temp, "wb");
+
+  if (fh == NULL) {
+    g_error = LIBWAD_OPEN_FAILED;
+    free(temp);
+    return 0;
+  }
+
+  int written = (size == 0 || fwrite(data, size, 1, fh) == 1);
+
+  written = fclose(fh) == 0 && written;
+
+  if (!written || !io_replace(temp, path)) {
+    g_error = LIBWAD_IO_ERROR;
+    remove(temp);
+    free(temp);
+    return 0;
+  }
+
+  free(temp);
+
+  return 1;
+}
+
+static int nand_write_section(struct nand_install* install,
+                              wad_section_t section, const char* format)
+{
+  unsigned char* data = io_read_section(install->wad, section);
+
+  if (data == NULL)
+    return 0;
+
+  char* path = nand_path(install->root, format, install->title_high,
+                         install->title_low);
+
+  int result = path != NULL &&
+               nand_write_file(path, data,
+                               wad_get_section_size(install->wad, section));
+
+  free(path);
+  free(data);
+
+  return result;
+}
+
+// Adds the certificates of the wad missing from sys/cert.sys, which is needed
+// to export titles again
+static int nand_write_certs(struct nand_install* install)
+{
+  char* path = nand_path(install->root, "/sys/cert.sys");
+
+  if (path == NULL)
+    return 0;
+
+  unsigned char* chain = io_read_section(install->wad, WAD_SECTION_CERTCHAIN);
+
+  if (chain == NULL) {
+    free(path);
+    return 0;
+  }
+
+  size_t size = 0;
+  unsigned char* certs = util_read_file(path, &size);
+
+  // No certificates were installed yet
+  if (certs == NULL)
+    size = 0;
+
+  size_t merged_size;
+  unsigned char* merged =
+      certchain_merge(certs, size, chain,
+                      wad_get_section_size(install->wad, WAD_SECTION_CERTCHAIN),
+                      &merged_size);
+
+  int result = merged != NULL &&
+               (merged_size == size ||
+                nand_write_file(path, merged, merged_size));
+
+  free(merged);
+  free(certs);
+  free(chain);
+  free(path);
+
+  return result;
+}
+
+// Picks the destination of every content, leaving out those already present
+static int nand_plan(struct nand_install* install, nand_install_stats_t* stats)
+{
+  tmd_t tmd = install->wad->tmd;
+  uint16_t count = tmd_get_content_count(tmd);
+
+  for (uint16_t i = 0; i < count; i++) {
+    const tmd_content_t* content = tmd_get_content(tmd, i);
+    char* path;
+
+    if (content->type & LIBWAD_CONTENT_SHARED) {
+      char name[9];
+
+      if (!nand_map_name(install, content, name))
+        return 0;
+
+      path = nand_path(install->root, "/shared1/%s.app", name);
+      stats->shared++;
+    } else {
+      path = nand_path(install->root, "/title/%08x/%08x/content/%08x.app",
+                       install->title_high, install->title_low,
+                       (unsigned)content->id);
+    }
+
+    if (path == NULL)
+      return 0;
+
+    // A shared content may be listed more than once
+    int duplicate = 0;
+
+    for (uint16_t j = 0; j < i && !duplicate; j++)
+      duplicate = install->targets[j] != NULL &&
+                  strcmp(install->targets[j], path) == 0;
+
+    if (duplicate || nand_is_installed(path, content)) {
+      stats->skipped++;
+      free(path);
+      continue;
+    }
+
+    install->targets[i] = path;
+  }
+
+  return 1;
+}
+
+// Decrypts the planned contents next to their destinations, moving each one
+// into place once its hash was verified
+static int nand_install_contents(struct nand_install* install,
+                                 nand_install_stats_t* stats)
+{
+  uint16_t count = tmd_get_content_count(install->wad->tmd);
+
+  batch_t engine = batch_open(0, libwad_get_thread_count(), BATCH_BACKEND_AUTO);
+
+  if (engine == NULL)
+    return 0;
+
+  libwad_error_t error = LIBWAD_NO_ERROR;
+
+  for (uint16_t i = 0; i < count; i++) {
+    if (install->targets[i] == NULL)
+      continue;
+
+    char* temp = nand_path(install->targets[i], ".tmp");
+
+    if (temp == NULL) {
+      error = LIBWAD_BAD_ALLOC;
+      break;
+    }
+
+    batch_job_t job = {install->wad, i, temp, LIBWAD_VERIFY_HASH, temp};
+
+    if (!batch_submit(engine, &job)) {
+      error = (libwad_error_t)g_error;
+      free(temp);
+      break;
+    }
+  }
+
+  batch_completion_t completion;
+
+  while (batch_wait(engine, &completion)) {
+    char* temp = (char*)completion.job.user;
+
+    if (completion.error == LIBWAD_NO_ERROR &&
+        !io_replace(temp, install->targets[completion.job.index]))
+      completion.error = LIBWAD_IO_ERROR;
+
+    if (completion.error != LIBWAD_NO_ERROR) {
+      remove(temp);
+
+      if (error == LIBWAD_NO_ERROR)
+        error = completion.error;
+    } else {
+      stats->installed++;
+    }
+
+    free(temp);
+  }
+
+  batch_close(engine);
+
+  if (error != LIBWAD_NO_ERROR) {
+    g_error = error;
+    return 0;
+  }
+
+  return 1;
+}
+
+int wad_install_to_nand(wad_t handle, const char* root,
+                        nand_install_stats_t* stats)
+{
+  struct wad_data* wad = (struct wad_data*)handle;
+  nand_install_stats_t dummy;
+
+  if (stats == NULL)
+    stats = &dummy;
+
+  memset(stats, 0, sizeof(*stats));
+
+  uint64_t title_id = tmd_get_title_id(wad->tmd);
+  uint16_t count = tmd_get_content_count(wad->tmd);
+
+  struct nand_install install;
+
+  install.wad = wad;
+  install.root = root;
+  install.title_high = (uint32_t)(title_id >> 32);
+  install.title_low = (uint32_t)title_id;
+  install.map = NULL;
+  install.map_count = 0;
+  install.map_changed = 0;
+  install.targets = (char**)calloc(count > 0 ? count : 1, sizeof(char*));
+
+  if (install.targets == NULL) {
+    g_error = LIBWAD_BAD_ALLOC;
+    return 0;
+  }
+
+  // The tmd goes last, so titles only show up once they are complete
+  int result = nand_make_directories(&install) &&
+               nand_load_map(root, &install.map, &install.map_count) &&
+               nand_plan(&install, stats) &&
+               nand_install_contents(&install, stats);
+
+  if (result && install.map_changed) {
+    char* path = nand_path(root, "/shared1/content.map");
+
+    result = path != NULL &&
+             nand_write_file(path, install.map,
+                             sizeof(*install.map) * install.map_count);
+
+    free(path);
+  }
+
+  result = result && nand_write_certs(&install) &&
+           nand_write_section(&install, WAD_SECTION_TICKET,
+                              "/ticket/%08x/%08x.tik") &&
+           nand_write_section(&install, WAD_SECTION_TMD,
+                              "/title/%08x/%08x/content/title.tmd");
+
+  for (uint16_t i = 0; i < count; i++)
+    free(install.targets[i]);
+
+  free(install.targets);
+  free(install.map);
+
+  return result;
+}
+
+// A content being exported. Workers encrypt it into a ring of slots which
+// the calling thread writes out in order.
+struct nand_export_content {
+  const tmd_content_t* content;
+  char* path;
+
+  uint64_t chunk_count;
+  size_t slot_size;
+  unsigned char* slots;
+  // Encrypted bytes held by each slot
+  size_t lengths[NAND_EXPORT_SLOTS];
+  uint64_t produced;
+  uint64_t consumed;
+  unsigned char hash[20];
+};
+
+struct nand_export {
+  mbedtls_aes_context aes;
+
+  struct nand_export_content* contents;
+  uint16_t count;
+
+  mutex_t mutex;
+  cond_t produced_cond;
+  cond_t consumed_cond;
+  // Next content to be encrypted and the one being written
+  uint16_t next;
+  uint16_t writing;
+  // Contents may be picked up at most this far ahead of the writer
+  uint16_t window;
+  int failed;
+  libwad_error_t error;
+};
+
+// Called with the mutex held
+static void nand_export_fail(struct nand_export* export,
+                             libwad_error_t error)
+{
+  if (!export->failed) {
+    export->failed = 1;
+    export->error = error;
+  }
+
+  cond_broadcast(&export->produced_cond);
+  cond_broadcast(&export->consumed_cond);
+}
+
+// Reads, hashes and encrypts a content chunk by chunk
+static libwad_error_t nand_export_encrypt(struct nand_export* export,
+                                          struct nand_export_content* c)
+{
+  FILE* fh = fopen(c->path, "rb");
+
+  if (fh == NULL)
+    return LIBWAD_OPEN_FAILED;
+
+  unsigned char iv[16];
+  data_get_content_iv(c->content, iv);
+
+  mbedtls_sha1_context sha1;
+  mbedtls_sha1_init(&sha1);
+  mbedtls_sha1_starts_ret(&sha1);
+
+  libwad_error_t error = LIBWAD_NO_ERROR;
+
+  for (uint64_t i = 0; i < c->chunk_count && error == LIBWAD_NO_ERROR; i++) {
+    mutex_lock(&export->mutex);
+
+    while (!export->failed && i >= c->consumed + NAND_EXPORT_SLOTS)
+      cond_wait(&export->consumed_cond, &export->mutex);
+
+    int failed = export->failed;
+
+    mutex_unlock(&export->mutex);
+
+    if (failed)
+      break;
+
+    unsigned char* slot = c->slots + (i % NAND_EXPORT_SLOTS) * c->slot_size;
+    uint64_t remaining = c->content->size - i * NAND_EXPORT_CHUNK_SIZE;
+    size_t length = remaining > NAND_EXPORT_CHUNK_SIZE
+                        ? NAND_EXPORT_CHUNK_SIZE
+                        : (size_t)remaining;
+    size_t encrypted = (length + 15) & ~(size_t)15;
+
+    if (length != 0 && fread(slot, length, 1, fh) != 1) {
+      error = LIBWAD_IO_ERROR;
+      break;
+    }
+
+    mbedtls_sha1_update_ret(&sha1, slot, length);
+
+    // Contents are zero padded to the AES block size
+    memset(slot + length, 0, encrypted - length);
+
+    if (mbedtls_aes_crypt_cbc(&export->aes, MBEDTLS_AES_ENCRYPT, encrypted, iv,
+                              slot, slot) != 0) {
+      error = LIBWAD_DECRYPTION_FAILED;
+      break;
+    }
+
+    // The writer only sees the last chunk once the content was verified
+    if (i + 1 == c->chunk_count) {
+      mbedtls_sha1_finish_ret(&sha1, c->hash);
+
+      if (fgetc(fh) != EOF ||
+          memcmp(c->hash, c->content->hash, sizeof(c->hash)) != 0)
+        error = LIBWAD_HASH_MISMATCH;
+    }
+
+    if (error == LIBWAD_NO_ERROR) {
+      mutex_lock(&export->mutex);
+      c->lengths[i % NAND_EXPORT_SLOTS] = encrypted;
+      c->produced = i + 1;
+      cond_broadcast(&export->produced_cond);
+      mutex_unlock(&export->mutex);
+    }
+  }
+
+  mbedtls_sha1_free(&sha1);
+  fclose(fh);
+
+  return error;
+}
+
+static void nand_export_worker(void* arg)
+{
+  struct nand_export* export = (struct nand_export*)arg;
+
+  mutex_lock(&export->mutex);
+
+  while (!export->failed && export->next < export->count) {
+    if (export->next >= export->writing + export->window) {
+      cond_wait(&export->consumed_cond, &export->mutex);
+      continue;
+    }
+
+    struct nand_export_content* c = &export->contents[export->next++];
+
+    mutex_unlock(&export->mutex);
+
+    libwad_error_t error = LIBWAD_BAD_ALLOC;
+
+    c->slots = (unsigned char*)malloc(
+        c->slot_size * (size_t)(c->chunk_count < NAND_EXPORT_SLOTS
+                                    ? c->chunk_count
+                                    : NAND_EXPORT_SLOTS));
+
+    if (c->slots != NULL)
+      error = nand_export_encrypt(export, c);
+
+    mutex_lock(&export->mutex);
+
+    if (error != LIBWAD_NO_ERROR)
+      nand_export_fail(export, error);
+  }
+
+  mutex_unlock(&export->mutex);
+}
+
+// Writes the contents to the wad in order as the workers encrypt them
+static int nand_export_write(struct nand_export* export, wad_writer_t writer)
+{
+  for (uint16_t i = 0; i < export->count; i++) {
+    struct nand_export_content* c = &export->contents[i];
+
+    if (!wad_writer_begin_content(writer))
+      return 0;
+
+    for (uint64_t chunk = 0; chunk < c->chunk_count; chunk++) {
+      mutex_lock(&export->mutex);
+
+      while (!export->failed && c->produced <= chunk)
+        cond_wait(&export->produced_cond, &export->mutex);
+
+      int failed = export->failed;
+
+      mutex_unlock(&export->mutex);
+
+      if (failed) {
+        g_error = export->error;
+        return 0;
+      }
+
+      uint64_t remaining = c->content->size - chunk * NAND_EXPORT_CHUNK_SIZE;
+
+      if (!writer_write_encrypted(
+              writer, c->slots + (chunk % NAND_EXPORT_SLOTS) * c->slot_size,
+              c->lengths[chunk % NAND_EXPORT_SLOTS],
+              remaining > NAND_EXPORT_CHUNK_SIZE ? NAND_EXPORT_CHUNK_SIZE
+                                                 : remaining))
+        return 0;
+
+      mutex_lock(&export->mutex);
+      c->consumed = chunk + 1;
+      cond_broadcast(&export->consumed_cond);
+      mutex_unlock(&export->mutex);
+    }
+
+    if (!writer_end_encrypted(writer, c->hash))
+      return 0;
+
+    // The worker is done with the content once its last chunk was produced
+    mutex_lock(&export->mutex);
+    free(c->slots);
+    c->slots = NULL;
+    export->writing = i + 1;
+    cond_broadcast(&export->consumed_cond);
+    mutex_unlock(&export->mutex);
+  }
+
+  return 1;
+}
+
+// Finds the file every content of an installed title is stored in
+static int nand_export_locate(struct nand_export* export, const char* root,
+                              uint64_t title_id)
+{
+  struct content_map_layout* map = NULL;
+  size_t map_count = 0;
+
+  if (!nand_load_map(root, &map, &map_count))
+    return 0;
+
+  int result = 1;
+
+  for (uint16_t i = 0; i < export->count && result; i++) {
+    struct nand_export_content* c = &export->contents[i];
+
+    if (c->content->type & LIBWAD_CONTENT_SHARED) {
+      const struct content_map_layout* entry =
+          nand_map_find(map, map_count, c->content);
+
+      if (entry == NULL) {
+        g_error = LIBWAD_NOT_FOUND;
+        result = 0;
+        break;
+      }
+
+      c->path = nand_path(root, "/shared1/%.8s.app", entry->name);
+    } else {
+      c->path = nand_path(root, "/title/%08x/%08x/content/%08x.app",
+                          (unsigned)(title_id >> 32), (unsigned)title_id,
+                          (unsigned)c->content->id);
+    }
+
+    uint64_t chunks =
+        (c->content->size + NAND_EXPORT_CHUNK_SIZE - 1) / NAND_EXPORT_CHUNK_SIZE;
+
+    // Empty contents still take a chunk, so they pass through the writer too
+    c->chunk_count = chunks > 0 ? chunks : 1;
+    c->slot_size = chunks > 1 ? NAND_EXPORT_CHUNK_SIZE
+                              : (size_t)((c->content->size + 15) & ~15ULL);
+
+    if (c->slot_size == 0)
+      c->slot_size = 16;
+
+    result = c->path != NULL;
+  }
+
+  free(map);
+
+  return result;
+}
+
+// Encrypts the contents on worker threads while writing them out in order
+static int nand_export_contents(struct nand_export* export,
+                                wad_writer_t writer)
+{
+  unsigned workers = libwad_get_thread_count();
+
+  if (workers > export->count)
+    workers = export->count;
+
+  if (workers == 0)
+    return 1;
+
+  thread_t* threads = (thread_t*)malloc(sizeof(thread_t) * workers);
+
+  if (threads == NULL) {
+    g_error = LIBWAD_BAD_ALLOC;
+    return 0;
+  }
+
+  mutex_init(&export->mutex);
+  cond_init(&export->produced_cond);
+  cond_init(&export->consumed_cond);
+
+  export->window = (uint16_t)(workers * 2);
+
+  unsigned started = 0;
+
+  for (; started < workers; started++) {
+    if (!thread_create(&threads[started], nand_export_worker, export))
+      break;
+  }
+
+  int result = started > 0 && nand_export_write(export, writer);
+
+  if (started == 0)
+    g_error = LIBWAD_BAD_ALLOC;
+
+  if (!result) {
+    mutex_lock(&export->mutex);
+    nand_export_fail(export, (libwad_error_t)g_error);
+    mutex_unlock(&export->mutex);
+  }
+
+  for (unsigned i = 0; i < started; i++)
+    thread_join(threads[i]);
+
+  cond_destroy(&export->consumed_cond);
+  cond_destroy(&export->produced_cond);
+  mutex_destroy(&export->mutex);
+
+  free(threads);
+
+  return result;
+}
+
+// Reads a file below the root of the NAND
+static unsigned char* nand_read(const char* root, size_t* size,
+                                const char* format, uint64_t title_id)
+{
+  char* path = nand_path(root, format, (unsigned)(title_id >> 32),
+                         (unsigned)title_id);
+
+  if (path == NULL)
+    return NULL;
+
+  unsigned char* buffer = util_read_file(path, size);
+
+  free(path);
+
+  return buffer;
+}
+
+int wad_export_from_nand(const char* root, uint64_t title_id,
+                         const char* path)
+{
+  size_t tmd_size, ticket_size, certs_size, chain_size;
+
+  unsigned char* tmd_data =
+      nand_read(root, &tmd_size, "/title/%08x/%08x/content/title.tmd", title_id);
+  unsigned char* ticket_data =
+      nand_read(root, &ticket_size, "/ticket/%08x/%08x.tik", title_id);
+  unsigned char* certs = nand_read(root, &certs_size, "/sys/cert.sys", 0);
+
+  tmd_t tmd = NULL;
+  ticket_t ticket = NULL;
+  unsigned char* chain = NULL;
+  struct nand_export export;
+  wad_writer_t writer = NULL;
+  int result = 0;
+
+  memset(&export, 0, sizeof(export));
+  mbedtls_aes_init(&export.aes);
+
+  if (tmd_data == NULL || ticket_data == NULL || certs == NULL) {
+    g_error = LIBWAD_NOT_FOUND;
+    goto done;
+  }
+
+  tmd = tmd_parse_buffer(tmd_data, tmd_size);
+  ticket = ticket_parse_buffer(ticket_data, ticket_size);
+
+  if (tmd == NULL || ticket == NULL)
+    goto done;
+
+  // Only keep the certificates needed to check the ticket and tmd
+  char tmd_issuer[65] = {0};
+
+  memcpy(tmd_issuer, tmd_data + offsetof(struct tmd_header_layout, issuer),
+         64);
+
+  const char* issuers[] = {ticket_get_issuer(ticket), tmd_issuer};
+
+  chain = certchain_select(certs, certs_size, issuers, 2, &chain_size);
+
+  if (chain == NULL)
+    goto done;
+
+  export.count = tmd_get_content_count(tmd);
+  export.contents = (struct nand_export_content*)calloc(
+      export.count > 0 ? export.count : 1, sizeof(struct nand_export_content));
+
+  if (export.contents == NULL) {
+    g_error = LIBWAD_BAD_ALLOC;
+    goto done;
+  }
+
+  for (uint16_t i = 0; i < export.count; i++)
+    export.contents[i].content = tmd_get_content(tmd, i);
+
+  if (!nand_export_locate(&export, root, title_id))
+    goto done;
+
+  mbedtls_aes_setkey_enc(&export.aes, ticket_get_title_key(ticket), 128);
+
+  writer = wad_writer_open(path, chain, (uint32_t)chain_size, ticket_data,
+                           (uint32_t)ticket_size, tmd_data, (uint32_t)tmd_size);
+
+  if (writer == NULL)
+    goto done;
+
+  if (!nand_export_contents(&export, writer)) {
+    wad_writer_abort(writer);
+    remove(path);
+    goto done;
+  }
+
+  result = wad_writer_close(writer, NULL, 0);
+
+  if (!result)
+    remove(path);
+
+done:
+  for (uint16_t i = 0; export.contents != NULL && i < export.count; i++) {
+    free(export.contents[i].path);
+    free(export.contents[i].slots);
+  }
+
+  free(export.contents);
+  mbedtls_aes_free(&export.aes);
+  free(chain);
+
+  if (tmd != NULL)
+    tmd_close(tmd);
+
+  if (ticket != NULL)
+    ticket_close(ticket);
+
+  free(certs);
+  free(ticket_data);
+  free(tmd_data);
+
+  return result;
+}
@@ -0,0 +1,215 @@
+// Copyright 2019 spycrab0
+// Licensed under GPLv3+
+// Refer to the LICENSE file included.
+
+#include "nus.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "certchain.h"
+#include "layout.h"
+#include "ticket.h"
+#include "tmd.h"
+#include "util.h"
+#include "wad.h"
+
+// Names the tmd and ticket go by in update server mirrors
+static const char* const NUS_TMD_NAMES[] = {"title.tmd", "tmd"};
+static const char* const NUS_TICKET_NAMES[] = {"cetk", "title.tik"};
+
+#define NUS_NAME_COUNT 2
+
+int nus_is_directory(const char* path)
+{
+  struct stat st;
+
+  return stat(path, &st) == 0 && (st.st_mode & S_IFMT) == S_IFDIR;
+}
+
+static char* nus_join(const char* directory, const char* name)
+{
+  size_t length = strlen(directory) + 1 + strlen(name) + 1;
+  char* path = (char*)malloc(length);
+
+  if (path != NULL)
+    snprintf(path, length, "%s/%s", directory, name);
+
+  return path;
+}
+
+// Reads the first of the given files that exists
+static unsigned char* nus_read_any(const char* directory,
+                                   const char* const* names, size_t* size)
+{
+  for (size_t i = 0; i < NUS_NAME_COUNT; i++) {
+    char* path = nus_join(directory, names[i]);
+
+    if (path == NULL) {
+      g_error = LIBWAD_BAD_ALLOC;
+      return NULL;
+    }
+
+    unsigned char* buffer = util_read_file(path, size);
+
+    free(path);
+
+    if (buffer != NULL)
+      return buffer;
+  }
+
+  g_error = LIBWAD_NOT_FOUND;
+  return NULL;
+}
+
+static unsigned char* nus_copy(const unsigned char* data, size_t size)
+{
+  unsigned char* copy = (unsigned char*)malloc(size);
+
+  if (copy != NULL)
+    memcpy(copy, data, size);
+
+  return copy;
+}
+
+static int nus_parse(struct wad_data* wad, const unsigned char* tmd,
+                     size_t tmd_size, const unsigned char* ticket,
+                     size_t ticket_size)
+{
+  wad->tmd = tmd_parse_buffer(tmd, tmd_size);
+
+  if (wad->tmd == NULL) {
+    g_error = LIBWAD_BAD_TMD;
+    return 0;
+  }
+
+  wad->ticket = ticket_parse_buffer(ticket, ticket_size);
+
+  if (wad->ticket == NULL) {
+    g_error = LIBWAD_BAD_TICKET;
+    return 0;
+  }
+
+  // The update servers append the certificates needed to check the
+  // signatures to both files, the CA certificate ends up in both of them
+  size_t tmd_end = sizeof(struct tmd_header_layout) +
+                   tmd_get_content_count(wad->tmd) *
+                       sizeof(struct tmd_content_layout);
+  size_t ticket_end = sizeof(struct ticket_layout);
+  size_t certs_size = (tmd_size - tmd_end) + (ticket_size - ticket_end);
+
+  unsigned char* certs = (unsigned char*)malloc(certs_size + 1);
+
+  if (certs == NULL) {
+    g_error = LIBWAD_BAD_ALLOC;
+    return 0;
+  }
+
+  memcpy(certs, tmd + tmd_end, tmd_size - tmd_end);
+  memcpy(certs + tmd_size - tmd_end, ticket + ticket_end,
+         ticket_size - ticket_end);
+
+  wad->certchain = certchain_parse_buffer(certs, certs_size);
+  wad->section_data[WAD_SECTION_CERTCHAIN] = certs;
+
+  if (wad->certchain == NULL) {
+    g_error = LIBWAD_BAD_CERTCHAIN;
+    return 0;
+  }
+
+  certchain_remove_duplicates(wad->certchain);
+
+  // Keep the sections around for io_read_section()
+  wad->section_data[WAD_SECTION_TICKET] = nus_copy(ticket, ticket_end);
+  wad->section_data[WAD_SECTION_TMD] = nus_copy(tmd, tmd_end);
+
+  if (wad->section_data[WAD_SECTION_TICKET] == NULL ||
+      wad->section_data[WAD_SECTION_TMD] == NULL) {
+    g_error = LIBWAD_BAD_ALLOC;
+    return 0;
+  }
+
+  wad->type = 0x49730000;
+  wad->certchain_size = (uint32_t)certs_size;
+  wad->ticket_size = (uint32_t)ticket_end;
+  wad->tmd_size = (uint32_t)tmd_end;
+  wad->data_size = 0;
+  wad->footer_size = 0;
+
+  return 1;
+}
+
+// Opens the file of every content, missing ones are left NULL and fail once
+// they are read
+static int nus_open_contents(struct wad_data* wad, const char* path)
+{
+  uint16_t count = tmd_get_content_count(wad->tmd);
+
+  wad->content_files = (FILE**)calloc(count > 0 ? count : 1, sizeof(FILE*));
+
+  if (wad->content_files == NULL) {
+    g_error = LIBWAD_BAD_ALLOC;
+    return 0;
+  }
+
+  wad->content_file_count = count;
+
+  for (uint16_t i = 0; i < count; i++) {
+    const tmd_content_t* content = tmd_get_content(wad->tmd, i);
+
+    // Mirrors store contents with or without the .app extension
+    static const char* const formats[] = {"%08x.app", "%08x"};
+
+    for (size_t f = 0; f < 2 && wad->content_files[i] == NULL; f++) {
+      char name[16];
+
+      snprintf(name, sizeof(name), formats[f], (unsigned)content->id);
+
+      char* content_path = nus_join(path, name);
+
+      if (content_path == NULL) {
+        g_error = LIBWAD_BAD_ALLOC;
+        return 0;
+      }
+
+      wad->content_files[i] = fopen(content_path, "rb");
+
+      free(content_path);
+    }
+
+    wad->data_size += (uint32_t)align64(content->size, 64);
+  }
+
+  return 1;
+}
+
+int nus_open(struct wad_data* wad, const char* path)
+{
+  size_t tmd_size, ticket_size;
+
+  unsigned char* tmd = nus_read_any(path, NUS_TMD_NAMES, &tmd_size);
+
+  if (tmd == NULL)
+    return 0;
+
+  unsigned char* ticket = nus_read_any(path, NUS_TICKET_NAMES, &ticket_size);
+
+  if (ticket == NULL) {
+    free(tmd);
+    return 0;
+  }
+
+  int ret = nus_parse(wad, tmd, tmd_size, ticket, ticket_size) &&
+            nus_open_contents(wad, path);
+
+  // The directory's own timestamps don't change when a content is rewritten
+  // in place, so its blocks are never cached
+  wad->cache_id = 0;
+
+  free(tmd);
+  free(ticket);
+
+  return ret;
+}
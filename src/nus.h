@@ -0,0 +1,18 @@
+// Copyright 2019 spycrab0
+// Licensed under GPLv3+
+// Refer to the LICENSE file included.
+
+#ifndef NUS_H
+#define NUS_H
+
+struct wad_data;
+
+// Returns 1 if path names a directory
+int nus_is_directory(const char* path);
+
+// Sets up a wad from a directory laid out like the update servers serve
+// titles: the tmd, the ticket (cetk) and one file per content named after its
+// content id
+int nus_open(struct wad_data* wad, const char* path);
+
+#endif
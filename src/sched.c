@@ -0,0 +1,603 @@
+// Copyright 2019 spycrab0
+// Licensed under GPLv3+
+// Refer to the LICENSE file included.
+
+#include "libwad.h"
+
+#include <memory.h>
+#include <stdlib.h>
+
+#include <mbedtls/sha1.h>
+
+#include "io.h"
+#include "stats.h"
+#include "thread.h"
+#include "wad.h"
+
+// Contents are split into tasks of this size, smaller ones form a single task
+#define SCHED_SEGMENT_SIZE 0x400000
+
+// Segments of a content in flight per worker. Segments are hashed in order,
+// so this bounds the memory held by segments waiting for an earlier one.
+#define SCHED_WINDOW_PER_THREAD 2
+
+struct sched_job;
+
+struct sched_task {
+  struct sched_job* job;
+  uint64_t segment;
+
+  // Link in the deque of a worker
+  struct sched_task* prev;
+  struct sched_task* next;
+};
+
+struct sched_job {
+  batch_job_t job;
+  const tmd_content_t* content;
+  int out;
+
+  uint64_t segment_count;
+  // One task per segment, allocated up front so queueing never fails
+  struct sched_task* tasks;
+  // Decrypted segments waiting to be hashed
+  unsigned char** ready;
+
+  // Guards everything below
+  mutex_t lock;
+  uint64_t next_spawn;
+  uint64_t next_hash;
+  // Segments queued or running
+  uint64_t outstanding;
+  // Whether a worker is currently hashing segments of this job
+  int hashing;
+  int finished;
+  libwad_error_t error;
+  mbedtls_sha1_context sha1;
+
+  // Set under the lock of the scheduler once the job completed
+  int done;
+  // Link in the list of jobs in submission order
+  struct sched_job* next;
+};
+
+// The owner pushes and pops at the tail, other workers steal from the head.
+// Tasks are coarse enough for a lock per deque not to matter.
+struct sched_deque {
+  mutex_t lock;
+  struct sched_task* head;
+  struct sched_task* tail;
+};
+
+struct sched_data;
+
+struct sched_worker {
+  struct sched_data* sched;
+  unsigned index;
+  thread_t thread;
+  struct sched_deque deque;
+};
+
+struct sched_data {
+  struct sched_worker* workers;
+  unsigned worker_count;
+  unsigned started;
+  uint64_t window;
+
+  mutex_t lock;
+  // Signalled when tasks are queued or the scheduler stops
+  cond_t task_cond;
+  // Signalled when a job completes
+  cond_t done_cond;
+
+  // Tasks sitting in any deque
+  uint64_t queued;
+  // Jobs that have not completed yet
+  unsigned jobs_active;
+  // Deque the next submitted task goes to
+  unsigned next_deque;
+  volatile int closing;
+  int stop;
+
+  // Completions are handed out from the head
+  struct sched_job* head;
+  struct sched_job* tail;
+};
+
+static void sched_deque_push(struct sched_deque* deque, struct sched_task* task)
+{
+  mutex_lock(&deque->lock);
+
+  task->next = NULL;
+  task->prev = deque->tail;
+
+  if (deque->tail != NULL)
+    deque->tail->next = task;
+  else
+    deque->head = task;
+
+  deque->tail = task;
+
+  mutex_unlock(&deque->lock);
+}
+
+static struct sched_task* sched_deque_take(struct sched_deque* deque,
+                                           int steal)
+{
+  mutex_lock(&deque->lock);
+
+  struct sched_task* task = steal ? deque->head : deque->tail;
+
+  if (task != NULL) {
+    if (task->prev != NULL)
+      task->prev->next = task->next;
+    else
+      deque->head = task->next;
+
+    if (task->next != NULL)
+      task->next->prev = task->prev;
+    else
+      deque->tail = task->prev;
+  }
+
+  mutex_unlock(&deque->lock);
+
+  return task;
+}
+
+static void sched_push(struct sched_data* sched, unsigned worker,
+                       struct sched_task* task)
+{
+  // Counted first so a thief taking it right away can't make the count wrap
+  mutex_lock(&sched->lock);
+  sched->queued++;
+  mutex_unlock(&sched->lock);
+
+  sched_deque_push(&sched->workers[worker].deque, task);
+
+  mutex_lock(&sched->lock);
+  cond_signal(&sched->task_cond);
+  mutex_unlock(&sched->lock);
+}
+
+// Takes a task from our own deque or steals one from the others, returns NULL
+// once the scheduler stops
+static struct sched_task* sched_take(struct sched_data* sched, unsigned worker)
+{
+  for (;;) {
+    struct sched_task* task =
+        sched_deque_take(&sched->workers[worker].deque, 0);
+
+    // Deques of workers that failed to start simply stay empty
+    for (unsigned i = 1; task == NULL && i < sched->worker_count; i++) {
+      unsigned victim = (worker + i) % sched->worker_count;
+
+      task = sched_deque_take(&sched->workers[victim].deque, 1);
+    }
+
+    mutex_lock(&sched->lock);
+
+    if (task != NULL) {
+      sched->queued--;
+      mutex_unlock(&sched->lock);
+      return task;
+    }
+
+    // A task queued after we looked is picked up on the next round
+    while (sched->queued == 0 && !sched->stop)
+      cond_wait(&sched->task_cond, &sched->lock);
+
+    int stop = sched->stop && sched->queued == 0;
+
+    mutex_unlock(&sched->lock);
+
+    if (stop)
+      return NULL;
+  }
+}
+
+static size_t sched_segment_length(const struct sched_job* job,
+                                   uint64_t segment)
+{
+  uint64_t remaining = job->content->size - segment * SCHED_SEGMENT_SIZE;
+
+  return remaining > SCHED_SEGMENT_SIZE ? SCHED_SEGMENT_SIZE
+                                        : (size_t)remaining;
+}
+
+static void sched_finish_job(struct sched_data* sched, struct sched_job* job)
+{
+  libwad_error_t error = job->error;
+
+  if (error == LIBWAD_NO_ERROR && job->job.verify == LIBWAD_VERIFY_HASH) {
+    unsigned char hash[20];
+    mbedtls_sha1_finish_ret(&job->sha1, hash);
+
+    if (memcmp(hash, job->content->hash, 20) != 0)
+      error = LIBWAD_HASH_MISMATCH;
+  }
+
+  // Segments decrypted after a failure were never hashed
+  for (uint64_t i = 0; i < job->segment_count; i++) {
+    free(job->ready[i]);
+    job->ready[i] = NULL;
+  }
+
+  if (job->out != -1) {
+    io_close_output(job->out);
+    job->out = -1;
+  }
+
+  STATS_COUNT(STATS_EXTRACTS);
+
+  mutex_lock(&sched->lock);
+  job->error = error;
+  job->done = 1;
+  sched->jobs_active--;
+  cond_broadcast(&sched->done_cond);
+  mutex_unlock(&sched->lock);
+}
+
+// Hands a decrypted segment (NULL on failure) to its job. Whoever completes
+// the next segment in order hashes it along with any that were waiting for it
+// and queues further segments on its own deque.
+static void sched_complete_segment(struct sched_data* sched, unsigned worker,
+                                   struct sched_job* job, uint64_t segment,
+                                   unsigned char* data, libwad_error_t error)
+{
+  struct sched_task* spawned = NULL;
+  int finished = 0;
+
+  mutex_lock(&job->lock);
+
+  job->outstanding--;
+  job->ready[segment] = data;
+
+  if (error != LIBWAD_NO_ERROR && job->error == LIBWAD_NO_ERROR)
+    job->error = error;
+
+  if (!job->hashing) {
+    job->hashing = 1;
+
+    while (job->error == LIBWAD_NO_ERROR &&
+           job->next_hash < job->segment_count &&
+           job->ready[job->next_hash] != NULL) {
+      uint64_t number = job->next_hash;
+      unsigned char* segment_data = job->ready[number];
+
+      job->ready[number] = NULL;
+
+      mutex_unlock(&job->lock);
+
+      if (job->job.verify == LIBWAD_VERIFY_HASH) {
+        size_t length = sched_segment_length(job, number);
+
+        STATS_TIMER(hash_timer);
+        mbedtls_sha1_update_ret(&job->sha1, segment_data, length);
+        STATS_ADD(STATS_HASH, length, hash_timer);
+      }
+
+      free(segment_data);
+
+      mutex_lock(&job->lock);
+
+      job->next_hash++;
+
+      // Keep the window full, the list ends up with the lowest segment last
+      // so we pop it first
+      if (job->next_spawn < job->segment_count) {
+        struct sched_task* task = &job->tasks[job->next_spawn++];
+
+        job->outstanding++;
+        task->next = spawned;
+        spawned = task;
+      }
+    }
+
+    job->hashing = 0;
+
+    finished = !job->finished && job->outstanding == 0 &&
+               (job->error != LIBWAD_NO_ERROR ||
+                job->next_hash == job->segment_count);
+
+    if (finished)
+      job->finished = 1;
+  }
+
+  mutex_unlock(&job->lock);
+
+  while (spawned != NULL) {
+    struct sched_task* task = spawned;
+
+    spawned = spawned->next;
+    sched_push(sched, worker, task);
+  }
+
+  if (finished)
+    sched_finish_job(sched, job);
+}
+
+static void sched_run(struct sched_data* sched, unsigned worker,
+                      struct sched_task* task)
+{
+  struct sched_job* job = task->job;
+  uint64_t offset = task->segment * SCHED_SEGMENT_SIZE;
+  size_t length = sched_segment_length(job, task->segment);
+
+  mutex_lock(&job->lock);
+  libwad_error_t error = job->error;
+  mutex_unlock(&job->lock);
+
+  if (error == LIBWAD_NO_ERROR && sched->closing)
+    error = LIBWAD_CANCELLED;
+
+  unsigned char* data = NULL;
+
+  // Jobs that failed already only need their segments accounted for
+  if (error == LIBWAD_NO_ERROR) {
+    data = (unsigned char*)malloc(length > 0 ? length : 1);
+
+    if (data == NULL)
+      error = LIBWAD_BAD_ALLOC;
+    else if (length != 0 && !data_read_range(job->job.wad, job->job.index,
+                                             offset, length, data))
+      error = (libwad_error_t)g_error;
+    else if (job->out != -1 && length != 0 &&
+             !io_pwrite(job->out, data, length, offset))
+      error = LIBWAD_IO_ERROR;
+
+    if (error != LIBWAD_NO_ERROR) {
+      free(data);
+      data = NULL;
+    }
+  }
+
+  sched_complete_segment(sched, worker, job, task->segment, data, error);
+}
+
+static void sched_worker_main(void* arg)
+{
+  struct sched_worker* worker = (struct sched_worker*)arg;
+  struct sched_data* sched = worker->sched;
+
+  struct sched_task* task;
+
+  while ((task = sched_take(sched, worker->index)) != NULL)
+    sched_run(sched, worker->index, task);
+}
+
+static void sched_free_job(struct sched_job* job)
+{
+  if (job->out != -1)
+    io_close_output(job->out);
+
+  for (uint64_t i = 0; job->ready != NULL && i < job->segment_count; i++)
+    free(job->ready[i]);
+
+  mutex_destroy(&job->lock);
+  mbedtls_sha1_free(&job->sha1);
+  free(job->ready);
+  free(job->tasks);
+  free(job);
+}
+
+static void sched_stop(struct sched_data* sched)
+{
+  mutex_lock(&sched->lock);
+  sched->stop = 1;
+  cond_broadcast(&sched->task_cond);
+  mutex_unlock(&sched->lock);
+
+  for (unsigned i = 0; i < sched->started; i++)
+    thread_join(sched->workers[i].thread);
+
+  while (sched->head != NULL) {
+    struct sched_job* job = sched->head;
+
+    sched->head = job->next;
+    sched_free_job(job);
+  }
+
+  for (unsigned i = 0; sched->workers != NULL && i < sched->worker_count; i++)
+    mutex_destroy(&sched->workers[i].deque.lock);
+
+  mutex_destroy(&sched->lock);
+  cond_destroy(&sched->task_cond);
+  cond_destroy(&sched->done_cond);
+  free(sched->workers);
+  free(sched);
+}
+
+sched_t sched_open(unsigned threads)
+{
+  struct sched_data* sched =
+      (struct sched_data*)calloc(1, sizeof(struct sched_data));
+
+  if (sched == NULL) {
+    g_error = LIBWAD_BAD_ALLOC;
+    return NULL;
+  }
+
+  if (threads == 0)
+    threads = libwad_get_thread_count();
+
+  mutex_init(&sched->lock);
+  cond_init(&sched->task_cond);
+  cond_init(&sched->done_cond);
+
+  sched->workers =
+      (struct sched_worker*)calloc(threads, sizeof(struct sched_worker));
+
+  if (sched->workers == NULL) {
+    g_error = LIBWAD_BAD_ALLOC;
+    sched_stop(sched);
+    return NULL;
+  }
+
+  sched->worker_count = threads;
+
+  for (unsigned i = 0; i < threads; i++) {
+    sched->workers[i].sched = sched;
+    sched->workers[i].index = i;
+    mutex_init(&sched->workers[i].deque.lock);
+  }
+
+  for (; sched->started < threads; sched->started++) {
+    struct sched_worker* worker = &sched->workers[sched->started];
+
+    if (!thread_create(&worker->thread, sched_worker_main, worker))
+      break;
+  }
+
+  if (sched->started == 0) {
+    g_error = LIBWAD_BAD_ALLOC;
+    sched_stop(sched);
+    return NULL;
+  }
+
+  sched->window = (uint64_t)sched->started * SCHED_WINDOW_PER_THREAD;
+
+  return sched;
+}
+
+int sched_submit(sched_t handle, const batch_job_t* job)
+{
+  struct sched_data* sched = (struct sched_data*)handle;
+  struct wad_data* wad = (struct wad_data*)job->wad;
+  tmd_content_t* content = tmd_get_content(wad->tmd, job->index);
+
+  if (content == NULL) {
+    g_error = LIBWAD_OUT_OF_RANGE;
+    return 0;
+  }
+
+  struct sched_job* entry =
+      (struct sched_job*)calloc(1, sizeof(struct sched_job));
+
+  if (entry == NULL) {
+    g_error = LIBWAD_BAD_ALLOC;
+    return 0;
+  }
+
+  entry->job = *job;
+  entry->content = content;
+  entry->out = -1;
+  entry->error = LIBWAD_NO_ERROR;
+
+  mutex_init(&entry->lock);
+  mbedtls_sha1_init(&entry->sha1);
+  mbedtls_sha1_starts_ret(&entry->sha1);
+
+  // Empty contents still need a task to complete them
+  entry->segment_count =
+      (content->size + SCHED_SEGMENT_SIZE - 1) / SCHED_SEGMENT_SIZE;
+
+  if (entry->segment_count == 0)
+    entry->segment_count = 1;
+
+  entry->tasks = (struct sched_task*)calloc((size_t)entry->segment_count,
+                                            sizeof(struct sched_task));
+  entry->ready = (unsigned char**)calloc((size_t)entry->segment_count,
+                                         sizeof(unsigned char*));
+
+  if (entry->tasks == NULL || entry->ready == NULL) {
+    g_error = LIBWAD_BAD_ALLOC;
+    sched_free_job(entry);
+    return 0;
+  }
+
+  if (job->output != NULL) {
+    entry->out = io_open_output(job->output);
+
+    if (entry->out == -1) {
+      g_error = LIBWAD_OPEN_FAILED;
+      sched_free_job(entry);
+      return 0;
+    }
+
+    io_preallocate(entry->out, content->size);
+  }
+
+  for (uint64_t i = 0; i < entry->segment_count; i++) {
+    entry->tasks[i].job = entry;
+    entry->tasks[i].segment = i;
+  }
+
+  uint64_t initial = entry->segment_count < sched->window
+                         ? entry->segment_count
+                         : sched->window;
+
+  entry->next_spawn = initial;
+  entry->outstanding = initial;
+
+  mutex_lock(&sched->lock);
+
+  if (sched->tail != NULL)
+    sched->tail->next = entry;
+  else
+    sched->head = entry;
+
+  sched->tail = entry;
+  sched->jobs_active++;
+
+  mutex_unlock(&sched->lock);
+
+  // Spread the first segments, idle workers steal the rest
+  for (uint64_t i = 0; i < initial; i++) {
+    sched_push(sched, sched->next_deque, &entry->tasks[i]);
+    sched->next_deque = (sched->next_deque + 1) % sched->started;
+  }
+
+  return 1;
+}
+
+int sched_wait(sched_t handle, batch_completion_t* completion)
+{
+  struct sched_data* sched = (struct sched_data*)handle;
+
+  mutex_lock(&sched->lock);
+
+  while (sched->head != NULL && !sched->head->done)
+    cond_wait(&sched->done_cond, &sched->lock);
+
+  struct sched_job* job = sched->head;
+
+  if (job != NULL) {
+    sched->head = job->next;
+
+    if (sched->head == NULL)
+      sched->tail = NULL;
+  }
+
+  mutex_unlock(&sched->lock);
+
+  if (job == NULL)
+    return 0;
+
+  completion->job = job->job;
+  completion->error = job->error;
+
+  sched_free_job(job);
+
+  return 1;
+}
+
+void sched_close(sched_t handle)
+{
+  if (handle == NULL)
+    return;
+
+  struct sched_data* sched = (struct sched_data*)handle;
+
+  // Segments that have not started yet are skipped
+  sched->closing = 1;
+
+  mutex_lock(&sched->lock);
+
+  while (sched->jobs_active > 0)
+    cond_wait(&sched->done_cond, &sched->lock);
+
+  mutex_unlock(&sched->lock);
+
+  sched_stop(sched);
+}
@@ -0,0 +1,138 @@
+// Copyright 2019 spycrab0
+// Licensed under GPLv3+
+// Refer to the LICENSE file included.
+
+#include "libwad.h"
+
+#include <memory.h>
+
+#include "io.h"
+#include "thread.h"
+#include "wad.h"
+
+struct section_copy {
+  struct wad_data* wad;
+  wad_section_t section;
+  const char* path;
+  libwad_error_t error;
+};
+
+// Runs on its own thread, so errors are only stored in the copy
+static void section_copy_run(void* arg)
+{
+  struct section_copy* copy = (struct section_copy*)arg;
+
+  // Directory titles have no wad file to copy the raw sections out of
+  if (copy->wad->fh == NULL) {
+    copy->error = LIBWAD_NOT_SUPPORTED;
+    return;
+  }
+
+  uint32_t size = wad_get_section_size(copy->wad, copy->section);
+
+  if (size == WAD_BAD_SECTION) {
+    copy->error = LIBWAD_OUT_OF_RANGE;
+    return;
+  }
+
+  int fd = io_open_output(copy->path);
+
+  if (fd < 0) {
+    copy->error = LIBWAD_OPEN_FAILED;
+    return;
+  }
+
+  io_preallocate(fd, size);
+
+  copy->error =
+      io_copy(copy->wad, fd, wad_get_section_offset(copy->wad, copy->section),
+              size)
+          ? LIBWAD_NO_ERROR
+          : LIBWAD_IO_ERROR;
+
+  io_close_output(fd);
+}
+
+int wad_read_section(wad_t handle, wad_section_t section, uint64_t offset,
+                     size_t length, unsigned char* dst)
+{
+  struct wad_data* wad = (struct wad_data*)handle;
+  uint32_t size = wad_get_section_size(wad, section);
+
+  if (size == WAD_BAD_SECTION || offset > size || length > size - offset) {
+    g_error = LIBWAD_OUT_OF_RANGE;
+    return 0;
+  }
+
+  // Directory titles only hold the sections that were read from their files
+  if (wad->fh == NULL) {
+    if (wad->section_data[section] == NULL) {
+      g_error = LIBWAD_NOT_SUPPORTED;
+      return 0;
+    }
+
+    memcpy(dst, wad->section_data[section] + offset, length);
+    return 1;
+  }
+
+  uint64_t start = wad_get_section_offset(wad, section) + offset;
+
+  if (length != 0 && !io_read(wad, dst, length, start)) {
+    g_error = LIBWAD_IO_ERROR;
+    return 0;
+  }
+
+  return 1;
+}
+
+int wad_extract_section(wad_t handle, wad_section_t section, const char* path)
+{
+  libwad_error_t error;
+
+  return wad_extract_sections(handle, &section, &path, 1, &error);
+}
+
+int wad_extract_sections(wad_t handle, const wad_section_t* sections,
+                         const char* const* paths, size_t count,
+                         libwad_error_t* errors)
+{
+  struct section_copy copies[WAD_SECTION_FOOTER + 1];
+  thread_t threads[WAD_SECTION_FOOTER + 1];
+  int started[WAD_SECTION_FOOTER + 1];
+
+  if (count > WAD_SECTION_FOOTER + 1) {
+    g_error = LIBWAD_OUT_OF_RANGE;
+    return 0;
+  }
+
+  // Sections don't overlap, so each one is copied on its own thread
+  for (size_t i = 0; i < count; i++) {
+    copies[i].wad = (struct wad_data*)handle;
+    copies[i].section = sections[i];
+    copies[i].path = paths[i];
+    copies[i].error = LIBWAD_NO_ERROR;
+
+    started[i] = count > 1 &&
+                 thread_create(&threads[i], section_copy_run, &copies[i]);
+
+    if (!started[i])
+      section_copy_run(&copies[i]);
+  }
+
+  int result = 1;
+
+  for (size_t i = 0; i < count; i++) {
+    if (started[i])
+      thread_join(threads[i]);
+
+    if (errors != NULL)
+      errors[i] = copies[i].error;
+
+    if (copies[i].error != LIBWAD_NO_ERROR) {
+      g_error = copies[i].error;
+      result = 0;
+    }
+  }
+
+  return result;
+}
@@ -0,0 +1,113 @@
+// Copyright 2019 spycrab0
+// Licensed under GPLv3+
+// Refer to the LICENSE file included.
+
+#include "stats.h"
+
+#include <memory.h>
+
+#include "libwad.h"
+
+#ifdef LIBWAD_ENABLE_STATS
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+static volatile uint64_t s_bytes[STATS_STAGE_COUNT];
+static volatile uint64_t s_ns[STATS_STAGE_COUNT];
+static volatile uint64_t s_counters[STATS_COUNTER_COUNT];
+
+static void stats_atomic_add(volatile uint64_t* value, uint64_t amount)
+{
+#ifdef _MSC_VER
+  InterlockedExchangeAdd64((volatile LONG64*)value, (LONG64)amount);
+#else
+  __atomic_fetch_add(value, amount, __ATOMIC_RELAXED);
+#endif
+}
+
+static uint64_t stats_atomic_load(volatile uint64_t* value)
+{
+#ifdef _MSC_VER
+  return (uint64_t)InterlockedCompareExchange64((volatile LONG64*)value, 0, 0);
+#else
+  return __atomic_load_n(value, __ATOMIC_RELAXED);
+#endif
+}
+
+static void stats_atomic_store(volatile uint64_t* value, uint64_t v)
+{
+#ifdef _MSC_VER
+  InterlockedExchange64((volatile LONG64*)value, (LONG64)v);
+#else
+  __atomic_store_n(value, v, __ATOMIC_RELAXED);
+#endif
+}
+
+uint64_t stats_now()
+{
+#ifdef _WIN32
+  LARGE_INTEGER frequency, counter;
+  QueryPerformanceFrequency(&frequency);
+  QueryPerformanceCounter(&counter);
+  return (uint64_t)(counter.QuadPart * 1000000000.0 / frequency.QuadPart);
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+void stats_add(stats_stage_t stage, uint64_t bytes, uint64_t start)
+{
+  stats_atomic_add(&s_bytes[stage], bytes);
+  stats_atomic_add(&s_ns[stage], stats_now() - start);
+}
+
+void stats_count(stats_counter_t counter)
+{
+  stats_atomic_add(&s_counters[counter], 1);
+}
+
+int libwad_get_stats(libwad_stats_t* stats)
+{
+  stats->opens = stats_atomic_load(&s_counters[STATS_OPENS]);
+  stats->extracts = stats_atomic_load(&s_counters[STATS_EXTRACTS]);
+
+  stats->read_bytes = stats_atomic_load(&s_bytes[STATS_READ]);
+  stats->read_ns = stats_atomic_load(&s_ns[STATS_READ]);
+  stats->decrypt_bytes = stats_atomic_load(&s_bytes[STATS_DECRYPT]);
+  stats->decrypt_ns = stats_atomic_load(&s_ns[STATS_DECRYPT]);
+  stats->hash_bytes = stats_atomic_load(&s_bytes[STATS_HASH]);
+  stats->hash_ns = stats_atomic_load(&s_ns[STATS_HASH]);
+  stats->alloc_bytes = stats_atomic_load(&s_bytes[STATS_ALLOC]);
+  stats->alloc_ns = stats_atomic_load(&s_ns[STATS_ALLOC]);
+
+  return 1;
+}
+
+void libwad_reset_stats()
+{
+  for (int i = 0; i < STATS_STAGE_COUNT; i++) {
+    stats_atomic_store(&s_bytes[i], 0);
+    stats_atomic_store(&s_ns[i], 0);
+  }
+
+  for (int i = 0; i < STATS_COUNTER_COUNT; i++)
+    stats_atomic_store(&s_counters[i], 0);
+}
+
+#else
+
+int libwad_get_stats(libwad_stats_t* stats)
+{
+  memset(stats, 0, sizeof(libwad_stats_t));
+  return 0;
+}
+
+void libwad_reset_stats() {}
+
+#endif
@@ -0,0 +1,44 @@
+// Copyright 2019 spycrab0
+// Licensed under GPLv3+
+// Refer to the LICENSE file included.
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+
+typedef enum {
+  STATS_READ = 0,
+  STATS_DECRYPT = 1,
+  STATS_HASH = 2,
+  STATS_ALLOC = 3,
+  STATS_STAGE_COUNT = 4
+} stats_stage_t;
+
+typedef enum {
+  STATS_OPENS = 0,
+  STATS_EXTRACTS = 1,
+  STATS_COUNTER_COUNT = 2
+} stats_counter_t;
+
+#ifdef LIBWAD_ENABLE_STATS
+
+uint64_t stats_now();
+void stats_add(stats_stage_t stage, uint64_t bytes, uint64_t start);
+void stats_count(stats_counter_t counter);
+
+// Starts timing a stage
+#define STATS_TIMER(name) uint64_t name = stats_now()
+// Adds the bytes and the time elapsed since the timer was started to a stage
+#define STATS_ADD(stage, bytes, name) stats_add(stage, bytes, name)
+#define STATS_COUNT(counter) stats_count(counter)
+
+#else
+
+#define STATS_TIMER(name)
+#define STATS_ADD(stage, bytes, name) ((void)0)
+#define STATS_COUNT(counter) ((void)0)
+
+#endif
+
+#endif
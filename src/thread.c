@@ -0,0 +1,145 @@
+// Copyright 2019 spycrab0
+// Licensed under GPLv3+
+// Refer to the LICENSE file included.
+
+#include "thread.h"
+
+#include <stdlib.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+struct thread_start {
+  thread_func_t func;
+  void* arg;
+};
+
+#ifdef _WIN32
+
+void mutex_init(mutex_t* mutex) { InitializeSRWLock(mutex); }
+
+void mutex_destroy(mutex_t* mutex) { (void)mutex; }
+
+void mutex_lock(mutex_t* mutex) { AcquireSRWLockExclusive(mutex); }
+
+void mutex_unlock(mutex_t* mutex) { ReleaseSRWLockExclusive(mutex); }
+
+void cond_init(cond_t* cond) { InitializeConditionVariable(cond); }
+
+void cond_destroy(cond_t* cond) { (void)cond; }
+
+void cond_wait(cond_t* cond, mutex_t* mutex)
+{
+  SleepConditionVariableSRW(cond, mutex, INFINITE, 0);
+}
+
+void cond_signal(cond_t* cond) { WakeConditionVariable(cond); }
+
+void cond_broadcast(cond_t* cond) { WakeAllConditionVariable(cond); }
+
+static DWORD WINAPI thread_entry(LPVOID param)
+{
+  struct thread_start start = *(struct thread_start*)param;
+
+  free(param);
+  start.func(start.arg);
+
+  return 0;
+}
+
+int thread_create(thread_t* thread, thread_func_t func, void* arg)
+{
+  struct thread_start* start =
+      (struct thread_start*)malloc(sizeof(struct thread_start));
+
+  if (start == NULL)
+    return 0;
+
+  start->func = func;
+  start->arg = arg;
+
+  *thread = CreateThread(NULL, 0, thread_entry, start, 0, NULL);
+
+  if (*thread == NULL) {
+    free(start);
+    return 0;
+  }
+
+  return 1;
+}
+
+void thread_join(thread_t thread)
+{
+  WaitForSingleObject(thread, INFINITE);
+  CloseHandle(thread);
+}
+
+unsigned thread_get_cpu_count()
+{
+  SYSTEM_INFO info;
+
+  GetSystemInfo(&info);
+
+  return info.dwNumberOfProcessors > 0 ? info.dwNumberOfProcessors : 1;
+}
+
+#else
+
+void mutex_init(mutex_t* mutex) { pthread_mutex_init(mutex, NULL); }
+
+void mutex_destroy(mutex_t* mutex) { pthread_mutex_destroy(mutex); }
+
+void mutex_lock(mutex_t* mutex) { pthread_mutex_lock(mutex); }
+
+void mutex_unlock(mutex_t* mutex) { pthread_mutex_unlock(mutex); }
+
+void cond_init(cond_t* cond) { pthread_cond_init(cond, NULL); }
+
+void cond_destroy(cond_t* cond) { pthread_cond_destroy(cond); }
+
+void cond_wait(cond_t* cond, mutex_t* mutex) { pthread_cond_wait(cond, mutex); }
+
+void cond_signal(cond_t* cond) { pthread_cond_signal(cond); }
+
+void cond_broadcast(cond_t* cond) { pthread_cond_broadcast(cond); }
+
+static void* thread_entry(void* param)
+{
+  struct thread_start start = *(struct thread_start*)param;
+
+  free(param);
+  start.func(start.arg);
+
+  return NULL;
+}
+
+int thread_create(thread_t* thread, thread_func_t func, void* arg)
+{
+  struct thread_start* start =
+      (struct thread_start*)malloc(sizeof(struct thread_start));
+
+  if (start == NULL)
+    return 0;
+
+  start->func = func;
+  start->arg = arg;
+
+  if (pthread_create(thread, NULL, thread_entry, start) != 0) {
+    free(start);
+    return 0;
+  }
+
+  return 1;
+}
+
+void thread_join(thread_t thread) { pthread_join(thread, NULL); }
+
+unsigned thread_get_cpu_count()
+{
+  long count = sysconf(_SC_NPROCESSORS_ONLN);
+
+  return count > 0 ? (unsigned)count : 1;
+}
+
+#endif
@@ -0,0 +1,46 @@
+// Copyright 2019 spycrab0
+// Licensed under GPLv3+
+// Refer to the LICENSE file included.
+
+#ifndef THREAD_H
+#define THREAD_H
+
+#ifdef _WIN32
+#include <windows.h>
+
+typedef SRWLOCK mutex_t;
+typedef CONDITION_VARIABLE cond_t;
+typedef HANDLE thread_t;
+
+#define MUTEX_INITIALIZER SRWLOCK_INIT
+#else
+#include <pthread.h>
+
+typedef pthread_mutex_t mutex_t;
+typedef pthread_cond_t cond_t;
+typedef pthread_t thread_t;
+
+#define MUTEX_INITIALIZER PTHREAD_MUTEX_INITIALIZER
+#endif
+
+typedef void (*thread_func_t)(void* arg);
+
+void mutex_init(mutex_t* mutex);
+void mutex_destroy(mutex_t* mutex);
+void mutex_lock(mutex_t* mutex);
+void mutex_unlock(mutex_t* mutex);
+
+void cond_init(cond_t* cond);
+void cond_destroy(cond_t* cond);
+void cond_wait(cond_t* cond, mutex_t* mutex);
+void cond_signal(cond_t* cond);
+void cond_broadcast(cond_t* cond);
+
+// Returns 1 on success or 0 if the thread could not be created
+int thread_create(thread_t* thread, thread_func_t func, void* arg);
+void thread_join(thread_t thread);
+
+// Returns the number of processors available or 1 if unknown
+unsigned thread_get_cpu_count();
+
+#endif
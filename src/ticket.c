@@ -9,19 +9,82 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "io.h"
+#include "layout.h"
+#include "stats.h"
+#include "thread.h"
 #include "util.h"
 #include "wad.h"
 
 struct ticket_data {
-  FILE* fh;
   char issuer[64];
   unsigned char title_key[16];
   char console_id[4];
   uint64_t title_id;
 };
 
-static struct ticket_data* ticket_parse(FILE* fh)
+enum ticket_common_key {
+  TICKET_KEY_NORMAL,
+  TICKET_KEY_KOREA,
+  TICKET_KEY_VWII,
+  TICKET_KEY_DEBUG,
+  TICKET_KEY_COUNT
+};
+
+// Common keys are expanded once, the first time a ticket needs them
+static mbedtls_aes_context s_common_keys[TICKET_KEY_COUNT];
+static int s_common_keys_ready[TICKET_KEY_COUNT];
+static mutex_t s_common_keys_lock = MUTEX_INITIALIZER;
+
+static mbedtls_aes_context* ticket_get_common_key(enum ticket_common_key type)
+{
+  static const unsigned char* const keys[TICKET_KEY_COUNT] = {
+      NORMAL_COMMON_KEY, KOREA_COMMON_KEY, VWII_COMMON_KEY, DEBUG_COMMON_KEY};
+
+  mutex_lock(&s_common_keys_lock);
+
+  if (!s_common_keys_ready[type]) {
+    mbedtls_aes_init(&s_common_keys[type]);
+    mbedtls_aes_setkey_dec(&s_common_keys[type], keys[type], 128);
+    s_common_keys_ready[type] = 1;
+  }
+
+  mutex_unlock(&s_common_keys_lock);
+
+  return &s_common_keys[type];
+}
+
+// Picks the common key a ticket's title key is encrypted with
+static enum ticket_common_key ticket_select_common_key(
+    const struct ticket_layout* ticket)
+{
+  if (strncmp("Root-CA00000002-XS00000006", ticket->issuer,
+              sizeof(ticket->issuer)) == 0)
+    return TICKET_KEY_DEBUG;
+
+  switch (ticket->common_key_index) {
+  case 1:
+    return TICKET_KEY_KOREA;
+  case 2:
+    return TICKET_KEY_VWII;
+  case 0:
+  default:
+    // Dolphin ignores invalid key types, so do we
+    return TICKET_KEY_NORMAL;
+  }
+}
+
+ticket_t ticket_parse_buffer(const unsigned char* buffer, size_t size)
 {
+  struct ticket_layout ticket;
+
+  if (size < sizeof(ticket)) {
+    g_error = LIBWAD_BAD_TICKET;
+    return NULL;
+  }
+
+  memcpy(&ticket, buffer, sizeof(ticket));
+
   struct ticket_data* data =
       (struct ticket_data*)malloc(sizeof(struct ticket_data));
 
@@ -30,95 +93,170 @@ static struct ticket_data* ticket_parse(FILE* fh)
     return NULL;
   }
 
-  data->fh = NULL;
+  memcpy(data->issuer, ticket.issuer, sizeof(data->issuer));
+  memcpy(data->console_id, ticket.console_id, sizeof(data->console_id));
+  data->title_id = be64(ticket.title_id);
+
+  enum ticket_common_key key = ticket_select_common_key(&ticket);
+
+  // Decrypt title key, the IV is the big endian title id
+
+  STATS_TIMER(decrypt_timer);
+
+  unsigned char iv[16] = {0};
+  memcpy(iv, &ticket.title_id, sizeof(ticket.title_id));
+
+  int ret = mbedtls_aes_crypt_cbc(ticket_get_common_key(key),
+                                  MBEDTLS_AES_DECRYPT, 16, iv, ticket.title_key,
+                                  data->title_key);
+
+  STATS_ADD(STATS_DECRYPT, 16, decrypt_timer);
+
+  if (ret != 0) {
+    free(data);
+    return NULL;
+  }
+
+  return data;
+}
 
-  unsigned char enc_title_key[16];
+int ticket_decrypt_keys(const unsigned char* const* tickets,
+                        const size_t* sizes, size_t count,
+                        ticket_key_t* keys)
+{
+  // Tickets are sorted by common key, so each group can be decrypted at once
+  size_t* order = (size_t*)malloc(sizeof(size_t) * (count > 0 ? count : 1));
+  unsigned char* blocks = (unsigned char*)malloc(16 * (count > 0 ? count : 1));
+  unsigned char* plain = (unsigned char*)malloc(16 * (count > 0 ? count : 1));
 
-  // Skip signature fields
-  fseek(fh, 0x0140, SEEK_CUR);
+  if (order == NULL || blocks == NULL || plain == NULL) {
+    g_error = LIBWAD_BAD_ALLOC;
+    free(order);
+    free(blocks);
+    free(plain);
+    return 0;
+  }
 
-  fread(&data->issuer, sizeof(data->issuer), 1, fh);
+  size_t group_start[TICKET_KEY_COUNT + 1] = {0};
+  int result = 1;
 
-  int use_debug_key =
-      strncmp("Root-CA00000002-XS00000006", data->issuer, 64) == 0;
+  for (size_t i = 0; i < count; i++) {
+    ticket_key_t* key = &keys[i];
 
-  fseek(fh, 0x3c + 0x03, SEEK_CUR);
+    memset(key, 0, sizeof(*key));
 
-  fread(enc_title_key, sizeof(enc_title_key), 1, fh);
+    if (sizes[i] < sizeof(struct ticket_layout)) {
+      key->error = LIBWAD_BAD_TICKET;
+      g_error = LIBWAD_BAD_TICKET;
+      result = 0;
+      continue;
+    }
 
-  fseek(fh, 1, SEEK_CUR); // Unknown
-  fseek(fh, 8, SEEK_CUR); // Ticket ID
+    struct ticket_layout ticket;
+    memcpy(&ticket, tickets[i], sizeof(ticket));
 
-  fread(&data->console_id, sizeof(data->console_id), 1, fh);
+    memcpy(key->issuer, ticket.issuer, sizeof(key->issuer));
+    key->issuer[sizeof(key->issuer) - 1] = '\0';
+    key->title_id = be64(ticket.title_id);
 
-  fread(&data->title_id, sizeof(data->title_id), 1, fh);
+    group_start[ticket_select_common_key(&ticket) + 1]++;
+  }
 
-  fseek(fh, 2 + 2 + 4 + 4 + 1, SEEK_CUR);
+  for (int type = 0; type < TICKET_KEY_COUNT; type++)
+    group_start[type + 1] += group_start[type];
 
-  uint8_t key_type;
-  fread(&key_type, sizeof(key_type), 1, fh);
+  size_t next[TICKET_KEY_COUNT];
+  memcpy(next, group_start, sizeof(next));
 
-  const unsigned char* key;
+  for (size_t i = 0; i < count; i++) {
+    if (keys[i].error != LIBWAD_NO_ERROR)
+      continue;
 
-  switch (key_type) {
-  case 1:
-    key = KOREA_COMMON_KEY;
-    break;
-  case 2:
-    key = VWII_COMMON_KEY;
-  case 0:
-  default:
-    // Dolphin ignores invalid key types, so do we
-    key = NORMAL_COMMON_KEY;
+    struct ticket_layout ticket;
+    memcpy(&ticket, tickets[i], sizeof(ticket));
+
+    enum ticket_common_key type = ticket_select_common_key(&ticket);
+
+    order[next[type]] = i;
+    memcpy(blocks + 16 * next[type], ticket.title_key, 16);
+    next[type]++;
   }
 
-  if (use_debug_key)
-    key = DEBUG_COMMON_KEY;
+  STATS_TIMER(decrypt_timer);
 
-  // Decrypt title key
+  for (int type = 0; type < TICKET_KEY_COUNT; type++) {
+    size_t first = group_start[type], n = group_start[type + 1] - first;
 
-  mbedtls_aes_context ctx;
+    if (n == 0)
+      continue;
 
-  mbedtls_aes_setkey_dec(&ctx, key, 128);
+    // Running the whole group through CBC with a zero IV decrypts every block
+    // in one call. Each result is then off by the preceding ciphertext block,
+    // which is swapped for the IV of the ticket it belongs to.
+    unsigned char iv[16] = {0};
 
-  unsigned char iv[16] = {0};
-  memcpy(iv, &data->title_id, 8);
+    if (mbedtls_aes_crypt_cbc(ticket_get_common_key(
+                                  (enum ticket_common_key)type),
+                              MBEDTLS_AES_DECRYPT, 16 * n, iv,
+                              blocks + 16 * first, plain + 16 * first) != 0) {
+      for (size_t j = first; j < first + n; j++)
+        keys[order[j]].error = LIBWAD_DECRYPTION_FAILED;
 
-  int ret = mbedtls_aes_crypt_cbc(&ctx, MBEDTLS_AES_DECRYPT, 16, iv,
-                                  &enc_title_key[0],
-                                  (unsigned char*)&data->title_key[0]);
+      g_error = LIBWAD_DECRYPTION_FAILED;
+      result = 0;
+      continue;
+    }
 
-  if (ret != 0) {
-    free(data);
-    return NULL;
+    for (size_t j = first; j < first + n; j++) {
+      ticket_key_t* key = &keys[order[j]];
+      uint64_t title_id = be64(key->title_id);
+
+      for (int x = 0; x < 16; x++) {
+        unsigned char previous = j > first ? blocks[16 * (j - 1) + x] : 0;
+        unsigned char ticket_iv =
+            x < 8 ? ((const unsigned char*)&title_id)[x] : 0;
+
+        key->title_key[x] = plain[16 * j + x] ^ previous ^ ticket_iv;
+      }
+    }
   }
 
-  be_int64(&data->title_id);
+  STATS_ADD(STATS_DECRYPT, 16 * count, decrypt_timer);
 
-  return data;
+  free(order);
+  free(blocks);
+  free(plain);
+
+  return result;
 }
 
 ticket_t ticket_from_wad(struct wad_data* wad)
 {
-  fseek(wad->fh, (long)wad_get_section_offset(wad, WAD_SECTION_TICKET),
-        SEEK_SET);
-  return ticket_parse(wad->fh);
+  unsigned char* buffer = io_read_section(wad, WAD_SECTION_TICKET);
+
+  if (buffer == NULL)
+    return NULL;
+
+  ticket_t ticket = ticket_parse_buffer(buffer, wad->ticket_size);
+
+  free(buffer);
+
+  return ticket;
 }
 
 ticket_t ticket_open(const char* filename)
 {
-  FILE* fh = fopen(filename, "rb");
+  size_t size;
+  unsigned char* buffer = util_read_file(filename, &size);
 
-  if (!fh) {
-    g_error = LIBWAD_OPEN_FAILED;
+  if (buffer == NULL)
     return NULL;
-  }
 
-  struct ticket_data* data = ticket_parse(fh);
+  ticket_t ticket = ticket_parse_buffer(buffer, size);
 
-  data->fh = fh;
+  free(buffer);
 
-  return (ticket_t)data;
+  return ticket;
 }
 
 void ticket_close(ticket_t handle)
@@ -126,11 +264,6 @@ void ticket_close(ticket_t handle)
   if (handle == NULL)
     return;
 
-  FILE* fh = ((struct ticket_data*)handle)->fh;
-
-  if (fh)
-    fclose(fh);
-
   free(handle);
 }
 
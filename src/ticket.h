@@ -11,6 +11,10 @@
 
 struct wad_data;
 
+// Far more than any ticket format needs
+#define TICKET_MAX_SIZE 0x10000
+
 ticket_t ticket_from_wad(struct wad_data* wad);
+ticket_t ticket_parse_buffer(const unsigned char* buffer, size_t size);
 
 #endif
@@ -5,12 +5,14 @@
 #include "tmd.h"
 
 #include <stdlib.h>
+#include <string.h>
 
+#include "io.h"
+#include "layout.h"
 #include "util.h"
 #include "wad.h"
 
 struct tmd_data {
-  FILE* fh;
   uint64_t ios_version;
   uint64_t title_id;
   uint32_t title_type;
@@ -21,75 +23,70 @@ struct tmd_data {
   tmd_content_t* contents;
 };
 
-static tmd_t tmd_parse(FILE* fh)
+tmd_t tmd_parse_buffer(const unsigned char* buffer, size_t size)
 {
-  struct tmd_data* data = (struct tmd_data*)malloc(sizeof(struct tmd_data));
+  struct tmd_header_layout header;
 
-  if (data == NULL) {
-    g_error = LIBWAD_BAD_ALLOC;
+  if (size < sizeof(header)) {
+    g_error = LIBWAD_BAD_TMD;
     return NULL;
   }
 
-  data->fh = NULL;
-
-  fseek(fh, 0x184, SEEK_CUR);
-
-  fread(&data->ios_version, sizeof(data->ios_version), 1, fh);
-  be_int64(&data->ios_version);
-
-  fread(&data->title_id, sizeof(data->title_id), 1, fh);
-  be_int64(&data->title_id);
-
-  fread(&data->title_type, sizeof(data->title_type), 1, fh);
-  be_int32(&data->title_type);
+  memcpy(&header, buffer, sizeof(header));
 
-  fread(&data->group_id, sizeof(data->group_id), 1, fh);
-  be_int16(&data->group_id);
+  uint16_t content_count = be16(header.content_count);
 
-  fseek(fh, sizeof(uint16_t), SEEK_CUR); // Skip zero field
-
-  fread(&data->region, sizeof(data->region), 1, fh);
-  be_int16(&data->region);
-
-  // Skip ratings, reserved, ipc mask, reserved, access rights
-  fseek(fh,
-        sizeof(char[16]) + sizeof(char[12]) + sizeof(char[12]) +
-            sizeof(char[18]) + sizeof(uint32_t),
-        SEEK_CUR);
+  if ((size - sizeof(header)) / sizeof(struct tmd_content_layout) <
+      content_count) {
+    g_error = LIBWAD_BAD_TMD;
+    return NULL;
+  }
 
-  fread(&data->title_version, sizeof(data->title_version), 1, fh);
-  be_int16(&data->title_version);
+  struct tmd_data* data = (struct tmd_data*)malloc(sizeof(struct tmd_data));
 
-  fread(&data->content_count, sizeof(data->content_count), 1, fh);
-  be_int16(&data->content_count);
+  if (data == NULL) {
+    g_error = LIBWAD_BAD_ALLOC;
+    return NULL;
+  }
 
-  // Skip boot index and padding
-  fseek(fh, sizeof(uint16_t) + sizeof(uint16_t), SEEK_CUR);
+  data->ios_version = be64(header.ios_version);
+  data->title_id = be64(header.title_id);
+  data->title_type = be32(header.title_type);
+  data->group_id = be16(header.group_id);
+  data->region = be16(header.region);
+  data->title_version = be16(header.title_version);
+  data->content_count = content_count;
 
   data->contents =
       (tmd_content_t*)malloc(sizeof(tmd_content_t) * data->content_count);
 
   if (data->contents == NULL) {
     g_error = LIBWAD_BAD_ALLOC;
-    data_close(data);
+    free(data);
     return NULL;
   }
 
+  const unsigned char* records = buffer + sizeof(header);
+
   for (uint32_t i = 0; i < data->content_count; i++) {
+    struct tmd_content_layout record;
     tmd_content_t* c = &(data->contents[i]);
-    fread(&c->id, sizeof(c->id), 1, fh);
-    be_int32(&c->id);
-
-    fread(&c->index, sizeof(c->index), 1, fh);
-    be_int16(&c->index);
 
-    fread(&c->type, sizeof(c->type), 1, fh);
-    be_int16(&c->type);
-
-    fread(&c->size, sizeof(c->size), 1, fh);
-    be_int64(&c->size);
-
-    fread(&c->hash, sizeof(c->hash), 1, fh);
+    memcpy(&record, records + i * sizeof(record), sizeof(record));
+
+    c->id = be32(record.id);
+    c->index = be16(record.index);
+    c->type = be16(record.type);
+    c->size = be64(record.size);
+    memcpy(c->hash, record.hash, sizeof(c->hash));
+
+    // Content sizes decide how much is allocated when extracting
+    if (c->size > TMD_MAX_CONTENT_SIZE) {
+      g_error = LIBWAD_BAD_TMD;
+      free(data->contents);
+      free(data);
+      return NULL;
+    }
   }
 
   return data;
@@ -97,25 +94,31 @@ static tmd_t tmd_parse(FILE* fh)
 
 tmd_t tmd_from_wad(struct wad_data* wad)
 {
-  fseek(wad->fh, (long)wad_get_section_offset(wad, WAD_SECTION_TMD), SEEK_SET);
+  unsigned char* buffer = io_read_section(wad, WAD_SECTION_TMD);
 
-  return tmd_parse(wad->fh);
+  if (buffer == NULL)
+    return NULL;
+
+  tmd_t tmd = tmd_parse_buffer(buffer, wad->tmd_size);
+
+  free(buffer);
+
+  return tmd;
 }
 
 ticket_t tmd_open(const char* filename)
 {
-  FILE* fh = fopen(filename, "rb");
+  size_t size;
+  unsigned char* buffer = util_read_file(filename, &size);
 
-  if (!fh) {
-    g_error = LIBWAD_OPEN_FAILED;
+  if (buffer == NULL)
     return NULL;
-  }
 
-  struct tmd_data* data = tmd_parse(fh);
+  tmd_t tmd = tmd_parse_buffer(buffer, size);
 
-  data->fh = fh;
+  free(buffer);
 
-  return (ticket_t)data;
+  return (ticket_t)tmd;
 }
 
 uint16_t tmd_get_content_count(tmd_t handle)
@@ -193,11 +196,6 @@ void tmd_close(tmd_t handle)
   if (handle == NULL)
     return;
 
-  FILE* fh = ((struct tmd_data*)handle)->fh;
-
-  if (fh != NULL)
-    fclose(fh);
-
   free(((struct tmd_data*)handle)->contents);
   free(handle);
 }
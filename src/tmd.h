@@ -9,6 +9,13 @@
 
 struct wad_data;
 
+// Largest tmd possible: The header followed by 65535 content records
+#define TMD_MAX_SIZE (0x1e4 + 0xffff * 36)
+
+// Contents have to fit in the 32-bit sized data section of a wad
+#define TMD_MAX_CONTENT_SIZE 0xffffffffULL
+
 tmd_t tmd_from_wad(struct wad_data* wad);
+tmd_t tmd_parse_buffer(const unsigned char* buffer, size_t size);
 
 #endif
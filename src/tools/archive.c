@@ -0,0 +1,274 @@
+// Copyright 2019 spycrab0
+// Licensed under GPLv3+
+// Refer to the LICENSE file included.
+
+#include "archive.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dirent.h>
+#endif
+
+// Wads open at once, the next ones are opened as earlier ones complete
+#define ARCHIVE_MAX_OPEN_WADS 32
+
+struct archive_wad {
+  const char* path;
+  wad_t wad;
+  // Jobs that have not been picked up yet
+  unsigned remaining;
+};
+
+struct archive_state {
+  sched_t sched;
+  const char* out_dir;
+  wad_io_policy_t io_policy;
+  data_verify_t verify;
+
+  struct archive_wad* wads;
+  int count;
+  int next;
+  int open;
+  int failed;
+};
+
+static int archive_is_wad(const char* name)
+{
+  size_t length = strlen(name);
+
+  if (length < 4)
+    return 0;
+
+  const char* extension = name + length - 4;
+
+  return extension[0] == '.' && tolower((unsigned char)extension[1]) == 'w' &&
+         tolower((unsigned char)extension[2]) == 'a' &&
+         tolower((unsigned char)extension[3]) == 'd';
+}
+
+static int archive_compare(const void* a, const void* b)
+{
+  return strcmp(*(const char* const*)a, *(const char* const*)b);
+}
+
+static int archive_add(char*** list, int* count, int* capacity,
+                       const char* directory, const char* name)
+{
+  if (*count == *capacity) {
+    int new_capacity = *capacity != 0 ? *capacity * 2 : 64;
+    char** new_list = (char**)realloc(*list, sizeof(char*) * new_capacity);
+
+    if (new_list == NULL)
+      return 0;
+
+    *list = new_list;
+    *capacity = new_capacity;
+  }
+
+  size_t length = strlen(directory) + 1 + strlen(name) + 1;
+  char* path = (char*)malloc(length);
+
+  if (path == NULL)
+    return 0;
+
+  snprintf(path, length, "%s/%s", directory, name);
+  (*list)[(*count)++] = path;
+
+  return 1;
+}
+
+char** archive_list_wads(const char* directory, int* count)
+{
+  char** list = NULL;
+  int capacity = 0;
+  int result = 1;
+
+  *count = 0;
+
+#ifdef _WIN32
+  char pattern[MAX_PATH];
+  snprintf(pattern, sizeof(pattern), "%s\\*", directory);
+
+  WIN32_FIND_DATAA data;
+  HANDLE find = FindFirstFileA(pattern, &data);
+
+  if (find == INVALID_HANDLE_VALUE)
+    return NULL;
+
+  do {
+    if (archive_is_wad(data.cFileName))
+      result = archive_add(&list, count, &capacity, directory, data.cFileName);
+  } while (result && FindNextFileA(find, &data));
+
+  FindClose(find);
+#else
+  DIR* dir = opendir(directory);
+
+  if (dir == NULL)
+    return NULL;
+
+  struct dirent* entry;
+
+  // Directories named like wads are titles mirrored from the update servers
+  while (result && (entry = readdir(dir)) != NULL) {
+    if (archive_is_wad(entry->d_name))
+      result = archive_add(&list, count, &capacity, directory, entry->d_name);
+  }
+
+  closedir(dir);
+#endif
+
+  // An empty directory still gets a list
+  if (result && list == NULL)
+    result = (list = (char**)malloc(sizeof(char*))) != NULL;
+
+  if (!result) {
+    archive_free_list(list, *count);
+    return NULL;
+  }
+
+  qsort(list, *count, sizeof(char*), archive_compare);
+
+  return list;
+}
+
+void archive_free_list(char** list, int count)
+{
+  if (list == NULL)
+    return;
+
+  for (int i = 0; i < count; i++)
+    free(list[i]);
+
+  free(list);
+}
+
+// Opens wads and queues their contents until enough of them are open
+static void archive_open_more(struct archive_state* state)
+{
+  while (state->next < state->count && state->open < ARCHIVE_MAX_OPEN_WADS) {
+    struct archive_wad* entry = &state->wads[state->next++];
+
+    entry->wad = wad_open_ex(entry->path, state->io_policy);
+
+    if (entry->wad == NULL) {
+      fprintf(stderr, "%s: Failed to open: %s\n", entry->path,
+              libwad_get_error_msg());
+      state->failed = 1;
+      continue;
+    }
+
+    uint16_t content_count = tmd_get_content_count(wad_get_tmd(entry->wad));
+
+    // Several wads of a directory can hold the same title, but their names
+    // are unique
+    const char* name = strrchr(entry->path, '/');
+    name = name != NULL ? name + 1 : entry->path;
+
+    for (uint16_t i = 0; i < content_count; i++) {
+      char output[512];
+
+      if (state->out_dir != NULL &&
+          snprintf(output, sizeof(output), "%s/%s-%04hu.bin", state->out_dir,
+                   name, i) >= (int)sizeof(output)) {
+        printf("%s: Content %2hu...Error: Output path is too long\n",
+               entry->path, i);
+        state->failed = 1;
+        continue;
+      }
+
+      batch_job_t job = {entry->wad, i,
+                         state->out_dir != NULL ? output : NULL,
+                         state->verify, entry};
+
+      if (!sched_submit(state->sched, &job)) {
+        printf("%s: Content %2hu...Error: %s\n", entry->path, i,
+               libwad_get_error_msg());
+        state->failed = 1;
+        continue;
+      }
+
+      entry->remaining++;
+    }
+
+    if (entry->remaining == 0) {
+      wad_close(entry->wad);
+      entry->wad = NULL;
+      continue;
+    }
+
+    state->open++;
+  }
+}
+
+int archive_process(const char* directory, const char* out_dir, unsigned jobs,
+                    wad_io_policy_t io_policy, data_verify_t verify,
+                    int quiet)
+{
+  struct archive_state state;
+
+  memset(&state, 0, sizeof(state));
+  state.out_dir = out_dir;
+  state.io_policy = io_policy;
+  state.verify = verify;
+
+  char** paths = archive_list_wads(directory, &state.count);
+
+  if (paths == NULL) {
+    fprintf(stderr, "Failed to list wads in '%s'\n", directory);
+    return 1;
+  }
+
+  state.sched = sched_open(jobs);
+  state.wads = (struct archive_wad*)calloc(
+      state.count > 0 ? state.count : 1, sizeof(struct archive_wad));
+
+  if (state.sched == NULL || state.wads == NULL) {
+    fprintf(stderr, "Failed to start scheduler: %s\n", libwad_get_error_msg());
+    sched_close(state.sched);
+    free(state.wads);
+    archive_free_list(paths, state.count);
+    return 1;
+  }
+
+  for (int i = 0; i < state.count; i++)
+    state.wads[i].path = paths[i];
+
+  archive_open_more(&state);
+
+  batch_completion_t completion;
+
+  // Completions arrive in the order the contents were queued
+  while (sched_wait(state.sched, &completion)) {
+    struct archive_wad* entry = (struct archive_wad*)completion.job.user;
+
+    if (completion.error != LIBWAD_NO_ERROR) {
+      printf("%s: Content %2hu...Error: %s\n", entry->path,
+             completion.job.index, libwad_error_to_string(completion.error));
+      state.failed = 1;
+    } else if (!quiet) {
+      printf("%s: Content %2hu...Ok\n", entry->path, completion.job.index);
+    }
+
+    if (--entry->remaining == 0) {
+      wad_close(entry->wad);
+      entry->wad = NULL;
+      state.open--;
+
+      archive_open_more(&state);
+    }
+  }
+
+  sched_close(state.sched);
+
+  free(state.wads);
+  archive_free_list(paths, state.count);
+
+  return state.failed;
+}
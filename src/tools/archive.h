@@ -0,0 +1,22 @@
+// Copyright 2019 spycrab0
+// Licensed under GPLv3+
+// Refer to the LICENSE file included.
+
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <libwad.h>
+
+// Lists the wads in a directory sorted by name, returns NULL on failure
+char** archive_list_wads(const char* directory, int* count);
+void archive_free_list(char** list, int count);
+
+// Verifies or extracts every content of every wad in a directory through the
+// scheduler, printing the results in order. Contents are written to out_dir
+// as (wad file name)-(index).bin unless it is NULL. Returns 1 if anything
+// failed.
+int archive_process(const char* directory, const char* out_dir, unsigned jobs,
+                    wad_io_policy_t io_policy, data_verify_t verify,
+                    int quiet);
+
+#endif
@@ -0,0 +1,182 @@
+// Copyright 2019 spycrab0
+// Licensed under GPLv3+
+// Refer to the LICENSE file included.
+
+#include "gen.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <mbedtls/aes.h>
+
+#define GEN_CHUNK_SIZE 0x10000
+
+#define GEN_TICKET_SIZE 0x2a4
+#define GEN_TMD_HEADER_SIZE 0x1e4
+#define GEN_TMD_CONTENT_SIZE 36
+
+#define SIGNATURE_RSA_4096 0x10000
+#define SIGNATURE_RSA_2048 0x10001
+#define KEY_RSA_2048 1
+
+static const unsigned char COMMON_KEY[16] = {0xeb, 0xe4, 0x2a, 0x22, 0x5e, 0x85,
+                                             0x93, 0xe4, 0x48, 0xd9, 0xc5, 0x45,
+                                             0x73, 0x81, 0xaa, 0xf7};
+
+static void put16(unsigned char* p, uint16_t v)
+{
+  p[0] = v >> 8;
+  p[1] = v & 0xff;
+}
+
+static void put32(unsigned char* p, uint32_t v)
+{
+  put16(p, v >> 16);
+  put16(p + 2, v & 0xffff);
+}
+
+static void put64(unsigned char* p, uint64_t v)
+{
+  put32(p, v >> 32);
+  put32(p + 4, v & 0xffffffff);
+}
+
+static uint32_t xorshift32(uint32_t* state)
+{
+  uint32_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return *state = x;
+}
+
+// Returns the size of the certificate
+static size_t gen_cert(unsigned char* p, uint32_t signature_type,
+                       const char* issuer, const char* name)
+{
+  size_t signature_size = signature_type == SIGNATURE_RSA_4096 ? 0x200 : 0x100;
+
+  put32(p, signature_type);
+  p += 4 + signature_size + 0x3c;
+
+  strncpy((char*)p, issuer, 0x40);
+  put32(p + 0x40, KEY_RSA_2048);
+  strncpy((char*)p + 0x44, name, 0x40);
+
+  // Public key (modulus, exponent, padding)
+  put32(p + 0x84 + 0x100, 0x10001);
+
+  return 4 + signature_size + 0x3c + 0x40 + 4 + 0x40 + 0x100 + 4 + 0x38;
+}
+
+int gen_write_wad(const char* path, uint64_t title_id, uint16_t count,
+                  const uint64_t* sizes, uint32_t seed)
+{
+  unsigned char certchain[0x400 + 0x300 + 0x300] = {0};
+  size_t certchain_size = 0;
+
+  certchain_size += gen_cert(certchain + certchain_size, SIGNATURE_RSA_4096,
+                             "Root", "CA00000001");
+  certchain_size += gen_cert(certchain + certchain_size, SIGNATURE_RSA_2048,
+                             "Root-CA00000001", "XS00000003");
+  certchain_size += gen_cert(certchain + certchain_size, SIGNATURE_RSA_2048,
+                             "Root-CA00000001", "CP00000004");
+
+  uint32_t state = seed != 0 ? seed : 1;
+
+  // Ticket
+  unsigned char ticket[GEN_TICKET_SIZE] = {0};
+  unsigned char title_key[16];
+
+  for (int i = 0; i < 16; i++)
+    title_key[i] = xorshift32(&state) & 0xff;
+
+  put32(ticket, SIGNATURE_RSA_2048);
+  strcpy((char*)ticket + 0x140, "Root-CA00000001-XS00000003");
+  put64(ticket + 0x1dc, title_id);
+
+  mbedtls_aes_context ctx;
+  mbedtls_aes_init(&ctx);
+  mbedtls_aes_setkey_enc(&ctx, COMMON_KEY, 128);
+
+  unsigned char iv[16] = {0};
+  put64(iv, title_id);
+
+  mbedtls_aes_crypt_cbc(&ctx, MBEDTLS_AES_ENCRYPT, 16, iv, title_key,
+                        ticket + 0x1bf);
+  mbedtls_aes_free(&ctx);
+
+  // Title metadata. Sizes and hashes are filled in by the writer
+  size_t tmd_size = GEN_TMD_HEADER_SIZE + count * GEN_TMD_CONTENT_SIZE;
+  unsigned char* tmd = (unsigned char*)calloc(1, tmd_size);
+  unsigned char* chunk = (unsigned char*)malloc(GEN_CHUNK_SIZE);
+
+  if (tmd == NULL || chunk == NULL) {
+    free(tmd);
+    free(chunk);
+    return 0;
+  }
+
+  put32(tmd, SIGNATURE_RSA_2048);
+  strcpy((char*)tmd + 0x140, "Root-CA00000001-CP00000004");
+  put64(tmd + 0x184, 0x000000010000003aULL); // IOS58
+  put64(tmd + 0x18c, title_id);
+  put32(tmd + 0x194, LIBWAD_TYPE_CHANNEL);
+  put16(tmd + 0x19c, LIBWAD_REGION_INTERNATIONAL);
+  put16(tmd + 0x1de, count);
+
+  for (uint16_t i = 0; i < count; i++) {
+    unsigned char* record = tmd + GEN_TMD_HEADER_SIZE + i * GEN_TMD_CONTENT_SIZE;
+
+    put32(record, i);
+    put16(record + 4, i);
+    put16(record + 6, 1); // Normal content
+  }
+
+  wad_writer_t writer =
+      wad_writer_open(path, certchain, (uint32_t)certchain_size, ticket,
+                      sizeof(ticket), tmd, (uint32_t)tmd_size);
+
+  free(tmd);
+
+  if (writer == NULL) {
+    free(chunk);
+    return 0;
+  }
+
+  for (uint16_t i = 0; i < count; i++) {
+    if (!wad_writer_begin_content(writer)) {
+      wad_writer_abort(writer);
+      free(chunk);
+      return 0;
+    }
+
+    for (uint64_t offset = 0; offset < sizes[i]; offset += GEN_CHUNK_SIZE) {
+      size_t length = GEN_CHUNK_SIZE;
+
+      if (length > sizes[i] - offset)
+        length = (size_t)(sizes[i] - offset);
+
+      for (size_t x = 0; x < length; x += 4) {
+        uint32_t r = xorshift32(&state);
+        memcpy(chunk + x, &r, length - x < 4 ? length - x : 4);
+      }
+
+      if (!wad_writer_write(writer, chunk, length)) {
+        wad_writer_abort(writer);
+        free(chunk);
+        return 0;
+      }
+    }
+
+    if (!wad_writer_end_content(writer)) {
+      wad_writer_abort(writer);
+      free(chunk);
+      return 0;
+    }
+  }
+
+  free(chunk);
+
+  return wad_writer_close(writer, NULL, 0);
+}
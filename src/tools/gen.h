@@ -0,0 +1,15 @@
+// Copyright 2019 spycrab0
+// Licensed under GPLv3+
+// Refer to the LICENSE file included.
+
+#ifndef GEN_H
+#define GEN_H
+
+#include <libwad.h>
+
+// Writes a wad with fake certificate chain, ticket and tmd and pseudo random
+// contents of the given sizes
+int gen_write_wad(const char* path, uint64_t title_id, uint16_t count,
+                  const uint64_t* sizes, uint32_t seed);
+
+#endif
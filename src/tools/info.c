@@ -6,6 +6,8 @@
 
 #include <inttypes.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 int info_print_certchain(certchain_t handle)
 {
@@ -79,4 +81,92 @@ int info_print_tmd(tmd_t handle)
   }
 
   return 1;
-}
\ No newline at end of file
+}
+int info_print_progress(uint64_t processed, uint64_t total, uint16_t index,
+                        void* user)
+{
+  if (total == 0)
+    return 0;
+
+  // Print the percentage and move the cursor back so the next status
+  // overwrites it, clearing it once the content is done
+  if (processed < total)
+    printf("%3d%%\b\b\b\b", (int)(processed * 100 / total));
+  else
+    printf("    \b\b\b\b");
+
+  fflush(stdout);
+
+  return 0;
+}
+
+static void info_print_stage(const char* name, uint64_t bytes, uint64_t ns)
+{
+  double seconds = ns / 1e9;
+  double mib = bytes / (1024.0 * 1024.0);
+
+  printf("%s%" PRIu64 " bytes in %.3f ms", name, bytes, ns / 1e6);
+
+  if (seconds > 0)
+    printf(" (%.1f MiB/s)", mib / seconds);
+
+  printf("\n");
+}
+
+int info_print_stats()
+{
+  libwad_stats_t stats;
+
+  if (!libwad_get_stats(&stats)) {
+    fprintf(stderr, "Statistics are not available (built without "
+                    "ENABLE_STATS)\n");
+    return 0;
+  }
+
+  printf("\nStatistics:\n\n");
+
+  printf("Opens:\t\t%" PRIu64 "\n", stats.opens);
+  printf("Extracts:\t%" PRIu64 "\n", stats.extracts);
+
+  info_print_stage("Read:\t\t", stats.read_bytes, stats.read_ns);
+  info_print_stage("Decrypt:\t", stats.decrypt_bytes, stats.decrypt_ns);
+  info_print_stage("Hash:\t\t", stats.hash_bytes, stats.hash_ns);
+  info_print_stage("Alloc:\t\t", stats.alloc_bytes, stats.alloc_ns);
+
+  return 1;
+}
+
+static void info_print_stats_at_exit()
+{
+  info_print_stats();
+}
+
+void info_enable_stats()
+{
+  libwad_reset_stats();
+  atexit(info_print_stats_at_exit);
+}
+
+int info_parse_io_policy(const char* name, wad_io_policy_t* policy)
+{
+  static const struct {
+    const char* name;
+    wad_io_policy_t policy;
+  } policies[] = {{"normal", WAD_IO_NORMAL},
+                  {"sequential", WAD_IO_SEQUENTIAL},
+                  {"dropbehind", WAD_IO_DROP_BEHIND},
+                  {"direct", WAD_IO_DIRECT}};
+
+  for (size_t i = 0; i < sizeof(policies) / sizeof(policies[0]); i++) {
+    if (strcmp(name, policies[i].name) == 0) {
+      *policy = policies[i].policy;
+      return 1;
+    }
+  }
+
+  fprintf(stderr,
+          "Unknown I/O policy '%s', expected normal, sequential, dropbehind "
+          "or direct\n",
+          name);
+  return 0;
+}
@@ -10,5 +10,16 @@
 int info_print_certchain(certchain_t handle);
 int info_print_ticket(ticket_t handle);
 int info_print_tmd(tmd_t handle);
+int info_print_stats();
+
+// Progress callback printing the percentage of the current content
+int info_print_progress(uint64_t processed, uint64_t total, uint16_t index,
+                        void* user);
+
+// Prints the statistics once the program exits
+void info_enable_stats();
+
+// Parses the argument of --io, returns 0 for unknown policies
+int info_parse_io_policy(const char* name, wad_io_policy_t* policy);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,277 @@
+// Copyright 2019 spycrab0
+// Licensed under GPLv3+
+// Refer to the LICENSE file included.
+
+#include "journal.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#define JOURNAL_LINE_SIZE 4096
+
+struct journal_record {
+  uint16_t index;
+  char hash[20];
+  uint64_t size;
+  char* output;
+};
+
+struct journal {
+  FILE* fh;
+  const char* wad_path;
+
+  struct journal_record* records;
+  size_t record_count;
+  size_t record_capacity;
+};
+
+static int journal_sync(FILE* fh)
+{
+  if (fflush(fh) != 0)
+    return 0;
+
+#ifdef _WIN32
+  return _commit(_fileno(fh)) == 0;
+#else
+  return fsync(fileno(fh)) == 0;
+#endif
+}
+
+static int journal_get_file_size(const char* path, uint64_t* size)
+{
+#ifdef _WIN32
+  struct _stat64 info;
+
+  if (_stat64(path, &info) != 0)
+    return 0;
+#else
+  struct stat info;
+
+  if (stat(path, &info) != 0)
+    return 0;
+#endif
+
+  *size = (uint64_t)info.st_size;
+
+  return 1;
+}
+
+static int journal_parse_hash(const char* text, char hash[20])
+{
+  for (int i = 0; i < 20; i++) {
+    unsigned value;
+
+    if (sscanf(text + i * 2, "%2x", &value) != 1)
+      return 0;
+
+    hash[i] = (char)value;
+  }
+
+  return text[40] == '\t';
+}
+
+static int journal_add(journal_t* journal, uint16_t index, const char hash[20],
+                       uint64_t size, const char* output)
+{
+  if (journal->record_count == journal->record_capacity) {
+    size_t capacity =
+        journal->record_capacity != 0 ? journal->record_capacity * 2 : 16;
+    struct journal_record* records = (struct journal_record*)realloc(
+        journal->records, capacity * sizeof(struct journal_record));
+
+    if (records == NULL)
+      return 0;
+
+    journal->records = records;
+    journal->record_capacity = capacity;
+  }
+
+  struct journal_record* record = &journal->records[journal->record_count];
+
+  record->output = (char*)malloc(strlen(output) + 1);
+
+  if (record->output == NULL)
+    return 0;
+
+  strcpy(record->output, output);
+  record->index = index;
+  record->size = size;
+  memcpy(record->hash, hash, 20);
+
+  journal->record_count++;
+
+  return 1;
+}
+
+// Adds the record on a complete line if it belongs to our wad
+static int journal_parse_line(journal_t* journal, char* line)
+{
+  char* end;
+  unsigned long index = strtoul(line, &end, 10);
+
+  char hash[20];
+
+  if (*end != '\t' || index > UINT16_MAX || !journal_parse_hash(end + 1, hash))
+    return 1;
+
+  uint64_t size = strtoull(end + 42, &end, 10);
+
+  if (*end != '\t')
+    return 1;
+
+  char* output = end + 1;
+  char* wad_path = strchr(output, '\t');
+
+  if (wad_path == NULL)
+    return 1;
+
+  *wad_path++ = '\0';
+  wad_path[strcspn(wad_path, "\n")] = '\0';
+
+  if (strcmp(wad_path, journal->wad_path) != 0)
+    return 1;
+
+  return journal_add(journal, (uint16_t)index, hash, size, output);
+}
+
+static int journal_load(journal_t* journal, const char* path, int* complete)
+{
+  FILE* fh = fopen(path, "rb");
+
+  *complete = 1;
+
+  if (fh == NULL)
+    return 1;
+
+  char line[JOURNAL_LINE_SIZE];
+  int result = 1;
+
+  while (result && fgets(line, sizeof(line), fh) != NULL) {
+    size_t length = strlen(line);
+    int whole = length > 0 && line[length - 1] == '\n';
+
+    // Lines that are too long or torn are skipped along with their rest
+    if (*complete && whole)
+      result = journal_parse_line(journal, line);
+
+    *complete = whole;
+  }
+
+  fclose(fh);
+
+  return result;
+}
+
+journal_t* journal_open(const char* path, const char* wad_path)
+{
+  journal_t* journal = (journal_t*)calloc(1, sizeof(journal_t));
+
+  if (journal == NULL)
+    return NULL;
+
+  journal->wad_path = wad_path;
+
+  int complete;
+
+  if (!journal_load(journal, path, &complete)) {
+    journal_close(journal);
+    return NULL;
+  }
+
+  journal->fh = fopen(path, "ab");
+
+  // Start a fresh line after a record torn by a crash
+  if (journal->fh == NULL || (!complete && fputc('\n', journal->fh) == EOF)) {
+    journal_close(journal);
+    return NULL;
+  }
+
+  return journal;
+}
+
+void journal_close(journal_t* journal)
+{
+  if (journal == NULL)
+    return;
+
+  if (journal->fh != NULL)
+    fclose(journal->fh);
+
+  for (size_t i = 0; i < journal->record_count; i++)
+    free(journal->records[i].output);
+
+  free(journal->records);
+  free(journal);
+}
+
+int journal_is_done(journal_t* journal, uint16_t index, const char hash[20],
+                    const char* filename)
+{
+  // Later records replace earlier ones
+  for (size_t i = journal->record_count; i-- > 0;) {
+    const struct journal_record* record = &journal->records[i];
+
+    if (record->index != index || strcmp(record->output, filename) != 0)
+      continue;
+
+    uint64_t size;
+
+    return memcmp(record->hash, hash, 20) == 0 &&
+           journal_get_file_size(filename, &size) && size == record->size;
+  }
+
+  return 0;
+}
+
+void journal_get_temp_filename(char* temp, size_t size, const char* filename)
+{
+  snprintf(temp, size, "%s.part", filename);
+}
+
+int journal_commit(journal_t* journal, uint16_t index, const char hash[20],
+                   const char* temp, const char* filename)
+{
+  // The data has to be on disk before the rename can expose it
+  FILE* fh = fopen(temp, "r+b");
+
+  if (fh == NULL)
+    return 0;
+
+  int synced = journal_sync(fh);
+
+  fclose(fh);
+
+  uint64_t size;
+
+  if (!synced || !journal_get_file_size(temp, &size))
+    return 0;
+
+#ifdef _WIN32
+  remove(filename);
+#endif
+
+  if (rename(temp, filename) != 0)
+    return 0;
+
+  // A rename lost in a crash leaves the output missing, which makes the
+  // record fail the size check on the next run
+  fprintf(journal->fh, "%hu\t", index);
+
+  for (int i = 0; i < 20; i++)
+    fprintf(journal->fh, "%02x", (unsigned char)hash[i]);
+
+  fprintf(journal->fh, "\t%" PRIu64 "\t%s\t%s\n", size, filename,
+          journal->wad_path);
+
+  return journal_sync(journal->fh) &&
+         journal_add(journal, index, hash, size, filename);
+}
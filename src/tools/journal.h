@@ -0,0 +1,35 @@
+// Copyright 2019 spycrab0
+// Licensed under GPLv3+
+// Refer to the LICENSE file included.
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Journals are text files with one line per extracted content, holding its
+// index, the SHA-1 from the tmd, the size of the output, the output path and
+// the wad path separated by tabs. Lines are only ever appended, a line cut
+// short by a crash is ignored.
+typedef struct journal journal_t;
+
+// Opens or creates a journal, keeping the records of the given wad
+journal_t* journal_open(const char* path, const char* wad_path);
+void journal_close(journal_t* journal);
+
+// Whether an earlier run extracted the content to filename. Only the size of
+// the output is checked, the hash has to match the one in the tmd.
+int journal_is_done(journal_t* journal, uint16_t index, const char hash[20],
+                    const char* filename);
+
+// Gets the name output is written to until journal_commit() moves it into
+// place
+void journal_get_temp_filename(char* temp, size_t size, const char* filename);
+
+// Flushes the temporary file to disk, renames it to filename and appends a
+// record, which is flushed as well
+int journal_commit(journal_t* journal, uint16_t index, const char hash[20],
+                   const char* temp, const char* filename);
+
+#endif
@@ -0,0 +1,1029 @@
+// Copyright 2019 spycrab0
+// Licensed under GPLv3+
+// Refer to the LICENSE file included.
+
+#include "patch.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <mbedtls/sha1.h>
+
+#define PATCH_CHUNK_SIZE 0x100000
+
+#define TMD_CONTENT_COUNT_OFFSET 0x1de
+#define TMD_CONTENTS_OFFSET 0x1e4
+#define TMD_CONTENT_SIZE 36
+
+// Size of the blocks of the old content that are looked up in the new one,
+// shorter matches end up as inserted bytes
+#define DELTA_BLOCK_SIZE 32
+#define DELTA_HASH_BASE 0x01000193u
+
+// A delta is a sequence of these operations, each followed by big endian
+// arguments: COPY (offset: 64, length: 32), INSERT (length: 32, bytes)
+#define DELTA_COPY 0
+#define DELTA_INSERT 1
+
+static const wad_section_t PATCH_SECTIONS[] = {
+    WAD_SECTION_CERTCHAIN, WAD_SECTION_TICKET, WAD_SECTION_TMD,
+    WAD_SECTION_FOOTER};
+
+#define PATCH_SECTION_COUNT (sizeof(PATCH_SECTIONS) / sizeof(PATCH_SECTIONS[0]))
+
+static char patch_error[256];
+
+static void patch_set_error(const char* format, ...)
+{
+  va_list args;
+
+  va_start(args, format);
+  vsnprintf(patch_error, sizeof(patch_error), format, args);
+  va_end(args);
+}
+
+const char* patch_get_error()
+{
+  return patch_error;
+}
+
+struct buffer {
+  unsigned char* data;
+  size_t size;
+  size_t capacity;
+};
+
+static int buffer_append(struct buffer* buffer, const void* data, size_t size)
+{
+  if (buffer->size + size > buffer->capacity) {
+    size_t capacity = buffer->capacity == 0 ? 0x1000 : buffer->capacity;
+
+    while (capacity < buffer->size + size)
+      capacity *= 2;
+
+    unsigned char* grown = (unsigned char*)realloc(buffer->data, capacity);
+
+    if (grown == NULL)
+      return 0;
+
+    buffer->data = grown;
+    buffer->capacity = capacity;
+  }
+
+  memcpy(buffer->data + buffer->size, data, size);
+  buffer->size += size;
+
+  return 1;
+}
+
+static void put16(unsigned char* p, uint16_t v)
+{
+  p[0] = v >> 8;
+  p[1] = v & 0xff;
+}
+
+static void put32(unsigned char* p, uint32_t v)
+{
+  put16(p, v >> 16);
+  put16(p + 2, v & 0xffff);
+}
+
+static void put64(unsigned char* p, uint64_t v)
+{
+  put32(p, v >> 32);
+  put32(p + 4, v & 0xffffffff);
+}
+
+static uint16_t get16(const unsigned char* p)
+{
+  return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+static uint32_t get32(const unsigned char* p)
+{
+  return (uint32_t)get16(p) << 16 | get16(p + 2);
+}
+
+static uint64_t get64(const unsigned char* p)
+{
+  return (uint64_t)get32(p) << 32 | get32(p + 4);
+}
+
+static int write_value(FILE* fh, uint64_t value, size_t size)
+{
+  unsigned char bytes[8];
+
+  put64(bytes, value);
+
+  return fwrite(bytes + 8 - size, size, 1, fh) == 1;
+}
+
+static int read_value(FILE* fh, uint64_t* value, size_t size)
+{
+  unsigned char bytes[8] = {0};
+
+  if (fread(bytes + 8 - size, size, 1, fh) != 1)
+    return 0;
+
+  *value = get64(bytes);
+
+  return 1;
+}
+
+static uint32_t delta_hash(const unsigned char* p)
+{
+  uint32_t hash = 0;
+
+  for (size_t i = 0; i < DELTA_BLOCK_SIZE; i++)
+    hash = hash * DELTA_HASH_BASE + p[i];
+
+  return hash;
+}
+
+static int delta_insert(struct buffer* out, const unsigned char* data,
+                        size_t size)
+{
+  while (size > 0) {
+    uint32_t length = size > 0xffffffff ? 0xffffffff : (uint32_t)size;
+    unsigned char op[5] = {DELTA_INSERT};
+
+    put32(op + 1, length);
+
+    if (!buffer_append(out, op, sizeof(op)) ||
+        !buffer_append(out, data, length))
+      return 0;
+
+    data += length;
+    size -= length;
+  }
+
+  return 1;
+}
+
+static int delta_copy(struct buffer* out, uint64_t offset, size_t size)
+{
+  while (size > 0) {
+    uint32_t length = size > 0xffffffff ? 0xffffffff : (uint32_t)size;
+    unsigned char op[13] = {DELTA_COPY};
+
+    put64(op + 1, offset);
+    put32(op + 9, length);
+
+    if (!buffer_append(out, op, sizeof(op)))
+      return 0;
+
+    offset += length;
+    size -= length;
+  }
+
+  return 1;
+}
+
+// Encodes new_data as copies from old_data and inserted bytes. Returns 0 if
+// the delta would not be smaller than limit and -1 on allocation failures.
+static int delta_encode(const unsigned char* old_data, size_t old_size,
+                        const unsigned char* new_data, size_t new_size,
+                        size_t limit, struct buffer* out)
+{
+  size_t block_count = old_size / DELTA_BLOCK_SIZE;
+  size_t table_size = 1;
+
+  while (table_size < block_count * 2)
+    table_size *= 2;
+
+  // Offsets (plus one) of the blocks of the old data by hash. Only the first
+  // block per slot is kept so runs of identical blocks can't degrade lookups.
+  size_t* table = (size_t*)calloc(table_size, sizeof(size_t));
+
+  if (table == NULL)
+    return -1;
+
+  for (size_t i = 0; i < block_count; i++) {
+    size_t* slot =
+        &table[delta_hash(old_data + i * DELTA_BLOCK_SIZE) & (table_size - 1)];
+
+    if (*slot == 0)
+      *slot = i * DELTA_BLOCK_SIZE + 1;
+  }
+
+  uint32_t power = 1;
+
+  for (size_t i = 1; i < DELTA_BLOCK_SIZE; i++)
+    power *= DELTA_HASH_BASE;
+
+  size_t literal = 0;
+  size_t position = 0;
+  uint32_t hash = 0;
+
+  if (block_count != 0 && new_size >= DELTA_BLOCK_SIZE)
+    hash = delta_hash(new_data);
+  else
+    position = new_size;
+
+  int ret = -1;
+
+  while (position + DELTA_BLOCK_SIZE <= new_size) {
+    size_t candidate = table[hash & (table_size - 1)];
+
+    if (candidate != 0 && memcmp(old_data + candidate - 1,
+                                 new_data + position, DELTA_BLOCK_SIZE) == 0) {
+      size_t offset = candidate - 1;
+      size_t length = DELTA_BLOCK_SIZE;
+
+      while (offset + length < old_size && position + length < new_size &&
+             old_data[offset + length] == new_data[position + length])
+        length++;
+
+      // Grow the match backwards into the bytes that would be inserted
+      while (position > literal && offset > 0 &&
+             old_data[offset - 1] == new_data[position - 1]) {
+        position--;
+        offset--;
+        length++;
+      }
+
+      if (!delta_insert(out, new_data + literal, position - literal) ||
+          !delta_copy(out, offset, length))
+        goto fail;
+
+      position += length;
+      literal = position;
+
+      if (out->size >= limit) {
+        ret = 0;
+        goto fail;
+      }
+
+      if (position + DELTA_BLOCK_SIZE <= new_size)
+        hash = delta_hash(new_data + position);
+
+      continue;
+    }
+
+    if (out->size + (position - literal) >= limit) {
+      ret = 0;
+      goto fail;
+    }
+
+    if (position + DELTA_BLOCK_SIZE < new_size)
+      hash = (hash - new_data[position] * power) * DELTA_HASH_BASE +
+             new_data[position + DELTA_BLOCK_SIZE];
+
+    position++;
+  }
+
+  if (!delta_insert(out, new_data + literal, new_size - literal))
+    goto fail;
+
+  ret = out->size < limit;
+
+fail:
+  free(table);
+
+  return ret;
+}
+
+static int delta_apply(const unsigned char* old_data, uint64_t old_size,
+                       const unsigned char* delta, uint64_t delta_size,
+                       unsigned char* out, uint64_t out_size)
+{
+  uint64_t position = 0;
+  uint64_t written = 0;
+
+  while (position < delta_size) {
+    unsigned char op = delta[position++];
+
+    if (op == DELTA_COPY) {
+      if (delta_size - position < 12)
+        return 0;
+
+      uint64_t offset = get64(delta + position);
+      uint64_t length = get32(delta + position + 8);
+
+      position += 12;
+
+      if (offset > old_size || length > old_size - offset ||
+          length > out_size - written)
+        return 0;
+
+      memcpy(out + written, old_data + offset, (size_t)length);
+      written += length;
+    } else if (op == DELTA_INSERT) {
+      if (delta_size - position < 4)
+        return 0;
+
+      uint64_t length = get32(delta + position);
+
+      position += 4;
+
+      if (length > delta_size - position || length > out_size - written)
+        return 0;
+
+      memcpy(out + written, delta + position, (size_t)length);
+      position += length;
+      written += length;
+    } else {
+      return 0;
+    }
+  }
+
+  return written == out_size;
+}
+
+static int hash_file(FILE* fh, unsigned char hash[20])
+{
+  unsigned char* chunk = (unsigned char*)malloc(PATCH_CHUNK_SIZE);
+
+  if (chunk == NULL || fseek(fh, 0, SEEK_SET) != 0) {
+    free(chunk);
+    return 0;
+  }
+
+  mbedtls_sha1_context sha1;
+
+  mbedtls_sha1_init(&sha1);
+  mbedtls_sha1_starts_ret(&sha1);
+
+  size_t length;
+
+  while ((length = fread(chunk, 1, PATCH_CHUNK_SIZE, fh)) > 0)
+    mbedtls_sha1_update_ret(&sha1, chunk, length);
+
+  int ret = !ferror(fh);
+
+  mbedtls_sha1_finish_ret(&sha1, hash);
+  mbedtls_sha1_free(&sha1);
+  free(chunk);
+
+  return ret;
+}
+
+// Extracts a content, empty contents yield a valid buffer as well
+static unsigned char* extract_content(wad_t wad, uint16_t position)
+{
+  if (tmd_get_content(wad_get_tmd(wad), position)->size == 0)
+    return (unsigned char*)malloc(1);
+
+  return data_extract_from_wad(wad, position, LIBWAD_VERIFY_HASH);
+}
+
+static int find_copy_source(tmd_t old_tmd, const tmd_content_t* content,
+                            uint16_t* source)
+{
+  for (uint16_t i = 0; i < tmd_get_content_count(old_tmd); i++) {
+    const tmd_content_t* candidate = tmd_get_content(old_tmd, i);
+
+    if (candidate->size == content->size &&
+        memcmp(candidate->hash, content->hash, sizeof(content->hash)) == 0) {
+      *source = i;
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+static int find_delta_source(tmd_t old_tmd, const tmd_content_t* content,
+                             uint16_t* source)
+{
+  for (uint16_t i = 0; i < tmd_get_content_count(old_tmd); i++) {
+    const tmd_content_t* candidate = tmd_get_content(old_tmd, i);
+
+    if (candidate->index == content->index && candidate->size != 0) {
+      *source = i;
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+// Writes the operation for one content of the new wad
+static int create_content(FILE* patch, wad_t old_wad, wad_t new_wad,
+                          uint16_t position, patch_content_info_t* info)
+{
+  tmd_t old_tmd = wad_get_tmd(old_wad);
+  const tmd_content_t* content = tmd_get_content(wad_get_tmd(new_wad), position);
+
+  info->size = content->size;
+
+  if (find_copy_source(old_tmd, content, &info->source)) {
+    info->op = PATCH_CONTENT_COPY;
+    info->patch_size = 3;
+
+    if (!write_value(patch, PATCH_CONTENT_COPY, 1) ||
+        !write_value(patch, info->source, 2)) {
+      patch_set_error("Failed to write patch");
+      return 0;
+    }
+
+    return 1;
+  }
+
+  unsigned char* new_data = extract_content(new_wad, position);
+
+  if (new_data == NULL) {
+    patch_set_error("Failed to extract content %hu: %s", position,
+                    libwad_get_error_msg());
+    return 0;
+  }
+
+  struct buffer delta = {0};
+  int ret = 0;
+
+  info->op = PATCH_CONTENT_FULL;
+
+  if (find_delta_source(old_tmd, content, &info->source)) {
+    unsigned char* old_data = extract_content(old_wad, info->source);
+
+    if (old_data == NULL) {
+      patch_set_error("Failed to extract content %hu of the old wad: %s",
+                      info->source, libwad_get_error_msg());
+      goto fail;
+    }
+
+    int encoded = delta_encode(
+        old_data, (size_t)tmd_get_content(old_tmd, info->source)->size,
+        new_data, (size_t)content->size, (size_t)content->size, &delta);
+
+    free(old_data);
+
+    if (encoded < 0) {
+      patch_set_error("Failed to allocate memory");
+      goto fail;
+    }
+
+    if (encoded)
+      info->op = PATCH_CONTENT_DELTA;
+  }
+
+  const unsigned char* payload = new_data;
+  uint64_t payload_size = content->size;
+
+  if (info->op == PATCH_CONTENT_DELTA) {
+    payload = delta.data;
+    payload_size = delta.size;
+  }
+
+  info->patch_size = 1 + (info->op == PATCH_CONTENT_DELTA ? 2 : 0) + 8 +
+                     payload_size;
+
+  if (!write_value(patch, info->op, 1) ||
+      (info->op == PATCH_CONTENT_DELTA &&
+       !write_value(patch, info->source, 2)) ||
+      !write_value(patch, payload_size, 8) ||
+      (payload_size != 0 &&
+       fwrite(payload, (size_t)payload_size, 1, patch) != 1)) {
+    patch_set_error("Failed to write patch");
+    goto fail;
+  }
+
+  ret = 1;
+
+fail:
+  free(delta.data);
+  free(new_data);
+
+  return ret;
+}
+
+// Reads one section of the new wad into a newly allocated buffer
+static unsigned char* read_section(FILE* new_file, wad_t new_wad,
+                                   wad_section_t section, uint32_t* size)
+{
+  *size = wad_get_section_size(new_wad, section);
+
+  unsigned char* data = (unsigned char*)malloc(*size + 1);
+
+  if (data == NULL) {
+    patch_set_error("Failed to allocate memory");
+    return NULL;
+  }
+
+  if (*size != 0 &&
+      (fseek(new_file, (long)wad_get_section_offset(new_wad, section),
+             SEEK_SET) != 0 ||
+       fread(data, *size, 1, new_file) != 1)) {
+    patch_set_error("Failed to read the sections of the new wad");
+    free(data);
+    return NULL;
+  }
+
+  return data;
+}
+
+// Rebuilds the new wad the way patch_apply() will, so wads laid out or
+// padded differently than the writer does it are refused before a patch is
+// written that could never be applied
+static int check_rebuild(FILE* new_file, wad_t new_wad,
+                         const unsigned char hash[20], const char* temp_path)
+{
+  unsigned char* sections[PATCH_SECTION_COUNT] = {NULL};
+  uint32_t sizes[PATCH_SECTION_COUNT];
+  wad_writer_t writer = NULL;
+  int ret = 0;
+
+  for (size_t i = 0; i < PATCH_SECTION_COUNT; i++) {
+    sections[i] = read_section(new_file, new_wad, PATCH_SECTIONS[i], &sizes[i]);
+
+    if (sections[i] == NULL)
+      goto fail;
+  }
+
+  writer = wad_writer_open(temp_path, sections[0], sizes[0], sections[1],
+                           sizes[1], sections[2], sizes[2]);
+
+  if (writer == NULL) {
+    patch_set_error("Failed to create '%s': %s", temp_path,
+                    libwad_get_error_msg());
+    goto fail;
+  }
+
+  tmd_t tmd = wad_get_tmd(new_wad);
+
+  for (uint16_t i = 0; i < tmd_get_content_count(tmd); i++) {
+    unsigned char* data = extract_content(new_wad, i);
+
+    if (data == NULL) {
+      patch_set_error("Failed to extract content %hu of the new wad: %s", i,
+                      libwad_get_error_msg());
+      goto fail;
+    }
+
+    int written = wad_writer_add_content(writer, data,
+                                         (size_t)tmd_get_content(tmd, i)->size);
+
+    free(data);
+
+    if (!written) {
+      patch_set_error("Failed to write '%s': %s", temp_path,
+                      libwad_get_error_msg());
+      goto fail;
+    }
+  }
+
+  int closed = wad_writer_close(writer, sections[3], sizes[3]);
+
+  writer = NULL;
+
+  if (!closed) {
+    patch_set_error("Failed to write '%s': %s", temp_path,
+                    libwad_get_error_msg());
+    goto fail;
+  }
+
+  FILE* rebuilt = fopen(temp_path, "rb");
+  unsigned char rebuilt_hash[20];
+
+  if (rebuilt == NULL || !hash_file(rebuilt, rebuilt_hash)) {
+    patch_set_error("Failed to read '%s'", temp_path);
+
+    if (rebuilt != NULL)
+      fclose(rebuilt);
+
+    goto fail;
+  }
+
+  fclose(rebuilt);
+
+  if (memcmp(rebuilt_hash, hash, 20) != 0) {
+    patch_set_error("The new wad is not laid out the way wadpatch rebuilds "
+                    "wads, a patch could not be applied");
+    goto fail;
+  }
+
+  ret = 1;
+
+fail:
+  wad_writer_abort(writer);
+  remove(temp_path);
+
+  for (size_t i = 0; i < PATCH_SECTION_COUNT; i++)
+    free(sections[i]);
+
+  return ret;
+}
+
+static int create_sections(FILE* patch, FILE* new_file, wad_t new_wad)
+{
+  for (size_t i = 0; i < PATCH_SECTION_COUNT; i++) {
+    uint32_t size;
+    unsigned char* section =
+        read_section(new_file, new_wad, PATCH_SECTIONS[i], &size);
+
+    if (section == NULL)
+      return 0;
+
+    int written = write_value(patch, size, 4) &&
+                  (size == 0 || fwrite(section, size, 1, patch) == 1);
+
+    free(section);
+
+    if (!written) {
+      patch_set_error("Failed to write patch");
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+int patch_create(const char* old_path, const char* new_path,
+                 const char* patch_path, patch_report_t report, void* user)
+{
+  wad_t old_wad = NULL;
+  wad_t new_wad = NULL;
+  FILE* new_file = NULL;
+  FILE* patch = NULL;
+  int ret = 0;
+
+  old_wad = wad_open(old_path);
+
+  if (old_wad == NULL) {
+    patch_set_error("Failed to open '%s': %s", old_path,
+                    libwad_get_error_msg());
+    goto fail;
+  }
+
+  new_wad = wad_open(new_path);
+
+  if (new_wad == NULL) {
+    patch_set_error("Failed to open '%s': %s", new_path,
+                    libwad_get_error_msg());
+    goto fail;
+  }
+
+  new_file = fopen(new_path, "rb");
+
+  if (new_file == NULL) {
+    patch_set_error("Failed to open '%s'", new_path);
+    goto fail;
+  }
+
+  patch = fopen(patch_path, "wb");
+
+  if (patch == NULL) {
+    patch_set_error("Failed to open '%s' for writing", patch_path);
+    goto fail;
+  }
+
+  unsigned char hash[20];
+
+  if (!hash_file(new_file, hash)) {
+    patch_set_error("Failed to read '%s'", new_path);
+    goto fail;
+  }
+
+  size_t temp_length = strlen(patch_path) + 7;
+  char* temp_path = (char*)malloc(temp_length);
+
+  if (temp_path == NULL) {
+    patch_set_error("Failed to allocate memory");
+    goto fail;
+  }
+
+  snprintf(temp_path, temp_length, "%s.check", patch_path);
+
+  int rebuilds = check_rebuild(new_file, new_wad, hash, temp_path);
+
+  free(temp_path);
+
+  if (!rebuilds)
+    goto fail;
+
+  uint16_t count = tmd_get_content_count(wad_get_tmd(new_wad));
+
+  if (fwrite(PATCH_MAGIC, 4, 1, patch) != 1 ||
+      !write_value(patch, PATCH_VERSION, 4)) {
+    patch_set_error("Failed to write patch");
+    goto fail;
+  }
+
+  if (!create_sections(patch, new_file, new_wad))
+    goto fail;
+
+  if (fwrite(hash, sizeof(hash), 1, patch) != 1 ||
+      !write_value(patch, count, 2)) {
+    patch_set_error("Failed to write patch");
+    goto fail;
+  }
+
+  for (uint16_t i = 0; i < count; i++) {
+    patch_content_info_t info;
+
+    if (!create_content(patch, old_wad, new_wad, i, &info))
+      goto fail;
+
+    if (report != NULL)
+      report(i, &info, user);
+  }
+
+  ret = 1;
+
+fail:
+  if (patch != NULL && fclose(patch) != 0 && ret) {
+    patch_set_error("Failed to write patch");
+    ret = 0;
+  }
+
+  if (!ret && patch != NULL)
+    remove(patch_path);
+
+  if (new_file != NULL)
+    fclose(new_file);
+
+  wad_close(new_wad);
+  wad_close(old_wad);
+
+  return ret;
+}
+
+// Reads the payload of an operation into a newly allocated buffer
+static unsigned char* read_payload(FILE* patch, uint64_t* size)
+{
+  if (!read_value(patch, size, 8) || *size > (size_t)-1 - 1) {
+    patch_set_error("Patch is malformed");
+    return NULL;
+  }
+
+  unsigned char* payload = (unsigned char*)malloc((size_t)*size + 1);
+
+  if (payload == NULL) {
+    patch_set_error("Failed to allocate memory");
+    return NULL;
+  }
+
+  if (*size != 0 && fread(payload, (size_t)*size, 1, patch) != 1) {
+    patch_set_error("Patch is truncated");
+    free(payload);
+    return NULL;
+  }
+
+  return payload;
+}
+
+// Rebuilds the decrypted data of one content of the new wad
+static unsigned char* apply_content(FILE* patch, wad_t old_wad,
+                                    uint64_t expected_size,
+                                    patch_content_info_t* info)
+{
+  tmd_t old_tmd = wad_get_tmd(old_wad);
+  uint64_t op;
+  uint64_t source = 0;
+
+  if (!read_value(patch, &op, 1) ||
+      (op != PATCH_CONTENT_FULL && !read_value(patch, &source, 2))) {
+    patch_set_error("Patch is truncated");
+    return NULL;
+  }
+
+  if (op > PATCH_CONTENT_FULL ||
+      (op != PATCH_CONTENT_FULL && source >= tmd_get_content_count(old_tmd))) {
+    patch_set_error("Patch is malformed");
+    return NULL;
+  }
+
+  info->op = (patch_content_op_t)op;
+  info->source = (uint16_t)source;
+  info->size = expected_size;
+  info->patch_size = op == PATCH_CONTENT_FULL ? 1 : 3;
+
+  if (op == PATCH_CONTENT_COPY) {
+    if (tmd_get_content(old_tmd, info->source)->size != expected_size) {
+      patch_set_error("Content %hu of the old wad does not match the patch",
+                      info->source);
+      return NULL;
+    }
+
+    unsigned char* data = extract_content(old_wad, info->source);
+
+    if (data == NULL)
+      patch_set_error("Failed to extract content %hu of the old wad: %s",
+                      info->source, libwad_get_error_msg());
+
+    return data;
+  }
+
+  uint64_t payload_size;
+  unsigned char* payload = read_payload(patch, &payload_size);
+
+  if (payload == NULL)
+    return NULL;
+
+  info->patch_size += 8 + payload_size;
+
+  if (op == PATCH_CONTENT_FULL) {
+    // The caller hashes and writes expected_size bytes of it
+    if (payload_size != expected_size) {
+      patch_set_error("Patch is malformed");
+      free(payload);
+      return NULL;
+    }
+
+    return payload;
+  }
+
+  unsigned char* old_data = extract_content(old_wad, info->source);
+
+  if (old_data == NULL) {
+    patch_set_error("Failed to extract content %hu of the old wad: %s",
+                    info->source, libwad_get_error_msg());
+    free(payload);
+    return NULL;
+  }
+
+  unsigned char* data = (unsigned char*)malloc((size_t)expected_size + 1);
+
+  if (data == NULL) {
+    patch_set_error("Failed to allocate memory");
+  } else if (!delta_apply(old_data, tmd_get_content(old_tmd, info->source)->size,
+                          payload, payload_size, data, expected_size)) {
+    patch_set_error("Delta does not apply to content %hu of the old wad",
+                    info->source);
+    free(data);
+    data = NULL;
+  }
+
+  free(old_data);
+  free(payload);
+
+  return data;
+}
+
+int patch_apply(const char* old_path, const char* patch_path,
+                const char* out_path, patch_report_t report, void* user)
+{
+  wad_t old_wad = NULL;
+  FILE* patch = NULL;
+  wad_writer_t writer = NULL;
+  unsigned char* sections[PATCH_SECTION_COUNT] = {NULL};
+  uint32_t sizes[PATCH_SECTION_COUNT] = {0};
+  int started = 0;
+  int ret = 0;
+
+  old_wad = wad_open(old_path);
+
+  if (old_wad == NULL) {
+    patch_set_error("Failed to open '%s': %s", old_path,
+                    libwad_get_error_msg());
+    goto fail;
+  }
+
+  patch = fopen(patch_path, "rb");
+
+  if (patch == NULL) {
+    patch_set_error("Failed to open '%s'", patch_path);
+    goto fail;
+  }
+
+  char magic[4];
+  uint64_t version;
+
+  if (fread(magic, sizeof(magic), 1, patch) != 1 ||
+      memcmp(magic, PATCH_MAGIC, sizeof(magic)) != 0 ||
+      !read_value(patch, &version, 4)) {
+    patch_set_error("'%s' is not a wad patch", patch_path);
+    goto fail;
+  }
+
+  if (version != PATCH_VERSION) {
+    patch_set_error("Unsupported patch version %u", (unsigned)version);
+    goto fail;
+  }
+
+  for (size_t i = 0; i < PATCH_SECTION_COUNT; i++) {
+    uint64_t size;
+
+    if (!read_value(patch, &size, 4)) {
+      patch_set_error("Patch is truncated");
+      goto fail;
+    }
+
+    sizes[i] = (uint32_t)size;
+    sections[i] = (unsigned char*)malloc(sizes[i] + 1);
+
+    if (sections[i] == NULL) {
+      patch_set_error("Failed to allocate memory");
+      goto fail;
+    }
+
+    if (sizes[i] != 0 && fread(sections[i], sizes[i], 1, patch) != 1) {
+      patch_set_error("Patch is truncated");
+      goto fail;
+    }
+  }
+
+  const unsigned char* tmd = sections[2];
+  uint32_t tmd_size = sizes[2];
+  unsigned char hash[20];
+  uint64_t count;
+
+  if (fread(hash, sizeof(hash), 1, patch) != 1 ||
+      !read_value(patch, &count, 2)) {
+    patch_set_error("Patch is truncated");
+    goto fail;
+  }
+
+  if (tmd_size < TMD_CONTENTS_OFFSET ||
+      get16(tmd + TMD_CONTENT_COUNT_OFFSET) != count) {
+    patch_set_error("Patch is malformed");
+    goto fail;
+  }
+
+  writer = wad_writer_open(out_path, sections[0], sizes[0], sections[1],
+                           sizes[1], tmd, tmd_size);
+
+  if (writer == NULL) {
+    patch_set_error("Failed to create '%s': %s", out_path,
+                    libwad_get_error_msg());
+    goto fail;
+  }
+
+  started = 1;
+
+  // The writer verified that the tmd holds a record for every content
+  for (uint16_t i = 0; i < count; i++) {
+    const unsigned char* record =
+        tmd + TMD_CONTENTS_OFFSET + i * TMD_CONTENT_SIZE;
+    uint64_t size = get64(record + 8);
+    patch_content_info_t info;
+    unsigned char* data = apply_content(patch, old_wad, size, &info);
+
+    if (data == NULL)
+      goto fail;
+
+    unsigned char content_hash[20];
+
+    mbedtls_sha1_ret(data, (size_t)size, content_hash);
+
+    if (memcmp(content_hash, record + 16, sizeof(content_hash)) != 0) {
+      patch_set_error("Content %hu does not match the hash in the tmd", i);
+      free(data);
+      goto fail;
+    }
+
+    int written = wad_writer_add_content(writer, data, (size_t)size);
+
+    free(data);
+
+    if (!written) {
+      patch_set_error("Failed to write '%s': %s", out_path,
+                      libwad_get_error_msg());
+      goto fail;
+    }
+
+    if (report != NULL)
+      report(i, &info, user);
+  }
+
+  int closed = wad_writer_close(writer, sections[3], sizes[3]);
+
+  writer = NULL;
+
+  if (!closed) {
+    patch_set_error("Failed to write '%s': %s", out_path,
+                    libwad_get_error_msg());
+    goto fail;
+  }
+
+  FILE* out = fopen(out_path, "rb");
+  unsigned char out_hash[20];
+
+  if (out == NULL || !hash_file(out, out_hash)) {
+    patch_set_error("Failed to read '%s'", out_path);
+
+    if (out != NULL)
+      fclose(out);
+
+    goto fail;
+  }
+
+  fclose(out);
+
+  // The contents are right at this point, so a mismatch means the new wad
+  // was laid out or padded differently than the writer does it
+  if (memcmp(out_hash, hash, sizeof(hash)) != 0) {
+    patch_set_error("Rebuilt wad does not match the SHA-1 of the new wad");
+    goto fail;
+  }
+
+  ret = 1;
+
+fail:
+  wad_writer_abort(writer);
+
+  if (!ret && started)
+    remove(out_path);
+
+  for (size_t i = 0; i < PATCH_SECTION_COUNT; i++)
+    free(sections[i]);
+
+  if (patch != NULL)
+    fclose(patch);
+
+  wad_close(old_wad);
+
+  return ret;
+}
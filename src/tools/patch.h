@@ -0,0 +1,51 @@
+// Copyright 2019 spycrab0
+// Licensed under GPLv3+
+// Refer to the LICENSE file included.
+
+#ifndef PATCH_H
+#define PATCH_H
+
+#include <libwad.h>
+
+// Patch files start with the magic and version, followed by the certificate
+// chain, ticket, tmd and footer of the new wad, the SHA-1 of the whole new wad
+// and one operation per content of the new wad. All integers are big endian.
+#define PATCH_MAGIC "WPAT"
+#define PATCH_VERSION 1
+
+typedef enum {
+  // Reuse a content of the old wad with the same size and hash
+  PATCH_CONTENT_COPY = 0,
+  // Rebuild the content from a content of the old wad and a delta
+  PATCH_CONTENT_DELTA = 1,
+  // Store the decrypted content as is
+  PATCH_CONTENT_FULL = 2
+} patch_content_op_t;
+
+typedef struct {
+  patch_content_op_t op;
+  // Position of the content in the old wad used by copies and deltas
+  uint16_t source;
+  // Size of the content in the new wad
+  uint64_t size;
+  // Bytes the operation takes up in the patch
+  uint64_t patch_size;
+} patch_content_info_t;
+
+typedef void (*patch_report_t)(uint16_t position,
+                               const patch_content_info_t* info, void* user);
+
+// Writes a patch turning the old wad into the new one, report is called for
+// every content once it was written
+int patch_create(const char* old_path, const char* new_path,
+                 const char* patch_path, patch_report_t report, void* user);
+
+// Rebuilds the new wad from the old one and the patch, verifying the hash of
+// every content and of the whole output
+int patch_apply(const char* old_path, const char* patch_path,
+                const char* out_path, patch_report_t report, void* user);
+
+// Returns a description of the last failure of patch_create or patch_apply
+const char* patch_get_error();
+
+#endif
@@ -0,0 +1,1012 @@
+// Copyright 2019 spycrab0
+// Licensed under GPLv3+
+// Refer to the LICENSE file included.
+
+#define _GNU_SOURCE
+
+#include "serve.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "archive.h"
+
+// Largest request head we accept
+#define SERVE_HEADER_LIMIT 8192
+
+// Amount of data read and sent at once
+#define SERVE_CHUNK_SIZE 0x100000
+
+// Seconds a connection may stay idle
+#define SERVE_TIMEOUT 30
+
+// Accepted connections waiting for a thread
+#define SERVE_QUEUE_SIZE 256
+
+// Milliseconds to wait before accepting again when out of file descriptors
+#define SERVE_ACCEPT_BACKOFF 100
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+static const char* SERVE_SECTION_NAMES[] = {"header", "certchain", "ticket",
+                                            "tmd",    "data",      "footer"};
+
+struct serve_title {
+  uint64_t title_id;
+  char* path;
+};
+
+struct serve_handle {
+  size_t title;
+  wad_t wad;
+  unsigned refs;
+  uint64_t last_used;
+  // Handles opened while the pool was busy are closed once released
+  int pooled;
+};
+
+struct serve_state {
+  const serve_options_t* options;
+
+  struct serve_title* titles;
+  size_t title_count;
+
+  pthread_mutex_t pool_lock;
+  struct serve_handle* handles;
+  size_t handle_count;
+  uint64_t clock;
+
+  pthread_mutex_t queue_lock;
+  pthread_cond_t queue_cond;
+  pthread_cond_t space_cond;
+  int queue[SERVE_QUEUE_SIZE];
+  size_t queue_head;
+  size_t queue_count;
+};
+
+struct serve_request {
+  char method[8];
+  char target[1024];
+  char range[128];
+  int has_range;
+  int keep_alive;
+};
+
+struct serve_connection {
+  int fd;
+  char buffer[SERVE_HEADER_LIMIT];
+  size_t used;
+};
+
+typedef int (*serve_reader_t)(wad_t wad, unsigned which, uint64_t offset,
+                              size_t length, unsigned char* dst);
+
+static int serve_read_content(wad_t wad, unsigned which, uint64_t offset,
+                              size_t length, unsigned char* dst)
+{
+  return data_read_range(wad, (uint16_t)which, offset, length, dst);
+}
+
+static int serve_read_section(wad_t wad, unsigned which, uint64_t offset,
+                              size_t length, unsigned char* dst)
+{
+  return wad_read_section(wad, (wad_section_t)which, offset, length, dst);
+}
+
+static int serve_compare_titles(const void* a, const void* b)
+{
+  uint64_t x = ((const struct serve_title*)a)->title_id;
+  uint64_t y = ((const struct serve_title*)b)->title_id;
+
+  return x < y ? -1 : x > y;
+}
+
+// Reads the title id of every wad in the directory
+static int serve_index(struct serve_state* state)
+{
+  int count;
+  char** paths = archive_list_wads(state->options->directory, &count);
+
+  if (paths == NULL) {
+    fprintf(stderr, "Failed to list wads in '%s'\n",
+            state->options->directory);
+    return 0;
+  }
+
+  state->titles = (struct serve_title*)calloc(count > 0 ? count : 1,
+                                              sizeof(struct serve_title));
+
+  if (state->titles == NULL) {
+    archive_free_list(paths, count);
+    return 0;
+  }
+
+  for (int i = 0; i < count; i++) {
+    wad_t wad = wad_open_ex(paths[i], state->options->io_policy);
+
+    if (wad == NULL) {
+      fprintf(stderr, "%s: Failed to open: %s\n", paths[i],
+              libwad_get_error_msg());
+      free(paths[i]);
+      continue;
+    }
+
+    struct serve_title* title = &state->titles[state->title_count++];
+
+    title->title_id = tmd_get_title_id(wad_get_tmd(wad));
+    title->path = paths[i];
+
+    wad_close(wad);
+  }
+
+  free(paths);
+
+  qsort(state->titles, state->title_count, sizeof(struct serve_title),
+        serve_compare_titles);
+
+  // Only the first wad of a title is served
+  size_t kept = 0;
+
+  for (size_t i = 0; i < state->title_count; i++) {
+    if (kept > 0 &&
+        state->titles[kept - 1].title_id == state->titles[i].title_id) {
+      fprintf(stderr, "%s: Skipped, %016" PRIx64 " is served from %s\n",
+              state->titles[i].path, state->titles[i].title_id,
+              state->titles[kept - 1].path);
+      free(state->titles[i].path);
+      continue;
+    }
+
+    state->titles[kept++] = state->titles[i];
+  }
+
+  state->title_count = kept;
+
+  return 1;
+}
+
+static struct serve_title* serve_find_title(struct serve_state* state,
+                                            uint64_t title_id)
+{
+  struct serve_title key = {title_id, NULL};
+
+  return (struct serve_title*)bsearch(&key, state->titles, state->title_count,
+                                      sizeof(struct serve_title),
+                                      serve_compare_titles);
+}
+
+// Finds the pooled handle of a title, or else a slot a new one could take: a
+// free one or the least recently used handle nobody is reading from. Called
+// with the pool lock held.
+static struct serve_handle* serve_lookup(struct serve_state* state,
+                                         size_t title,
+                                         struct serve_handle** slot)
+{
+  *slot = NULL;
+
+  for (size_t i = 0; i < state->handle_count; i++) {
+    struct serve_handle* entry = &state->handles[i];
+
+    if (entry->wad != NULL && entry->title == title)
+      return entry;
+
+    if (entry->wad == NULL ||
+        (entry->refs == 0 &&
+         (*slot == NULL ||
+          ((*slot)->wad != NULL && entry->last_used < (*slot)->last_used))))
+      *slot = entry;
+  }
+
+  return NULL;
+}
+
+// Gets an open handle for a title, reusing the pool where possible
+static struct serve_handle* serve_acquire(struct serve_state* state,
+                                          size_t title)
+{
+  pthread_mutex_lock(&state->pool_lock);
+
+  struct serve_handle* slot;
+  struct serve_handle* handle = serve_lookup(state, title, &slot);
+
+  if (handle != NULL) {
+    handle->refs++;
+    handle->last_used = ++state->clock;
+    pthread_mutex_unlock(&state->pool_lock);
+    return handle;
+  }
+
+  pthread_mutex_unlock(&state->pool_lock);
+
+  // Opening reads and parses the wad, don't hold up other connections
+  wad_t wad =
+      wad_open_ex(state->titles[title].path, state->options->io_policy);
+
+  if (wad == NULL)
+    return NULL;
+
+  pthread_mutex_lock(&state->pool_lock);
+
+  // Another connection may have opened the title in the meantime
+  handle = serve_lookup(state, title, &slot);
+
+  if (handle == NULL && state->handle_count < state->options->pool_size &&
+      (slot == NULL || slot->wad != NULL))
+    slot = &state->handles[state->handle_count++];
+
+  wad_t unused = NULL;
+
+  if (handle != NULL) {
+    unused = wad;
+  } else if (slot != NULL) {
+    // Evict the least recently used handle nobody is reading from
+    unused = slot->wad;
+    handle = slot;
+    handle->pooled = 1;
+  } else {
+    handle = (struct serve_handle*)calloc(1, sizeof(struct serve_handle));
+
+    if (handle == NULL) {
+      pthread_mutex_unlock(&state->pool_lock);
+      wad_close(wad);
+      return NULL;
+    }
+  }
+
+  if (unused != wad) {
+    handle->title = title;
+    handle->wad = wad;
+    handle->refs = 0;
+  }
+
+  handle->refs++;
+  handle->last_used = ++state->clock;
+
+  pthread_mutex_unlock(&state->pool_lock);
+
+  wad_close(unused);
+
+  return handle;
+}
+
+static void serve_release(struct serve_state* state,
+                          struct serve_handle* handle)
+{
+  pthread_mutex_lock(&state->pool_lock);
+
+  if (--handle->refs == 0 && !handle->pooled) {
+    wad_close(handle->wad);
+    free(handle);
+  }
+
+  pthread_mutex_unlock(&state->pool_lock);
+}
+
+static int serve_send_all(int fd, const void* data, size_t size)
+{
+  const char* pos = (const char*)data;
+
+  while (size > 0) {
+    ssize_t sent = send(fd, pos, size, MSG_NOSIGNAL);
+
+    if (sent < 0 && errno == EINTR)
+      continue;
+
+    if (sent <= 0)
+      return 0;
+
+    pos += sent;
+    size -= (size_t)sent;
+  }
+
+  return 1;
+}
+
+static const char* serve_reason(int status)
+{
+  switch (status) {
+  case 200:
+    return "OK";
+  case 206:
+    return "Partial Content";
+  case 400:
+    return "Bad Request";
+  case 404:
+    return "Not Found";
+  case 405:
+    return "Method Not Allowed";
+  case 416:
+    return "Range Not Satisfiable";
+  case 431:
+    return "Request Header Fields Too Large";
+  case 501:
+    return "Not Implemented";
+  default:
+    return "Internal Server Error";
+  }
+}
+
+static void serve_log(struct serve_state* state,
+                      const struct serve_request* request, int status,
+                      uint64_t length)
+{
+  if (state->options->quiet)
+    return;
+
+  printf("%s %s %d %" PRIu64 "\n", request->method, request->target, status,
+         length);
+  fflush(stdout);
+}
+
+static int serve_send_head(struct serve_connection* connection, int status,
+                           const char* type, uint64_t length,
+                           const char* extra, int keep_alive)
+{
+  char head[512];
+
+  int size = snprintf(head, sizeof(head),
+                      "HTTP/1.1 %d %s\r\n"
+                      "Content-Type: %s\r\n"
+                      "Content-Length: %" PRIu64 "\r\n"
+                      "%s"
+                      "Connection: %s\r\n\r\n",
+                      status, serve_reason(status), type, length,
+                      extra != NULL ? extra : "",
+                      keep_alive ? "keep-alive" : "close");
+
+  return size > 0 && (size_t)size < sizeof(head) &&
+         serve_send_all(connection->fd, head, (size_t)size);
+}
+
+// Sends a short text body, returns whether the connection stays open
+static int serve_send_text(struct serve_state* state,
+                           struct serve_connection* connection,
+                           const struct serve_request* request, int status,
+                           const char* text, const char* extra)
+{
+  size_t length = strlen(text);
+
+  serve_log(state, request, status, length);
+
+  return serve_send_head(connection, status, "text/plain", length, extra,
+                         request->keep_alive) &&
+         (strcmp(request->method, "HEAD") == 0 ||
+          serve_send_all(connection->fd, text, length)) &&
+         request->keep_alive;
+}
+
+static int serve_send_error(struct serve_state* state,
+                            struct serve_connection* connection,
+                            const struct serve_request* request, int status)
+{
+  char text[64];
+
+  snprintf(text, sizeof(text), "%s\n", serve_reason(status));
+
+  return serve_send_text(state, connection, request, status, text, NULL);
+}
+
+// Parses a Range header, returns 1 for a range within the data, -1 if it
+// can't be satisfied and 0 if it should be ignored. Several ranges at once
+// are answered with the whole data, as HTTP allows.
+static int serve_parse_range(const char* value, uint64_t size, uint64_t* first,
+                             uint64_t* last)
+{
+  if (strncasecmp(value, "bytes=", 6) != 0 || strchr(value, ',') != NULL)
+    return 0;
+
+  const char* spec = value + 6;
+  char* end;
+
+  if (*spec == '-') {
+    if (!isdigit((unsigned char)spec[1]))
+      return 0;
+
+    uint64_t suffix = strtoull(spec + 1, &end, 10);
+
+    if (*end != '\0')
+      return 0;
+
+    if (suffix == 0 || size == 0)
+      return -1;
+
+    *first = suffix < size ? size - suffix : 0;
+    *last = size - 1;
+    return 1;
+  }
+
+  if (!isdigit((unsigned char)*spec))
+    return 0;
+
+  *first = strtoull(spec, &end, 10);
+
+  if (*end != '-')
+    return 0;
+
+  spec = end + 1;
+  *last = UINT64_MAX;
+
+  if (*spec != '\0') {
+    if (!isdigit((unsigned char)*spec))
+      return 0;
+
+    *last = strtoull(spec, &end, 10);
+
+    if (*end != '\0' || *last < *first)
+      return 0;
+  }
+
+  if (*first >= size)
+    return -1;
+
+  if (*last >= size)
+    *last = size - 1;
+
+  return 1;
+}
+
+// Sends the requested range of a content or section, decrypting only what
+// the range covers
+static int serve_send_data(struct serve_state* state,
+                           struct serve_connection* connection,
+                           const struct serve_request* request, wad_t wad,
+                           serve_reader_t reader, unsigned which,
+                           uint64_t size)
+{
+  uint64_t first = 0, last = size - 1;
+  int status = 200;
+  char extra[128];
+
+  if (request->has_range) {
+    int range = serve_parse_range(request->range, size, &first, &last);
+
+    if (range < 0) {
+      snprintf(extra, sizeof(extra), "Content-Range: bytes */%" PRIu64 "\r\n",
+               size);
+      return serve_send_text(state, connection, request, 416,
+                             "Range Not Satisfiable\n", extra);
+    }
+
+    if (range > 0)
+      status = 206;
+  }
+
+  uint64_t length = size != 0 ? last - first + 1 : 0;
+
+  if (status == 206)
+    snprintf(extra, sizeof(extra),
+             "Accept-Ranges: bytes\r\n"
+             "Content-Range: bytes %" PRIu64 "-%" PRIu64 "/%" PRIu64 "\r\n",
+             first, last, size);
+  else
+    snprintf(extra, sizeof(extra), "Accept-Ranges: bytes\r\n");
+
+  int head = strcmp(request->method, "HEAD") == 0;
+
+  size_t buffer_size =
+      length < SERVE_CHUNK_SIZE ? (size_t)length : SERVE_CHUNK_SIZE;
+  unsigned char* buffer = NULL;
+
+  // The first chunk is read up front so failures still get a proper status
+  if (!head && length != 0) {
+    buffer = (unsigned char*)malloc(buffer_size);
+
+    if (buffer == NULL)
+      return serve_send_error(state, connection, request, 500);
+
+    if (!reader(wad, which, first, buffer_size, buffer)) {
+      free(buffer);
+      return serve_send_error(
+          state, connection, request,
+          libwad_get_error() == LIBWAD_NOT_SUPPORTED ? 501 : 500);
+    }
+  }
+
+  serve_log(state, request, status, length);
+
+  int result = serve_send_head(connection, status, "application/octet-stream",
+                               length, extra, request->keep_alive);
+
+  for (uint64_t offset = 0; result && buffer != NULL && offset < length;) {
+    size_t chunk = (size_t)(length - offset < buffer_size ? length - offset
+                                                          : buffer_size);
+
+    // Headers are out, so failing from here on can only drop the connection
+    result = (offset == 0 || reader(wad, which, first + offset, chunk,
+                                    buffer)) &&
+             serve_send_all(connection->fd, buffer, chunk);
+
+    offset += chunk;
+  }
+
+  free(buffer);
+
+  return result && request->keep_alive;
+}
+
+static int serve_list_titles(struct serve_state* state,
+                             struct serve_connection* connection,
+                             const struct serve_request* request)
+{
+  size_t capacity = state->title_count * 64 + 1;
+  char* text = (char*)malloc(capacity);
+
+  if (text == NULL)
+    return serve_send_error(state, connection, request, 500);
+
+  size_t length = 0;
+
+  text[0] = '\0';
+
+  for (size_t i = 0; i < state->title_count; i++) {
+    const char* path = state->titles[i].path;
+    const char* name = strrchr(path, '/');
+
+    length += snprintf(text + length, capacity - length, "%016" PRIx64 " %.*s\n",
+                       state->titles[i].title_id, 40,
+                       name != NULL ? name + 1 : path);
+  }
+
+  int result =
+      serve_send_text(state, connection, request, 200, text, NULL);
+
+  free(text);
+
+  return result;
+}
+
+static int serve_list_title(struct serve_state* state,
+                            struct serve_connection* connection,
+                            const struct serve_request* request, wad_t wad)
+{
+  tmd_t tmd = wad_get_tmd(wad);
+  uint16_t count = tmd_get_content_count(tmd);
+
+  size_t capacity = (size_t)(WAD_SECTION_FOOTER + 1 + count) * 48 + 1;
+  char* text = (char*)malloc(capacity);
+
+  if (text == NULL)
+    return serve_send_error(state, connection, request, 500);
+
+  size_t length = 0;
+
+  text[0] = '\0';
+
+  for (int i = 0; i <= WAD_SECTION_FOOTER; i++)
+    length += snprintf(text + length, capacity - length, "section/%s %u\n",
+                       SERVE_SECTION_NAMES[i],
+                       wad_get_section_size(wad, (wad_section_t)i));
+
+  for (uint16_t i = 0; i < count; i++)
+    length += snprintf(text + length, capacity - length,
+                       "content/%hu %" PRIu64 "\n", i,
+                       tmd_get_content(tmd, i)->size);
+
+  int result =
+      serve_send_text(state, connection, request, 200, text, NULL);
+
+  free(text);
+
+  return result;
+}
+
+// Routes /(title id)/section/(name) and /(title id)/content/(index)
+static int serve_title(struct serve_state* state,
+                       struct serve_connection* connection,
+                       const struct serve_request* request, const char* path)
+{
+  char* end;
+  uint64_t title_id = strtoull(path, &end, 16);
+
+  struct serve_title* title =
+      end != path && (*end == '\0' || *end == '/')
+          ? serve_find_title(state, title_id)
+          : NULL;
+
+  if (title == NULL)
+    return serve_send_error(state, connection, request, 404);
+
+  const char* rest = *end == '/' ? end + 1 : end;
+
+  struct serve_handle* handle =
+      serve_acquire(state, (size_t)(title - state->titles));
+
+  if (handle == NULL)
+    return serve_send_error(state, connection, request, 500);
+
+  wad_t wad = handle->wad;
+  int result = -1;
+
+  if (*rest == '\0') {
+    result = serve_list_title(state, connection, request, wad);
+  } else if (strncmp(rest, "section/", 8) == 0) {
+    for (int i = 0; i <= WAD_SECTION_FOOTER && result < 0; i++) {
+      if (strcmp(rest + 8, SERVE_SECTION_NAMES[i]) == 0)
+        result = serve_send_data(state, connection, request, wad,
+                                 serve_read_section, (unsigned)i,
+                                 wad_get_section_size(wad, (wad_section_t)i));
+    }
+  } else if (strncmp(rest, "content/", 8) == 0 &&
+             isdigit((unsigned char)rest[8])) {
+    unsigned long index = strtoul(rest + 8, &end, 10);
+    tmd_content_t* content =
+        *end == '\0' && index <= UINT16_MAX
+            ? tmd_get_content(wad_get_tmd(wad), (uint16_t)index)
+            : NULL;
+
+    if (content != NULL)
+      result = serve_send_data(state, connection, request, wad,
+                               serve_read_content, (unsigned)index,
+                               content->size);
+  }
+
+  serve_release(state, handle);
+
+  if (result < 0)
+    return serve_send_error(state, connection, request, 404);
+
+  return result;
+}
+
+// Answers one request, returns whether the connection stays open
+static int serve_handle(struct serve_state* state,
+                        struct serve_connection* connection,
+                        struct serve_request* request)
+{
+  if (strcmp(request->method, "GET") != 0 &&
+      strcmp(request->method, "HEAD") != 0)
+    return serve_send_text(state, connection, request, 405,
+                           "Method Not Allowed\n", "Allow: GET, HEAD\r\n");
+
+  char* query = strchr(request->target, '?');
+
+  if (query != NULL)
+    *query = '\0';
+
+  if (request->target[0] != '/')
+    return serve_send_error(state, connection, request, 400);
+
+  if (request->target[1] == '\0')
+    return serve_list_titles(state, connection, request);
+
+  return serve_title(state, connection, request, request->target + 1);
+}
+
+static char* serve_trim(char* value)
+{
+  while (*value == ' ' || *value == '\t')
+    value++;
+
+  size_t length = strlen(value);
+
+  while (length > 0 && (value[length - 1] == ' ' || value[length - 1] == '\t'))
+    value[--length] = '\0';
+
+  return value;
+}
+
+// Parses the request head in the buffer, returns 0 if it is malformed
+static int serve_parse(char* head, struct serve_request* request)
+{
+  memset(request, 0, sizeof(struct serve_request));
+
+  char* line_end = strstr(head, "\r\n");
+
+  if (line_end == NULL)
+    return 0;
+
+  *line_end = '\0';
+
+  char version[16];
+
+  if (sscanf(head, "%7s %1023s %15s", request->method, request->target,
+             version) != 3 ||
+      strncmp(version, "HTTP/1.", 7) != 0)
+    return 0;
+
+  request->keep_alive = strcmp(version, "HTTP/1.0") != 0;
+
+  for (char* line = line_end + 2; *line != '\0';) {
+    line_end = strstr(line, "\r\n");
+
+    if (line_end == NULL)
+      return 0;
+
+    *line_end = '\0';
+
+    char* colon = strchr(line, ':');
+
+    if (colon == NULL)
+      return 0;
+
+    *colon = '\0';
+
+    char* value = serve_trim(colon + 1);
+
+    if (strcasecmp(line, "Connection") == 0) {
+      if (strcasecmp(value, "close") == 0)
+        request->keep_alive = 0;
+      else if (strcasecmp(value, "keep-alive") == 0)
+        request->keep_alive = 1;
+    } else if (strcasecmp(line, "Range") == 0) {
+      snprintf(request->range, sizeof(request->range), "%s", value);
+      request->has_range = 1;
+    } else if (strcasecmp(line, "Content-Length") == 0 ||
+               strcasecmp(line, "Transfer-Encoding") == 0) {
+      // Bodies are never read, so the connection can't be reused
+      request->keep_alive = 0;
+    }
+
+    line = line_end + 2;
+  }
+
+  return 1;
+}
+
+static void serve_connection(struct serve_state* state, int fd)
+{
+  struct serve_connection* connection =
+      (struct serve_connection*)malloc(sizeof(struct serve_connection));
+
+  if (connection == NULL)
+    return;
+
+  connection->fd = fd;
+  connection->used = 0;
+
+  for (;;) {
+    char* end = NULL;
+
+    // Requests may arrive pipelined, so leftovers are kept in the buffer
+    while ((end = (char*)memmem(connection->buffer, connection->used,
+                                "\r\n\r\n", 4)) == NULL &&
+           connection->used < sizeof(connection->buffer) - 1) {
+      ssize_t received =
+          recv(fd, connection->buffer + connection->used,
+               sizeof(connection->buffer) - 1 - connection->used, 0);
+
+      if (received < 0 && errno == EINTR)
+        continue;
+
+      if (received <= 0)
+        break;
+
+      connection->used += (size_t)received;
+    }
+
+    struct serve_request request;
+
+    if (end == NULL) {
+      // Don't bother answering connections that just went away
+      if (connection->used == sizeof(connection->buffer) - 1) {
+        memset(&request, 0, sizeof(request));
+        snprintf(request.method, sizeof(request.method), "-");
+        serve_send_error(state, connection, &request, 431);
+      }
+
+      break;
+    }
+
+    size_t head_size = (size_t)(end - connection->buffer) + 4;
+
+    // Lines are split as strings, so a NUL would hide the rest of the head
+    int valid = memchr(connection->buffer, '\0', head_size) == NULL;
+
+    // Keep the blank line's first CRLF so every header line ends with one
+    end[2] = '\0';
+
+    int keep_open;
+
+    if (!valid || !serve_parse(connection->buffer, &request)) {
+      memset(&request, 0, sizeof(request));
+      snprintf(request.method, sizeof(request.method), "-");
+      serve_send_error(state, connection, &request, 400);
+      keep_open = 0;
+    } else {
+      keep_open = serve_handle(state, connection, &request);
+    }
+
+    if (!keep_open)
+      break;
+
+    connection->used -= head_size;
+    memmove(connection->buffer, connection->buffer + head_size,
+            connection->used);
+  }
+
+  free(connection);
+}
+
+static void* serve_worker(void* arg)
+{
+  struct serve_state* state = (struct serve_state*)arg;
+
+  for (;;) {
+    pthread_mutex_lock(&state->queue_lock);
+
+    while (state->queue_count == 0)
+      pthread_cond_wait(&state->queue_cond, &state->queue_lock);
+
+    int fd = state->queue[state->queue_head];
+
+    state->queue_head = (state->queue_head + 1) % SERVE_QUEUE_SIZE;
+    state->queue_count--;
+
+    pthread_cond_signal(&state->space_cond);
+    pthread_mutex_unlock(&state->queue_lock);
+
+    serve_connection(state, fd);
+    close(fd);
+  }
+
+  return NULL;
+}
+
+static int serve_listen(const serve_options_t* options)
+{
+  struct addrinfo hints;
+  struct addrinfo* addresses;
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE;
+
+  int error = getaddrinfo(options->address, options->port, &hints, &addresses);
+
+  if (error != 0) {
+    fprintf(stderr, "Failed to resolve '%s': %s\n", options->address,
+            gai_strerror(error));
+    return -1;
+  }
+
+  int fd = -1;
+
+  for (struct addrinfo* address = addresses; address != NULL && fd < 0;
+       address = address->ai_next) {
+    fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+
+    if (fd < 0)
+      continue;
+
+    int yes = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+    if (bind(fd, address->ai_addr, address->ai_addrlen) != 0 ||
+        listen(fd, SOMAXCONN) != 0) {
+      close(fd);
+      fd = -1;
+    }
+  }
+
+  freeaddrinfo(addresses);
+
+  if (fd < 0)
+    fprintf(stderr, "Failed to listen on %s:%s: %s\n", options->address,
+            options->port, strerror(errno));
+
+  return fd;
+}
+
+int serve_run(const serve_options_t* options)
+{
+  struct serve_state* state =
+      (struct serve_state*)calloc(1, sizeof(struct serve_state));
+
+  if (state == NULL)
+    return 1;
+
+  state->options = options;
+  state->handles = (struct serve_handle*)calloc(
+      options->pool_size > 0 ? options->pool_size : 1,
+      sizeof(struct serve_handle));
+
+  if (state->handles == NULL || !serve_index(state))
+    return 1;
+
+  pthread_mutex_init(&state->pool_lock, NULL);
+  pthread_mutex_init(&state->queue_lock, NULL);
+  pthread_cond_init(&state->queue_cond, NULL);
+  pthread_cond_init(&state->space_cond, NULL);
+
+  // Clients hanging up mid-response must not take the server down
+  signal(SIGPIPE, SIG_IGN);
+
+  int listen_fd = serve_listen(options);
+
+  if (listen_fd < 0)
+    return 1;
+
+  struct sockaddr_storage address;
+  socklen_t address_size = sizeof(address);
+  char port[NI_MAXSERV] = "?";
+
+  if (getsockname(listen_fd, (struct sockaddr*)&address, &address_size) == 0)
+    getnameinfo((struct sockaddr*)&address, address_size, NULL, 0, port,
+                sizeof(port), NI_NUMERICSERV);
+
+  unsigned started = 0;
+
+  for (; started < options->threads; started++) {
+    pthread_t thread;
+
+    if (pthread_create(&thread, NULL, serve_worker, state) != 0)
+      break;
+
+    pthread_detach(thread);
+  }
+
+  if (started == 0) {
+    fprintf(stderr, "Failed to start threads\n");
+    close(listen_fd);
+    return 1;
+  }
+
+  printf("Serving %zu titles on port %s\n", state->title_count, port);
+  fflush(stdout);
+
+  int out_of_fds = 0;
+
+  for (;;) {
+    int fd = accept(listen_fd, NULL, NULL);
+
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+
+      // The pending connection stays queued, so retrying at once would spin
+      // until another connection closes
+      if (errno == EMFILE || errno == ENFILE) {
+        if (!out_of_fds)
+          fprintf(stderr, "Out of file descriptors, waiting for connections "
+                          "to close\n");
+
+        out_of_fds = 1;
+
+        struct timespec delay = {0, SERVE_ACCEPT_BACKOFF * 1000000L};
+        nanosleep(&delay, NULL);
+        continue;
+      }
+
+      fprintf(stderr, "Failed to accept connections: %s\n", strerror(errno));
+      break;
+    }
+
+    out_of_fds = 0;
+
+    struct timeval timeout = {SERVE_TIMEOUT, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    pthread_mutex_lock(&state->queue_lock);
+
+    while (state->queue_count == SERVE_QUEUE_SIZE)
+      pthread_cond_wait(&state->space_cond, &state->queue_lock);
+
+    state->queue[(state->queue_head + state->queue_count) % SERVE_QUEUE_SIZE] =
+        fd;
+    state->queue_count++;
+
+    pthread_cond_signal(&state->queue_cond);
+    pthread_mutex_unlock(&state->queue_lock);
+  }
+
+  close(listen_fd);
+
+  return 1;
+}
@@ -0,0 +1,27 @@
+// Copyright 2019 spycrab0
+// Licensed under GPLv3+
+// Refer to the LICENSE file included.
+
+#ifndef SERVE_H
+#define SERVE_H
+
+#include <libwad.h>
+
+typedef struct {
+  // Directory holding the wads to serve
+  const char* directory;
+  const char* address;
+  const char* port;
+  // Number of connections handled at once
+  unsigned threads;
+  // Number of wads kept open between requests
+  unsigned pool_size;
+  wad_io_policy_t io_policy;
+  int quiet;
+} serve_options_t;
+
+// Indexes the wads in the directory and answers requests until the process is
+// killed. Returns 1 if the server could not be started.
+int serve_run(const serve_options_t* options);
+
+#endif
@@ -4,18 +4,100 @@
 
 #include "info.h"
 
+#include <inttypes.h>
 #include <stdio.h>
+#include <stdlib.h>
 
 #include <libwad.h>
 
 #define OPTPARSE_IMPLEMENTATION
 #include <optparse.h>
 
+static unsigned char* read_file(const char* path, size_t* size)
+{
+  FILE* fh = fopen(path, "rb");
+
+  if (fh == NULL)
+    return NULL;
+
+  fseek(fh, 0, SEEK_END);
+  long length = ftell(fh);
+  fseek(fh, 0, SEEK_SET);
+
+  unsigned char* buffer =
+      length > 0 ? (unsigned char*)malloc((size_t)length) : NULL;
+
+  if (buffer != NULL && fread(buffer, (size_t)length, 1, fh) != 1) {
+    free(buffer);
+    buffer = NULL;
+  }
+
+  fclose(fh);
+
+  *size = buffer != NULL ? (size_t)length : 0;
+
+  return buffer;
+}
+
+// Decrypts the title keys of all given tickets at once and lists them
+static int print_keys(const char** paths, int count)
+{
+  unsigned char** tickets =
+      (unsigned char**)calloc(count, sizeof(unsigned char*));
+  size_t* sizes = (size_t*)calloc(count, sizeof(size_t));
+  ticket_key_t* keys = (ticket_key_t*)calloc(count, sizeof(ticket_key_t));
+
+  if (tickets == NULL || sizes == NULL || keys == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    free(tickets);
+    free(sizes);
+    free(keys);
+    return 1;
+  }
+
+  for (int i = 0; i < count; i++) {
+    tickets[i] = read_file(paths[i], &sizes[i]);
+
+    if (tickets[i] == NULL)
+      fprintf(stderr, "Failed to read ticket '%s'\n", paths[i]);
+  }
+
+  int ret = !ticket_decrypt_keys((const unsigned char* const*)tickets, sizes,
+                                 count, keys);
+
+  for (int i = 0; i < count; i++) {
+    if (keys[i].error != LIBWAD_NO_ERROR) {
+      printf("%s: Error: %s\n", paths[i],
+             libwad_error_to_string(keys[i].error));
+      continue;
+    }
+
+    printf("%s: %016" PRIx64 " (%s) ", paths[i], keys[i].title_id,
+           util_title_id_to_string(keys[i].title_id));
+
+    for (int x = 0; x < 16; x++)
+      printf("%02hhx", keys[i].title_key[x]);
+
+    printf(" %s\n", keys[i].issuer);
+  }
+
+  for (int i = 0; i < count; i++)
+    free(tickets[i]);
+
+  free(tickets);
+  free(sizes);
+  free(keys);
+
+  return ret;
+}
+
 void show_help(const char* program)
 {
-  printf("%s [options] (ticketfile)\n\n"
+  printf("%s [options] (ticketfile...)\n\n"
+         "Given more than one ticket, only the title keys are listed.\n\n"
          "Options:\n\n"
          "-h, --help\t\tShow this message\n"
+         "-S, --stats\t\tPrint performance statistics on exit\n"
          "-v, --version\t\tDisplay version\n\n",
          program);
 }
@@ -25,8 +107,10 @@ int main(int argc, char** argv)
   struct optparse options;
   optparse_init(&options, argv);
 
-  struct optparse_long flags[] = {
-      {"help", 'h', OPTPARSE_NONE}, {"version", 'v', OPTPARSE_NONE}, {0}};
+  struct optparse_long flags[] = {{"help", 'h', OPTPARSE_NONE},
+                                  {"stats", 'S', OPTPARSE_NONE},
+                                  {"version", 'v', OPTPARSE_NONE},
+                                  {0}};
 
   for (char c = optparse_long(&options, flags, NULL); c != -1;
        c = optparse_long(&options, flags, NULL)) {
@@ -34,6 +118,9 @@ int main(int argc, char** argv)
     case 'h':
       show_help(argv[0]);
       return 0;
+    case 'S':
+      info_enable_stats();
+      break;
     case 'v':
       printf("ticketinfo from libwad version %s\n",
              libwad_get_version_string());
@@ -52,6 +139,28 @@ int main(int argc, char** argv)
     return 1;
   }
 
+  const char* next_path = optparse_arg(&options);
+
+  if (next_path != NULL) {
+    const char** paths = (const char**)malloc(sizeof(const char*) * argc);
+    int count = 0;
+
+    if (paths == NULL)
+      return 1;
+
+    paths[count++] = ticket_path;
+
+    for (const char* path = next_path; path != NULL;
+         path = optparse_arg(&options))
+      paths[count++] = path;
+
+    int ret = print_keys(paths, count);
+
+    free(paths);
+
+    return ret;
+  }
+
   ticket_t ticket = ticket_open(ticket_path);
 
   if (ticket == NULL) {
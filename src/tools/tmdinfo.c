@@ -16,6 +16,7 @@ void show_help(const char* program)
   printf("%s [options] (tmdfile)\n\n"
          "Options:\n\n"
          "-h, --help\t\tShow this message\n"
+         "-S, --stats\t\tPrint performance statistics on exit\n"
          "-v, --version\t\tDisplay version\n\n",
          program);
 }
@@ -25,8 +26,10 @@ int main(int argc, char** argv)
   struct optparse options;
   optparse_init(&options, argv);
 
-  struct optparse_long flags[] = {
-      {"help", 'h', OPTPARSE_NONE}, {"version", 'v', OPTPARSE_NONE}, {0}};
+  struct optparse_long flags[] = {{"help", 'h', OPTPARSE_NONE},
+                                  {"stats", 'S', OPTPARSE_NONE},
+                                  {"version", 'v', OPTPARSE_NONE},
+                                  {0}};
 
   for (char c = optparse_long(&options, flags, NULL); c != -1;
        c = optparse_long(&options, flags, NULL)) {
@@ -34,6 +37,9 @@ int main(int argc, char** argv)
     case 'h':
       show_help(argv[0]);
       return 0;
+    case 'S':
+      info_enable_stats();
+      break;
     case 'v':
       printf("tmdinfo from libwad version %s\n", libwad_get_version_string());
       return 0;
@@ -0,0 +1,150 @@
+// Copyright 2019 spycrab0
+// Licensed under GPLv3+
+// Refer to the LICENSE file included.
+
+#include <inttypes.h>
+#include <stdio.h>
+
+#include <libwad.h>
+
+#define OPTPARSE_IMPLEMENTATION
+#include <optparse.h>
+
+#include "info.h"
+
+void show_help(const char* program)
+{
+  printf("%s [options] (old wadfile) (new wadfile)\n\n"
+         "Exits with 0 if the contents are identical, 1 if they differ and 2 "
+         "on errors.\n\n"
+         "Options:\n\n"
+         "-b, --bytes\t\tCompare modified contents byte by byte\n"
+         "-h, --help\t\tShow this message\n"
+         "-S, --stats\t\tPrint performance statistics on exit\n"
+         "-v, --version\t\tDisplay version\n\n",
+         program);
+}
+
+static void print_entry(const wad_diff_entry_t* entry)
+{
+  const tmd_content_t* old_content = entry->old_content;
+  const tmd_content_t* new_content = entry->new_content;
+
+  printf("Content %2hu...", entry->index);
+
+  switch (entry->status) {
+  case WAD_DIFF_UNCHANGED:
+    printf("Unchanged\n");
+    break;
+  case WAD_DIFF_ADDED:
+    printf("Added (id %08x, %" PRIu64 " bytes)\n", new_content->id,
+           new_content->size);
+    break;
+  case WAD_DIFF_REMOVED:
+    printf("Removed (id %08x, %" PRIu64 " bytes)\n", old_content->id,
+           old_content->size);
+    break;
+  case WAD_DIFF_MODIFIED:
+    printf("Modified (id %08x -> %08x, %" PRIu64 " -> %" PRIu64 " bytes)\n",
+           old_content->id, new_content->id, old_content->size,
+           new_content->size);
+
+    if (entry->first_difference != WAD_DIFF_NO_DIFFERENCE)
+      printf("\t%" PRIu64 " bytes differ, starting at offset 0x%" PRIx64 "\n",
+             entry->changed_bytes, entry->first_difference);
+    break;
+  }
+}
+
+int main(int argc, char** argv)
+{
+  struct optparse options;
+
+  optparse_init(&options, argv);
+
+  wad_diff_mode_t mode = WAD_DIFF_TMD;
+
+  struct optparse_long flags[] = {{"bytes", 'b', OPTPARSE_NONE},
+                                  {"help", 'h', OPTPARSE_NONE},
+                                  {"stats", 'S', OPTPARSE_NONE},
+                                  {"version", 'v', OPTPARSE_NONE},
+                                  {0}};
+
+  for (int c = optparse_long(&options, flags, NULL); c != -1;
+       c = optparse_long(&options, flags, NULL)) {
+    switch (c) {
+    case 'b':
+      mode = WAD_DIFF_BYTES;
+      break;
+    case 'h':
+      show_help(argv[0]);
+      return 0;
+    case 'S':
+      info_enable_stats();
+      break;
+    case 'v':
+      printf("waddiff from libwad version %s\n", libwad_get_version_string());
+      return 0;
+    case '?':
+      fprintf(
+          stderr,
+          "Invalid arguments provided or parameter missing. See -h for help\n");
+      return 2;
+    }
+  }
+
+  const char* old_path = optparse_arg(&options);
+  const char* new_path = optparse_arg(&options);
+
+  if (old_path == NULL || new_path == NULL) {
+    show_help(argv[0]);
+    return 2;
+  }
+
+  wad_t old_wad = wad_open(old_path);
+
+  if (old_wad == NULL) {
+    fprintf(stderr, "Failed to open '%s': %s\n", old_path,
+            libwad_get_error_msg());
+    return 2;
+  }
+
+  wad_t new_wad = wad_open(new_path);
+
+  if (new_wad == NULL) {
+    fprintf(stderr, "Failed to open '%s': %s\n", new_path,
+            libwad_get_error_msg());
+    wad_close(old_wad);
+    return 2;
+  }
+
+  wad_diff_t diff = wad_diff(old_wad, new_wad, mode);
+
+  if (diff == NULL) {
+    fprintf(stderr, "Failed to compare: %s\n", libwad_get_error_msg());
+    wad_close(old_wad);
+    wad_close(new_wad);
+    return 2;
+  }
+
+  size_t counts[WAD_DIFF_MODIFIED + 1] = {0};
+
+  for (size_t i = 0; i < wad_diff_get_count(diff); i++) {
+    const wad_diff_entry_t* entry = wad_diff_get_entry(diff, i);
+
+    print_entry(entry);
+    counts[entry->status]++;
+  }
+
+  printf("\n%zu unchanged, %zu modified, %zu added, %zu removed\n",
+         counts[WAD_DIFF_UNCHANGED], counts[WAD_DIFF_MODIFIED],
+         counts[WAD_DIFF_ADDED], counts[WAD_DIFF_REMOVED]);
+
+  int identical = counts[WAD_DIFF_UNCHANGED] == wad_diff_get_count(diff);
+
+  wad_diff_close(diff);
+  wad_close(old_wad);
+  wad_close(new_wad);
+
+  return identical ? 0 : 1;
+}
@@ -0,0 +1,108 @@
+// Copyright 2019 spycrab0
+// Licensed under GPLv3+
+// Refer to the LICENSE file included.
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <libwad.h>
+
+#define OPTPARSE_IMPLEMENTATION
+#include <optparse.h>
+
+#include "info.h"
+
+void show_help(const char* program)
+{
+  printf("%s [options] (nand root) (title id) [output]\n\n"
+         "Exports a title installed in a NAND directory into a wad.\n"
+         "The title id is given in hex, e.g. 0001000148414241. The wad is\n"
+         "named after the title unless an output path is given.\n\n"
+         "Options:\n\n"
+         "-h, --help\t\tShow this message\n"
+         "-j, --jobs COUNT\tNumber of worker threads (default: one per "
+         "processor)\n"
+         "-q, --quiet\t\tQuiet\n"
+         "-S, --stats\t\tPrint performance statistics on exit\n"
+         "-v, --version\t\tDisplay version\n\n",
+         program);
+}
+
+int main(int argc, char** argv)
+{
+  struct optparse options;
+
+  optparse_init(&options, argv);
+
+  int quiet = 0;
+
+  struct optparse_long flags[] = {{"help", 'h', OPTPARSE_NONE},
+                                  {"jobs", 'j', OPTPARSE_REQUIRED},
+                                  {"quiet", 'q', OPTPARSE_NONE},
+                                  {"stats", 'S', OPTPARSE_NONE},
+                                  {"version", 'v', OPTPARSE_NONE},
+                                  {0}};
+
+  for (int c = optparse_long(&options, flags, NULL); c != -1;
+       c = optparse_long(&options, flags, NULL)) {
+    switch (c) {
+    case 'h':
+      show_help(argv[0]);
+      return 0;
+    case 'j':
+      libwad_set_thread_count((unsigned)atoi(options.optarg));
+      break;
+    case 'q':
+      quiet = 1;
+      break;
+    case 'S':
+      info_enable_stats();
+      break;
+    case 'v':
+      printf("wadexport from libwad version %s\n", libwad_get_version_string());
+      return 0;
+    case '?':
+      fprintf(
+          stderr,
+          "Invalid arguments provided or parameter missing. See -h for help\n");
+      return 1;
+    }
+  }
+
+  const char* root = optparse_arg(&options);
+  const char* id = optparse_arg(&options);
+  const char* output = optparse_arg(&options);
+
+  if (root == NULL || id == NULL) {
+    show_help(argv[0]);
+    return 1;
+  }
+
+  char* end;
+  uint64_t title_id = strtoull(id, &end, 16);
+
+  if (*end != '\0') {
+    fprintf(stderr, "Invalid title id '%s'\n", id);
+    return 1;
+  }
+
+  char filename[256];
+
+  if (output == NULL) {
+    snprintf(filename, sizeof(filename), "%s.wad",
+             util_title_id_to_string(title_id));
+    output = filename;
+  }
+
+  if (!wad_export_from_nand(root, title_id, output)) {
+    fprintf(stderr, "Failed to export %016" PRIx64 ": %s\n", title_id,
+            libwad_get_error_msg());
+    return 1;
+  }
+
+  if (!quiet)
+    printf("Exported %016" PRIx64 " to %s\n", title_id, output);
+
+  return 0;
+}
@@ -11,19 +11,279 @@
 #define OPTPARSE_IMPLEMENTATION
 #include <optparse.h>
 
+#include "archive.h"
+#include "info.h"
+#include "journal.h"
+
+static void get_output_filename(char* filename, size_t size,
+                                const char* out_path, const char* title_id,
+                                uint16_t index, int single)
+{
+  if (single)
+    snprintf(filename, size, "%s%s", out_path == NULL ? title_id : out_path,
+             out_path == NULL ? ".bin" : "");
+  else
+    snprintf(filename, size, "%s-%04hu.bin",
+             out_path == NULL ? title_id : out_path, index);
+}
+
+// Contents go to a temporary file first when resuming, which is moved into
+// place and recorded once complete
+static void get_write_filename(char* filename, size_t size,
+                               const char* output, journal_t* journal)
+{
+  if (journal != NULL)
+    journal_get_temp_filename(filename, size, output);
+  else
+    snprintf(filename, size, "%s", output);
+}
+
+// Records a finished content in the journal if resuming
+static int finish_output(journal_t* journal, wad_t wad, uint16_t index,
+                         const char* written, const char* output)
+{
+  if (journal == NULL)
+    return 1;
+
+  const tmd_content_t* content = tmd_get_content(wad_get_tmd(wad), index);
+
+  if (!journal_commit(journal, index, content->hash, written, output)) {
+    remove(written);
+    return 0;
+  }
+
+  return 1;
+}
+
+static int is_done(journal_t* journal, wad_t wad, uint16_t index,
+                   const char* output)
+{
+  return journal != NULL &&
+         journal_is_done(journal, index,
+                         tmd_get_content(wad_get_tmd(wad), index)->hash,
+                         output);
+}
+
+// Extracts all contents in the range at once using the batch engine
+static int extract_batch(wad_t wad, uint16_t from, uint16_t to, unsigned jobs,
+                         data_verify_t verify, const char* out_path,
+                         const char* title_id, int quiet, journal_t* journal)
+{
+  batch_t engine = batch_open(0, jobs, BATCH_BACKEND_AUTO);
+
+  if (engine == NULL) {
+    fprintf(stderr, "Failed to start batch engine: %s\n",
+            libwad_get_error_msg());
+    return 1;
+  }
+
+  int failed = 0;
+
+  for (uint16_t i = from; i < to; i++) {
+    char filename[256];
+
+    get_output_filename(filename, sizeof(filename), out_path, title_id, i,
+                        from + 1 == to);
+
+    if (is_done(journal, wad, i, filename)) {
+      if (!quiet)
+        printf("Skipped content %2hu\n", i);
+
+      continue;
+    }
+
+    char written[256];
+
+    get_write_filename(written, sizeof(written), filename, journal);
+
+    batch_job_t job = {wad, i, written, verify, NULL};
+
+    if (!batch_submit(engine, &job)) {
+      fprintf(stderr, "Failed to queue entry %hu: %s\n", i,
+              libwad_get_error_msg());
+      failed = 1;
+    }
+  }
+
+  batch_completion_t completion;
+
+  while (batch_wait(engine, &completion)) {
+    char filename[256], written[256];
+
+    get_output_filename(filename, sizeof(filename), out_path, title_id,
+                        completion.job.index, from + 1 == to);
+    get_write_filename(written, sizeof(written), filename, journal);
+
+    if (completion.error != LIBWAD_NO_ERROR) {
+      fprintf(stderr, "Failed to extract entry %hu: %s\n",
+              completion.job.index, libwad_error_to_string(completion.error));
+      failed = 1;
+
+      if (journal != NULL)
+        remove(written);
+    } else if (!finish_output(journal, wad, completion.job.index, written,
+                              filename)) {
+      fprintf(stderr, "Failed to record entry %hu\n", completion.job.index);
+      failed = 1;
+    } else if (!quiet) {
+      printf("Extracted content %2hu\n", completion.job.index);
+    }
+  }
+
+  batch_close(engine);
+
+  if (!failed)
+    printf("\nDone.\n");
+
+  return failed;
+}
+
+struct sequential_state {
+  wad_t wad;
+  journal_t* journal;
+  const char* out_path;
+  const char* title_id;
+  int single;
+  int quiet;
+  int keep_going;
+  int failed;
+  FILE* fh;
+  char filename[256];
+  char written[256];
+};
+
+static int extract_chunk(const data_chunk_t* chunk, void* user)
+{
+  struct sequential_state* state = (struct sequential_state*)user;
+
+  if (chunk->offset == 0) {
+    if (!state->quiet)
+      printf("Extracting content %2hu...", chunk->index);
+
+    get_output_filename(state->filename, sizeof(state->filename),
+                        state->out_path, state->title_id, chunk->index,
+                        state->single);
+    get_write_filename(state->written, sizeof(state->written),
+                       state->filename, state->journal);
+
+    state->fh = fopen(state->written, "wb");
+
+    if (state->fh == NULL) {
+      printf("Error: Failed to open file for writing '%s'\n", state->written);
+      state->failed = 1;
+      return !state->keep_going;
+    }
+  }
+
+  // The rest of a content we failed to write
+  if (state->fh == NULL)
+    return 0;
+
+  if (chunk->length != 0 &&
+      fwrite(chunk->data, chunk->length, 1, state->fh) != 1) {
+    printf("Error: Failed to write\n");
+    fclose(state->fh);
+    state->fh = NULL;
+    state->failed = 1;
+    return !state->keep_going;
+  }
+
+  if (!state->quiet)
+    info_print_progress(chunk->offset + chunk->length, chunk->size,
+                        chunk->index, NULL);
+
+  if (!chunk->last)
+    return 0;
+
+  fclose(state->fh);
+  state->fh = NULL;
+
+  if (chunk->verdict != LIBWAD_NO_ERROR) {
+    printf("Error: %s\n", libwad_error_to_string(chunk->verdict));
+    remove(state->written);
+    state->failed = 1;
+    return !state->keep_going;
+  }
+
+  if (!finish_output(state->journal, state->wad, chunk->index, state->written,
+                     state->filename)) {
+    printf("Error: Failed to record in journal\n");
+    state->failed = 1;
+    return !state->keep_going;
+  }
+
+  if (!state->quiet)
+    printf("Ok\n");
+
+  return 0;
+}
+
+// Extracts all contents in a single pass over the file
+static int extract_sequential(wad_t wad, data_verify_t verify,
+                              const char* out_path, const char* title_id,
+                              int single, int quiet, int keep_going,
+                              journal_t* journal)
+{
+  struct sequential_state state;
+
+  memset(&state, 0, sizeof(state));
+  state.wad = wad;
+  state.journal = journal;
+  state.out_path = out_path;
+  state.title_id = title_id;
+  state.single = single;
+  state.quiet = quiet;
+  state.keep_going = keep_going;
+
+  // Progress is printed along with the chunks instead
+  wad_set_progress_callback(wad, NULL, NULL);
+
+  if (!data_extract_all(wad, extract_chunk, &state, verify) &&
+      libwad_get_error() != LIBWAD_HASH_MISMATCH &&
+      libwad_get_error() != LIBWAD_CANCELLED) {
+    fprintf(stderr, "Failed to extract: %s\n", libwad_get_error_msg());
+    state.failed = 1;
+  }
+
+  if (state.fh != NULL)
+    fclose(state.fh);
+
+  if (!state.failed)
+    printf("\nDone.\n");
+
+  return state.failed;
+}
+
 void show_help(const char* program)
 {
   printf("%s [options] (wadfile)\n\n"
          "Options:\n\n"
+         "-b, --batch\t\tExtract all contents concurrently\n"
+         "-d, --decompress\tDecompress LZ77 compressed contents\n"
+         "-D, --directory\tExtract every wad in a directory into the "
+         "output\n\t\t\tdirectory (default: the current one)\n"
          "-f, --from INDEX\tStart extracting at entry\n"
          "-h, --help\t\tShow this message\n"
          "-i, --ignore-hashes\tIgnore content hashes\n"
+         "-I, --io POLICY\tRead with the given I/O policy (normal, "
+         "sequential,\n\t\t\tdropbehind or direct)\n"
+         "-j, --jobs COUNT\tNumber of worker threads, also used to decrypt\n"
+         "\t\t\tlarge contents (default: one per processor)\n"
          "-k, --keep-going\tKeep going despite errors\n"
+         "-m, --memory MIB\tLimit the memory held for contents read whole\n"
+         "\t\t\t(with -d, -f, -n or -t), those that don't fit\n"
+         "\t\t\tfail. Extracting every content streams it in\n"
+         "\t\t\tchunks and isn't limited\n"
          "-n, --entry INDEX\tExtract given entry only\n"
          "-o, --output NAME\tOutput path\n"
          "-q, --quiet\t\tQuiet\n"
+         "-r, --resume JOURNAL\tWrite contents to temporary files and record\n"
+         "\t\t\tfinished ones in JOURNAL, skipping contents an\n"
+         "\t\t\tearlier run already extracted. Always checks\n"
+         "\t\t\tcontent hashes\n"
          "-s, --sections\t\tExtract sections instead of contents\n"
          "-t, --to INDEX\t\tStop extracting at entry\n"
+         "-S, --stats\t\tPrint performance statistics on exit\n"
          "-v, --version\t\tDisplay version\n\n",
          program);
 }
@@ -35,18 +295,30 @@ int main(int argc, char** argv)
   optparse_init(&options, argv);
 
   uint16_t from = 0, to = 0;
-  int quiet = 0, keep_going = 0, verify_hash = 0, sections = 0;
+  int quiet = 0, keep_going = 0, verify_hash = 1, sections = 0,
+      decompress = 0, batch = 0, directory = 0;
+  unsigned jobs = 0;
+  wad_io_policy_t io_policy = WAD_IO_NORMAL;
   const char* out_path = NULL;
+  const char* journal_path = NULL;
 
-  struct optparse_long flags[] = {{"from", 'f', OPTPARSE_OPTIONAL},
+  struct optparse_long flags[] = {{"batch", 'b', OPTPARSE_NONE},
+                                  {"decompress", 'd', OPTPARSE_NONE},
+                                  {"directory", 'D', OPTPARSE_NONE},
+                                  {"from", 'f', OPTPARSE_OPTIONAL},
                                   {"help", 'h', OPTPARSE_NONE},
                                   {"ignore-hashes", 'i', OPTPARSE_NONE},
+                                  {"io", 'I', OPTPARSE_REQUIRED},
+                                  {"jobs", 'j', OPTPARSE_REQUIRED},
                                   {"keep-going", 'k', OPTPARSE_NONE},
+                                  {"memory", 'm', OPTPARSE_REQUIRED},
                                   {"entry", 'n', OPTPARSE_OPTIONAL},
                                   {"output", 'o', OPTPARSE_REQUIRED},
                                   {"quiet", 'q', OPTPARSE_NONE},
+                                  {"resume", 'r', OPTPARSE_REQUIRED},
                                   {"sections", 's', OPTPARSE_NONE},
                                   {"to", 't', OPTPARSE_OPTIONAL},
+                                  {"stats", 'S', OPTPARSE_NONE},
                                   {"version", 'v', OPTPARSE_NONE},
                                   {0}};
 
@@ -59,6 +331,27 @@ int main(int argc, char** argv)
     case 's':
       sections = 1;
       break;
+    case 'b':
+      batch = 1;
+      break;
+    case 'd':
+      decompress = 1;
+      break;
+    case 'D':
+      directory = 1;
+      break;
+    case 'I':
+      if (!info_parse_io_policy(options.optarg, &io_policy))
+        return 1;
+      break;
+    case 'j':
+      jobs = (unsigned)atoi(options.optarg);
+      libwad_set_thread_count(jobs);
+      break;
+    case 'm':
+      libwad_set_memory_budget((size_t)strtoul(options.optarg, NULL, 10) *
+                               1024 * 1024);
+      break;
     case 'n':
       from = atoi(options.optarg);
       to = from + 1;
@@ -68,6 +361,9 @@ int main(int argc, char** argv)
     case 'i':
       verify_hash = 0;
       break;
+    case 'S':
+      info_enable_stats();
+      break;
     case 'v':
       printf("wadextract from libwad version %s\n",
              libwad_get_version_string());
@@ -85,6 +381,9 @@ int main(int argc, char** argv)
     case 'q':
       quiet = 1;
       break;
+    case 'r':
+      journal_path = options.optarg;
+      break;
     case '?':
       fprintf(
           stderr,
@@ -100,7 +399,38 @@ int main(int argc, char** argv)
     return 1;
   }
 
-  wad_t wad = wad_open(wad_path);
+  // Contents are recorded as done for good, so they have to be checked first
+  if (journal_path != NULL)
+    verify_hash = 1;
+
+  if (directory) {
+    if (sections || decompress || journal_path != NULL) {
+      fprintf(stderr, "--directory can not be combined with --sections, "
+                      "--decompress or --resume\n");
+      return 1;
+    }
+
+    int ret = archive_process(
+        wad_path, out_path != NULL ? out_path : ".", jobs, io_policy,
+        verify_hash ? LIBWAD_VERIFY_HASH : LIBWAD_DONT_VERIFY_HASH, quiet);
+
+    if (!ret)
+      printf("\nDone.\n");
+
+    return ret;
+  }
+
+  if (sections && journal_path != NULL) {
+    fprintf(stderr, "--resume can not be combined with --sections\n");
+    return 1;
+  }
+
+  if (batch && decompress) {
+    fprintf(stderr, "--decompress can not be combined with --batch\n");
+    return 1;
+  }
+
+  wad_t wad = wad_open_ex(wad_path, io_policy);
 
   if (wad == NULL) {
     fprintf(stderr, "Failed to open '%s': %s", wad_path,
@@ -114,63 +444,59 @@ int main(int argc, char** argv)
   uint16_t count = tmd_get_content_count(tmd);
 
   if (sections) {
-    uint64_t offsets[WAD_SECTION_FOOTER + 1];
-    uint32_t sizes[WAD_SECTION_FOOTER + 1];
-
     const char* section_names[] = {"header", "certchain", "ticket",
                                    "tmd",    "data",      "footer"};
 
+    wad_section_t types[WAD_SECTION_FOOTER + 1];
+    char filenames[WAD_SECTION_FOOTER + 1][256];
+    const char* paths[WAD_SECTION_FOOTER + 1];
+    libwad_error_t errors[WAD_SECTION_FOOTER + 1];
+    size_t section_count = 0;
+
     for (int i = 0; i <= WAD_SECTION_FOOTER; i++) {
-      offsets[i] = wad_get_section_offset(wad, i);
-      sizes[i] = wad_get_section_size(wad, i);
+      if (wad_get_section_size(wad, i) == 0)
+        continue;
+
+      snprintf(filenames[section_count], sizeof(filenames[section_count]),
+               "%s-%s.bin", out_path == NULL ? title_id : out_path,
+               section_names[i]);
+
+      types[section_count] = (wad_section_t)i;
+      paths[section_count] = filenames[section_count];
+      section_count++;
     }
 
-    wad_close(wad);
+    wad_extract_sections(wad, types, paths, section_count, errors);
 
-    FILE* wad_fh = fopen(wad_path, "rb");
+    int failed = 0;
+    size_t j = 0;
 
     for (int i = 0; i <= WAD_SECTION_FOOTER; i++) {
       printf("Extracting %s...", section_names[i]);
 
-      if (sizes[i] == 0) {
+      if (j == section_count || types[j] != i) {
         printf("Empty\n");
         continue;
       }
 
-      char filename[256];
-
-      snprintf(filename, sizeof(filename), "%s-%s.bin",
-               out_path == NULL ? title_id : out_path, section_names[i]);
-
-      FILE* fh = fopen((const char*)filename, "wb");
-
-      if (fh == NULL) {
-        fclose(wad_fh);
-        printf("Error: Failed to open file for writing '%s'\n", filename);
-
-        if (keep_going)
-          continue;
-        else
-          return 1;
+      if (errors[j] != LIBWAD_NO_ERROR) {
+        printf("Error: %s '%s'\n", libwad_error_to_string(errors[j]),
+               paths[j]);
+        failed = 1;
+      } else {
+        printf("Ok\n");
       }
 
-      char* buffer = (char*)malloc(sizes[i]);
-
-      fseek(wad_fh, (long)offsets[i], SEEK_SET);
-      fread(buffer, sizes[i], 1, wad_fh);
-      fwrite(buffer, sizes[i], 1, fh);
-
-      free(buffer);
-
-      fclose(fh);
-
-      printf("Ok\n");
+      j++;
     }
 
-    fclose(wad_fh);
-    return 0;
+    wad_close(wad);
+    return failed;
   }
 
+  if (!quiet)
+    wad_set_progress_callback(wad, info_print_progress, NULL);
+
   if (to == 0)
     to = count;
 
@@ -184,13 +510,79 @@ int main(int argc, char** argv)
     return 1;
   }
 
-  for (uint16_t i = from; i < to; i++) {
+  journal_t* journal = NULL;
+
+  if (journal_path != NULL) {
+    journal = journal_open(journal_path, wad_path);
+
+    if (journal == NULL) {
+      fprintf(stderr, "Failed to open journal '%s'\n", journal_path);
+      wad_close(wad);
+      return 1;
+    }
+  }
+
+  if (batch) {
+    int ret = extract_batch(
+        wad, from, to, jobs,
+        verify_hash ? LIBWAD_VERIFY_HASH : LIBWAD_DONT_VERIFY_HASH, out_path,
+        title_id, quiet, journal);
+
+    journal_close(journal);
+    wad_close(wad);
+
+    return ret;
+  }
+
+  // A single pass over the file only pays off if nothing has to be skipped
+  int skipping = 0;
+
+  for (uint16_t i = from; i < to && journal != NULL && !skipping; i++) {
+    char filename[256];
+
+    get_output_filename(filename, sizeof(filename), out_path, title_id, i,
+                        from + 1 == to);
+
+    skipping = is_done(journal, wad, i, filename);
+  }
+
+  if (from == 0 && to == count && !decompress && !skipping) {
+    int ret = extract_sequential(
+        wad, verify_hash ? LIBWAD_VERIFY_HASH : LIBWAD_DONT_VERIFY_HASH,
+        out_path, title_id, from + 1 == to, quiet, keep_going, journal);
+
+    journal_close(journal);
+    wad_close(wad);
+
+    return ret;
+  }
+
+  int failed = 0;
+
+  for (uint16_t i = from; i < to && !failed; i++) {
+    char filename[256], written[256];
+
+    get_output_filename(filename, sizeof(filename), out_path, title_id, i,
+                        from + 1 == to);
+    get_write_filename(written, sizeof(written), filename, journal);
+
+    if (is_done(journal, wad, i, filename)) {
+      if (!quiet)
+        printf("Skipped content %2hu\n", i);
+
+      continue;
+    }
 
     if (!quiet)
       printf("Extracting content %2hu...", i);
 
-    unsigned char* data = data_extract_from_wad(
-        wad, i, verify_hash ? LIBWAD_VERIFY_HASH : LIBWAD_DONT_VERIFY_HASH);
+    data_verify_t verify =
+        verify_hash ? LIBWAD_VERIFY_HASH : LIBWAD_DONT_VERIFY_HASH;
+
+    size_t size = (size_t)tmd_get_content(tmd, i)->size;
+    unsigned char* data =
+        decompress ? data_extract_decompressed(wad, i, verify, &size)
+                   : data_extract_from_wad(wad, i, verify);
 
     if (data == NULL) {
       if (keep_going) {
@@ -200,43 +592,52 @@ int main(int argc, char** argv)
 
       fprintf(stderr, "Failed to extract entry %hu: %s\n", i,
               libwad_get_error_msg());
-      return 1;
+      failed = 1;
+      break;
     }
 
-    char filename[256];
-
-    if (from + 1 == to)
-      snprintf(filename, sizeof(filename), "%s%s",
-               out_path == NULL ? title_id : out_path,
-               out_path == NULL ? ".bin" : "");
-    else
-      snprintf(filename, sizeof(filename), "%s-%04hu.bin",
-               out_path == NULL ? title_id : out_path, i);
+    FILE* fh = fopen(written, "wb");
 
-    FILE* fh = fopen(filename, "wb");
+    if (fh == NULL || (size != 0 && fwrite(data, size, 1, fh) != 1)) {
+      if (fh != NULL)
+        fclose(fh);
 
-    uint64_t size = tmd_get_content(tmd, i)->size;
+      free(data);
 
-    if (fwrite(data, (long)size, 1, fh) != 1) {
       if (keep_going) {
         printf("Error: Failed to write\n");
-        free(data);
         continue;
       }
 
-      free(data);
       fprintf(stderr, "Failed to write entry %hu\n", i);
-      return 1;
+      failed = 1;
+      break;
     }
 
     free(data);
+    fclose(fh);
+
+    if (!finish_output(journal, wad, i, written, filename)) {
+      if (keep_going) {
+        printf("Error: Failed to record in journal\n");
+        continue;
+      }
+
+      fprintf(stderr, "Failed to record entry %hu in journal\n", i);
+      failed = 1;
+      break;
+    }
 
     if (!quiet)
       printf("Ok\n");
-
-    fclose(fh);
   }
 
+  journal_close(journal);
+  wad_close(wad);
+
+  if (failed)
+    return 1;
+
   printf("\nDone.\n");
 
   return 0;
@@ -0,0 +1,151 @@
+// Copyright 2019 spycrab0
+// Licensed under GPLv3+
+// Refer to the LICENSE file included.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libwad.h>
+
+#define OPTPARSE_IMPLEMENTATION
+#include <optparse.h>
+
+#include "gen.h"
+#include "info.h"
+
+void show_help(const char* program)
+{
+  printf("%s [options] (output)\n\n"
+         "Generates a wad with fake signatures and random contents.\n\n"
+         "Options:\n\n"
+         "-h, --help\t\tShow this message\n"
+         "-i, --title-id ID\tTitle ID in hex (default: 0001000157414447)\n"
+         "-n, --contents COUNT\tNumber of contents (default: 1)\n"
+         "-q, --quiet\t\tQuiet\n"
+         "-r, --seed SEED\t\tSeed for the random contents\n"
+         "-s, --size SIZES\tContent size in bytes (default: 1048576).\n"
+         "\t\t\tSeparate multiple sizes by commas to give each content\n"
+         "\t\t\tits own size, the last one is repeated\n"
+         "-S, --stats\t\tPrint performance statistics on exit\n"
+         "-v, --version\t\tDisplay version\n\n",
+         program);
+}
+
+int main(int argc, char** argv)
+{
+  struct optparse options;
+
+  optparse_init(&options, argv);
+
+  uint64_t title_id = 0x0001000157414447ULL;
+  uint32_t seed = 1;
+  long count = 1;
+  int quiet = 0;
+  const char* size_list = "1048576";
+
+  struct optparse_long flags[] = {{"help", 'h', OPTPARSE_NONE},
+                                  {"title-id", 'i', OPTPARSE_REQUIRED},
+                                  {"contents", 'n', OPTPARSE_REQUIRED},
+                                  {"quiet", 'q', OPTPARSE_NONE},
+                                  {"seed", 'r', OPTPARSE_REQUIRED},
+                                  {"size", 's', OPTPARSE_REQUIRED},
+                                  {"stats", 'S', OPTPARSE_NONE},
+                                  {"version", 'v', OPTPARSE_NONE},
+                                  {0}};
+
+  for (int c = optparse_long(&options, flags, NULL); c != -1;
+       c = optparse_long(&options, flags, NULL)) {
+    switch (c) {
+    case 'h':
+      show_help(argv[0]);
+      return 0;
+    case 'i':
+      title_id = strtoull(options.optarg, NULL, 16);
+      break;
+    case 'n':
+      count = strtol(options.optarg, NULL, 10);
+      break;
+    case 'q':
+      quiet = 1;
+      break;
+    case 'r':
+      seed = (uint32_t)strtoul(options.optarg, NULL, 10);
+      break;
+    case 's':
+      size_list = options.optarg;
+      break;
+    case 'S':
+      info_enable_stats();
+      break;
+    case 'v':
+      printf("wadgen from libwad version %s\n", libwad_get_version_string());
+      return 0;
+    case '?':
+      fprintf(
+          stderr,
+          "Invalid arguments provided or parameter missing. See -h for help\n");
+      return 1;
+    }
+  }
+
+  const char* out_path = optparse_arg(&options);
+
+  if (out_path == NULL) {
+    show_help(argv[0]);
+    return 1;
+  }
+
+  if (count < 1 || count > 0xffff) {
+    fprintf(stderr, "Content count has to be between 1 and 65535\n");
+    return 1;
+  }
+
+  uint64_t* sizes = (uint64_t*)malloc(sizeof(uint64_t) * count);
+
+  if (sizes == NULL) {
+    fprintf(stderr, "Failed to allocate memory\n");
+    return 1;
+  }
+
+  const char* p = size_list;
+  uint64_t total = 0;
+
+  for (long i = 0; i < count; i++) {
+    char* end;
+    sizes[i] = i == 0 ? 0 : sizes[i - 1];
+
+    if (*p != '\0') {
+      sizes[i] = strtoull(p, &end, 10);
+      p = *end == ',' ? end + 1 : end;
+    }
+
+    // Contents are padded to 64 bytes
+    total += (sizes[i] + 63) & ~(uint64_t)63;
+  }
+
+  // The data section size is stored as 32-bit value
+  if (total > 0xffffffffULL) {
+    fprintf(stderr, "Contents exceed the maximum size of a wad\n");
+    free(sizes);
+    return 1;
+  }
+
+  if (!quiet)
+    printf("Writing %ld contents (%llu bytes) to '%s'...", count,
+           (unsigned long long)total, out_path);
+
+  if (!gen_write_wad(out_path, title_id, (uint16_t)count, sizes, seed)) {
+    fprintf(stderr, "Failed to generate '%s': %s\n", out_path,
+            libwad_get_error_msg());
+    free(sizes);
+    return 1;
+  }
+
+  free(sizes);
+
+  if (!quiet)
+    printf("Ok\n");
+
+  return 0;
+}
@@ -11,6 +11,8 @@
 #define OPTPARSE_IMPLEMENTATION
 #include <optparse.h>
 
+#include "info.h"
+
 // Taken from util.c
 // Not the prettiest sight but I don't want to expose util.h
 static uint16_t be_int16v(uint16_t i)
@@ -74,6 +76,7 @@ void show_help(const char* program)
          "-q, --quiet\t\tQuiet\n"
          "-t, --ticket TICKET\tTicket path (required)\n"
          "-m, --tmd TMD\t\tTitle metadata path (required)\n"
+         "-S, --stats\t\tPrint performance statistics on exit\n"
          "-v, --version\t\tDisplay version\n\n",
          program);
 }
@@ -98,7 +101,8 @@ int main(int argc, char** argv)
       {"data", 'd', OPTPARSE_REQUIRED},   {"help", 'h', OPTPARSE_NONE},
       {"tmd", 'm', OPTPARSE_REQUIRED},    {"output", 'o', OPTPARSE_REQUIRED},
       {"quiet", 'q', OPTPARSE_NONE},      {"ticket", 't', OPTPARSE_REQUIRED},
-      {"version", 'v', OPTPARSE_NONE},    {0}};
+      {"stats", 'S', OPTPARSE_NONE},      {"version", 'v', OPTPARSE_NONE},
+      {0}};
 
   for (int c = optparse_long(&options, flags, NULL); c != -1;
        c = optparse_long(&options, flags, NULL)) {
@@ -124,6 +128,9 @@ int main(int argc, char** argv)
     case 't':
       ticket_path = options.optarg;
       break;
+    case 'S':
+      info_enable_stats();
+      break;
     case 'v':
       printf("wadextract from libwad version %s\n",
              libwad_get_version_string());
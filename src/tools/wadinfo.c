@@ -21,6 +21,7 @@ void show_help(const char* program)
          "-h, --help\t\tShow this message\n"
          "-t, --ticket\t\tDisplay ticket information\n"
          "-m, --tmd\t\tDisplay TMD information\n"
+         "-S, --stats\t\tPrint performance statistics on exit\n"
          "-v, --version\t\tDisplay version\n\n",
          program);
 }
@@ -36,6 +37,7 @@ int main(int argc, char** argv)
                                   {"help", 'h', OPTPARSE_NONE},
                                   {"tmd", 'm', OPTPARSE_NONE},
                                   {"ticket", 't', OPTPARSE_NONE},
+                                  {"stats", 'S', OPTPARSE_NONE},
                                   {"version", 'v', OPTPARSE_NONE},
                                   {0}};
 
@@ -56,6 +58,9 @@ int main(int argc, char** argv)
     case 'c':
       display_certchain = 1;
       break;
+    case 'S':
+      info_enable_stats();
+      break;
     case 'v':
       printf("wadinfo from libwad version %s\n", libwad_get_version_string());
       return 0;
@@ -0,0 +1,132 @@
+// Copyright 2019 spycrab0
+// Licensed under GPLv3+
+// Refer to the LICENSE file included.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <libwad.h>
+
+#define OPTPARSE_IMPLEMENTATION
+#include <optparse.h>
+
+#include "info.h"
+
+void show_help(const char* program)
+{
+  printf("%s [options] (nand root) (wadfile...)\n\n"
+         "Installs wads into a NAND directory as used by emulators.\n"
+         "Contents that are already installed are skipped, shared contents\n"
+         "are stored once in shared1.\n\n"
+         "Options:\n\n"
+         "-h, --help\t\tShow this message\n"
+         "-I, --io POLICY\tRead with the given I/O policy (normal, "
+         "sequential,\n\t\t\tdropbehind or direct)\n"
+         "-j, --jobs COUNT\tNumber of worker threads (default: one per "
+         "processor)\n"
+         "-k, --keep-going\tKeep going despite errors\n"
+         "-q, --quiet\t\tQuiet\n"
+         "-S, --stats\t\tPrint performance statistics on exit\n"
+         "-v, --version\t\tDisplay version\n\n",
+         program);
+}
+
+int main(int argc, char** argv)
+{
+  struct optparse options;
+
+  optparse_init(&options, argv);
+
+  int quiet = 0, keep_going = 0;
+  wad_io_policy_t io_policy = WAD_IO_NORMAL;
+
+  struct optparse_long flags[] = {{"help", 'h', OPTPARSE_NONE},
+                                  {"io", 'I', OPTPARSE_REQUIRED},
+                                  {"jobs", 'j', OPTPARSE_REQUIRED},
+                                  {"keep-going", 'k', OPTPARSE_NONE},
+                                  {"quiet", 'q', OPTPARSE_NONE},
+                                  {"stats", 'S', OPTPARSE_NONE},
+                                  {"version", 'v', OPTPARSE_NONE},
+                                  {0}};
+
+  for (int c = optparse_long(&options, flags, NULL); c != -1;
+       c = optparse_long(&options, flags, NULL)) {
+    switch (c) {
+    case 'h':
+      show_help(argv[0]);
+      return 0;
+    case 'I':
+      if (!info_parse_io_policy(options.optarg, &io_policy))
+        return 1;
+      break;
+    case 'j':
+      libwad_set_thread_count((unsigned)atoi(options.optarg));
+      break;
+    case 'k':
+      keep_going = 1;
+      break;
+    case 'q':
+      quiet = 1;
+      break;
+    case 'S':
+      info_enable_stats();
+      break;
+    case 'v':
+      printf("wadinstall from libwad version %s\n",
+             libwad_get_version_string());
+      return 0;
+    case '?':
+      fprintf(
+          stderr,
+          "Invalid arguments provided or parameter missing. See -h for help\n");
+      return 1;
+    }
+  }
+
+  const char* root = optparse_arg(&options);
+  const char* wad_path = optparse_arg(&options);
+
+  if (root == NULL || wad_path == NULL) {
+    show_help(argv[0]);
+    return 1;
+  }
+
+  int failed = 0;
+
+  for (; wad_path != NULL; wad_path = optparse_arg(&options)) {
+    wad_t wad = wad_open_ex(wad_path, io_policy);
+
+    if (wad == NULL) {
+      fprintf(stderr, "%s: Failed to open: %s\n", wad_path,
+              libwad_get_error_msg());
+      failed = 1;
+
+      if (!keep_going)
+        break;
+
+      continue;
+    }
+
+    nand_install_stats_t stats;
+
+    if (!wad_install_to_nand(wad, root, &stats)) {
+      fprintf(stderr, "%s: Failed to install: %s\n", wad_path,
+              libwad_get_error_msg());
+      failed = 1;
+    } else if (!quiet) {
+      uint64_t title_id = tmd_get_title_id(wad_get_tmd(wad));
+
+      printf("%s: Installed %s (%hu written, %hu already present, %hu "
+             "shared)\n",
+             wad_path, util_title_id_to_string(title_id), stats.installed,
+             stats.skipped, stats.shared);
+    }
+
+    wad_close(wad);
+
+    if (failed && !keep_going)
+      break;
+  }
+
+  return failed;
+}
@@ -0,0 +1,120 @@
+// Copyright 2019 spycrab0
+// Licensed under GPLv3+
+// Refer to the LICENSE file included.
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <libwad.h>
+
+#define OPTPARSE_IMPLEMENTATION
+#include <optparse.h>
+
+#include "info.h"
+#include "patch.h"
+
+void show_help(const char* program)
+{
+  printf("%s [options] create (old wadfile) (new wadfile) (patch)\n"
+         "%s [options] apply (old wadfile) (patch) (output)\n\n"
+         "Creates patches between two versions of a wad and applies them.\n"
+         "Unchanged contents are copied from the old wad, modified ones are\n"
+         "stored as a delta against the content with the same index.\n\n"
+         "Options:\n\n"
+         "-h, --help\t\tShow this message\n"
+         "-q, --quiet\t\tQuiet\n"
+         "-S, --stats\t\tPrint performance statistics on exit\n"
+         "-v, --version\t\tDisplay version\n\n",
+         program, program);
+}
+
+static void print_content(uint16_t position, const patch_content_info_t* info,
+                          void* user)
+{
+  printf("Content %2hu...", position);
+
+  switch (info->op) {
+  case PATCH_CONTENT_COPY:
+    printf("Copied from content %hu\n", info->source);
+    break;
+  case PATCH_CONTENT_DELTA:
+    printf("Delta against content %hu (%" PRIu64 " of %" PRIu64 " bytes)\n",
+           info->source, info->patch_size, info->size);
+    break;
+  case PATCH_CONTENT_FULL:
+    printf("Stored (%" PRIu64 " bytes)\n", info->size);
+    break;
+  }
+}
+
+int main(int argc, char** argv)
+{
+  struct optparse options;
+
+  optparse_init(&options, argv);
+
+  int quiet = 0;
+
+  struct optparse_long flags[] = {{"help", 'h', OPTPARSE_NONE},
+                                  {"quiet", 'q', OPTPARSE_NONE},
+                                  {"stats", 'S', OPTPARSE_NONE},
+                                  {"version", 'v', OPTPARSE_NONE},
+                                  {0}};
+
+  for (int c = optparse_long(&options, flags, NULL); c != -1;
+       c = optparse_long(&options, flags, NULL)) {
+    switch (c) {
+    case 'h':
+      show_help(argv[0]);
+      return 0;
+    case 'q':
+      quiet = 1;
+      break;
+    case 'S':
+      info_enable_stats();
+      break;
+    case 'v':
+      printf("wadpatch from libwad version %s\n", libwad_get_version_string());
+      return 0;
+    case '?':
+      fprintf(
+          stderr,
+          "Invalid arguments provided or parameter missing. See -h for help\n");
+      return 1;
+    }
+  }
+
+  const char* command = optparse_arg(&options);
+  const char* paths[3];
+
+  for (int i = 0; i < 3; i++)
+    paths[i] = optparse_arg(&options);
+
+  if (command == NULL || paths[2] == NULL) {
+    show_help(argv[0]);
+    return 1;
+  }
+
+  patch_report_t report = quiet ? NULL : print_content;
+
+  if (strcmp(command, "create") == 0) {
+    if (!patch_create(paths[0], paths[1], paths[2], report, NULL)) {
+      fprintf(stderr, "Failed to create patch: %s\n", patch_get_error());
+      return 1;
+    }
+  } else if (strcmp(command, "apply") == 0) {
+    if (!patch_apply(paths[0], paths[1], paths[2], report, NULL)) {
+      fprintf(stderr, "Failed to apply patch: %s\n", patch_get_error());
+      return 1;
+    }
+  } else {
+    fprintf(stderr, "Unknown command '%s'. See -h for help\n", command);
+    return 1;
+  }
+
+  if (!quiet)
+    printf("Done.\n");
+
+  return 0;
+}
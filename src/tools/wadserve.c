@@ -0,0 +1,117 @@
+// Copyright 2019 spycrab0
+// Licensed under GPLv3+
+// Refer to the LICENSE file included.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <libwad.h>
+
+#define OPTPARSE_IMPLEMENTATION
+#include <optparse.h>
+
+#include "info.h"
+#include "serve.h"
+
+void show_help(const char* program)
+{
+  printf("%s [options] (directory)\n\n"
+         "Options:\n\n"
+         "-a, --address ADDRESS\tAddress to listen on (default: 127.0.0.1)\n"
+         "-c, --cache MIB\t\tMemory used to cache decrypted blocks "
+         "(default: 64)\n"
+         "-h, --help\t\tShow this message\n"
+         "-I, --io POLICY\t\tRead with the given I/O policy (normal, "
+         "sequential,\n\t\t\tdropbehind or direct)\n"
+         "-j, --jobs COUNT\tNumber of connections served at once "
+         "(default: 8)\n"
+         "-p, --port PORT\t\tPort to listen on, 0 picks a free one "
+         "(default: 8080)\n"
+         "-P, --pool COUNT\tNumber of wads kept open between requests "
+         "(default: 64)\n"
+         "-q, --quiet\t\tDon't log requests\n"
+         "-S, --stats\t\tPrint performance statistics on exit\n"
+         "-v, --version\t\tDisplay version\n\n",
+         program);
+}
+
+int main(int argc, char** argv)
+{
+  struct optparse options;
+
+  optparse_init(&options, argv);
+
+  serve_options_t serve = {NULL, "127.0.0.1", "8080", 8, 64, WAD_IO_NORMAL, 0};
+  size_t cache = 64;
+
+  struct optparse_long flags[] = {{"address", 'a', OPTPARSE_REQUIRED},
+                                  {"cache", 'c', OPTPARSE_REQUIRED},
+                                  {"help", 'h', OPTPARSE_NONE},
+                                  {"io", 'I', OPTPARSE_REQUIRED},
+                                  {"jobs", 'j', OPTPARSE_REQUIRED},
+                                  {"port", 'p', OPTPARSE_REQUIRED},
+                                  {"pool", 'P', OPTPARSE_REQUIRED},
+                                  {"quiet", 'q', OPTPARSE_NONE},
+                                  {"stats", 'S', OPTPARSE_NONE},
+                                  {"version", 'v', OPTPARSE_NONE},
+                                  {0}};
+
+  for (int c = optparse_long(&options, flags, NULL); c != -1;
+       c = optparse_long(&options, flags, NULL)) {
+    switch (c) {
+    case 'a':
+      serve.address = options.optarg;
+      break;
+    case 'c':
+      cache = (size_t)strtoul(options.optarg, NULL, 10);
+      break;
+    case 'h':
+      show_help(argv[0]);
+      return 0;
+    case 'I':
+      if (!info_parse_io_policy(options.optarg, &serve.io_policy))
+        return 1;
+      break;
+    case 'j':
+      serve.threads = (unsigned)atoi(options.optarg);
+      break;
+    case 'p':
+      serve.port = options.optarg;
+      break;
+    case 'P':
+      serve.pool_size = (unsigned)atoi(options.optarg);
+      break;
+    case 'q':
+      serve.quiet = 1;
+      break;
+    case 'S':
+      info_enable_stats();
+      break;
+    case 'v':
+      printf("wadserve from libwad version %s\n", libwad_get_version_string());
+      return 0;
+    case '?':
+      fprintf(
+          stderr,
+          "Invalid arguments provided or parameter missing. See -h for help\n");
+      return 1;
+    }
+  }
+
+  serve.directory = optparse_arg(&options);
+
+  if (serve.directory == NULL) {
+    show_help(argv[0]);
+    return 1;
+  }
+
+  if (serve.threads == 0) {
+    fprintf(stderr, "At least one connection thread is required\n");
+    return 1;
+  }
+
+  // Clients fetching ranges of the same content hit the same blocks
+  libwad_cache_set_budget(cache * 1024 * 1024);
+
+  return serve_run(&serve);
+}
@@ -2,6 +2,7 @@
 // Licensed under GPLv3+
 // Refer to the LICENSE file included.
 
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -11,12 +12,103 @@
 #define OPTPARSE_IMPLEMENTATION
 #include <optparse.h>
 
+#include "archive.h"
+#include "info.h"
+
+// Verifies all contents of the given wads at once using the batch engine
+static int verify_batch(const char** paths, int count, unsigned jobs,
+                        wad_io_policy_t io_policy)
+{
+  batch_t engine = batch_open(0, jobs, BATCH_BACKEND_AUTO);
+
+  if (engine == NULL) {
+    fprintf(stderr, "Failed to start batch engine: %s\n",
+            libwad_get_error_msg());
+    return 1;
+  }
+
+  wad_t* wads = (wad_t*)calloc(count, sizeof(wad_t));
+
+  if (wads == NULL) {
+    fprintf(stderr, "Failed to allocate memory\n");
+    batch_close(engine);
+    return 1;
+  }
+
+  int error_content = 0;
+
+  for (int i = 0; i < count; i++) {
+    wads[i] = wad_open_ex(paths[i], io_policy);
+
+    if (wads[i] == NULL) {
+      fprintf(stderr, "%s: Failed to open: %s\n", paths[i],
+              libwad_get_error_msg());
+      error_content = 1;
+      continue;
+    }
+
+    uint16_t content_count = tmd_get_content_count(wad_get_tmd(wads[i]));
+
+    for (uint16_t j = 0; j < content_count; j++) {
+      batch_job_t job = {wads[i], j, NULL, LIBWAD_VERIFY_HASH,
+                         (void*)paths[i]};
+
+      if (!batch_submit(engine, &job)) {
+        printf("%s: Content %2hu...Error: %s\n", paths[i], j,
+               libwad_get_error_msg());
+        error_content = 1;
+      }
+    }
+  }
+
+  batch_completion_t completion;
+
+  while (batch_wait(engine, &completion)) {
+    const char* path = (const char*)completion.job.user;
+
+    if (completion.error != LIBWAD_NO_ERROR) {
+      printf("%s: Content %2hu...Error: %s\n", path, completion.job.index,
+             libwad_error_to_string(completion.error));
+      error_content = 1;
+    } else {
+      printf("%s: Content %2hu...Ok\n", path, completion.job.index);
+    }
+  }
+
+  batch_close(engine);
+
+  for (int i = 0; i < count; i++)
+    wad_close(wads[i]);
+
+  free(wads);
+
+  if (error_content) {
+    fprintf(stderr, "Failed to verify\n");
+    return 1;
+  }
+
+  printf("Verified\n");
+  return 0;
+}
+
 void show_help(const char* program)
 {
   printf("%s [options] (wadfile)\n\n"
          "Options:\n\n"
+         "-b, --batch\t\tVerify all contents concurrently, accepts multiple "
+         "wads\n"
+         "-D, --directory\tVerify every wad in the given directories\n"
          "-h, --help\t\tShow this message\n"
-         "-v, --version\t\tDisplay version\n\n",
+         "-I, --io POLICY\tRead with the given I/O policy (normal, "
+         "sequential,\n\t\t\tdropbehind or direct)\n"
+         "-j, --jobs COUNT\tNumber of worker threads, also used to decrypt\n"
+         "\t\t\tlarge contents (default: one per processor)\n"
+         "-S, --stats\t\tPrint performance statistics on exit\n"
+         "-v, --version\t\tDisplay version\n"
+         "-w, --write-index FILE\tVerify the wad and write a hash index of "
+         "its\n\t\t\tcontents to FILE\n"
+         "-x, --index FILE\tCheck contents chunk by chunk against a hash "
+         "index,\n\t\t\treporting the exact chunk that is damaged\n\n",
          program);
 }
 
@@ -26,18 +118,55 @@ int main(int argc, char** argv)
 
   optparse_init(&options, argv);
 
-  struct optparse_long flags[] = {
-      {"help", 'h', OPTPARSE_NONE}, {"version", 'v', OPTPARSE_NONE}, {0}};
+  int batch = 0, directory = 0;
+  unsigned jobs = 0;
+  const char* write_index = NULL;
+  const char* index = NULL;
+  wad_io_policy_t io_policy = WAD_IO_NORMAL;
+
+  struct optparse_long flags[] = {{"batch", 'b', OPTPARSE_NONE},
+                                  {"directory", 'D', OPTPARSE_NONE},
+                                  {"help", 'h', OPTPARSE_NONE},
+                                  {"io", 'I', OPTPARSE_REQUIRED},
+                                  {"jobs", 'j', OPTPARSE_REQUIRED},
+                                  {"stats", 'S', OPTPARSE_NONE},
+                                  {"version", 'v', OPTPARSE_NONE},
+                                  {"write-index", 'w', OPTPARSE_REQUIRED},
+                                  {"index", 'x', OPTPARSE_REQUIRED},
+                                  {0}};
 
   for (int c = optparse_long(&options, flags, NULL); c != -1;
        c = optparse_long(&options, flags, NULL)) {
     switch (c) {
+    case 'b':
+      batch = 1;
+      break;
+    case 'D':
+      directory = 1;
+      break;
     case 'h':
       show_help(argv[0]);
       return 0;
+    case 'I':
+      if (!info_parse_io_policy(options.optarg, &io_policy))
+        return 1;
+      break;
+    case 'j':
+      jobs = (unsigned)atoi(options.optarg);
+      libwad_set_thread_count(jobs);
+      break;
+    case 'S':
+      info_enable_stats();
+      break;
     case 'v':
       printf("wadverify from libwad version %s\n", libwad_get_version_string());
       return 0;
+    case 'w':
+      write_index = options.optarg;
+      break;
+    case 'x':
+      index = options.optarg;
+      break;
     case '?':
       fprintf(
           stderr,
@@ -53,7 +182,45 @@ int main(int argc, char** argv)
     return 1;
   }
 
-  wad_t wad = wad_open(wad_path);
+  if ((batch || directory) && (write_index != NULL || index != NULL)) {
+    fprintf(stderr,
+            "Hash indexes can not be used with --batch or --directory\n");
+    return 1;
+  }
+
+  if (directory) {
+    int failed = 0;
+
+    for (const char* path = wad_path; path != NULL;
+         path = optparse_arg(&options))
+      failed |= archive_process(path, NULL, jobs, io_policy,
+                                LIBWAD_VERIFY_HASH, 0);
+
+    if (failed) {
+      fprintf(stderr, "Failed to verify\n");
+      return 1;
+    }
+
+    printf("Verified\n");
+    return 0;
+  }
+
+  if (batch) {
+    const char** paths = (const char**)malloc(sizeof(const char*) * argc);
+    int count = 0;
+
+    for (const char* path = wad_path; path != NULL && paths != NULL;
+         path = optparse_arg(&options))
+      paths[count++] = path;
+
+    int ret = verify_batch(paths, count, jobs, io_policy);
+
+    free(paths);
+
+    return ret;
+  }
+
+  wad_t wad = wad_open_ex(wad_path, io_policy);
 
   if (wad == NULL) {
     fprintf(stderr, "Failed to open: %s\n", libwad_get_error_msg());
@@ -62,6 +229,29 @@ int main(int argc, char** argv)
 
   printf("Opened successfully\n");
 
+  if (index != NULL && !wad_load_hash_index(wad, index)) {
+    fprintf(stderr, "Failed to load hash index: %s\n", libwad_get_error_msg());
+    wad_close(wad);
+    return 1;
+  }
+
+  if (write_index != NULL) {
+    // Writing the index checks every content against the tmd on its own
+    if (!wad_write_hash_index(wad, write_index)) {
+      fprintf(stderr, "Failed to write hash index: %s\n",
+              libwad_get_error_msg());
+      wad_close(wad);
+      return 1;
+    }
+
+    wad_close(wad);
+
+    printf("Verified, wrote hash index to %s\n", write_index);
+    return 0;
+  }
+
+  wad_set_progress_callback(wad, info_print_progress, NULL);
+
   tmd_t tmd = wad_get_tmd(wad);
 
   uint16_t content_count = tmd_get_content_count(tmd);
@@ -71,17 +261,20 @@ int main(int argc, char** argv)
   for (uint16_t i = 0; i < content_count; i++) {
     printf("Content %2hu...", i);
 
-    unsigned char* data = data_extract_from_wad(wad, i, LIBWAD_VERIFY_HASH);
-
-    if (data == NULL) {
+    if (!data_verify_from_wad(wad, i)) {
       printf("Error: %s\n", libwad_get_error_msg());
       error_content = 1;
+
+      wad_bad_chunk_t chunk;
+
+      if (wad_get_bad_chunk(wad, &chunk) && chunk.index == i)
+        printf("Bad chunk at offset 0x%" PRIx64 " (%" PRIu64 " bytes)\n",
+               chunk.offset, chunk.length);
+
       continue;
     }
 
     printf("Ok\n");
-
-    free(data);
   }
 
   wad_close(wad);
@@ -0,0 +1,409 @@
+// Copyright 2019 spycrab0
+// Licensed under GPLv3+
+// Refer to the LICENSE file included.
+
+#include <memory.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util.h"
+#include "wad.h"
+
+#define U8_MAGIC 0x55aa382d
+#define U8_HEADER_SIZE 0x20
+#define U8_NODE_SIZE 12
+
+// Content 0 of channels carries an IMET banner header in front of the archive
+#define IMET_MAGIC 0x494d4554
+
+struct u8_data {
+  // Backing storage: Either a caller provided buffer or a content of a wad
+  const unsigned char* buffer;
+  size_t size;
+  wad_t wad;
+  uint16_t index;
+  // Offset of the archive relative to the start of buffer / content
+  uint64_t base;
+
+  // Copy of node and string table (only when reading from a wad)
+  unsigned char* table;
+
+  uint32_t node_count;
+  u8_node_t* nodes;
+
+  // Open addressing hash table over (parent, name) -> node index
+  uint32_t* lookup;
+  uint32_t lookup_mask;
+};
+
+static uint32_t u8_read32(const unsigned char* p)
+{
+  uint32_t value;
+  memcpy(&value, p, sizeof(value));
+  return be32(value);
+}
+
+static uint32_t u8_hash(uint32_t parent, const char* name, size_t length)
+{
+  // FNV-1a
+  uint32_t hash = 0x811c9dc5 ^ parent;
+
+  for (size_t i = 0; i < length; i++) {
+    hash ^= (unsigned char)name[i];
+    hash *= 0x01000193;
+  }
+
+  return hash;
+}
+
+// Locates the archive inside a content, skipping an IMET header if present
+static int u8_find_base(const unsigned char* head, size_t size, uint64_t* base)
+{
+  if (size >= 4 && u8_read32(head) == U8_MAGIC) {
+    *base = 0;
+    return 1;
+  }
+
+  if (size >= 0x44 && u8_read32(head + 0x40) == IMET_MAGIC) {
+    *base = 0x640;
+    return 1;
+  }
+
+  if (size >= 4 && u8_read32(head) == IMET_MAGIC) {
+    *base = 0x600;
+    return 1;
+  }
+
+  return 0;
+}
+
+// Builds the flat node table and lookup index out of the raw node and string
+// tables. archive_size is used for bounds checking the file entries
+static int u8_build(struct u8_data* u8, const unsigned char* table,
+                    uint32_t table_size, uint64_t archive_size)
+{
+  if (table_size < U8_NODE_SIZE) {
+    g_error = LIBWAD_BAD_ARCHIVE;
+    return 0;
+  }
+
+  // The root node holds the total amount of nodes
+  uint32_t count = u8_read32(table + 8);
+
+  if (count == 0 || count > table_size / U8_NODE_SIZE ||
+      table[0] != U8_NODE_DIRECTORY) {
+    g_error = LIBWAD_BAD_ARCHIVE;
+    return 0;
+  }
+
+  const char* strings = (const char*)table + count * U8_NODE_SIZE;
+  uint32_t strings_size = table_size - count * U8_NODE_SIZE;
+
+  uint32_t lookup_size = 16;
+
+  while (lookup_size < count * 2)
+    lookup_size *= 2;
+
+  u8->nodes = (u8_node_t*)malloc(sizeof(u8_node_t) * count);
+  u8->lookup = (uint32_t*)malloc(sizeof(uint32_t) * lookup_size);
+  // Directories that are still open while walking the table
+  uint32_t* stack = (uint32_t*)malloc(sizeof(uint32_t) * count);
+
+  if (u8->nodes == NULL || u8->lookup == NULL || stack == NULL) {
+    g_error = LIBWAD_BAD_ALLOC;
+    free(stack);
+    return 0;
+  }
+
+  memset(u8->lookup, 0xff, sizeof(uint32_t) * lookup_size);
+  u8->lookup_mask = lookup_size - 1;
+  u8->node_count = count;
+
+  uint32_t depth = 0;
+
+  for (uint32_t i = 0; i < count; i++) {
+    const unsigned char* raw = table + i * U8_NODE_SIZE;
+    u8_node_t* node = &u8->nodes[i];
+
+    uint32_t name_offset = u8_read32(raw) & 0x00ffffff;
+
+    if (name_offset >= strings_size ||
+        memchr(strings + name_offset, '\0', strings_size - name_offset) ==
+            NULL) {
+      g_error = LIBWAD_BAD_ARCHIVE;
+      free(stack);
+      return 0;
+    }
+
+    // Leave every directory we have walked past
+    while (depth > 0 && u8->nodes[stack[depth - 1]].size <= i)
+      depth--;
+
+    node->type = raw[0];
+    node->name = strings + name_offset;
+    node->offset = u8_read32(raw + 4);
+    node->size = u8_read32(raw + 8);
+    node->parent = depth > 0 ? stack[depth - 1] : U8_BAD_NODE;
+
+    if (node->type == U8_NODE_DIRECTORY) {
+      if (node->size <= i || node->size > count) {
+        g_error = LIBWAD_BAD_ARCHIVE;
+        free(stack);
+        return 0;
+      }
+
+      stack[depth++] = i;
+    } else if (node->type != U8_NODE_FILE || i == 0 ||
+               (uint64_t)node->offset + node->size > archive_size) {
+      g_error = LIBWAD_BAD_ARCHIVE;
+      free(stack);
+      return 0;
+    }
+
+    if (i == 0)
+      continue;
+
+    uint32_t slot =
+        u8_hash(node->parent, node->name, strlen(node->name)) & u8->lookup_mask;
+
+    while (u8->lookup[slot] != U8_BAD_NODE)
+      slot = (slot + 1) & u8->lookup_mask;
+
+    u8->lookup[slot] = i;
+  }
+
+  free(stack);
+
+  return 1;
+}
+
+static struct u8_data* u8_alloc()
+{
+  struct u8_data* u8 = (struct u8_data*)calloc(1, sizeof(struct u8_data));
+
+  if (u8 == NULL)
+    g_error = LIBWAD_BAD_ALLOC;
+
+  return u8;
+}
+
+u8_t u8_open_buffer(const unsigned char* buffer, size_t size)
+{
+  uint64_t base;
+
+  if (!u8_find_base(buffer, size, &base) || base + U8_HEADER_SIZE > size) {
+    g_error = LIBWAD_BAD_ARCHIVE;
+    return NULL;
+  }
+
+  const unsigned char* header = buffer + base;
+
+  uint32_t root_offset = u8_read32(header + 4);
+  uint32_t table_size = u8_read32(header + 8);
+
+  if (u8_read32(header) != U8_MAGIC ||
+      (uint64_t)root_offset + table_size > size - base) {
+    g_error = LIBWAD_BAD_ARCHIVE;
+    return NULL;
+  }
+
+  struct u8_data* u8 = u8_alloc();
+
+  if (u8 == NULL)
+    return NULL;
+
+  u8->buffer = buffer;
+  u8->size = size;
+  u8->base = base;
+
+  if (!u8_build(u8, header + root_offset, table_size, size - base)) {
+    u8_close(u8);
+    return NULL;
+  }
+
+  return u8;
+}
+
+u8_t u8_open_from_wad(wad_t handle, uint16_t index)
+{
+  tmd_content_t* content = tmd_get_content(wad_get_tmd(handle), index);
+
+  if (content == NULL) {
+    g_error = LIBWAD_OUT_OF_RANGE;
+    return NULL;
+  }
+
+  // Large enough to detect an IMET header and read the archive header behind
+  // it
+  unsigned char head[0x640 + U8_HEADER_SIZE];
+  size_t head_size = sizeof(head);
+
+  if (head_size > content->size)
+    head_size = (size_t)content->size;
+
+  if (!data_read_range(handle, index, 0, head_size, head))
+    return NULL;
+
+  uint64_t base;
+
+  if (!u8_find_base(head, head_size, &base) ||
+      base + U8_HEADER_SIZE > head_size) {
+    g_error = LIBWAD_BAD_ARCHIVE;
+    return NULL;
+  }
+
+  uint32_t root_offset = u8_read32(head + base + 4);
+  uint32_t table_size = u8_read32(head + base + 8);
+
+  if (u8_read32(head + base) != U8_MAGIC ||
+      (uint64_t)root_offset + table_size > content->size - base) {
+    g_error = LIBWAD_BAD_ARCHIVE;
+    return NULL;
+  }
+
+  struct u8_data* u8 = u8_alloc();
+
+  if (u8 == NULL)
+    return NULL;
+
+  u8->wad = handle;
+  u8->index = index;
+  u8->base = base;
+  u8->size = (size_t)content->size;
+
+  // Only the node and string tables are read, file data stays in the wad
+  u8->table = (unsigned char*)malloc(table_size);
+
+  if (u8->table == NULL) {
+    g_error = LIBWAD_BAD_ALLOC;
+    u8_close(u8);
+    return NULL;
+  }
+
+  if (!data_read_range(handle, index, base + root_offset, table_size,
+                       u8->table) ||
+      !u8_build(u8, u8->table, table_size, content->size - base)) {
+    u8_close(u8);
+    return NULL;
+  }
+
+  return u8;
+}
+
+void u8_close(u8_t handle)
+{
+  if (handle == NULL)
+    return;
+
+  struct u8_data* u8 = (struct u8_data*)handle;
+
+  free(u8->table);
+  free(u8->nodes);
+  free(u8->lookup);
+  free(u8);
+}
+
+uint32_t u8_get_node_count(u8_t handle)
+{
+  return ((struct u8_data*)handle)->node_count;
+}
+
+const u8_node_t* u8_get_node(u8_t handle, uint32_t index)
+{
+  struct u8_data* u8 = (struct u8_data*)handle;
+
+  if (index >= u8->node_count) {
+    g_error = LIBWAD_OUT_OF_RANGE;
+    return NULL;
+  }
+
+  return &u8->nodes[index];
+}
+
+uint32_t u8_find(u8_t handle, const char* path)
+{
+  struct u8_data* u8 = (struct u8_data*)handle;
+
+  uint32_t current = 0;
+
+  while (*path != '\0') {
+    if (*path == '/') {
+      path++;
+      continue;
+    }
+
+    size_t length = strcspn(path, "/");
+
+    if (u8->nodes[current].type != U8_NODE_DIRECTORY) {
+      g_error = LIBWAD_NOT_FOUND;
+      return U8_BAD_NODE;
+    }
+
+    uint32_t slot = u8_hash(current, path, length) & u8->lookup_mask;
+    uint32_t found = U8_BAD_NODE;
+
+    for (; u8->lookup[slot] != U8_BAD_NODE;
+         slot = (slot + 1) & u8->lookup_mask) {
+      const u8_node_t* node = &u8->nodes[u8->lookup[slot]];
+
+      if (node->parent == current && strncmp(node->name, path, length) == 0 &&
+          node->name[length] == '\0') {
+        found = u8->lookup[slot];
+        break;
+      }
+    }
+
+    if (found == U8_BAD_NODE) {
+      g_error = LIBWAD_NOT_FOUND;
+      return U8_BAD_NODE;
+    }
+
+    current = found;
+    path += length;
+  }
+
+  return current;
+}
+
+const unsigned char* u8_get_file_data(u8_t handle, uint32_t index,
+                                      size_t* size)
+{
+  struct u8_data* u8 = (struct u8_data*)handle;
+
+  if (index >= u8->node_count ||
+      u8->nodes[index].type != U8_NODE_FILE) {
+    g_error = LIBWAD_OUT_OF_RANGE;
+    return NULL;
+  }
+
+  // Archives backed by a wad have nothing to point into
+  if (u8->buffer == NULL)
+    return NULL;
+
+  if (size != NULL)
+    *size = u8->nodes[index].size;
+
+  return u8->buffer + u8->base + u8->nodes[index].offset;
+}
+
+int u8_read_file(u8_t handle, uint32_t index, uint64_t offset, size_t length,
+                 unsigned char* dst)
+{
+  struct u8_data* u8 = (struct u8_data*)handle;
+
+  if (index >= u8->node_count || u8->nodes[index].type != U8_NODE_FILE ||
+      offset > u8->nodes[index].size ||
+      length > u8->nodes[index].size - offset) {
+    g_error = LIBWAD_OUT_OF_RANGE;
+    return 0;
+  }
+
+  uint64_t start = u8->base + u8->nodes[index].offset + offset;
+
+  if (u8->buffer != NULL) {
+    memcpy(dst, u8->buffer + start, length);
+    return 1;
+  }
+
+  return data_read_range(u8->wad, u8->index, start, length, dst);
+}
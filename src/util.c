@@ -6,6 +6,10 @@
 #include "libwad.h"
 
 #include <ctype.h>
+#include <memory.h>
+#include <stdlib.h>
+
+#include "wad.h"
 
 const unsigned char NORMAL_COMMON_KEY[16] = {0xeb, 0xe4, 0x2a, 0x22, 0x5e, 0x85,
                                              0x93, 0xe4, 0x48, 0xd9, 0xc5, 0x45,
@@ -23,40 +27,89 @@ const unsigned char VWII_COMMON_KEY[16] = {0x30, 0xbf, 0xc7, 0x6e, 0x7c, 0x19,
                                            0xaf, 0xbb, 0x23, 0x16, 0x33, 0x30,
                                            0xce, 0xd7, 0xc2, 0x8d};
 
-uint16_t be_int16v(uint16_t i) { return (i & 0xff) << 8 | (i & 0xff00) >> 8; }
+uint32_t align32(uint32_t offset)
+{
+  if (offset % 64 == 0)
+    return offset;
 
-void be_int16(uint16_t* i) { *i = be_int16v(*i); }
+  return offset + 64 - (offset % 64);
+}
 
-uint32_t be_int32v(uint32_t i)
+uint64_t align64(uint64_t offset, uint64_t mod)
 {
-  return (uint32_t)be_int16v(i & 0xffff) << 16 |
-         be_int16v((i & 0xffff0000) >> 16);
-}
+  if (offset % mod == 0)
+    return offset;
 
-void be_int32(uint32_t* i) { *i = be_int32v(*i); }
+  return offset + mod - (offset % mod);
+}
 
-uint64_t be_int64v(uint64_t i)
+void reader_init(struct reader* reader, const unsigned char* data, size_t size)
 {
-  return (uint64_t)be_int32v(i & 0xffffffff) << 32 |
-         be_int32v((i & 0xffffffff00000000) >> 32);
+  reader->data = data;
+  reader->size = size;
+  reader->pos = 0;
+  reader->overrun = 0;
 }
 
-void be_int64(uint64_t* i) { *i = be_int64v(*i); }
+void reader_read(struct reader* reader, void* dst, size_t size)
+{
+  size_t available = reader->pos < reader->size ? reader->size - reader->pos : 0;
 
-uint32_t align32(uint32_t offset)
+  if (size > available) {
+    memset((unsigned char*)dst + available, 0, size - available);
+    reader->overrun = 1;
+    size = available;
+  }
+
+  memcpy(dst, reader->data + reader->pos, size);
+  reader->pos += size;
+}
+
+void reader_skip(struct reader* reader, size_t size)
 {
-  if (offset % 64 == 0)
-    return offset;
+  size_t available = reader->pos < reader->size ? reader->size - reader->pos : 0;
 
-  return offset + 64 - (offset % 64);
+  if (size > available)
+    reader->overrun = 1;
+
+  reader->pos += size;
 }
 
-uint64_t align64(uint64_t offset, uint64_t mod)
+unsigned char* util_read_file(const char* filename, size_t* size)
 {
-  if (offset % mod == 0)
-    return offset;
+  FILE* fh = fopen(filename, "rb");
 
-  return offset + mod - (offset % mod);
+  if (fh == NULL) {
+    g_error = LIBWAD_OPEN_FAILED;
+    return NULL;
+  }
+
+  fseek(fh, 0, SEEK_END);
+  long length = ftell(fh);
+  fseek(fh, 0, SEEK_SET);
+
+  // Allocate at least one byte so empty files don't look like errors
+  unsigned char* buffer =
+      length >= 0 ? (unsigned char*)malloc((size_t)length + 1) : NULL;
+
+  if (buffer == NULL) {
+    g_error = length >= 0 ? LIBWAD_BAD_ALLOC : LIBWAD_IO_ERROR;
+    fclose(fh);
+    return NULL;
+  }
+
+  if (length > 0 && fread(buffer, (size_t)length, 1, fh) != 1) {
+    g_error = LIBWAD_IO_ERROR;
+    free(buffer);
+    fclose(fh);
+    return NULL;
+  }
+
+  fclose(fh);
+
+  *size = (size_t)length;
+
+  return buffer;
 }
 
 static char s_filename[6 * 2 + 1] = {0};
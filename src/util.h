@@ -9,17 +9,83 @@
 #include <stdint.h>
 #include <stdio.h>
 
+#ifdef _MSC_VER
+#include <stdlib.h>
+#endif
+
 // Common keys
 extern const unsigned char NORMAL_COMMON_KEY[16];
 extern const unsigned char KOREA_COMMON_KEY[16];
 extern const unsigned char DEBUG_COMMON_KEY[16];
 extern const unsigned char VWII_COMMON_KEY[16];
 
-void be_int16(uint16_t* i);
-void be_int32(uint32_t* i);
-void be_int64(uint64_t* i);
+// Byte swaps compile down to a single instruction where the compiler offers
+// an intrinsic
+static inline uint16_t util_bswap16(uint16_t i)
+{
+#if defined(__GNUC__)
+  return __builtin_bswap16(i);
+#elif defined(_MSC_VER)
+  return _byteswap_ushort(i);
+#else
+  return (uint16_t)(i << 8 | i >> 8);
+#endif
+}
+
+static inline uint32_t util_bswap32(uint32_t i)
+{
+#if defined(__GNUC__)
+  return __builtin_bswap32(i);
+#elif defined(_MSC_VER)
+  return _byteswap_ulong(i);
+#else
+  return (uint32_t)util_bswap16(i & 0xffff) << 16 | util_bswap16(i >> 16);
+#endif
+}
+
+static inline uint64_t util_bswap64(uint64_t i)
+{
+#if defined(__GNUC__)
+  return __builtin_bswap64(i);
+#elif defined(_MSC_VER)
+  return _byteswap_uint64(i);
+#else
+  return (uint64_t)util_bswap32(i & 0xffffffff) << 32 | util_bswap32(i >> 32);
+#endif
+}
+
+// Convert between big endian and host byte order
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+static inline uint16_t be16(uint16_t i) { return i; }
+static inline uint32_t be32(uint32_t i) { return i; }
+static inline uint64_t be64(uint64_t i) { return i; }
+#else
+static inline uint16_t be16(uint16_t i) { return util_bswap16(i); }
+static inline uint32_t be32(uint32_t i) { return util_bswap32(i); }
+static inline uint64_t be64(uint64_t i) { return util_bswap64(i); }
+#endif
+
+static inline void be_int16(uint16_t* i) { *i = be16(*i); }
+static inline void be_int32(uint32_t* i) { *i = be32(*i); }
+static inline void be_int64(uint64_t* i) { *i = be64(*i); }
 
 uint32_t align32(uint32_t offset);
 uint64_t align64(uint64_t offset, uint64_t mod);
 
+// Cursor for parsing data held in memory. Reading past the end yields zeroes
+// and sets the overrun flag.
+struct reader {
+  const unsigned char* data;
+  size_t size;
+  size_t pos;
+  int overrun;
+};
+
+void reader_init(struct reader* reader, const unsigned char* data, size_t size);
+void reader_read(struct reader* reader, void* dst, size_t size);
+void reader_skip(struct reader* reader, size_t size);
+
+// Reads a whole file into a newly allocated buffer
+unsigned char* util_read_file(const char* filename, size_t* size);
+
 #endif
\ No newline at end of file
@@ -2,105 +2,217 @@
 // Licensed under GPLv3+
 // Refer to the LICENSE file included.
 
+#ifndef _WIN32
+#define _GNU_SOURCE
+#endif
+
 #include "wad.h"
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/stat.h>
 
 #include "certchain.h"
+#include "hashindex.h"
+#include "io.h"
+#include "layout.h"
+#include "nus.h"
+#include "stats.h"
 #include "ticket.h"
 #include "tmd.h"
 #include "util.h"
 
 #include "version.h"
 
-int g_error = 0;
-
-wad_t wad_open(const char* filename)
+// Sub-second parts of the modification and status change times
+#if defined(__APPLE__)
+#define WAD_MTIME_NSEC(st) ((st).st_mtimespec.tv_nsec)
+#define WAD_CTIME_NSEC(st) ((st).st_ctimespec.tv_nsec)
+#elif !defined(_WIN32)
+#define WAD_MTIME_NSEC(st) ((st).st_mtim.tv_nsec)
+#define WAD_CTIME_NSEC(st) ((st).st_ctim.tv_nsec)
+#else
+#define WAD_MTIME_NSEC(st) 0
+#define WAD_CTIME_NSEC(st) 0
+#endif
+
+THREAD_LOCAL int g_error = 0;
+
+static uint64_t wad_get_cache_id(const char* filename)
 {
-  FILE* fh = fopen(filename, "rb");
-
-  if (!fh) {
-    g_error = LIBWAD_OPEN_FAILED;
-    return NULL;
+  // FNV-1a over everything that identifies the file
+  uint64_t hash = 0xcbf29ce484222325ULL;
+
+  struct stat st;
+
+  if (stat(filename, &st) != 0)
+    return 0;
+
+  // A file rewritten in place within the same second keeps its size, inode
+  // and mtime in seconds, so the finer timestamps have to be included
+  uint64_t fields[] = {(uint64_t)st.st_dev,
+                       (uint64_t)st.st_ino,
+                       (uint64_t)st.st_size,
+                       (uint64_t)st.st_mtime,
+                       (uint64_t)WAD_MTIME_NSEC(st),
+                       (uint64_t)st.st_ctime,
+                       (uint64_t)WAD_CTIME_NSEC(st)};
+
+  for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+    for (int x = 0; x < 8; x++) {
+      hash ^= (fields[i] >> (x * 8)) & 0xff;
+      hash *= 0x100000001b3ULL;
+    }
   }
 
-  struct wad_data* wad = (struct wad_data*)malloc(sizeof(struct wad_data));
-
-  if (wad == NULL) {
-    g_error = LIBWAD_BAD_ALLOC;
-    return NULL;
+#ifdef _WIN32
+  // No inode numbers here, so tell files apart by name as well
+  for (const char* c = filename; *c != '\0'; c++) {
+    hash ^= (unsigned char)*c;
+    hash *= 0x100000001b3ULL;
   }
+#endif
 
-  wad->certchain = NULL;
-  wad->ticket = NULL;
-  wad->tmd = NULL;
-
-  wad->fh = fh;
+  return hash;
+}
 
-  // Parse header
-  uint32_t header_magic;
+wad_t wad_open(const char* filename)
+{
+  return wad_open_ex(filename, WAD_IO_NORMAL);
+}
 
-  fread(&header_magic, sizeof(header_magic), 1, fh);
+// Reads the header, certificate chain, ticket and tmd of a wad file
+static int wad_open_file(struct wad_data* wad, const char* filename,
+                         wad_io_policy_t policy)
+{
+  if (!io_open(wad, filename, policy)) {
+    g_error = LIBWAD_OPEN_FAILED;
+    return 0;
+  }
 
-  be_int32(&header_magic);
+  // Parse header
+  struct wad_header_layout header;
 
-  if (header_magic != 0x20) {
+  if (!io_read(wad, &header, sizeof(header), 0) ||
+      be32(header.header_size) != sizeof(header)) {
     g_error = LIBWAD_BAD_MAGIC;
-    wad_close(wad);
-    return NULL;
+    return 0;
   }
 
-  fread(&wad->type, sizeof(wad->type), 1, fh);
-  be_int32(&wad->type);
-
-  fread(&wad->certchain_size, sizeof(wad->certchain_size), 1, fh);
-  be_int32(&wad->certchain_size);
-
-  fseek(fh, 4, SEEK_CUR);
-
-  fread(&wad->ticket_size, sizeof(wad->ticket_size), 1, fh);
-  be_int32(&wad->ticket_size);
+  wad->type = be32(header.type);
+  wad->certchain_size = be32(header.certchain_size);
+  wad->ticket_size = be32(header.ticket_size);
+  wad->tmd_size = be32(header.tmd_size);
+  wad->data_size = be32(header.data_size);
+  wad->footer_size = be32(header.footer_size);
 
-  fread(&wad->tmd_size, sizeof(wad->tmd_size), 1, fh);
-  be_int32(&wad->tmd_size);
+  // Sections are read into memory whole, so don't take the header's word for
+  // their sizes
+  if (wad->certchain_size > CERTCHAIN_MAX_SIZE) {
+    g_error = LIBWAD_BAD_CERTCHAIN;
+    return 0;
+  }
 
-  fread(&wad->data_size, sizeof(wad->data_size), 1, fh);
-  be_int32(&wad->data_size);
+  if (wad->ticket_size > TICKET_MAX_SIZE) {
+    g_error = LIBWAD_BAD_TICKET;
+    return 0;
+  }
 
-  fread(&wad->footer_size, sizeof(wad->footer_size), 1, fh);
-  be_int32(&wad->footer_size);
+  if (wad->tmd_size > TMD_MAX_SIZE) {
+    g_error = LIBWAD_BAD_TMD;
+    return 0;
+  }
 
   wad->certchain = certchain_from_wad(wad);
 
   if (wad->certchain == NULL) {
     g_error = LIBWAD_BAD_CERTCHAIN;
-    wad_close(wad);
-    return NULL;
+    return 0;
   }
 
   wad->ticket = ticket_from_wad(wad);
 
   if (wad->ticket == NULL) {
     g_error = LIBWAD_BAD_TICKET;
-    wad_close(wad);
-    return NULL;
+    return 0;
   }
 
   wad->tmd = tmd_from_wad(wad);
 
   if (wad->tmd == NULL) {
     g_error = LIBWAD_BAD_TMD;
+    return 0;
+  }
+
+  return 1;
+}
+
+wad_t wad_open_ex(const char* filename, wad_io_policy_t policy)
+{
+  struct wad_data* wad = (struct wad_data*)malloc(sizeof(struct wad_data));
+
+  if (wad == NULL) {
+    g_error = LIBWAD_BAD_ALLOC;
+    return NULL;
+  }
+
+  wad->fh = NULL;
+  wad->direct_fd = -1;
+  wad->direct_buffer = NULL;
+  wad->io_policy = WAD_IO_NORMAL;
+  wad->content_files = NULL;
+  wad->content_file_count = 0;
+
+  for (int i = 0; i <= WAD_SECTION_FOOTER; i++)
+    wad->section_data[i] = NULL;
+
+  wad->certchain = NULL;
+  wad->ticket = NULL;
+  wad->tmd = NULL;
+  wad->decryptor = NULL;
+  wad->content_offsets = NULL;
+  wad->progress = NULL;
+  wad->progress_user = NULL;
+  wad->hash_index = NULL;
+
+  wad->cache_id = wad_get_cache_id(filename);
+
+  STATS_COUNT(STATS_OPENS);
+
+  // Titles mirrored from the update servers are directories of loose files
+  int opened = nus_is_directory(filename)
+                   ? nus_open(wad, filename)
+                   : wad_open_file(wad, filename, policy);
+
+  if (!opened) {
     wad_close(wad);
     return NULL;
   }
 
-  if (ferror(wad->fh) != 0) {
-    g_error = LIBWAD_IO_ERROR;
+  wad->decryptor = data_decryptor_open(wad->ticket);
+
+  if (wad->decryptor == NULL) {
     wad_close(wad);
     return NULL;
   }
 
+  uint16_t count = tmd_get_content_count(wad->tmd);
+
+  wad->content_offsets = (uint64_t*)malloc(sizeof(uint64_t) * (count + 1));
+
+  if (wad->content_offsets == NULL) {
+    g_error = LIBWAD_BAD_ALLOC;
+    wad_close(wad);
+    return NULL;
+  }
+
+  wad->content_offsets[0] = 0;
+
+  for (uint16_t i = 0; i < count; i++)
+    wad->content_offsets[i + 1] =
+        wad->content_offsets[i] +
+        align64(tmd_get_content(wad->tmd, i)->size, 64);
+
   return wad;
 }
 
@@ -111,18 +223,23 @@ void wad_close(wad_t handle)
 
   struct wad_data* wad = (struct wad_data*)handle;
 
-  fclose(wad->fh);
+  io_close(wad);
   certchain_close(wad->certchain);
   ticket_close(wad->ticket);
   tmd_close(wad->tmd);
+  data_decryptor_close(wad->decryptor);
+  hash_index_close(wad->hash_index);
+  free(wad->content_offsets);
   free(wad);
 
   handle = NULL;
 }
 
-const char* libwad_get_error_msg()
+const char* libwad_get_error_msg() { return libwad_error_to_string(g_error); }
+
+const char* libwad_error_to_string(libwad_error_t error)
 {
-  switch (g_error) {
+  switch (error) {
   case LIBWAD_NO_ERROR:
     return "No error";
   case LIBWAD_OPEN_FAILED:
@@ -145,6 +262,20 @@ const char* libwad_get_error_msg()
     return "Hashes do not match";
   case LIBWAD_BAD_CERTCHAIN:
     return "Bad certchain";
+  case LIBWAD_BAD_ARCHIVE:
+    return "Bad archive";
+  case LIBWAD_NOT_FOUND:
+    return "Not found";
+  case LIBWAD_DECOMPRESSION_FAILED:
+    return "Decompression failed";
+  case LIBWAD_CANCELLED:
+    return "Cancelled";
+  case LIBWAD_NOT_SUPPORTED:
+    return "Not supported";
+  case LIBWAD_BAD_INDEX:
+    return "Bad hash index";
+  case LIBWAD_OVER_BUDGET:
+    return "Memory budget exceeded";
   default:
     return "Unknown error";
   }
@@ -152,6 +283,15 @@ const char* libwad_get_error_msg()
 
 libwad_error_t libwad_get_error() { return g_error; }
 
+void wad_set_progress_callback(wad_t handle, wad_progress_callback_t callback,
+                               void* user)
+{
+  struct wad_data* wad = (struct wad_data*)handle;
+
+  wad->progress = callback;
+  wad->progress_user = user;
+}
+
 uint64_t wad_get_section_offset(wad_t handle, wad_section_t type)
 {
   if (type > WAD_SECTION_FOOTER)
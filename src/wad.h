@@ -6,10 +6,34 @@
 
 #include <stdio.h>
 
-extern int g_error;
+#include "thread.h"
+
+#ifdef _MSC_VER
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL __thread
+#endif
+
+// Every thread has its own, so workers can't clobber the error of a caller
+extern THREAD_LOCAL int g_error;
 
 struct wad_data {
+  // NULL for titles opened from a directory
   FILE* fh;
+  // Only valid with WAD_IO_DIRECT, -1 otherwise
+  int direct_fd;
+  // Aligned bounce buffer for direct reads, lent to one read at a time and
+  // NULL while in use. Only valid along with direct_fd
+  void* direct_buffer;
+  mutex_t direct_lock;
+  wad_io_policy_t io_policy;
+
+  // One file per content for titles opened from a directory, NULL otherwise
+  FILE** content_files;
+  uint16_t content_file_count;
+  // Certificate chain, ticket and tmd as read from the directory
+  unsigned char* section_data[WAD_SECTION_FOOTER + 1];
+
   uint32_t type;
   uint32_t certchain_size;
   uint32_t ticket_size;
@@ -20,4 +44,17 @@ struct wad_data {
   certchain_t certchain;
   ticket_t ticket;
   tmd_t tmd;
+  data_decryptor_t decryptor;
+
+  // Identifies the underlying file in the block cache
+  uint64_t cache_id;
+
+  // Offset of each content relative to the start of the data section
+  uint64_t* content_offsets;
+
+  wad_progress_callback_t progress;
+  void* progress_user;
+
+  // Chunk hashes loaded with wad_load_hash_index(), NULL otherwise
+  struct hash_index* hash_index;
 };
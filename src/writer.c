@@ -0,0 +1,426 @@
+// Copyright 2019 spycrab0
+// Licensed under GPLv3+
+// Refer to the LICENSE file included.
+
+#include <memory.h>
+#include <stdlib.h>
+
+#include <mbedtls/aes.h>
+#include <mbedtls/sha1.h>
+
+#include "writer.h"
+
+#include "layout.h"
+#include "ticket.h"
+#include "util.h"
+#include "wad.h"
+
+#define TMD_CONTENTS_OFFSET sizeof(struct tmd_header_layout)
+#define TMD_CONTENT_SIZE sizeof(struct tmd_content_layout)
+
+// Amount of data encrypted at once
+#define WRITER_CHUNK_SIZE 0x10000
+
+struct wad_writer {
+  FILE* fh;
+
+  uint32_t certchain_size;
+  uint32_t ticket_size;
+  uint32_t tmd_size;
+
+  // Patched with content sizes and hashes as contents are written
+  unsigned char* tmd;
+  uint64_t tmd_offset;
+  uint16_t content_count;
+
+  uint64_t data_offset;
+  uint64_t data_end;
+
+  mbedtls_aes_context aes;
+
+  // State of the content currently being written
+  int in_content;
+  uint16_t content;
+  uint64_t content_size;
+  unsigned char iv[16];
+  mbedtls_sha1_context sha1;
+  unsigned char partial[16];
+  size_t partial_size;
+  unsigned char* chunk;
+};
+
+static void writer_put64(unsigned char* dst, uint64_t value)
+{
+  be_int64(&value);
+  memcpy(dst, &value, sizeof(value));
+}
+
+static void writer_put32(unsigned char* dst, uint32_t value)
+{
+  be_int32(&value);
+  memcpy(dst, &value, sizeof(value));
+}
+
+static int writer_pad(struct wad_writer* writer)
+{
+  static const unsigned char zeros[64] = {0};
+
+  long offset = ftell(writer->fh);
+
+  if (offset < 0)
+    return 0;
+
+  size_t padding = (size_t)(align32((uint32_t)offset) - (uint32_t)offset);
+
+  return padding == 0 || fwrite(zeros, padding, 1, writer->fh) == 1;
+}
+
+static int writer_write_section(struct wad_writer* writer,
+                                const unsigned char* data, uint32_t size)
+{
+  if (size != 0 && fwrite(data, size, 1, writer->fh) != 1)
+    return 0;
+
+  return writer_pad(writer);
+}
+
+wad_writer_t wad_writer_open(const char* path, const unsigned char* certchain,
+                             uint32_t certchain_size,
+                             const unsigned char* ticket, uint32_t ticket_size,
+                             const unsigned char* tmd, uint32_t tmd_size)
+{
+  if (tmd_size < TMD_CONTENTS_OFFSET) {
+    g_error = LIBWAD_BAD_TMD;
+    return NULL;
+  }
+
+  uint16_t content_count;
+  memcpy(&content_count,
+         tmd + offsetof(struct tmd_header_layout, content_count),
+         sizeof(content_count));
+  be_int16(&content_count);
+
+  if (tmd_size <
+      TMD_CONTENTS_OFFSET + (uint32_t)content_count * TMD_CONTENT_SIZE) {
+    g_error = LIBWAD_BAD_TMD;
+    return NULL;
+  }
+
+  ticket_t parsed_ticket = ticket_parse_buffer(ticket, ticket_size);
+
+  if (parsed_ticket == NULL)
+    return NULL;
+
+  struct wad_writer* writer =
+      (struct wad_writer*)calloc(1, sizeof(struct wad_writer));
+
+  if (writer == NULL) {
+    g_error = LIBWAD_BAD_ALLOC;
+    ticket_close(parsed_ticket);
+    return NULL;
+  }
+
+  mbedtls_aes_init(&writer->aes);
+  mbedtls_aes_setkey_enc(&writer->aes, ticket_get_title_key(parsed_ticket),
+                         128);
+  ticket_close(parsed_ticket);
+
+  writer->certchain_size = certchain_size;
+  writer->ticket_size = ticket_size;
+  writer->tmd_size = tmd_size;
+  writer->content_count = content_count;
+
+  writer->tmd = (unsigned char*)malloc(tmd_size);
+  writer->chunk = (unsigned char*)malloc(WRITER_CHUNK_SIZE);
+
+  if (writer->tmd == NULL || writer->chunk == NULL) {
+    g_error = LIBWAD_BAD_ALLOC;
+    wad_writer_abort(writer);
+    return NULL;
+  }
+
+  memcpy(writer->tmd, tmd, tmd_size);
+
+  writer->fh = fopen(path, "wb");
+
+  if (writer->fh == NULL) {
+    g_error = LIBWAD_OPEN_FAILED;
+    wad_writer_abort(writer);
+    return NULL;
+  }
+
+  // The header is filled in once all sizes are known
+  unsigned char header[0x20] = {0};
+
+  if (!writer_write_section(writer, header, sizeof(header)) ||
+      !writer_write_section(writer, certchain, certchain_size) ||
+      !writer_write_section(writer, ticket, ticket_size)) {
+    g_error = LIBWAD_IO_ERROR;
+    wad_writer_abort(writer);
+    return NULL;
+  }
+
+  writer->tmd_offset = (uint64_t)ftell(writer->fh);
+
+  if (!writer_write_section(writer, tmd, tmd_size)) {
+    g_error = LIBWAD_IO_ERROR;
+    wad_writer_abort(writer);
+    return NULL;
+  }
+
+  writer->data_offset = (uint64_t)ftell(writer->fh);
+  writer->data_end = writer->data_offset;
+
+  return writer;
+}
+
+int wad_writer_begin_content(wad_writer_t handle)
+{
+  struct wad_writer* writer = (struct wad_writer*)handle;
+
+  if (writer->in_content || writer->content >= writer->content_count) {
+    g_error = LIBWAD_OUT_OF_RANGE;
+    return 0;
+  }
+
+  unsigned char* record =
+      writer->tmd + TMD_CONTENTS_OFFSET + writer->content * TMD_CONTENT_SIZE;
+
+  // The IV is the big endian content index followed by zeros
+  memset(writer->iv, 0, sizeof(writer->iv));
+  memcpy(writer->iv, record + offsetof(struct tmd_content_layout, index), 2);
+
+  mbedtls_sha1_init(&writer->sha1);
+  mbedtls_sha1_starts_ret(&writer->sha1);
+
+  writer->in_content = 1;
+  writer->content_size = 0;
+  writer->partial_size = 0;
+
+  return 1;
+}
+
+static int writer_encrypt(struct wad_writer* writer, const unsigned char* data,
+                          size_t size)
+{
+  while (size > 0) {
+    size_t length = size > WRITER_CHUNK_SIZE ? WRITER_CHUNK_SIZE : size;
+
+    if (mbedtls_aes_crypt_cbc(&writer->aes, MBEDTLS_AES_ENCRYPT, length,
+                              writer->iv, data, writer->chunk) != 0) {
+      g_error = LIBWAD_DECRYPTION_FAILED;
+      return 0;
+    }
+
+    if (fwrite(writer->chunk, length, 1, writer->fh) != 1) {
+      g_error = LIBWAD_IO_ERROR;
+      return 0;
+    }
+
+    data += length;
+    size -= length;
+  }
+
+  return 1;
+}
+
+int wad_writer_write(wad_writer_t handle, const unsigned char* data,
+                     size_t size)
+{
+  struct wad_writer* writer = (struct wad_writer*)handle;
+
+  if (!writer->in_content) {
+    g_error = LIBWAD_OUT_OF_RANGE;
+    return 0;
+  }
+
+  mbedtls_sha1_update_ret(&writer->sha1, data, size);
+  writer->content_size += size;
+
+  // Complete a block left over from the last call first
+  if (writer->partial_size != 0) {
+    size_t length = 16 - writer->partial_size;
+
+    if (length > size)
+      length = size;
+
+    memcpy(writer->partial + writer->partial_size, data, length);
+    writer->partial_size += length;
+    data += length;
+    size -= length;
+
+    if (writer->partial_size < 16)
+      return 1;
+
+    if (!writer_encrypt(writer, writer->partial, 16))
+      return 0;
+
+    writer->partial_size = 0;
+  }
+
+  size_t blocks = size & ~(size_t)15;
+
+  if (!writer_encrypt(writer, data, blocks))
+    return 0;
+
+  memcpy(writer->partial, data + blocks, size - blocks);
+  writer->partial_size = size - blocks;
+
+  return 1;
+}
+
+int writer_write_encrypted(wad_writer_t handle, const unsigned char* data,
+                           size_t encrypted_size, uint64_t size)
+{
+  struct wad_writer* writer = (struct wad_writer*)handle;
+
+  if (!writer->in_content || writer->partial_size != 0) {
+    g_error = LIBWAD_OUT_OF_RANGE;
+    return 0;
+  }
+
+  if (encrypted_size != 0 &&
+      fwrite(data, encrypted_size, 1, writer->fh) != 1) {
+    g_error = LIBWAD_IO_ERROR;
+    return 0;
+  }
+
+  writer->content_size += size;
+
+  return 1;
+}
+
+// Records the size and hash of the current content in the tmd
+static int writer_finish_content(struct wad_writer* writer,
+                                 const unsigned char hash[20])
+{
+  unsigned char* record =
+      writer->tmd + TMD_CONTENTS_OFFSET + writer->content * TMD_CONTENT_SIZE;
+
+  writer_put64(record + offsetof(struct tmd_content_layout, size),
+               writer->content_size);
+  memcpy(record + offsetof(struct tmd_content_layout, hash), hash, 20);
+
+  writer->data_end = (uint64_t)ftell(writer->fh);
+  writer->content++;
+
+  if (!writer_pad(writer)) {
+    g_error = LIBWAD_IO_ERROR;
+    return 0;
+  }
+
+  return 1;
+}
+
+int wad_writer_end_content(wad_writer_t handle)
+{
+  struct wad_writer* writer = (struct wad_writer*)handle;
+
+  if (!writer->in_content) {
+    g_error = LIBWAD_OUT_OF_RANGE;
+    return 0;
+  }
+
+  writer->in_content = 0;
+
+  unsigned char hash[20];
+  mbedtls_sha1_finish_ret(&writer->sha1, hash);
+  mbedtls_sha1_free(&writer->sha1);
+
+  // Contents are zero padded to the AES block size
+  if (writer->partial_size != 0) {
+    memset(writer->partial + writer->partial_size, 0,
+           16 - writer->partial_size);
+
+    if (!writer_encrypt(writer, writer->partial, 16))
+      return 0;
+  }
+
+  return writer_finish_content(writer, hash);
+}
+
+int writer_end_encrypted(wad_writer_t handle, const unsigned char hash[20])
+{
+  struct wad_writer* writer = (struct wad_writer*)handle;
+
+  if (!writer->in_content) {
+    g_error = LIBWAD_OUT_OF_RANGE;
+    return 0;
+  }
+
+  writer->in_content = 0;
+  mbedtls_sha1_free(&writer->sha1);
+
+  return writer_finish_content(writer, hash);
+}
+
+int wad_writer_add_content(wad_writer_t handle, const unsigned char* data,
+                           size_t size)
+{
+  return wad_writer_begin_content(handle) &&
+         wad_writer_write(handle, data, size) &&
+         wad_writer_end_content(handle);
+}
+
+int wad_writer_close(wad_writer_t handle, const unsigned char* footer,
+                     uint32_t footer_size)
+{
+  struct wad_writer* writer = (struct wad_writer*)handle;
+
+  if (writer->in_content || writer->content != writer->content_count) {
+    g_error = LIBWAD_BAD_TMD;
+    wad_writer_abort(writer);
+    return 0;
+  }
+
+  uint32_t data_size = (uint32_t)(writer->data_end - writer->data_offset);
+
+  unsigned char header[0x20] = {0};
+
+  writer_put32(header, 0x20);
+  memcpy(header + 4, "Is\0\0", 4);
+  writer_put32(header + 8, writer->certchain_size);
+  writer_put32(header + 16, writer->ticket_size);
+  writer_put32(header + 20, writer->tmd_size);
+  writer_put32(header + 24, data_size);
+  writer_put32(header + 28, footer_size);
+
+  if (!writer_write_section(writer, footer, footer_size) ||
+      fseek(writer->fh, (long)writer->tmd_offset, SEEK_SET) != 0 ||
+      fwrite(writer->tmd, writer->tmd_size, 1, writer->fh) != 1 ||
+      fseek(writer->fh, 0, SEEK_SET) != 0 ||
+      fwrite(header, sizeof(header), 1, writer->fh) != 1) {
+    g_error = LIBWAD_IO_ERROR;
+    wad_writer_abort(writer);
+    return 0;
+  }
+
+  int ret = fclose(writer->fh) == 0;
+  writer->fh = NULL;
+
+  if (!ret)
+    g_error = LIBWAD_IO_ERROR;
+
+  wad_writer_abort(writer);
+
+  return ret;
+}
+
+void wad_writer_abort(wad_writer_t handle)
+{
+  if (handle == NULL)
+    return;
+
+  struct wad_writer* writer = (struct wad_writer*)handle;
+
+  if (writer->fh != NULL)
+    fclose(writer->fh);
+
+  if (writer->in_content)
+    mbedtls_sha1_free(&writer->sha1);
+
+  mbedtls_aes_free(&writer->aes);
+  free(writer->tmd);
+  free(writer->chunk);
+  free(writer);
+}
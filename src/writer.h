@@ -0,0 +1,19 @@
+// Copyright 2019 spycrab0
+// Licensed under GPLv3+
+// Refer to the LICENSE file included.
+
+#ifndef WRITER_H
+#define WRITER_H
+
+#include "libwad.h"
+
+// Writes part of the current content that was encrypted by the caller, size
+// is the amount of decrypted data it holds. Only the last part of a content
+// may end in a padded block.
+int writer_write_encrypted(wad_writer_t handle, const unsigned char* data,
+                           size_t encrypted_size, uint64_t size);
+
+// Finishes a content written with writer_write_encrypted()
+int writer_end_encrypted(wad_writer_t handle, const unsigned char hash[20]);
+
+#endif